@@ -296,6 +296,8 @@ AardDictionary::AardDictionary( string const & id,
     chunks( idx, idxHeader.chunksOffset ),
     df( dictionaryFiles[ 0 ], "rb" )
 {
+    chunks.setStats( statistics.get() );
+
     // Read dictionary name
 
     idx.seek( sizeof( idxHeader ) );
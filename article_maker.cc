@@ -2,6 +2,7 @@
  * Part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
 
 #include "article_maker.hh"
+#include "articlecache.hh"
 #include "instances.hh"
 #include "wordfinder.hh"
 #include "config.hh"
@@ -9,10 +10,13 @@
 #include "utf8.hh"
 #include "wstring_qt.hh"
 #include <limits.h>
+#include <map>
+#include <algorithm>
 #include <QDir>
 #include <QFile>
 #include <QUrl>
 #include <QTextDocumentFragment>
+#include <QTimer>
 #include "folding.hh"
 #include "langcoder.hh"
 #include "gddebug.hh"
@@ -24,6 +28,36 @@ using gd::wstring;
 using std::set;
 using std::list;
 
+namespace {
+
+/// The requests for the articles which missed the lookup deadline, by their
+/// tokens. The pages pick them up with ArticleMaker::takeLateArticle().
+Mutex lateArticlesMutex;
+std::map< int, sptr< Dictionary::DataRequest > > lateArticles;
+int lastLateToken = 0;
+
+/// The pages closed early never pick their articles up, so only that many
+/// are kept, dropping the oldest ones
+size_t const MaxLateArticles = 64;
+
+int addLateArticle( sptr< Dictionary::DataRequest > const & req )
+{
+    Mutex::Lock _( lateArticlesMutex );
+
+    lateArticles[ ++lastLateToken ] = req;
+
+    if ( lateArticles.size() > MaxLateArticles )
+        lateArticles.erase( lateArticles.begin() );
+
+    return lastLateToken;
+}
+
+/// Lookups which had taken at least that many articles from a dictionary
+/// can tell whether it's a slow one
+quint64 const MinArticlesToDemote = 10;
+
+}
+
 ArticleMaker::ArticleMaker( vector< sptr< Dictionary::Class > > const & dictionaries_,
                             vector< Instances::Group > const & groups_,
                             QString const & displayStyle_,
@@ -35,6 +69,7 @@ ArticleMaker::ArticleMaker( vector< sptr< Dictionary::Class > > const & dictiona
     needExpandOptionalParts( true )
   , collapseBigArticles( true )
   , articleLimitSize( 500 )
+  , lookupDeadline( 0 )
 {
 }
 
@@ -225,6 +260,19 @@ std::string ArticleMaker::makeHtmlHeader( QString const & word,
               "el=document.getElementById('gdfrom-'+s);"
               "if(el && el.className.search('gdcollapsedarticle')>0) gdExpandArticle(s);"
               "} }"
+              "function gdLoadLateArticle( token, id ) {"
+              "var xhr = new XMLHttpRequest();"
+              "xhr.onreadystatechange = function() { if( xhr.readyState != 4 ) return;"
+              "var el = document.getElementById( 'gdlate-' + token ); if( !el ) return;"
+              "if( xhr.responseText ) { var body = document.createElement( 'div' ); body.innerHTML = xhr.responseText;"
+              "el.parentNode.replaceChild( body, el );"
+              // The scripts inserted with innerHTML never run, but the recreated ones do
+              "var scripts = body.getElementsByTagName( 'script' );"
+              "for( var i = 0; i < scripts.length; i++ ) { var old = scripts[ i ]; var s = document.createElement( 'script' );"
+              "for( var a = 0; a < old.attributes.length; a++ ) s.setAttribute( old.attributes[ a ].name, old.attributes[ a ].value );"
+              "s.text = old.text; old.parentNode.replaceChild( s, old ); } }"
+              "else { var art = document.getElementById( 'gdfrom-' + id ); if( art ) art.parentNode.removeChild( art ); } };"
+              "xhr.open( 'GET', 'gdlookup://localhost/?late=' + token, true ); xhr.send( null ); }"
               "</script>";
 
     result += "</head><body>";
@@ -384,13 +432,47 @@ sptr< Dictionary::DataRequest > ArticleMaker::makeDefinitionFor(QString const &
         return sptr< Dictionary::DataRequest >(new ArticleRequest( inWord.trimmed(), activeGroup ? activeGroup->name : "",
                                                                    contexts, unmutedDicts, header,
                                                                    collapseBigArticles ? articleLimitSize : -1,
-                                                                   needExpandOptionalParts, ignoreDiacritics ));
+                                                                   needExpandOptionalParts, ignoreDiacritics,
+                                                                   lookupDeadline ));
     }
     else
         return sptr< Dictionary::DataRequest >(new ArticleRequest( inWord.trimmed(), activeGroup ? activeGroup->name : "",
                                                                    contexts, activeDicts, header,
                                                                    collapseBigArticles ? articleLimitSize : -1,
-                                                                   needExpandOptionalParts, ignoreDiacritics ));
+                                                                   needExpandOptionalParts, ignoreDiacritics,
+                                                                   lookupDeadline ));
+}
+
+sptr< Dictionary::DataRequest > ArticleMaker::makePrefetchFor( QString const & word, unsigned groupId,
+                                                              QSet< QString > const & mutedDicts,
+                                                              bool ignoreDiacritics ) const
+{
+    Instances::Group const * activeGroup = 0;
+
+    for( unsigned x = 0; x < groups.size(); ++x )
+        if ( groups[ x ].id == groupId )
+        {
+            activeGroup = &groups[ x ];
+            break;
+        }
+
+    std::vector< sptr< Dictionary::Class > > const & groupDicts =
+            activeGroup ? activeGroup->dictionaries : dictionaries;
+
+    // The main forms are looked for in the same dictionaries as for the real
+    // lookup, as they're a part of the cache keys. Only the articles which
+    // can be cached are requested then, see ArticleRequest::altSearchFinished().
+    std::vector< sptr< Dictionary::Class > > activeDicts;
+
+    for( unsigned x = 0; x < groupDicts.size(); ++x )
+        if ( !mutedDicts.contains( QString::fromStdString( groupDicts[ x ]->getId() ) ) )
+            activeDicts.push_back( groupDicts[ x ] );
+
+    return sptr< Dictionary::DataRequest >( new ArticleRequest( word.trimmed(), activeGroup ? activeGroup->name : "",
+                                                                QMap< QString, QString >(), activeDicts, string(),
+                                                                collapseBigArticles ? articleLimitSize : -1,
+                                                                needExpandOptionalParts, ignoreDiacritics,
+                                                                0, true ) );
 }
 
 sptr< Dictionary::DataRequest > ArticleMaker::makeNotFoundTextFor(
@@ -448,6 +530,51 @@ void ArticleMaker::setCollapseParameters( bool autoCollapse, int articleSize )
     articleLimitSize = articleSize;
 }
 
+void ArticleMaker::setLookupDeadline( int msecs )
+{
+    lookupDeadline = msecs;
+}
+
+LateArticleStorer::LateArticleStorer( sptr< Dictionary::DataRequest > const & req_,
+                                      QByteArray const & cacheKey_ ):
+    req( req_ ), cacheKey( cacheKey_ ), stored( false )
+{
+    connect( req.get(), SIGNAL( finished() ),
+             this, SLOT( requestFinished() ), Qt::QueuedConnection );
+
+    // It could have finished before we connected
+    if ( req->isFinished() )
+        QMetaObject::invokeMethod( this, "requestFinished", Qt::QueuedConnection );
+}
+
+void LateArticleStorer::requestFinished()
+{
+    if ( stored )
+        return;
+
+    stored = true;
+
+    if ( req->dataSize() >= 0 && req->getErrorString().isEmpty() )
+        ArticleCache::store( cacheKey, req->getFullData() );
+
+    deleteLater();
+}
+
+sptr< Dictionary::DataRequest > ArticleMaker::takeLateArticle( int token )
+{
+    Mutex::Lock _( lateArticlesMutex );
+
+    std::map< int, sptr< Dictionary::DataRequest > >::iterator i = lateArticles.find( token );
+
+    if ( i == lateArticles.end() )
+        return sptr< Dictionary::DataRequest >();
+
+    sptr< Dictionary::DataRequest > req = i->second;
+    lateArticles.erase( i );
+
+    return req;
+}
+
 
 bool ArticleMaker::adjustFilePath( QString & fileName )
 {
@@ -473,7 +600,8 @@ ArticleRequest::ArticleRequest(
         QMap< QString, QString > const & contexts_,
         vector< sptr< Dictionary::Class > > const & activeDicts_,
         string const & header,
-        int sizeLimit, bool needExpandOptionalParts_, bool ignoreDiacritics_ ):
+        int sizeLimit, bool needExpandOptionalParts_, bool ignoreDiacritics_,
+        int deadline_, bool prefetch_ ):
     word( word_ ), group( group_ ), contexts( contexts_ ),
     activeDicts( activeDicts_ ),
     altsDone( false ), bodyDone( false ), foundAnyDefinitions( false ),
@@ -481,20 +609,52 @@ ArticleRequest::ArticleRequest(
   ,   articleSizeLimit( sizeLimit )
   ,   needExpandOptionalParts( needExpandOptionalParts_ )
   ,   ignoreDiacritics( ignoreDiacritics_ )
+  ,   deadline( deadline_ )
+  ,   deadlinePassed( false )
+  ,   prefetch( prefetch_ )
 {
     // No need to lock dataMutex on construction
 
+    // The dictionaries which usually miss the deadline are asked last, so
+    // that the fast ones don't have to wait behind them
+    if ( deadline > 0 )
+    {
+        vector< sptr< Dictionary::Class > > slowDicts;
+        vector< sptr< Dictionary::Class > >::iterator fastEnd = activeDicts.begin();
+
+        for( unsigned x = 0; x < activeDicts.size(); ++x )
+        {
+            if ( activeDicts[ x ]->getStats()->p95Ms( Dictionary::Stats::Article,
+                                                     MinArticlesToDemote ) > deadline )
+                slowDicts.push_back( activeDicts[ x ] );
+            else
+                *fastEnd++ = activeDicts[ x ];
+        }
+
+        std::copy( slowDicts.begin(), slowDicts.end(), fastEnd );
+    }
+
+    // The whole lookup goes to the trace too, as the parent of the requests
+    // made to the dictionaries
+    if( GdTrace::isEnabled() )
+        setTraceId( GdTrace::begin( string(), string(), prefetch ? "prefetch" : "article" ) );
+
     hasAnyData = true;
 
-    data.resize( header.size() );
-    memcpy( &data.front(), header.data(), header.size() );
+    data.assign( header.begin(), header.end() ); // No header when prefetching
 
     // Accumulate main forms
 
     for( unsigned x = 0; x < activeDicts.size(); ++x )
     {
+        int traceId = GdTrace::isEnabled() ?
+                          GdTrace::begin( activeDicts[ x ]->getId(), activeDicts[ x ]->getName(),
+                                          "alt search" ) : 0;
+
         sptr< Dictionary::WordSearchRequest > s = activeDicts[ x ]->findHeadwordsForSynonym( gd::toWString( word ) );
 
+        s->setTraceId( traceId );
+
         connect( s.get(), SIGNAL( finished() ),
                  this, SLOT( altSearchFinished() ), Qt::QueuedConnection );
 
@@ -551,29 +711,100 @@ void ArticleRequest::altSearchFinished()
 
         for( unsigned x = 0; x < activeDicts.size(); ++x )
         {
+            // The online dictionaries aren't bothered with the words which may
+            // never get looked up, and their articles aren't cached anyway
+            if ( prefetch && !ArticleCache::canCache( *activeDicts[ x ] ) )
+                continue;
+
+            int traceId = GdTrace::isEnabled() ?
+                              GdTrace::begin( activeDicts[ x ]->getId(), activeDicts[ x ]->getName(),
+                                              "body" ) : 0;
+            qint64 started = Dictionary::Stats::now();
+
             try
             {
-                sptr< Dictionary::DataRequest > r =
-                        activeDicts[ x ]->getArticle( wordStd, altsVector,
-                                                      gd::toWString( contexts.value( QString::fromStdString( activeDicts[ x ]->getId() ) ) ),
-                                                      ignoreDiacritics );
+                wstring context = gd::toWString( contexts.value( QString::fromStdString( activeDicts[ x ]->getId() ) ) );
+
+                QByteArray cacheKey = ArticleCache::makeKey( *activeDicts[ x ], wordStd, altsVector,
+                                                             context, ignoreDiacritics );
+
+                sptr< Dictionary::DataRequest > r;
+
+                if ( !cacheKey.isEmpty() )
+                {
+                    r = ArticleCache::find( cacheKey );
+                    activeDicts[ x ]->getStats()->addCacheAccess( Dictionary::Stats::RenderedArticles, r.get() );
+                }
+
+                if ( r.get() )
+                {
+                    // Already rendered once, nothing to measure. Storing it
+                    // again only marks it as recently used.
+                    GdTrace::end( traceId );
+                }
+                else
+                {
+                    r = activeDicts[ x ]->getArticle( wordStd, altsVector, context, ignoreDiacritics );
+
+                    r->setTraceId( traceId );
+                    r->setStats( activeDicts[ x ]->getStats(), Dictionary::Stats::Article, started );
+                }
 
                 connect( r.get(), SIGNAL( finished() ),
                          this, SLOT( bodyFinished() ), Qt::QueuedConnection );
 
                 bodyRequests.push_back( r );
+                bodyDicts.push_back( activeDicts[ x ] );
+                bodyCacheKeys.push_back( cacheKey );
             }
             catch( std::exception & e )
             {
+                GdTrace::end( traceId );
+
                 gdWarning( "getArticle request error (%s) in \"%s\"\n",
                            e.what(), activeDicts[ x ]->getName().c_str() );
             }
         }
 
+        if ( deadline > 0 )
+            QTimer::singleShot( deadline, this, SLOT( deadlineReached() ) );
+
         bodyFinished(); // Handle any ones which have already finished
     }
 }
 
+sptr< Dictionary::DataRequest > ArticleRequest::requestArticle( Dictionary::Class & dict )
+{
+    int traceId = GdTrace::isEnabled() ?
+                      GdTrace::begin( dict.getId(), dict.getName(), "body" ) : 0;
+    qint64 started = Dictionary::Stats::now();
+
+    try
+    {
+        sptr< Dictionary::DataRequest > r =
+            dict.getArticle( gd::toWString( word ), vector< wstring >( alts.begin(), alts.end() ),
+                             gd::toWString( contexts.value( QString::fromStdString( dict.getId() ) ) ),
+                             ignoreDiacritics );
+
+        r->setTraceId( traceId );
+        r->setStats( dict.getStats(), Dictionary::Stats::Article, started );
+
+        connect( r.get(), SIGNAL( finished() ),
+                 this, SLOT( bodyFinished() ), Qt::QueuedConnection );
+
+        return r;
+    }
+    catch( std::exception & e )
+    {
+        GdTrace::end( traceId );
+
+        gdWarning( "getArticle request error (%s) in \"%s\"\n",
+                   e.what(), dict.getName().c_str() );
+
+        return sptr< Dictionary::DataRequest >( new Dictionary::DataRequestInstant( false ) );
+    }
+}
+
 int ArticleRequest::findEndOfCloseDiv( const QString &str, int pos )
 {
     for( ; ; )
@@ -592,6 +823,76 @@ int ArticleRequest::findEndOfCloseDiv( const QString &str, int pos )
     }
 }
 
+string ArticleRequest::makeArticleHead( Dictionary::Class & dict, bool collapse )
+{
+    string dictId = dict.getId();
+
+    string head;
+
+    string gdFrom = "gdfrom-" + Html::escape( dictId );
+
+    if ( closePrevSpan )
+    {
+        head += "</div></div><div style=\"clear:both;\"></div><span class=\"gdarticleseparator\"></span>";
+    }
+    else
+    {
+        // This is the first article
+        head += "<script type=\"text/javascript\">"
+                "var gdCurrentArticle=\"" + gdFrom  + "\"; "
+                                                      "articleview.onJsActiveArticleChanged(gdCurrentArticle)</script>";
+    }
+
+    string jsVal = Html::escapeForJavaScript( dictId );
+    head += "<script type=\"text/javascript\">var gdArticleContents; "
+            "if ( !gdArticleContents ) gdArticleContents = \"" + jsVal +" \"; "
+                                                                        "else gdArticleContents += \"" + jsVal + " \";</script>";
+
+    head += string( "<div class=\"gdarticle" ) +
+            ( closePrevSpan ? "" : " gdactivearticle" ) +
+            ( collapse ? " gdcollapsedarticle" : "" ) +
+            "\" id=\"" + gdFrom +
+            "\" onClick=\"gdMakeArticleActive( '" + jsVal + "' );\" " +
+            " onContextMenu=\"gdMakeArticleActive( '" + jsVal + "' );\""
+            + ">";
+
+    closePrevSpan = true;
+
+    head += string( "<div class=\"gddictname\" onclick=\"gdExpandArticle(\'" ) + dictId + "\');"
+            + ( collapse ? "\" style=\"cursor:pointer;" : "" )
+            + "\" id=\"gddictname-" + Html::escape( dictId ) + "\""
+            + ( collapse ? string( " title=\"" ) + tr( "Expand article" ).toUtf8().data() + "\"" : "" )
+            + "><span class=\"gddicticon\"><img src=\"gico://" + Html::escape( dictId )
+            + "/dicticon.png\"></span><span class=\"gdfromprefix\">"  +
+            Html::escape( tr( "From " ).toUtf8().data() ) + "</span><span class=\"gddicttitle\">" +
+            Html::escape( dict.getDescName().c_str() ) + "</span>"
+            + "<span class=\"collapse_expand_area\"><img src=\"qrcx://localhost/icons/blank.png\" class=\""
+            + ( collapse ? "gdexpandicon" : "gdcollapseicon" )
+            + "\" id=\"expandicon-" + Html::escape( dictId ) + "\""
+            + ( collapse ? "" : string( " title=\"" ) + tr( "Collapse article" ).toUtf8().data() + "\"" )
+            + "></span>" + "</div>";
+
+    head += "<div class=\"gddictnamebodyseparator\"></div>";
+
+    head += "<div class=\"gdarticlebody gdlangfrom-";
+    head += LangCoder::intToCode2( dict.getLangFrom() ).toLatin1().data();
+    head += "\" lang=\"";
+    head += LangCoder::intToCode2( dict.getLangTo() ).toLatin1().data();
+    head += "\"";
+    head += " style=\"display:";
+    head += collapse ? "none" : "inline";
+    head += string( "\" id=\"gdarticlefrom-" ) + Html::escape( dictId ) + "\">";
+
+    return head;
+}
+
+void ArticleRequest::deadlineReached()
+{
+    deadlinePassed = true;
+
+    bodyFinished();
+}
+
 void ArticleRequest::bodyFinished()
 {
     if ( bodyDone )
@@ -603,6 +904,15 @@ void ArticleRequest::bodyFinished()
 
     while ( bodyRequests.size() )
     {
+        sptr< Dictionary::Class > activeDict = bodyDicts.front();
+
+        if ( ArticleCache::isMiss( *bodyRequests.front() ) )
+        {
+            // The cached article couldn't be read from disk after all
+            bodyRequests.front() = requestArticle( *activeDict );
+            continue;
+        }
+
         // Since requests should go in order, check the first one first
         if ( bodyRequests.front()->isFinished() )
         {
@@ -614,29 +924,15 @@ void ArticleRequest::bodyFinished()
 
             const QString &errorString = req.getErrorString();
 
+            if ( prefetch )
+            {
+                // Nobody sees the page, so it's only the cache being filled
+                if ( req.dataSize() >= 0 && errorString.isEmpty() && !bodyCacheKeys.front().isEmpty() )
+                    ArticleCache::store( bodyCacheKeys.front(), req.getFullData() );
+            }
+            else
             if ( req.dataSize() >= 0 || !errorString.isEmpty() )
             {
-                sptr< Dictionary::Class > const & activeDict =
-                        activeDicts[ activeDicts.size() - bodyRequests.size() ];
-
-                string dictId = activeDict->getId();
-
-                string head;
-
-                string gdFrom = "gdfrom-" + Html::escape( dictId );
-
-                if ( closePrevSpan )
-                {
-                    head += "</div></div><div style=\"clear:both;\"></div><span class=\"gdarticleseparator\"></span>";
-                }
-                else
-                {
-                    // This is the first article
-                    head += "<script type=\"text/javascript\">"
-                            "var gdCurrentArticle=\"" + gdFrom  + "\"; "
-                                                                  "articleview.onJsActiveArticleChanged(gdCurrentArticle)</script>";
-                }
-
                 bool collapse = false;
                 if( articleSizeLimit >= 0 )
                 {
@@ -674,45 +970,7 @@ void ArticleRequest::bodyFinished()
                     }
                 }
 
-                string jsVal = Html::escapeForJavaScript( dictId );
-                head += "<script type=\"text/javascript\">var gdArticleContents; "
-                        "if ( !gdArticleContents ) gdArticleContents = \"" + jsVal +" \"; "
-                                                                                    "else gdArticleContents += \"" + jsVal + " \";</script>";
-
-                head += string( "<div class=\"gdarticle" ) +
-                        ( closePrevSpan ? "" : " gdactivearticle" ) +
-                        ( collapse ? " gdcollapsedarticle" : "" ) +
-                        "\" id=\"" + gdFrom +
-                        "\" onClick=\"gdMakeArticleActive( '" + jsVal + "' );\" " +
-                        " onContextMenu=\"gdMakeArticleActive( '" + jsVal + "' );\""
-                        + ">";
-
-                closePrevSpan = true;
-
-                head += string( "<div class=\"gddictname\" onclick=\"gdExpandArticle(\'" ) + dictId + "\');"
-                        + ( collapse ? "\" style=\"cursor:pointer;" : "" )
-                        + "\" id=\"gddictname-" + Html::escape( dictId ) + "\""
-                        + ( collapse ? string( " title=\"" ) + tr( "Expand article" ).toUtf8().data() + "\"" : "" )
-                        + "><span class=\"gddicticon\"><img src=\"gico://" + Html::escape( dictId )
-                        + "/dicticon.png\"></span><span class=\"gdfromprefix\">"  +
-                        Html::escape( tr( "From " ).toUtf8().data() ) + "</span><span class=\"gddicttitle\">" +
-                        Html::escape( activeDict->getDescName().c_str() ) + "</span>"
-                        + "<span class=\"collapse_expand_area\"><img src=\"qrcx://localhost/icons/blank.png\" class=\""
-                        + ( collapse ? "gdexpandicon" : "gdcollapseicon" )
-                        + "\" id=\"expandicon-" + Html::escape( dictId ) + "\""
-                        + ( collapse ? "" : string( " title=\"" ) + tr( "Collapse article" ).toUtf8().data() + "\"" )
-                        + "></span>" + "</div>";
-
-                head += "<div class=\"gddictnamebodyseparator\"></div>";
-
-                head += "<div class=\"gdarticlebody gdlangfrom-";
-                head += LangCoder::intToCode2( activeDict->getLangFrom() ).toLatin1().data();
-                head += "\" lang=\"";
-                head += LangCoder::intToCode2( activeDict->getLangTo() ).toLatin1().data();
-                head += "\"";
-                head += " style=\"display:";
-                head += collapse ? "none" : "inline";
-                head += string( "\" id=\"gdarticlefrom-" ) + Html::escape( dictId ) + "\">";
+                string head = makeArticleHead( *activeDict, collapse );
 
                 if ( !errorString.isEmpty() )
                 {
@@ -743,12 +1001,48 @@ void ArticleRequest::bodyFinished()
                 wasUpdated = true;
 
                 foundAnyDefinitions = true;
+
+                if ( errorString.isEmpty() && !bodyCacheKeys.front().isEmpty() )
+                    ArticleCache::store( bodyCacheKeys.front(), req.getFullData() );
             }
             GD_DPRINTF( "erasing..\n" );
             bodyRequests.pop_front();
+            bodyDicts.pop_front();
+            bodyCacheKeys.pop_front();
             GD_DPRINTF( "erase done..\n" );
         }
         else
+        if ( deadlinePassed )
+        {
+            // Too late. The page gets a placeholder which fetches the article
+            // once it's there, see ArticleMaker::takeLateArticle(), and the
+            // ones after it don't have to wait anymore.
+
+            string token = QString::number( addLateArticle( bodyRequests.front() ) ).toUtf8().data();
+
+            if ( !bodyCacheKeys.front().isEmpty() )
+                new LateArticleStorer( bodyRequests.front(), bodyCacheKeys.front() );
+
+            string head = makeArticleHead( *activeDict, false );
+
+            head += "<div class=\"gdlatearticle\" id=\"gdlate-" + token + "\">"
+                    + Html::escape( tr( "Loading..." ).toUtf8().data() ) + "</div>"
+                    "<script type=\"text/javascript\">gdLoadLateArticle( " + token
+                    + ", '" + Html::escapeForJavaScript( activeDict->getId() ) + "' );</script>";
+
+            appendToData( head );
+
+            wasUpdated = true;
+
+            // It may still turn out empty, but the not-found page with its
+            // suggestions would be even less helpful
+            foundAnyDefinitions = true;
+
+            bodyRequests.pop_front();
+            bodyDicts.pop_front();
+            bodyCacheKeys.pop_front();
+        }
+        else
         {
             GD_DPRINTF( "one not finished.\n" );
             break;
@@ -770,7 +1064,7 @@ void ArticleRequest::bodyFinished()
                 closePrevSpan = false;
             }
 
-            if ( !foundAnyDefinitions )
+            if ( !foundAnyDefinitions && !prefetch )
             {
                 // No definitions were ever found, say so to the user.
 
@@ -1133,6 +1427,7 @@ void ArticleRequest::cancel()
         for( list< sptr< Dictionary::WordSearchRequest > >::iterator i =
              altSearches.begin(); i != altSearches.end(); ++i )
         {
+            (*i)->traceCancel();
             (*i)->cancel();
         }
     }
@@ -1141,6 +1436,7 @@ void ArticleRequest::cancel()
         for( list< sptr< Dictionary::DataRequest > >::iterator i =
              bodyRequests.begin(); i != bodyRequests.end(); ++i )
         {
+            (*i)->traceCancel();
             (*i)->cancel();
         }
     }
@@ -25,6 +25,7 @@ class ArticleMaker: public QObject
     bool needExpandOptionalParts;
     bool collapseBigArticles;
     int articleLimitSize;
+    int lookupDeadline;
 
 public:
 
@@ -57,6 +58,15 @@ public:
                                                        QStringList const & dictIDs = QStringList(),
                                                        bool ignoreDiacritics = false ) const;
 
+    /// Looks the word up like makeDefinitionFor() does, only for its articles
+    /// to get into ArticleCache, so that the actual lookup made shortly after
+    /// finds them there. Only the dictionaries whose articles can be cached
+    /// are asked. The lookup deadline doesn't apply, and nothing else is
+    /// searched for if there are no articles.
+    sptr< Dictionary::DataRequest > makePrefetchFor( QString const & word, unsigned groupId,
+                                                     QSet< QString > const & mutedDicts,
+                                                     bool ignoreDiacritics ) const;
+
     /// Makes up a text which states that no translation for the given word
     /// was found. Sometimes it's better to call this directly when it's already
     /// known that there's no translation.
@@ -78,6 +88,16 @@ public:
     /// Set collapse articles parameters
     void setCollapseParameters( bool autoCollapse, int articleSize );
 
+    /// Sets the time in milliseconds the dictionaries are given to find their
+    /// articles. The ones found later are fetched by the page on its own, see
+    /// takeLateArticle(). 0 means waiting for all of them.
+    void setLookupDeadline( int msecs );
+
+    /// Returns the request for the article which missed the lookup deadline,
+    /// by the token its placeholder was given. The request can only be taken
+    /// once. Returns an empty pointer if there's no such one.
+    static sptr< Dictionary::DataRequest > takeLateArticle( int token );
+
 private:
 
     /// Makes everything up to and including the opening body tag.
@@ -90,6 +110,26 @@ private:
     friend class ArticleRequest; // Allow it calling makeNotFoundBody()
 };
 
+/// Puts the article which missed the lookup deadline to ArticleCache once
+/// it's finished, deleting itself afterwards. This should really be private,
+/// but we need it to be handled by moc.
+class LateArticleStorer: public QObject
+{
+    Q_OBJECT
+
+    sptr< Dictionary::DataRequest > req;
+    QByteArray cacheKey;
+    bool stored;
+
+public:
+
+    LateArticleStorer( sptr< Dictionary::DataRequest > const &, QByteArray const & cacheKey );
+
+private slots:
+
+    void requestFinished();
+};
+
 /// The request specific to article maker. This should really be private,
 /// but we need it to be handled by moc.
 class ArticleRequest: public Dictionary::DataRequest
@@ -104,6 +144,8 @@ class ArticleRequest: public Dictionary::DataRequest
     std::list< sptr< Dictionary::WordSearchRequest > > altSearches;
     bool altsDone, bodyDone;
     std::list< sptr< Dictionary::DataRequest > > bodyRequests;
+    std::list< sptr< Dictionary::Class > > bodyDicts; // The dictionaries of bodyRequests
+    std::list< QByteArray > bodyCacheKeys; // ArticleCache keys of bodyRequests
     bool foundAnyDefinitions;
     bool closePrevSpan; // Indicates whether the last opened article span is to
     // be closed after the article ends.
@@ -126,6 +168,9 @@ class ArticleRequest: public Dictionary::DataRequest
     int articleSizeLimit;
     bool needExpandOptionalParts;
     bool ignoreDiacritics;
+    int deadline; // In milliseconds, 0 if none
+    bool deadlinePassed;
+    bool prefetch; // See ArticleMaker::makePrefetchFor()
 
 public:
 
@@ -134,7 +179,8 @@ public:
                     std::vector< sptr< Dictionary::Class > > const & activeDicts,
                     std::string const & header,
                     int sizeLimit, bool needExpandOptionalParts_,
-                    bool ignoreDiacritics = false );
+                    bool ignoreDiacritics = false,
+                    int deadline = 0, bool prefetch = false );
 
     virtual void cancel();
     //  { finish(); } // Add our own requests cancellation here
@@ -145,6 +191,7 @@ private slots:
     void bodyFinished();
     void stemmedSearchFinished();
     void individualWordFinished();
+    void deadlineReached();
 
 private:
 
@@ -164,8 +211,16 @@ private:
     /// Escapes the spacing between the words to include in html.
     std::string escapeSpacing( QString const & );
 
+    /// Requests the article from the dictionary itself, for when the cached
+    /// one turns out to be missing
+    sptr< Dictionary::DataRequest > requestArticle( Dictionary::Class & );
+
     /// Find end of corresponding </div> tag
     int findEndOfCloseDiv( QString const &, int pos );
+
+    /// Makes the html opening the article of the given dictionary, up to its
+    /// body, closing the previous one if needed
+    std::string makeArticleHead( Dictionary::Class &, bool collapse );
 };
 
 
@@ -12,6 +12,7 @@
 
 #include "article_netmgr.hh"
 #include "article_maker.hh"
+#include "resourcecache.hh"
 #include "wstring_qt.hh"
 #include "gddebug.hh"
 #include "qt4x5.hh"
@@ -296,7 +297,8 @@ QNetworkReply * ArticleNetworkAccessManager::createRequest( Operation op,
         sptr< Dictionary::DataRequest > dr = getResource( req.url(), contentType );
 
         if ( dr.get() )
-            return new ArticleResourceReply( this, req, dr, contentType );
+            return new ArticleResourceReply( this, req, dr, contentType,
+                                             ResourceCache::makeKey( req.url() ) );
     }
 
     // Check the Referer. If the user has opted-in to block elements from external
@@ -390,6 +392,18 @@ sptr< Dictionary::DataRequest > ArticleNetworkAccessManager::getResource(
         if ( Qt4x5::Url::queryItemValue( url, "blank" ) == "1" )
             return articleMaker.makeEmptyPage();
 
+        QString lateToken = Qt4x5::Url::queryItemValue( url, "late" );
+        if( !lateToken.isEmpty() )
+        {
+            // The article which missed the lookup deadline, fetched by its
+            // placeholder on the page
+            sptr< Dictionary::DataRequest > req = ArticleMaker::takeLateArticle( lateToken.toInt() );
+            if( req )
+                return req;
+
+            return sptr< Dictionary::DataRequest >(new Dictionary::DataRequestInstant( false ));
+        }
+
         bool groupIsValid = false;
 
         QString word = Qt4x5::Url::queryItemValue( url, "word" );
@@ -447,9 +461,22 @@ sptr< Dictionary::DataRequest > ArticleNetworkAccessManager::getResource(
 
         if ( !search )
         {
+            QByteArray cacheKey = ResourceCache::makeKey( url );
+
             for( unsigned x = 0; x < dictionaries.size(); ++x )
                 if ( dictionaries[ x ]->getId() == id )
                 {
+                    if( !cacheKey.isEmpty() )
+                    {
+                        // The same images and icons appear in many articles
+                        sptr< Dictionary::DataRequest > cached = ResourceCache::find( cacheKey );
+
+                        dictionaries[ x ]->getStats()->addCacheAccess( Dictionary::Stats::Resources,
+                                                                       cached.get() );
+                        if( cached )
+                            return cached;
+                    }
+
                     if( url.scheme() == "gico" )
                     {
                         QByteArray bytes;
@@ -460,6 +487,7 @@ sptr< Dictionary::DataRequest > ArticleNetworkAccessManager::getResource(
                         sptr< Dictionary::DataRequestInstant > ico ( new Dictionary::DataRequestInstant( true ) );
                         ico->getData().resize( bytes.size() );
                         memcpy( &( ico->getData().front() ), bytes.data(), bytes.size() );
+                        ResourceCache::store( cacheKey, ico->getData() );
                         return ico;
                     }
                     try
@@ -514,8 +542,9 @@ sptr< Dictionary::DataRequest > ArticleNetworkAccessManager::getResource(
 ArticleResourceReply::ArticleResourceReply( QObject * parent,
                                             QNetworkRequest const & netReq,
                                             sptr< Dictionary::DataRequest > const & req_,
-                                            QString const & contentType ):
-    QNetworkReply( parent ), req( req_ ), alreadyRead( 0 )
+                                            QString const & contentType,
+                                            QByteArray const & cacheKey_ ):
+    QNetworkReply( parent ), req( req_ ), alreadyRead( 0 ), cacheKey( cacheKey_ )
 {
     setRequest( netReq );
 
@@ -604,6 +633,9 @@ qint64 ArticleResourceReply::readData( char * out, qint64 maxSize )
 
     alreadyRead += toRead;
 
+    // The streamed resources needn't keep what was read already
+    req->releaseData( alreadyRead );
+
     if ( !toRead && finished )
         return -1;
     else
@@ -619,6 +651,10 @@ void ArticleResourceReply::finishedSlot()
 {
     if ( req->dataSize() < 0 )
         error( ContentNotFoundError );
+    else
+    if ( !cacheKey.isEmpty() && req->getErrorString().isEmpty() &&
+         req->getFullData().size() == (size_t) req->dataSize() ) // Nothing was released by streaming
+        ResourceCache::store( cacheKey, req->getFullData() );
 
     finished();
 }
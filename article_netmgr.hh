@@ -164,13 +164,17 @@ class ArticleResourceReply: public QNetworkReply
 
     sptr< Dictionary::DataRequest > req;
     qint64 alreadyRead;
+    QByteArray cacheKey; // Where to put the resource in ResourceCache, if anywhere
 
 public:
 
+    /// The resource gets stored in ResourceCache under the key given once
+    /// it's read in full, unless the key is empty
     ArticleResourceReply( QObject * parent,
                           QNetworkRequest const &,
                           sptr< Dictionary::DataRequest > const &,
-                          QString const & contentType );
+                          QString const & contentType,
+                          QByteArray const & cacheKey = QByteArray() );
 
     ~ArticleResourceReply();
 
@@ -0,0 +1,517 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "articlecache.hh"
+#include "config.hh"
+#include "wstring_qt.hh"
+#include "gddebug.hh"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <utility>
+
+namespace ArticleCache {
+
+namespace {
+
+size_t const MaxMemoryBytes = 8 * 1024 * 1024;
+qint64 const MaxDiskBytes = 64 * 1024 * 1024;
+
+/// Larger articles are rare and would push too many others out
+size_t const MaxArticleSize = 1024 * 1024;
+
+quint32 const FileSignature = 0x43414447; // GDAC, little-endian
+quint32 const FileVersion = 2;
+
+struct MemoryEntry
+{
+    QByteArray key;
+    std::vector< char > article;
+};
+
+struct DiskEntry
+{
+    qint64 size;
+    qint64 lastUsed;
+};
+
+struct PendingWrite
+{
+    QString name;
+    QByteArray key;
+    std::vector< char > article;
+};
+
+Mutex cacheMutex;
+
+std::list< MemoryEntry > memoryEntries; // The most recently used ones first
+std::map< QByteArray, std::list< MemoryEntry >::iterator > memoryIndex;
+size_t memoryBytes = 0;
+
+bool diskScanned = false;
+std::map< QString, DiskEntry > diskEntries; // By the file name
+qint64 diskBytes = 0;
+qint64 useCounter = 0; // Orders the disk entries by their last use
+
+std::list< PendingWrite > pendingWrites;
+bool diskRunnableStarted = false;
+
+QByteArray renderOptions;
+
+QString cacheDir()
+{
+    return Config::getIndexDir() + "articlecache";
+}
+
+QString fileNameFor( QByteArray const & key )
+{
+    return QString::fromLatin1( QCryptographicHash::hash( key, QCryptographicHash::Sha1 ).toHex() );
+}
+
+/// Returns the modification time and the size of the dictionary's index, or
+/// an empty string if it has none or its articles can't be cached. The index
+/// is looked at every time, as it's rewritten in place when the dictionary
+/// gets reindexed.
+QByteArray indexVersion( Dictionary::Class & dict )
+{
+    if ( dict.getFeatures() & Dictionary::ArticlesUseSessionFiles )
+        return QByteArray();
+
+    QFileInfo info( Config::getIndexDir() + QString::fromUtf8( dict.getId().c_str() ) );
+    if ( !info.exists() )
+        return QByteArray();
+
+    return QByteArray::number( info.lastModified().toMSecsSinceEpoch() ) + "-"
+           + QByteArray::number( info.size() );
+}
+
+/// Called with cacheMutex locked
+void putInMemory( QByteArray const & key, std::vector< char > const & article )
+{
+    std::map< QByteArray, std::list< MemoryEntry >::iterator >::iterator i = memoryIndex.find( key );
+
+    if ( i != memoryIndex.end() )
+    {
+        memoryEntries.splice( memoryEntries.begin(), memoryEntries, i->second );
+        return;
+    }
+
+    memoryEntries.push_front( MemoryEntry() );
+    memoryEntries.front().key = key;
+    memoryEntries.front().article = article;
+    memoryIndex[ key ] = memoryEntries.begin();
+    memoryBytes += article.size();
+
+    while ( memoryBytes > MaxMemoryBytes && memoryEntries.size() > 1 )
+    {
+        memoryBytes -= memoryEntries.back().article.size();
+        memoryIndex.erase( memoryEntries.back().key );
+        memoryEntries.pop_back();
+    }
+}
+
+/// Learns what's on disk from the previous runs. Run by DiskRunnable only.
+void scanDisk()
+{
+    {
+        Mutex::Lock _( cacheMutex );
+
+        if ( diskScanned )
+            return;
+    }
+
+    // The oldest files come first, so they get the lowest use counts
+    QFileInfoList files = QDir( cacheDir() ).entryInfoList( QDir::Files, QDir::Time | QDir::Reversed );
+
+    Mutex::Lock _( cacheMutex );
+
+    for( int x = 0; x < files.size(); ++x )
+    {
+        DiskEntry & entry = diskEntries[ files[ x ].fileName() ];
+        entry.size = files[ x ].size();
+        entry.lastUsed = ++useCounter;
+        diskBytes += entry.size;
+    }
+
+    diskScanned = true;
+}
+
+/// Removes the least recently used files once the disk tier grows too large.
+/// Run by DiskRunnable only.
+void trimDisk()
+{
+    std::vector< QString > removed;
+
+    {
+        Mutex::Lock _( cacheMutex );
+
+        if ( diskBytes <= MaxDiskBytes )
+            return;
+
+        std::vector< std::pair< qint64, QString > > byUse;
+        byUse.reserve( diskEntries.size() );
+
+        for( std::map< QString, DiskEntry >::const_iterator i = diskEntries.begin(); i != diskEntries.end(); ++i )
+            byUse.push_back( std::make_pair( i->second.lastUsed, i->first ) );
+
+        std::sort( byUse.begin(), byUse.end() );
+
+        // Make some room, so that it doesn't have to be done on every store
+        for( size_t x = 0; x < byUse.size() && diskBytes > MaxDiskBytes / 10 * 9; ++x )
+        {
+            diskBytes -= diskEntries[ byUse[ x ].second ].size;
+            diskEntries.erase( byUse[ x ].second );
+            removed.push_back( byUse[ x ].second );
+        }
+    }
+
+    QDir dir( cacheDir() );
+
+    for( size_t x = 0; x < removed.size(); ++x )
+        dir.remove( removed[ x ] );
+}
+
+bool readFromDisk( QString const & name, QByteArray const & key, std::vector< char > & article )
+{
+    QFile file( cacheDir() + QDir::separator() + name );
+    if ( !file.open( QFile::ReadOnly ) )
+        return false;
+
+    QDataStream in( &file );
+
+    quint32 signature, version;
+    QByteArray storedKey, data;
+
+    in >> signature >> version;
+    if ( signature != FileSignature || version != FileVersion )
+        return false;
+
+    in >> storedKey >> data;
+    if ( in.status() != QDataStream::Ok || storedKey != key )
+        return false;
+
+    article.assign( data.constData(), data.constData() + data.size() );
+
+    return true;
+}
+
+/// Run by DiskRunnable only
+void writeToDisk( PendingWrite const & write )
+{
+    {
+        Mutex::Lock _( cacheMutex );
+
+        // It could have been stored twice before the disk got scanned
+        if ( diskEntries.find( write.name ) != diskEntries.end() )
+            return;
+    }
+
+    QDir().mkpath( cacheDir() );
+
+    QFile file( cacheDir() + QDir::separator() + write.name );
+    if ( !file.open( QFile::WriteOnly | QFile::Truncate ) )
+        return;
+
+    QDataStream out( &file );
+    out << FileSignature << FileVersion << write.key
+        << QByteArray::fromRawData( write.article.empty() ? "" : &write.article.front(),
+                                    write.article.size() );
+
+    file.close();
+
+    if ( out.status() != QDataStream::Ok || file.error() != QFile::NoError )
+    {
+        gdWarning( "Can't write the article cache file %s\n", write.name.toUtf8().data() );
+        file.remove();
+        return;
+    }
+
+    Mutex::Lock _( cacheMutex );
+
+    DiskEntry & entry = diskEntries[ write.name ];
+    entry.size = file.size();
+    entry.lastUsed = ++useCounter;
+    diskBytes += entry.size;
+}
+
+/// Does all the disk work but reading, so that none of it is done on the GUI
+/// thread. Only one is running at a time, so it has the files to itself.
+class DiskRunnable: public QRunnable
+{
+public:
+
+    virtual void run()
+    {
+        scanDisk();
+
+        for( ; ; )
+        {
+            PendingWrite write;
+
+            {
+                Mutex::Lock _( cacheMutex );
+
+                if ( pendingWrites.empty() )
+                {
+                    diskRunnableStarted = false;
+                    return;
+                }
+
+                write.name.swap( pendingWrites.front().name );
+                write.key.swap( pendingWrites.front().key );
+                write.article.swap( pendingWrites.front().article );
+                pendingWrites.pop_front();
+            }
+
+            writeToDisk( write );
+            trimDisk();
+        }
+    }
+};
+
+/// Called with cacheMutex locked
+void startDiskRunnable()
+{
+    if ( diskRunnableStarted )
+        return;
+
+    diskRunnableStarted = true;
+
+    QThreadPool::globalInstance()->start( new DiskRunnable );
+}
+
+class DiskReadRequest;
+
+class DiskReadRequestRunnable: public QRunnable
+{
+    DiskReadRequest & r;
+    QSemaphore & hasExited;
+
+public:
+
+    DiskReadRequestRunnable( DiskReadRequest & r_,
+                             QSemaphore & hasExited_ ): r( r_ ),
+        hasExited( hasExited_ )
+    {}
+
+    ~DiskReadRequestRunnable()
+    {
+        hasExited.release();
+    }
+
+    virtual void run();
+};
+
+/// Reads the article stored on disk
+class DiskReadRequest: public Dictionary::DataRequest
+{
+    friend class DiskReadRequestRunnable;
+
+    QByteArray key;
+    QString name;
+
+    AtomicInt32 isCancelled;
+    QSemaphore hasExited;
+
+    bool missed;
+
+public:
+
+    DiskReadRequest( QByteArray const & key_, QString const & name_ ):
+        key( key_ ), name( name_ ), missed( false )
+    {
+        QThreadPool::globalInstance()->start(
+                    new DiskReadRequestRunnable( *this, hasExited ) );
+    }
+
+    void run(); // Run from another thread by DiskReadRequestRunnable
+
+    bool isMissed() const
+    { return missed; }
+
+    virtual void cancel()
+    {
+        isCancelled.ref();
+    }
+
+    ~DiskReadRequest()
+    {
+        isCancelled.ref();
+        hasExited.acquire();
+    }
+};
+
+void DiskReadRequestRunnable::run()
+{
+    r.run();
+}
+
+void DiskReadRequest::run()
+{
+    if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+    {
+        finish();
+        return;
+    }
+
+    std::vector< char > article;
+
+    if ( readFromDisk( name, key, article ) )
+    {
+        {
+            Mutex::Lock _( cacheMutex );
+            putInMemory( key, article );
+        }
+
+        Mutex::Lock _( dataMutex );
+
+        data.swap( article );
+        hasAnyData = true;
+    }
+    else
+    {
+        // Gone or damaged, so it's forgotten and gets stored anew
+        Mutex::Lock _( cacheMutex );
+
+        std::map< QString, DiskEntry >::iterator i = diskEntries.find( name );
+        if ( i != diskEntries.end() )
+        {
+            diskBytes -= i->second.size;
+            diskEntries.erase( i );
+        }
+
+        missed = true;
+    }
+
+    finish();
+}
+
+}
+
+QByteArray makeKey( Dictionary::Class & dict, gd::wstring const & word,
+                    std::vector< gd::wstring > const & alts,
+                    gd::wstring const & context, bool ignoreDiacritics )
+{
+    QByteArray version = indexVersion( dict );
+    if ( version.isEmpty() )
+        return QByteArray();
+
+    Mutex::Lock _( cacheMutex );
+
+    QByteArray key( dict.getId().c_str() );
+    key += '\0';
+    key += version;
+    key += '\0';
+    key += renderOptions;
+    key += '\0';
+    key += gd::toQString( word ).toUtf8();
+
+    for( size_t x = 0; x < alts.size(); ++x )
+    {
+        key += '\1';
+        key += gd::toQString( alts[ x ] ).toUtf8();
+    }
+
+    key += '\0';
+    key += gd::toQString( context ).toUtf8();
+    key += '\0';
+    key += ignoreDiacritics ? 'd' : 'n';
+
+    return key;
+}
+
+bool canCache( Dictionary::Class & dict )
+{
+    return !indexVersion( dict ).isEmpty();
+}
+
+sptr< Dictionary::DataRequest > find( QByteArray const & key )
+{
+    Mutex::Lock _( cacheMutex );
+
+    std::map< QByteArray, std::list< MemoryEntry >::iterator >::iterator i = memoryIndex.find( key );
+
+    if ( i != memoryIndex.end() )
+    {
+        memoryEntries.splice( memoryEntries.begin(), memoryEntries, i->second );
+
+        sptr< Dictionary::DataRequestInstant > result( new Dictionary::DataRequestInstant( true ) );
+        result->getData() = i->second->article;
+
+        return result;
+    }
+
+    if ( !diskScanned )
+    {
+        // The disk tier is of no use until then
+        startDiskRunnable();
+        return sptr< Dictionary::DataRequest >();
+    }
+
+    QString name = fileNameFor( key );
+
+    std::map< QString, DiskEntry >::iterator d = diskEntries.find( name );
+    if ( d == diskEntries.end() )
+        return sptr< Dictionary::DataRequest >();
+
+    d->second.lastUsed = ++useCounter;
+
+    return sptr< Dictionary::DataRequest >( new DiskReadRequest( key, name ) );
+}
+
+bool isMiss( Dictionary::DataRequest & request )
+{
+    DiskReadRequest * r = dynamic_cast< DiskReadRequest * >( &request );
+
+    return r && r->isFinished() && r->isMissed();
+}
+
+void store( QByteArray const & key, std::vector< char > const & article )
+{
+    if ( key.isEmpty() || article.size() > MaxArticleSize )
+        return;
+
+    Mutex::Lock _( cacheMutex );
+
+    putInMemory( key, article );
+
+    QString name = fileNameFor( key );
+
+    if ( diskScanned && diskEntries.find( name ) != diskEntries.end() )
+        return;
+
+    pendingWrites.push_back( PendingWrite() );
+    pendingWrites.back().name = name;
+    pendingWrites.back().key = key;
+    pendingWrites.back().article = article;
+
+    startDiskRunnable();
+}
+
+void setRenderOptions( QByteArray const & options )
+{
+    Mutex::Lock _( cacheMutex );
+
+    renderOptions = options;
+}
+
+void clearMemory()
+{
+    Mutex::Lock _( cacheMutex );
+
+    memoryEntries.clear();
+    memoryIndex.clear();
+    memoryBytes = 0;
+}
+
+}
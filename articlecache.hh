@@ -0,0 +1,63 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __ARTICLECACHE_HH_INCLUDED__
+#define __ARTICLECACHE_HH_INCLUDED__
+
+#include <QByteArray>
+#include <vector>
+#include "dictionary.hh"
+#include "wstring.hh"
+
+/// A cache of the articles rendered by the dictionaries, so that looking the
+/// same word up again doesn't have to decompress and convert anything. The
+/// most recently used articles are kept in memory, and the rest on disk, in
+/// the "articlecache" subdirectory of the index directory. Both tiers are
+/// bounded in size, dropping the least recently used articles.
+/// The version of the dictionary's index is a part of the key, so the
+/// articles of the dictionaries reindexed since are never picked up again.
+/// All the functions are thread-safe.
+namespace ArticleCache {
+
+/// Makes the key for the article the dictionary would return for the given
+/// arguments of Dictionary::Class::getArticle(). Returns an empty key if the
+/// dictionary's articles can't be cached, which is the case for the ones
+/// without an index, such as the online ones, and for the ones whose
+/// articles use the files made for the session, see
+/// Dictionary::ArticlesUseSessionFiles.
+QByteArray makeKey( Dictionary::Class &, gd::wstring const & word,
+                    std::vector< gd::wstring > const & alts,
+                    gd::wstring const & context, bool ignoreDiacritics );
+
+/// Returns true if the articles of the dictionary can be cached, which is
+/// when makeKey() doesn't return an empty key for it
+bool canCache( Dictionary::Class & );
+
+/// Returns the cached article as a request, or an empty pointer if there's no
+/// such article in the cache. The ones in memory are returned finished, and
+/// the ones on disk get read in another thread. The disk tier is looked at
+/// once it's scanned in the background, which the first call starts.
+sptr< Dictionary::DataRequest > find( QByteArray const & key );
+
+/// Returns true if the request returned by find() has finished without the
+/// article, its file being gone or damaged. The article has to be requested
+/// from the dictionary then.
+bool isMiss( Dictionary::DataRequest & );
+
+/// Puts the article into the cache. The too large ones are ignored. It gets
+/// written to disk in another thread. Storing the article which is cached
+/// already only marks it as recently used.
+void store( QByteArray const & key, std::vector< char > const & article );
+
+/// Sets the options the dictionaries render their articles with, such as the
+/// maximum picture width. The articles rendered with different options are
+/// kept apart.
+void setRenderOptions( QByteArray const & );
+
+/// Drops the articles kept in memory, such as the ones of the dictionaries
+/// which are gone after a reload. The disk tier stays, being bounded anyway,
+/// and its articles of the reindexed dictionaries are never picked up again.
+void clearMemory();
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "articleprefetcher.hh"
+
+namespace {
+
+/// How many of the top suggestions get prefetched
+int const MaxPrefetchedWords = 3;
+
+/// How long the typing has to pause before the prefetching starts, in
+/// milliseconds
+int const PrefetchDelay = 300;
+
+}
+
+ArticlePrefetcher::ArticlePrefetcher( ArticleMaker const & articleMaker_, QObject * parent ):
+    QObject( parent ), articleMaker( articleMaker_ ), group( 0 ), ignoreDiacritics( false )
+{
+    delayTimer.setSingleShot( true );
+    delayTimer.setInterval( PrefetchDelay );
+
+    connect( &delayTimer, SIGNAL( timeout() ), this, SLOT( startNext() ) );
+}
+
+void ArticlePrefetcher::prefetch( QStringList const & words_, unsigned group_,
+                                  QSet< QString > const & mutedDicts_, bool ignoreDiacritics_ )
+{
+    cancel();
+
+    words = words_.mid( 0, MaxPrefetchedWords );
+    group = group_;
+    mutedDicts = mutedDicts_;
+    ignoreDiacritics = ignoreDiacritics_;
+
+    if ( !words.isEmpty() )
+        delayTimer.start();
+}
+
+void ArticlePrefetcher::cancel()
+{
+    delayTimer.stop();
+    words.clear();
+
+    if ( lookup.get() )
+    {
+        disconnect( lookup.get(), 0, this, 0 );
+        lookup->cancel();
+        lookup.reset();
+    }
+}
+
+void ArticlePrefetcher::startNext()
+{
+    lookup.reset();
+
+    if ( words.isEmpty() )
+        return;
+
+    lookup = articleMaker.makePrefetchFor( words.takeFirst(), group, mutedDicts, ignoreDiacritics );
+
+    if ( lookup->isFinished() )
+    {
+        // Nothing to look up in, most likely
+        startNext();
+        return;
+    }
+
+    connect( lookup.get(), SIGNAL( finished() ),
+             this, SLOT( lookupFinished() ), Qt::QueuedConnection );
+}
+
+void ArticlePrefetcher::lookupFinished()
+{
+    // A queued signal of a cancelled lookup could still arrive
+    if ( !lookup.get() || !lookup->isFinished() )
+        return;
+
+    startNext();
+}
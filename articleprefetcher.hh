@@ -0,0 +1,54 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __ARTICLEPREFETCHER_HH_INCLUDED__
+#define __ARTICLEPREFETCHER_HH_INCLUDED__
+
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include "article_maker.hh"
+
+/// Looks the top suggestions up in the background while the user is still
+/// typing, so that by the time one of them gets chosen, its articles are
+/// already in ArticleCache, and the dictionaries' indices and chunks have
+/// been read. The words are looked up one at a time, and only once the
+/// typing pauses, so that the prefetching doesn't compete with the
+/// suggestions themselves.
+class ArticlePrefetcher: public QObject
+{
+    Q_OBJECT
+
+public:
+
+    ArticlePrefetcher( ArticleMaker const &, QObject * parent = 0 );
+
+    /// Replaces the words to prefetch with the first few of the ones given,
+    /// which are to be looked up in the group given with the dictionaries
+    /// muted skipped.
+    void prefetch( QStringList const & words, unsigned group,
+                   QSet< QString > const & mutedDicts, bool ignoreDiacritics );
+
+    /// Stops prefetching at once, cancelling the lookup under way. To be
+    /// called whenever the query changes or a word is looked up for real.
+    void cancel();
+
+private slots:
+
+    void startNext();
+    void lookupFinished();
+
+private:
+
+    ArticleMaker const & articleMaker;
+    QTimer delayTimer;
+
+    QStringList words; // Yet to be looked up
+    unsigned group;
+    QSet< QString > mutedDicts;
+    bool ignoreDiacritics;
+
+    sptr< Dictionary::DataRequest > lookup; // The one under way, if any
+};
+
+#endif
@@ -273,6 +273,8 @@ BglDictionary::BglDictionary( string const & id, string const & indexFile,
     idxHeader( idx.read< IdxHeader >() ),
     chunks( idx, idxHeader.chunksOffset )
 {
+    chunks.setStats( statistics.get() );
+
     idx.seek( sizeof( idxHeader ) );
 
     // Read the dictionary's name
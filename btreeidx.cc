@@ -5,6 +5,8 @@
 #include "file.hh"
 #include "folding.hh"
 #include "utf8.hh"
+#include "config.hh"
+#include "fsencoding.hh"
 #include <QRunnable>
 #include <QThreadPool>
 #include <math.h>
@@ -53,7 +55,7 @@ enum
 };
 
 BtreeIndex::BtreeIndex():
-    idxFile( 0 ), rootNodeLoaded( false )
+    idxFile( 0 ), indexStats( 0 ), rootNodeLoaded( false )
 {
 }
 
@@ -61,6 +63,7 @@ BtreeDictionary::BtreeDictionary( string const & id,
                                   vector< string > const & dictionaryFiles ):
     Dictionary::Class( id, dictionaryFiles )
 {
+    indexStats = statistics.get();
 }
 
 //bool BtreeDictionary::ensureInitDone(std::string *err)
@@ -123,6 +126,31 @@ vector< WordArticleLink > BtreeIndex::findArticles( wstring const & word, bool i
     return result;
 }
 
+namespace {
+
+/// Checks the headword, with its diacritics folded, against the wildcard
+/// pattern, which has to match from its beginning
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
+bool matchesWildcards( QRegularExpression const & regexp, wstring const & word,
+                       int minMatchLength )
+{
+    if( word.size() < (wstring::size_type)minMatchLength )
+        return false;
+
+    QRegularExpressionMatch match = regexp.match( gd::toQString( word ) );
+    return match.hasMatch() && match.capturedStart() == 0;
+}
+#else
+bool matchesWildcards( QRegExp & regexp, wstring const & word, int minMatchLength )
+{
+    return word.size() >= (wstring::size_type)minMatchLength
+           && regexp.indexIn( gd::toQString( word ) ) == 0
+           && regexp.matchedLength() >= minMatchLength;
+}
+#endif
+
+}
+
 class BtreeWordSearchRunnable: public QRunnable
 {
     BtreeWordSearchRequest & r;
@@ -301,6 +329,52 @@ void BtreeWordSearchRequest::findMatches()
             folded = Folding::applyWhitespaceOnly( str );
     }
 
+    if( useWildcards && folded.empty() )
+    {
+        // The pattern begins with a wildcard, so the btree is no help. Only
+        // the headwords having all the trigrams of its literal parts can match.
+        vector< uint64_t > trigrams;
+
+        if( NgramIndexing::NgramIndex::patternTrigrams( Folding::apply( str, true ), trigrams ) )
+        {
+            sptr< NgramIndexing::NgramIndex > ngramIdx = dict.getNgramIndex();
+
+            if( ngramIdx.get() )
+            {
+                try
+                {
+                    vector< uint32_t > candidates;
+                    ngramIdx->findCandidates( trigrams, candidates, isCancelled );
+
+                    for( size_t x = 0; x < candidates.size(); ++x )
+                    {
+                        if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                            break;
+
+                        wstring word = ngramIdx->getHeadword( candidates[ x ] );
+
+                        if( matchesWildcards( regexp, Folding::applyDiacriticsOnly( word ), minMatchLength ) )
+                        {
+                            Mutex::Lock _( dataMutex );
+
+                            addMatch( word );
+
+                            if ( matches.size() >= maxResults )
+                                break;
+                        }
+                    }
+
+                    return;
+                }
+                catch( std::exception & e )
+                {
+                    gdWarning( "Trigram index searching failed: \"%s\", error: %s\n",
+                               dict.getName().c_str(), e.what() );
+                }
+            }
+        }
+    }
+
     int initialFoldedSize = folded.size();
 
     int charsLeftToChop = 0;
@@ -316,6 +390,12 @@ void BtreeWordSearchRequest::findMatches()
                 charsLeftToChop = maxSuffixVariation;
     }
 
+    if ( charsLeftToChop && !useWildcards )
+    {
+        findStemmedMatches( folded, folded.size() - charsLeftToChop );
+        return;
+    }
+
     try
     {
         for( ; ; )
@@ -358,24 +438,8 @@ void BtreeWordSearchRequest::findMatches()
                             if( useWildcards )
                             {
                                 wstring word = Utf8::decode( chain[ x ].prefix + chain[ x ].word );
-                                wstring result = Folding::applyDiacriticsOnly( word );
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-                                if( result.size() >= (wstring::size_type)minMatchLength )
-                                {
-                                    QRegularExpressionMatch match = regexp.match( gd::toQString( result ) );
-                                    if( match.hasMatch() && match.capturedStart() == 0 )
-                                    {
-                                        addMatch( word );
-                                    }
-                                }
-#else
-                                if( result.size() >= (wstring::size_type)minMatchLength
-                                        && regexp.indexIn( gd::toQString( result ) ) == 0
-                                        && regexp.matchedLength() >= minMatchLength )
-                                {
+                                if( matchesWildcards( regexp, Folding::applyDiacriticsOnly( word ), minMatchLength ) )
                                     addMatch( word );
-                                }
-#endif
                             }
                             else
                             {
@@ -453,6 +517,106 @@ void BtreeWordSearchRequest::findMatches()
     }
 }
 
+void BtreeWordSearchRequest::findStemmedMatches( wstring const & folded, size_t shortestStem )
+{
+    // The keys beginning with each of the stems make a contiguous range, the
+    // longer stems' ranges nested in the shorter ones'. So instead of looking
+    // each stem up in turn, we descend once to the shortest one and scan its
+    // range forward, grouping the words by the length of the stem they share
+    // with the target. The longer stems go first, as they used to.
+
+    vector< vector< wstring > > byStem( folded.size() + 1 );
+
+    wstring shortest = folded.substr( 0, shortestStem );
+
+    try
+    {
+        bool exactMatch;
+        vector< char > leaf;
+        uint32_t nextLeaf;
+        char const * leafEnd;
+
+        char const * chainOffset = dict.findChainOffsetExactOrPrefix( shortest, exactMatch,
+                                                                      leaf, nextLeaf,
+                                                                      leafEnd );
+
+        while( chainOffset )
+        {
+            if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                return;
+
+            vector< WordArticleLink > chain = dict.readChain( chainOffset );
+
+            wstring chainHead = Utf8::decode( chain[ 0 ].word );
+
+            wstring resultFolded = Folding::apply( chainHead );
+            if( resultFolded.empty() )
+                resultFolded = Folding::applyWhitespaceOnly( chainHead );
+
+            if ( resultFolded.size() < shortestStem || resultFolded.compare( 0, shortestStem, shortest ) )
+                break; // Past the range of the shortest stem
+
+            size_t common = shortestStem;
+
+            while( common < folded.size() && common < resultFolded.size()
+                   && resultFolded[ common ] == folded[ common ] )
+                ++common;
+
+            // The words sharing this stem or a longer one, found so far
+            size_t enough = 0;
+
+            for( size_t x = common; x < byStem.size(); ++x )
+                enough += byStem[ x ].size();
+
+            if ( enough >= maxResults )
+            {
+                // The keys after the target can only share shorter stems
+                // with it, and they would be left out anyway
+                if ( resultFolded.compare( folded ) > 0 )
+                    break;
+            }
+            else
+                if ( (int)resultFolded.size() - (int)folded.size() <= maxSuffixVariation )
+                {
+                    for( unsigned x = 0; x < chain.size(); ++x )
+                        if ( allowMiddleMatches || Folding::apply( Utf8::decode( chain[ x ].prefix ) ).empty() )
+                            byStem[ common ].push_back( Utf8::decode( chain[ x ].prefix + chain[ x ].word ) );
+                }
+
+            if ( chainOffset >= leafEnd )
+            {
+                // We're past the current leaf, fetch the next one
+
+                if ( !nextLeaf )
+                    break; // That was the last leaf
+
+                Mutex::Lock _( *dict.idxFileMutex );
+
+                dict.readNode( nextLeaf, leaf );
+                leafEnd = &leaf.front() + leaf.size();
+
+                nextLeaf = dict.idxFile->read< uint32_t >();
+                chainOffset = &leaf.front() + sizeof( uint32_t );
+            }
+        }
+    }
+    catch( std::exception & e )
+    {
+        qWarning( "Index searching failed: \"%s\", error: %s\n",
+                  dict.getName().c_str(), e.what() );
+    }
+    catch(...)
+    {
+        gdWarning( "Index searching failed: \"%s\"\n", dict.getName().c_str() );
+    }
+
+    Mutex::Lock _( dataMutex );
+
+    for( size_t x = byStem.size(); x-- > shortestStem && matches.size() < maxResults; )
+        for( size_t y = 0; y < byStem[ x ].size() && matches.size() < maxResults; ++y )
+            addMatch( byStem[ x ][ y ] );
+}
+
 void BtreeWordSearchRequest::run()
 {
     if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
@@ -496,6 +660,177 @@ THROW_SPEC( std::exception )
                                                                              false, maxResults ));
 }
 
+sptr< Dictionary::WordSearchRequest > BtreeDictionary::fuzzyMatch(
+        wstring const & str, unsigned maxDistance, unsigned long maxResults )
+THROW_SPEC( std::exception )
+{
+    return sptr< Dictionary::WordSearchRequest >( new BtreeFuzzySearchRequest( *this, str, maxDistance, maxResults ) );
+}
+
+BtreeFuzzySearchRequest::BtreeFuzzySearchRequest( BtreeDictionary & dict_,
+                                                  wstring const & str_,
+                                                  unsigned maxDistance_,
+                                                  unsigned long maxResults_ ):
+    BtreeWordSearchRequest( dict_, str_, 0, -1, false, maxResults_, false ),
+    maxDistance( maxDistance_ )
+{
+    QThreadPool::globalInstance()->start(
+                new BtreeWordSearchRunnable( *this, hasExited ) );
+}
+
+void BtreeFuzzySearchRequest::findMatches()
+{
+    if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+        return;
+
+    wstring target = Folding::apply( str );
+
+    if ( target.empty() )
+        return;
+
+    size_t targetSize = target.size();
+
+    // rows[ x ] holds the distances between the first x characters of the
+    // current key and each prefix of the target. The rows of the beginning
+    // the key shares with the previous one are reused.
+    vector< vector< unsigned > > rows( 1, vector< unsigned >( targetSize + 1 ) );
+
+    for( size_t x = 0; x <= targetSize; ++x )
+        rows[ 0 ][ x ] = x;
+
+    wstring rowsKey; // The characters the rows were computed for
+
+    // The keys below this one are known to be too far from the target
+    wstring skipBelow;
+
+    try
+    {
+        bool exactMatch;
+        vector< char > leaf;
+        uint32_t nextLeaf;
+        char const * leafEnd;
+
+        char const * chainOffset = dict.findChainOffsetExactOrPrefix( wstring(), exactMatch,
+                                                                      leaf, nextLeaf,
+                                                                      leafEnd );
+
+        while( chainOffset )
+        {
+            if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                break;
+
+            vector< WordArticleLink > chain = dict.readChain( chainOffset );
+
+            wstring chainHead = Utf8::decode( chain[ 0 ].word );
+
+            wstring key = Folding::apply( chainHead );
+            if( key.empty() )
+                key = Folding::applyWhitespaceOnly( chainHead );
+
+            if ( key >= skipBelow )
+            {
+                size_t common = 0;
+
+                while( common < key.size() && common < rowsKey.size() && key[ common ] == rowsKey[ common ] )
+                    ++common;
+
+                rows.resize( common + 1 );
+                rowsKey.resize( common );
+
+                bool tooFar = false;
+
+                for( size_t depth = common; depth < key.size(); ++depth )
+                {
+                    vector< unsigned > const & prev = rows.back();
+                    vector< unsigned > row( targetSize + 1 );
+
+                    row[ 0 ] = prev[ 0 ] + 1;
+
+                    unsigned best = row[ 0 ];
+
+                    for( size_t x = 1; x <= targetSize; ++x )
+                    {
+                        unsigned cost = prev[ x - 1 ] + ( key[ depth ] == target[ x - 1 ] ? 0 : 1 );
+
+                        if ( prev[ x ] + 1 < cost )
+                            cost = prev[ x ] + 1;
+
+                        if ( row[ x - 1 ] + 1 < cost )
+                            cost = row[ x - 1 ] + 1;
+
+                        row[ x ] = cost;
+
+                        if ( cost < best )
+                            best = cost;
+                    }
+
+                    rows.push_back( row );
+                    rowsKey.push_back( key[ depth ] );
+
+                    if ( best > maxDistance )
+                    {
+                        // No key beginning like this one can get close enough
+                        skipBelow = key.substr( 0, depth + 1 );
+                        ++skipBelow[ depth ];
+                        tooFar = true;
+                        break;
+                    }
+                }
+
+                unsigned distance = rows.back()[ targetSize ];
+
+                if ( !tooFar && distance <= maxDistance )
+                {
+                    Mutex::Lock _( dataMutex );
+
+                    // Only the whole headwords, not the words in the middle of
+                    // phrases, since the goal is to find the right spelling
+                    for( unsigned x = 0; x < chain.size(); ++x )
+                        if ( Folding::apply( Utf8::decode( chain[ x ].prefix ) ).empty() )
+                            addMatch( Dictionary::WordMatch( Utf8::decode( chain[ x ].prefix + chain[ x ].word ),
+                                                             -(int)distance ) );
+
+                    if ( matches.size() >= maxResults )
+                        break;
+                }
+            }
+
+            if ( chainOffset >= leafEnd )
+            {
+                if ( !nextLeaf )
+                    break; // That was the last leaf
+
+                if ( key < skipBelow )
+                {
+                    // The rest of the skipped range may span many leaves, so
+                    // descend right past it instead of reading them all
+                    chainOffset = dict.findChainOffsetExactOrPrefix( skipBelow, exactMatch,
+                                                                     leaf, nextLeaf,
+                                                                     leafEnd );
+                    continue;
+                }
+
+                Mutex::Lock _( *dict.idxFileMutex );
+
+                dict.readNode( nextLeaf, leaf );
+                leafEnd = &leaf.front() + leaf.size();
+
+                nextLeaf = dict.idxFile->read< uint32_t >();
+                chainOffset = &leaf.front() + sizeof( uint32_t );
+            }
+        }
+    }
+    catch( std::exception & e )
+    {
+        qWarning( "Fuzzy index searching failed: \"%s\", error: %s\n",
+                  dict.getName().c_str(), e.what() );
+    }
+    catch(...)
+    {
+        gdWarning( "Fuzzy index searching failed: \"%s\"\n", dict.getName().c_str() );
+    }
+}
+
 void BtreeIndex::readNode( uint32_t offset, vector< char > & out )
 {
     idxFile->seek( offset );
@@ -531,6 +866,26 @@ void BtreeIndex::readNode( uint32_t offset, vector< char > & out )
          decompressedLength != out.size() )
         throw exFailedToDecompressNode();
 #endif
+
+    if ( indexStats )
+    {
+        indexStats->addCacheAccess( Dictionary::Stats::BtreeNodes, false );
+        indexStats->addDecompressed( uncompressedSize );
+    }
+}
+
+void BtreeIndex::loadRootNode()
+{
+    if ( rootNodeLoaded )
+    {
+        if ( indexStats )
+            indexStats->addCacheAccess( Dictionary::Stats::BtreeNodes, true );
+        return;
+    }
+
+    // Time to load our root node. We do it only once, at the first request.
+    readNode( rootOffset, rootNode );
+    rootNodeLoaded = true;
 }
 
 char const * BtreeIndex::findChainOffsetExactOrPrefix( wstring const & target,
@@ -554,12 +909,7 @@ char const * BtreeIndex::findChainOffsetExactOrPrefix( wstring const & target,
 
     uint32_t currentNodeOffset = rootOffset;
 
-    if ( !rootNodeLoaded )
-    {
-        // Time to load our root node. We do it only once, at the first request.
-        readNode( rootOffset, rootNode );
-        rootNodeLoaded = true;
-    }
+    loadRootNode();
 
     char const * leaf = &rootNode.front();
     leafEnd = leaf + rootNode.size();
@@ -1296,12 +1646,7 @@ void BtreeIndex::findArticleLinks( QVector< WordArticleLink > * articleLinks,
 
     Mutex::Lock _( *idxFileMutex );
 
-    if ( !rootNodeLoaded )
-    {
-        // Time to load our root node. We do it only once, at the first request.
-        readNode( rootOffset, rootNode );
-        rootNodeLoaded = true;
-    }
+    loadRootNode();
 
     char const * leaf = &rootNode.front();
     char const * leafEnd = leaf + rootNode.size();
@@ -1412,7 +1757,8 @@ void BtreeIndex::findArticleLinks( QVector< WordArticleLink > * articleLinks,
 
 void BtreeIndex::getHeadwordsFromOffsets( QList<uint32_t> & offsets,
                                           QVector<QString> & headwords,
-                                          AtomicInt32 * isCancelled )
+                                          AtomicInt32 * isCancelled,
+                                          QVector< uint32_t > * headwordOffsets )
 {
     uint32_t currentNodeOffset = rootOffset;
     uint32_t nextLeaf = 0;
@@ -1422,12 +1768,7 @@ void BtreeIndex::getHeadwordsFromOffsets( QList<uint32_t> & offsets,
 
     Mutex::Lock _( *idxFileMutex );
 
-    if ( !rootNodeLoaded )
-    {
-        // Time to load our root node. We do it only once, at the first request.
-        readNode( rootOffset, rootNode );
-        rootNodeLoaded = true;
-    }
+    loadRootNode();
 
     char const * leaf = &rootNode.front();
     char const * leafEnd = leaf + rootNode.size();
@@ -1490,6 +1831,8 @@ void BtreeIndex::getHeadwordsFromOffsets( QList<uint32_t> & offsets,
                     return;
 
                 headwords.append(  QString::fromUtf8( ( result[ i ].prefix + result[ i ].word ).c_str() ) );
+                if( headwordOffsets )
+                    headwordOffsets->append( result[ i ].articleOffset );
                 offsets.erase( it );
                 begOffsets = offsets.begin();
                 endOffsets = offsets.end();
@@ -1558,8 +1901,174 @@ bool BtreeDictionary::getHeadwords( QStringList &headwords )
     return headwords.size() > 0;
 }
 
+/// Reads the headwords chain by chain, keeping just the current leaf
+class BtreeHeadwordIterator: public Dictionary::HeadwordIterator
+{
+    BtreeIndex & index;
+    wstring prefix;
+    bool started, finished;
+    vector< char > leaf;
+    size_t chainPos; // Offset of the next chain in the leaf
+    uint32_t nextLeaf;
+
+public:
+
+    BtreeHeadwordIterator( BtreeIndex & index_, wstring const & prefix_ ):
+        index( index_ ), prefix( prefix_ ), started( false ), finished( false ),
+        chainPos( 0 ), nextLeaf( 0 )
+    {}
+
+    virtual bool next( QStringList & headwords, unsigned maxEntries );
+
+private:
+
+    /// Locates the first chain to read
+    void start();
+};
+
+void BtreeHeadwordIterator::start()
+{
+    started = true;
+
+    bool exactMatch;
+    vector< char > extLeaf;
+    char const * leafEnd;
+
+    char const * chainPtr = index.findChainOffsetExactOrPrefix( prefix, exactMatch,
+                                                                extLeaf, nextLeaf, leafEnd );
+
+    if ( !chainPtr )
+    {
+        finished = true;
+        return;
+    }
+
+    if ( !extLeaf.empty() && chainPtr >= &extLeaf.front()
+         && chainPtr < &extLeaf.front() + extLeaf.size() )
+    {
+        chainPos = chainPtr - &extLeaf.front();
+        leaf.swap( extLeaf );
+    }
+    else
+    {
+        // The root node is the only leaf, and it's kept by the index
+        chainPos = chainPtr - &index.rootNode.front();
+        leaf = index.rootNode;
+    }
+}
+
+bool BtreeHeadwordIterator::next( QStringList & headwords, unsigned maxEntries )
+{
+    if ( !started )
+        start();
+
+    QStringList chainHeadwords;
+
+    while( !finished && maxEntries )
+    {
+        if ( chainPos >= leaf.size() )
+        {
+            if ( !nextLeaf )
+            {
+                finished = true;
+                break;
+            }
+
+            Mutex::Lock _( *index.idxFileMutex );
+
+            index.readNode( nextLeaf, leaf );
+            nextLeaf = index.idxFile->read< uint32_t >();
+            chainPos = sizeof( uint32_t );
+
+            continue;
+        }
+
+        char const * ptr = &leaf.front() + chainPos;
+        vector< WordArticleLink > chain = index.readChain( ptr );
+        chainPos = ptr - &leaf.front();
+
+        --maxEntries;
+
+        if ( chain.empty() )
+            continue;
+
+        if ( !prefix.empty() )
+        {
+            wstring word = Utf8::decode( chain[ 0 ].word );
+            wstring folded = Folding::apply( word );
+            if ( folded.empty() )
+                folded = Folding::applyWhitespaceOnly( word );
+
+            if ( folded.compare( 0, prefix.size(), prefix ) != 0 )
+            {
+                // The chains are sorted by their folded words, so no more
+                // chains can match
+                finished = true;
+                break;
+            }
+        }
+
+        // Equal headwords fold the same, so they can only repeat in a chain
+        chainHeadwords.clear();
+
+        for( size_t x = 0; x < chain.size(); ++x )
+        {
+            // A headword of several words is also indexed by each of its
+            // trailing words, with the words before them as the prefix. It's
+            // given once, from the chain of its own.
+            if ( !chain[ x ].prefix.empty() )
+                continue;
+
+            QString headword = QString::fromUtf8( chain[ x ].word.c_str() );
+
+            if ( !chainHeadwords.contains( headword ) )
+                chainHeadwords.append( headword );
+        }
+
+        headwords += chainHeadwords;
+    }
+
+    return !finished;
+}
+
+sptr< NgramIndexing::NgramIndex > BtreeDictionary::getNgramIndex()
+{
+    if ( !idxFile )
+        return sptr< NgramIndexing::NgramIndex >();
+
+    IndexInfo info = getIndexInfo();
+    string indexFile = FsEncoding::encode( Config::getIndexDir() ) + getId();
+
+    return ngramIdx.get( indexFile + "_NGR", indexFile, info.btreeMaxElements, info.rootOffset );
+}
+
+sptr< Dictionary::HeadwordIterator > BtreeDictionary::getHeadwordIterator( wstring const & foldedPrefix )
+{
+    if ( !idxFile )
+        return sptr< Dictionary::HeadwordIterator >();
+
+    return sptr< Dictionary::HeadwordIterator >( new BtreeHeadwordIterator( *this, foldedPrefix ) );
+}
+
 void BtreeDictionary::getArticleText(uint32_t, QString &, QString & )
 {
 }
 
+void BtreeDictionary::getArticleTexts( QVector< uint32_t > const & articleAddresses,
+                                       ArticleTextHandler & handler )
+{
+    QString headword, text;
+
+    for( int x = 0; x < articleAddresses.size(); ++x )
+    {
+        headword.clear();
+        text.clear();
+
+        getArticleText( articleAddresses.at( x ), headword, text );
+
+        if( !handler.handleArticleText( articleAddresses.at( x ), headword, text ) )
+            break;
+    }
+}
+
 }
@@ -5,6 +5,7 @@
 #define __BTREEIDX_HH_INCLUDED__
 
 #include "dictionary.hh"
+#include "ngramidx.hh"
 
 #include <string>
 #include <vector>
@@ -100,10 +101,17 @@ public:
                            QSet< QString > * headwords,
                            AtomicInt32 * isCancelled = 0 );
 
-    /// Retrieve headwords for presented article addresses
+    /// Retrieve headwords for presented article addresses. They come in the
+    /// order of the index, so the article address of each of them is put to
+    /// headwordOffsets, if it's given.
     void getHeadwordsFromOffsets( QList< uint32_t > & offsets,
                                   QVector< QString > & headwords,
-                                  AtomicInt32 * isCancelled = 0 );
+                                  AtomicInt32 * isCancelled = 0,
+                                  QVector< uint32_t > * headwordOffsets = 0 );
+
+    /// Returns what the index was opened with
+    IndexInfo getIndexInfo() const
+    { return IndexInfo( indexNodeSize, rootOffset ); }
 
 protected:
 
@@ -129,6 +137,9 @@ protected:
     /// to the given vector and does nothing more.
     void readNode( uint32_t offset, vector< char > & out );
 
+    /// Loads the root node unless it's loaded already
+    void loadRootNode();
+
     /// Reads the word-article links' chain at the given offset. The pointer
     /// is updated to point to the next chain, if there's any.
     vector< WordArticleLink > readChain( char const * & );
@@ -142,6 +153,9 @@ protected:
     Mutex * idxFileMutex;
     File::Class * idxFile;
 
+    /// The node reads get counted there, if set
+    Dictionary::Stats * indexStats;
+
 private:
 
     uint32_t indexNodeSize;
@@ -149,6 +163,22 @@ private:
     bool rootNodeLoaded;
     vector< char > rootNode; // We load root note here and keep it at all times,
     // since all searches always start with it.
+
+    friend class BtreeHeadwordIterator;
+};
+
+/// Receives the articles fetched by BtreeDictionary::getArticleTexts().
+class ArticleTextHandler
+{
+public:
+
+    /// Called once for each fetched article. Returning false stops the
+    /// fetching of the remaining articles.
+    virtual bool handleArticleText( uint32_t articleAddress, QString const & headword,
+                                    QString const & text ) = 0;
+
+    virtual ~ArticleTextHandler()
+    {}
 };
 
 /// A base for the dictionary that utilizes a btree index build using
@@ -176,13 +206,31 @@ public:
                                                                 unsigned long maxResults )
     THROW_SPEC( std::exception );
 
+    /// Walks the btree leaves in order, skipping the ranges of the headwords
+    /// whose common beginning is already too far from the word.
+    virtual sptr< Dictionary::WordSearchRequest > fuzzyMatch( wstring const &,
+                                                              unsigned maxDistance,
+                                                              unsigned long maxResults )
+    THROW_SPEC( std::exception );
+
     virtual bool isLocalDictionary()
     { return true; }
 
     virtual bool getHeadwords( QStringList &headwords );
 
+    /// Walks the btree leaves in order, never holding more than one of them.
+    virtual sptr< Dictionary::HeadwordIterator > getHeadwordIterator( wstring const & foldedPrefix );
+
     virtual void getArticleText( uint32_t articleAddress, QString & headword, QString & text );
 
+    /// Fetches the texts of many articles at once, passing each of them to
+    /// the handler in an unspecified order. Dictionaries which store their
+    /// articles in compressed blocks override this to read and decompress
+    /// each block once for all the requested articles it contains. The
+    /// default implementation calls getArticleText() for every address.
+    virtual void getArticleTexts( QVector< uint32_t > const & articleAddresses,
+                                  ArticleTextHandler & handler );
+
     string const & ftsIndexName() const
     { return ftsIdxName; }
 
@@ -206,11 +254,23 @@ public:
     /// successful, or a human-readable error string otherwise.
     virtual bool ensureInitDone(string *err = 0) { return true; }
 
+    /// Returns the trigram index of the headwords, or an empty pointer if
+    /// there's no up-to-date one, which then starts being built in the
+    /// background. Used for the wildcard searches which can't use the btree.
+    sptr< NgramIndexing::NgramIndex > getNgramIndex();
+
 protected:
     Mutex ftsIdxMutex;
     string ftsIdxName;
 
+    NgramIndexing::NgramIndexHolder ngramIdx;
+
+    // The trigram index of the words of the FTS index, used by
+    // FTSResultsRequest
+    NgramIndexing::NgramIndexHolder ftsNgramIdx;
+
     friend class BtreeWordSearchRequest;
+    friend class BtreeFuzzySearchRequest;
     friend class FTSResultsRequest;
 };
 
@@ -227,6 +287,10 @@ protected:
     AtomicInt32 isCancelled;
     QSemaphore hasExited;
 
+    /// Finds the matches for all the stems of the folded word down to the
+    /// given length at once, see the definition
+    void findStemmedMatches( wstring const & folded, size_t shortestStem );
+
 public:
 
     BtreeWordSearchRequest( BtreeDictionary & dict_,
@@ -249,6 +313,24 @@ public:
     ~BtreeWordSearchRequest();
 };
 
+/// Finds the headwords within the given Levenshtein distance of the word.
+/// The edit distances are computed incrementally along the sorted keys, and
+/// once a key's beginning is too far from the word, all the keys sharing it
+/// are skipped. The matches get the negated distance as their weight.
+class BtreeFuzzySearchRequest: public BtreeWordSearchRequest
+{
+    unsigned maxDistance;
+
+public:
+
+    BtreeFuzzySearchRequest( BtreeDictionary & dict_,
+                             wstring const & str_,
+                             unsigned maxDistance_,
+                             unsigned long maxResults_ );
+
+    virtual void findMatches();
+};
+
 // Everything below is for building the index data.
 
 /// This represents the index in its source form, as a map which binds folded
@@ -2,6 +2,7 @@
  * Part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
 
 #include "chunkedstorage.hh"
+#include "dictstats.hh"
 #include <zlib.h>
 #include <string.h>
 
@@ -114,7 +115,7 @@ uint32_t Writer::finish()
     return offset;
 }
 
-Reader::Reader( File::Class & f, uint32_t offset ): file( f )
+Reader::Reader( File::Class & f, uint32_t offset ): file( f ), stats( 0 )
 {
     file.seek( offset );
 
@@ -153,6 +154,9 @@ char * Reader::getBlock( uint32_t address, vector< char > & chunk )
                          compressedData.size() ) != Z_OK ||
              decompressedLength != chunk.size() )
             throw exFailedToDecompressChunk();
+
+        if ( stats )
+            stats->addChunkRead( decompressedLength );
     }
 
     size_t offsetInChunk = address & 0xffFF;
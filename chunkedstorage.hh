@@ -14,6 +14,8 @@
 #include <stdint.h>
 #endif
 
+namespace Dictionary { class Stats; }
+
 /// A chunked compression storage. We use this for articles' bodies. The idea
 /// is to store data in a separately-compressed chunks, much like in dictzip,
 /// but without any fancy gzip-compatibility or whatever. Another difference
@@ -77,12 +79,18 @@ class Reader
 {
     vector< uint32_t > offsets;
     File::Class & file;
+    Dictionary::Stats * stats;
 
 public:
     /// Creates reader by giving it a file to read from and the offset returned
     /// by Writer::finish().
     Reader( File::Class &, uint32_t );
 
+    /// Makes the reader count the blocks read in the statistics given, which
+    /// must outlive it. 0 stops the counting.
+    void setStats( Dictionary::Stats * stats_ )
+    { stats = stats_; }
+
     /// Reads the block previously written by Writer, identified by its address.
     /// Uses the user-provided storage to load the entire chunk, and then to
     /// return a pointer to the requested block inside it.
@@ -221,6 +221,8 @@ Preferences::Preferences():
   , confirmFavoritesDeletion( true )
   , collapseBigArticles( false )
   , articleSizeLimit( 2000 )
+  , useLookupDeadline( false )
+  , lookupDeadline( 1500 )
   , maxDictionaryRefsInContextMenu ( 20 )
   #ifndef Q_WS_X11
   , trackClipboardChanges( false )
@@ -966,6 +968,12 @@ Class load() THROW_SPEC( exError )
         if ( !preferences.namedItem( "articleSizeLimit" ).isNull() )
             c.preferences.articleSizeLimit = preferences.namedItem( "articleSizeLimit" ).toElement().text().toUInt() ;
 
+        if ( !preferences.namedItem( "useLookupDeadline" ).isNull() )
+            c.preferences.useLookupDeadline = ( preferences.namedItem( "useLookupDeadline" ).toElement().text() == "1" );
+
+        if ( !preferences.namedItem( "lookupDeadline" ).isNull() )
+            c.preferences.lookupDeadline = preferences.namedItem( "lookupDeadline" ).toElement().text().toUInt() ;
+
         if ( !preferences.namedItem( "maxDictionaryRefsInContextMenu" ).isNull() )
             c.preferences.maxDictionaryRefsInContextMenu = preferences.namedItem( "maxDictionaryRefsInContextMenu" ).toElement().text().toUShort();
 
@@ -1492,6 +1500,8 @@ void Preferences::serial(pugi::xml_node &parent, const bool read)
         XEC_R(parent, addonStyle);
         XEC_R(parent, collapseBigArticles);
         XEC_R(parent, articleSizeLimit);
+        XEC_R(parent, useLookupDeadline);
+        XEC_R(parent, lookupDeadline);
 
         XEC_R(parent, maxDictionaryRefsInContextMenu);
 #ifndef Q_WS_X11
@@ -1571,6 +1581,8 @@ void Preferences::serial(pugi::xml_node &parent, const bool read)
         XEC_W(parent, addonStyle);
         XEC_W(parent, collapseBigArticles);
         XEC_W(parent, articleSizeLimit);
+        XEC_W(parent, useLookupDeadline);
+        XEC_W(parent, lookupDeadline);
 
         XEC_W(parent, maxDictionaryRefsInContextMenu);
 #ifndef Q_WS_X11
@@ -2742,6 +2754,14 @@ void save( Class const & c ) THROW_SPEC( exError )
         opt.appendChild( dd.createTextNode( QString::number( c.preferences.articleSizeLimit ) ) );
         preferences.appendChild( opt );
 
+        opt = dd.createElement( "useLookupDeadline" );
+        opt.appendChild( dd.createTextNode( c.preferences.useLookupDeadline ? "1" : "0" ) );
+        preferences.appendChild( opt );
+
+        opt = dd.createElement( "lookupDeadline" );
+        opt.appendChild( dd.createTextNode( QString::number( c.preferences.lookupDeadline ) ) );
+        preferences.appendChild( opt );
+
         opt = dd.createElement( "maxDictionaryRefsInContextMenu" );
         opt.appendChild( dd.createTextNode( QString::number( c.preferences.maxDictionaryRefsInContextMenu ) ) );
         preferences.appendChild( opt );
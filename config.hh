@@ -357,6 +357,12 @@ struct Preferences /*: public PUGIXML_EXTRA::XSBObject*/
     bool collapseBigArticles;
     int articleSizeLimit;
 
+    /// When set, the articles of the dictionaries which don't answer within
+    /// lookupDeadline milliseconds are shown later, in place of a placeholder,
+    /// and the dictionaries which keep being late are asked last
+    bool useLookupDeadline;
+    int lookupDeadline;
+
     unsigned short maxDictionaryRefsInContextMenu;
 #ifndef Q_WS_X11
     bool trackClipboardChanges;
@@ -165,6 +165,8 @@ DictdDictionary::DictdDictionary( string const & id,
         throw exDictzipError( string( dz_error_str( error ) )
                               + "(" + getDictionaryFilenames()[ 1 ] + ")" );
 
+    statistics->attach( dz );
+
     // Initialize the index
 
     openIndex( IndexInfo( idxHeader.indexBtreeMaxElements,
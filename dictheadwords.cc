@@ -5,6 +5,9 @@
 #include "gddebug.hh"
 #include "mainwindow.hh"
 #include "delegate.hh"
+#include "folding.hh"
+#include "wstring_qt.hh"
+#include "lazydictionary.hh"
 
 #include <QRegExp>
 #include <QDir>
@@ -20,11 +23,237 @@
 
 #define AUTO_APPLY_LIMIT 150000
 
+namespace {
+
+enum
+{
+    /// Rows to add to the list each time the view asks for more
+    FetchPageSize = 500,
+    /// Entries to read at most per event loop iteration, so that a filter
+    /// matching little doesn't freeze the dialog while searching
+    FetchMaxEntries = 20000,
+    /// Entries to read from the dictionary at once
+    ReadBatchSize = 256
+};
+
+/// Iterates over what Dictionary::getHeadwords() gives
+class ListHeadwordIterator: public Dictionary::HeadwordIterator
+{
+    QStringList headwords;
+    int pos;
+
+public:
+
+    ListHeadwordIterator( QStringList const & headwords_ ):
+        headwords( headwords_ ), pos( 0 )
+    {}
+
+    virtual bool next( QStringList & result, unsigned maxEntries )
+    {
+        for( ; pos < headwords.size() && maxEntries; ++pos, --maxEntries )
+            result.append( headwords[ pos ] );
+
+        return pos < headwords.size();
+    }
+};
+
+}
+
+HeadwordFilter::HeadwordFilter():
+    empty( true )
+{
+}
+
+HeadwordFilter::HeadwordFilter( QString const & text, int syntax_, bool matchCase ):
+    empty( text.isEmpty() )
+{
+    QRegExp::PatternSyntax syntax = QRegExp::PatternSyntax( syntax_ );
+
+    // A regexp anchored at the start lets the listing begin right where the
+    // matches may be in the index, and end once past them
+    if( syntax == QRegExp::RegExp && text.startsWith( '^' ) && !text.contains( '|' ) )
+    {
+        static QString const special = QString::fromLatin1( "\\.^$|?*+()[]{}" );
+
+        QString literal;
+
+        for( int x = 1; x < text.size(); ++x )
+        {
+            if( special.contains( text[ x ] ) )
+            {
+                // A quantifier makes the previous character optional
+                if( text[ x ] == '?' || text[ x ] == '*' || text[ x ] == '{' )
+                    literal.chop( 1 );
+                break;
+            }
+            literal += text[ x ];
+        }
+
+        foldedPrefix = Folding::apply( gd::toWString( literal ) );
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 12, 0 )
+    QRegularExpression::PatternOptions options = QRegularExpression::UseUnicodePropertiesOption;
+    if( !matchCase )
+        options |= QRegularExpression::CaseInsensitiveOption;
+
+    QString pattern;
+    switch( syntax )
+    {
+    case QRegExp::FixedString:  pattern = QRegularExpression::escape( text );
+        break;
+    case QRegExp::WildcardUnix: pattern = wildcardsToRegexp( text );
+        break;
+    default:                    pattern = text;
+        break;
+    }
+
+    regExp = QRegularExpression( pattern, options );
+
+    if( !regExp.isValid() )
+    {
+        gdWarning( "Invalid regexp pattern: %s\n", pattern.toUtf8().data() );
+        regExp.setPattern( QString::fromLatin1( "\1" ) );
+    }
+#else
+    regExp = QRegExp( text, matchCase ? Qt::CaseSensitive : Qt::CaseInsensitive, syntax );
+#endif
+}
+
+bool HeadwordFilter::matches( QString const & headword ) const
+{
+    if( empty )
+        return true;
+
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 12, 0 )
+    return regExp.match( headword ).hasMatch();
+#else
+    return regExp.indexIn( headword ) >= 0;
+#endif
+}
+
+HeadwordListModel::HeadwordListModel( QObject * parent ):
+    QAbstractListModel( parent ),
+    wanted( 0 )
+{
+}
+
+sptr< Dictionary::HeadwordIterator > HeadwordListModel::makeIterator( Dictionary::Class * dict,
+                                                                      gd::wstring const & foldedPrefix )
+{
+    sptr< Dictionary::HeadwordIterator > result = dict->getHeadwordIterator( foldedPrefix );
+
+    if( !result )
+    {
+        QStringList headwords;
+        dict->getHeadwords( headwords );
+        headwords.sort();
+
+        result = sptr< Dictionary::HeadwordIterator >( new ListHeadwordIterator( headwords ) );
+    }
+
+    return result;
+}
+
+void HeadwordListModel::reset( Dictionary::Class * dict, HeadwordFilter const & filter_ )
+{
+    beginResetModel();
+
+    filter = filter_;
+    headwords.clear();
+    wanted = 0;
+    iterator = dict ? makeIterator( dict, filter.getFoldedPrefix() )
+                    : sptr< Dictionary::HeadwordIterator >();
+
+    endResetModel();
+
+    emit headwordsRead();
+}
+
+int HeadwordListModel::rowCount( QModelIndex const & parent ) const
+{
+    return parent.isValid() ? 0 : headwords.size();
+}
+
+QVariant HeadwordListModel::data( QModelIndex const & index, int role ) const
+{
+    if( !index.isValid() || index.row() >= headwords.size() )
+        return QVariant();
+
+    if( role == Qt::DisplayRole || role == Qt::EditRole )
+        return headwords[ index.row() ];
+
+    return QVariant();
+}
+
+bool HeadwordListModel::canFetchMore( QModelIndex const & parent ) const
+{
+    return !parent.isValid() && iterator && !wanted;
+}
+
+void HeadwordListModel::fetchMore( QModelIndex const & parent )
+{
+    if( !canFetchMore( parent ) )
+        return;
+
+    wanted = FetchPageSize;
+    continueFetching();
+}
+
+void HeadwordListModel::continueFetching()
+{
+    if( !iterator || !wanted )
+        return;
+
+    QStringList found;
+    bool more = true;
+
+    try
+    {
+        for( int read = 0; more && read < FetchMaxEntries && found.size() < wanted;
+             read += ReadBatchSize )
+        {
+            batch.clear();
+            more = iterator->next( batch, ReadBatchSize );
+
+            for( int x = 0; x < batch.size(); ++x )
+                if( filter.matches( batch[ x ] ) )
+                    found.append( batch[ x ] );
+        }
+    }
+    catch( std::exception & e )
+    {
+        gdWarning( "Headwords reading error: %s\n", e.what() );
+        more = false;
+    }
+
+    if( !found.isEmpty() )
+    {
+        beginInsertRows( QModelIndex(), headwords.size(), headwords.size() + found.size() - 1 );
+        headwords += found;
+        endInsertRows();
+    }
+
+    wanted = qMax( 0, wanted - found.size() );
+
+    if( !more )
+    {
+        iterator.reset();
+        wanted = 0;
+    }
+    else
+    if( wanted )
+        QTimer::singleShot( 0, this, SLOT( continueFetching() ) );
+
+    emit headwordsRead();
+}
+
 DictHeadwords::DictHeadwords( QWidget *parent, Config::Class & cfg_,
                               Dictionary::Class *dict_ ) :
     QDialog(parent)
   , cfg( cfg_ )
   , dict( dict_ )
+  , waitingForDict( false )
   , helpAction( this )
 {
     ui.setupUi( this );
@@ -51,18 +280,9 @@ DictHeadwords::DictHeadwords( QWidget *parent, Config::Class & cfg_,
 
     ui.matchCase->setChecked( cfg.headwordsDialog.matchCase );
 
-    model = new QStringListModel( this );
-    model->setStringList( headers );
-
-    proxy = new QSortFilterProxyModel( this );
-
-    proxy->setSourceModel( model );
+    model = new HeadwordListModel( this );
 
-    proxy->setSortCaseSensitivity( Qt::CaseInsensitive );
-    proxy->setSortLocaleAware( true );
-    proxy->setDynamicSortFilter( false );
-
-    ui.headersListView->setModel( proxy );
+    ui.headersListView->setModel( model );
     ui.headersListView->setEditTriggers( QAbstractItemView::NoEditTriggers );
 
     // very important call, for performance reasons:
@@ -110,7 +330,7 @@ DictHeadwords::DictHeadwords( QWidget *parent, Config::Class & cfg_,
     connect( ui.headersListView, SIGNAL( clicked( QModelIndex ) ),
              this, SLOT( itemClicked( QModelIndex ) ) );
 
-    connect( proxy, SIGNAL( dataChanged( QModelIndex, QModelIndex ) ),
+    connect( model, SIGNAL( headwordsRead() ),
              this, SLOT( showHeadwordsNumber() ) );
 
     ui.headersListView->installEventFilter( this );
@@ -120,26 +340,27 @@ DictHeadwords::DictHeadwords( QWidget *parent, Config::Class & cfg_,
 
 DictHeadwords::~DictHeadwords()
 {
+    if( waitingForDict )
+        LazyDictionary::stopWaiting( *dict, this );
 }
 
 void DictHeadwords::setup( Dictionary::Class *dict_ )
 {
     QApplication::setOverrideCursor( Qt::WaitCursor );
 
+    if( waitingForDict )
+    {
+        LazyDictionary::stopWaiting( *dict, this );
+        waitingForDict = false;
+    }
+
     dict = dict_;
 
     setWindowTitle( QString::fromUtf8( dict->getName().c_str() ) );
 
-    headers.clear();
-    model->setStringList( headers );
-
-    dict->getHeadwords( headers );
-    model->setStringList( headers );
-
-    proxy->sort( 0 );
     filterChanged();
 
-    if( headers.size() > AUTO_APPLY_LIMIT )
+    if( isLarge() )
     {
         cfg.headwordsDialog.autoApply = ui.autoApply->isChecked();
         ui.autoApply->setChecked( false );
@@ -165,7 +386,7 @@ void DictHeadwords::savePos()
     cfg.headwordsDialog.searchMode = ui.searchModeCombo->currentIndex();
     cfg.headwordsDialog.matchCase = ui.matchCase->isChecked();
 
-    if( headers.size() <= AUTO_APPLY_LIMIT )
+    if( !isLarge() )
         cfg.headwordsDialog.autoApply = ui.autoApply->isChecked();
 
     cfg.headwordsDialog.headwordsDialogGeometry = saveGeometry();
@@ -209,59 +430,59 @@ void DictHeadwords::filterChangedInternal()
         QTimer::singleShot( 100, this, SLOT( filterChanged() ) );
 }
 
-void DictHeadwords::filterChanged()
+bool DictHeadwords::isLarge()
 {
-    QRegExp::PatternSyntax syntax =
-            QRegExp::PatternSyntax( ui.searchModeCombo->itemData(
-                                        ui.searchModeCombo->currentIndex()).toInt() );
-
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 12, 0 )
-    QRegularExpression::PatternOptions options = QRegularExpression::UseUnicodePropertiesOption;
-    if( !ui.matchCase->isChecked() )
-        options |= QRegularExpression::CaseInsensitiveOption;
+    return dict && dict->getWordCount() > AUTO_APPLY_LIMIT;
+}
 
-    QString pattern;
-    switch( syntax )
-    {
-    case QRegExp::FixedString:  pattern = QRegularExpression::escape( ui.filterLine->text() );
-        break;
-    case QRegExp::WildcardUnix: pattern = wildcardsToRegexp( ui.filterLine->text() );
-        break;
-    default:                    pattern = ui.filterLine->text();
-        break;
-    }
+HeadwordFilter DictHeadwords::currentFilter()
+{
+    return HeadwordFilter( ui.filterLine->text(),
+                           ui.searchModeCombo->itemData( ui.searchModeCombo->currentIndex() ).toInt(),
+                           ui.matchCase->isChecked() );
+}
 
-    QRegularExpression regExp( pattern, options );
+void DictHeadwords::filterChanged()
+{
+    if( waitingForDict )
+        return;
 
-    if( !regExp.isValid() )
+    // The dictionary may have to be opened first, which is done in the
+    // background so that the dialog doesn't freeze meanwhile
+    if( !LazyDictionary::isReady( *dict, this ) )
     {
-        gdWarning( "Invalid regexp pattern: %s\n", pattern.toUtf8().data() );
-        regExp.setPattern( QString::fromLatin1( "\1" ) );
+        waitingForDict = true;
+
+        model->reset( 0, HeadwordFilter() );
+        ui.exportButton->setEnabled( false );
+        ui.headersNumber->setText( tr( "Loading the dictionary..." ) );
+        return;
     }
 
     QApplication::setOverrideCursor( Qt::WaitCursor );
 
-    proxy->setFilterRegularExpression( regExp );
-#else
-    Qt::CaseSensitivity caseSensitivity = ui.matchCase->isChecked() ? Qt::CaseSensitive
-                                                                    : Qt::CaseInsensitive;
-    QRegExp regExp( ui.filterLine->text(), caseSensitivity, syntax );
+    model->reset( dict, currentFilter() );
 
-    QApplication::setOverrideCursor( Qt::WaitCursor );
+    // Fill the first page right away
+    model->fetchMore( QModelIndex() );
 
-    proxy->setFilterRegExp( regExp );
-#endif
+    QApplication::restoreOverrideCursor();
+}
 
-    proxy->sort( 0 );
+void DictHeadwords::proxyOpened()
+{
+    if( !waitingForDict )
+        return;
 
-    QApplication::restoreOverrideCursor();
+    waitingForDict = false;
+    ui.exportButton->setEnabled( true );
 
-    showHeadwordsNumber();
+    filterChanged();
 }
 
 void DictHeadwords::itemClicked( const QModelIndex & index )
 {
-    QVariant value = proxy->data( index, Qt::DisplayRole );
+    QVariant value = model->data( index, Qt::DisplayRole );
     if ( value.canConvert< QString >() )
     {
         QString headword = value.toString();
@@ -276,9 +497,14 @@ void DictHeadwords::autoApplyStateChanged( int state )
 
 void DictHeadwords::showHeadwordsNumber()
 {
+    // The filtered number is only known once everything was read
+    QString filtered = QString::number( model->rowCount() );
+    if( !model->isComplete() )
+        filtered += "+";
+
     ui.headersNumber->setText( tr( "Unique headwords total: %1, filtered: %2" )
-                               .arg( QString::number( headers.size() ) )
-                               .arg( QString::number( proxy->rowCount() ) ) );
+                               .arg( QString::number( dict ? dict->getWordCount() : 0 ) )
+                               .arg( filtered ) );
 }
 
 void DictHeadwords::saveHeadersToFile()
@@ -308,19 +534,18 @@ void DictHeadwords::saveHeadersToFile()
         if ( !file.open( QFile::WriteOnly | QIODevice::Text ) )
             break;
 
-        int headwordsNumber = proxy->rowCount();
+        // The headwords are read anew and written as they come, since the
+        // list shows only as many of them as were scrolled through
+        HeadwordFilter filter = currentFilter();
+        sptr< Dictionary::HeadwordIterator > iterator =
+            HeadwordListModel::makeIterator( dict, filter.getFoldedPrefix() );
 
-        // Setup progress dialog
-        int n = headwordsNumber;
-        int step = 1;
-        while( n > 1000 )
-        {
-            step *= 10;
-            n /= 10;
-        }
+        // The progress is measured in the entries read
+        int const progressSteps = 1000;
+        double entriesPerStep = qMax( 1.0, (double) dict->getWordCount() / progressSteps );
 
         QProgressDialog progress( tr( "Export headwords..."), tr( "Cancel" ),
-                                  0, n, this );
+                                  0, progressSteps, this );
         progress.setWindowModality( Qt::WindowModal );
 
         // Write UTF-8 BOM
@@ -331,31 +556,52 @@ void DictHeadwords::saveHeadersToFile()
 
         // Write headwords
 
-        int i;
-        for( i = 0; i < headwordsNumber; ++i )
+        QStringList batch;
+        bool more = true, failed = false;
+        qint64 read = 0;
+
+        while( more && !failed )
         {
-            if( i % step == 0 )
-                progress.setValue( i / step );
+            progress.setValue( qMin( progressSteps, int( read / entriesPerStep ) ) );
 
             if( progress.wasCanceled() )
                 break;
 
-            QVariant value = proxy->data( proxy->index( i, 0 ) );
-            if( !value.canConvert< QString >() )
-                continue;
+            batch.clear();
 
-            line = value.toString().toUtf8();
+            try
+            {
+                more = iterator->next( batch, ReadBatchSize );
+            }
+            catch( std::exception & e )
+            {
+                gdWarning( "Headwords reading error: %s\n", e.what() );
+                more = false;
+            }
 
-            line.replace( '\n', ' ' );
-            line.replace( '\r', ' ' );
+            read += batch.size();
 
-            line += "\n";
+            for( int x = 0; x < batch.size(); ++x )
+            {
+                if( !filter.matches( batch[ x ] ) )
+                    continue;
 
-            if ( file.write( line ) != line.size() )
-                break;
+                line = batch[ x ].toUtf8();
+
+                line.replace( '\n', ' ' );
+                line.replace( '\r', ' ' );
+
+                line += "\n";
+
+                if ( file.write( line ) != line.size() )
+                {
+                    failed = true;
+                    break;
+                }
+            }
         }
 
-        if( i < headwordsNumber && !progress.wasCanceled() )
+        if( failed )
             break;
 
         file.close();
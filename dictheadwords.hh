@@ -4,14 +4,101 @@
 #include <QDialog>
 #include <QStringList>
 #include <QAction>
+#include <QAbstractListModel>
+
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 12, 0 )
+#include <QRegularExpression>
+#else
+#include <QRegExp>
+#endif
 
 #include "ui_dictheadwords.h"
+#include "dictionary.hh"
 
-class QStringListModel;
-class QSortFilterProxyModel;
-namespace Dictionary { class Class; }
 namespace Config { struct Class; }
 
+/// Tests the headwords against the filter set up in the dialog
+class HeadwordFilter
+{
+public:
+
+    /// Makes a filter which passes everything
+    HeadwordFilter();
+
+    /// The syntax is one of QRegExp::PatternSyntax values
+    HeadwordFilter( QString const & text, int syntax, bool matchCase );
+
+    bool isEmpty() const
+    { return empty; }
+
+    bool matches( QString const & headword ) const;
+
+    /// Returns the folded prefix all the matching headwords start with, if
+    /// the filter is anchored at the start, or an empty string otherwise.
+    gd::wstring const & getFoldedPrefix() const
+    { return foldedPrefix; }
+
+private:
+
+    bool empty;
+    gd::wstring foldedPrefix;
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 12, 0 )
+    QRegularExpression regExp;
+#else
+    QRegExp regExp;
+#endif
+};
+
+/// Lists the dictionary's headwords in the index order. They are read from
+/// the dictionary only as far as the view is scrolled, and filtering just
+/// skips the ones not matching as they are read, so the whole list is never
+/// held in memory.
+class HeadwordListModel: public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+
+    HeadwordListModel( QObject * parent );
+
+    /// Starts listing anew, with the given dictionary and filter. A null
+    /// dictionary just empties the list.
+    void reset( Dictionary::Class * dict, HeadwordFilter const & filter );
+
+    /// Returns true once all the matching headwords were read
+    bool isComplete() const
+    { return !iterator; }
+
+    virtual int rowCount( QModelIndex const & parent = QModelIndex() ) const;
+    virtual QVariant data( QModelIndex const & index, int role = Qt::DisplayRole ) const;
+
+    virtual bool canFetchMore( QModelIndex const & parent ) const;
+    virtual void fetchMore( QModelIndex const & parent );
+
+    /// Returns an iterator over all the dictionary's headwords starting at
+    /// the given folded prefix, falling back to Dictionary::getHeadwords()
+    /// for dictionaries which can't iterate over them.
+    static sptr< Dictionary::HeadwordIterator > makeIterator( Dictionary::Class * dict,
+                                                              gd::wstring const & foldedPrefix );
+
+signals:
+
+    /// More headwords were read
+    void headwordsRead();
+
+private slots:
+
+    void continueFetching();
+
+private:
+
+    sptr< Dictionary::HeadwordIterator > iterator;
+    HeadwordFilter filter;
+    QStringList headwords;
+    int wanted; // Number of rows still to be found for the current fetch
+    QStringList batch;
+};
+
 class DictHeadwords : public QDialog
 {
     Q_OBJECT
@@ -26,10 +113,9 @@ public:
 protected:
     Config::Class & cfg;
     Dictionary::Class * dict;
-    QStringList headers;
-    QStringListModel * model;
-    QSortFilterProxyModel * proxy;
+    HeadwordListModel * model;
     QString dictId;
+    bool waitingForDict; // Until it's opened in the background
 
     QAction helpAction;
 
@@ -38,6 +124,10 @@ protected:
 
 private:
     Ui::DictHeadwords ui;
+
+    HeadwordFilter currentFilter();
+    bool isLarge();
+
 private slots:
     void savePos();
     void filterChangedInternal();
@@ -49,6 +139,7 @@ private slots:
     void showHeadwordsNumber();
     virtual void reject();
     void helpRequested();
+    void proxyOpened();
 
 signals:
     void headwordSelected( QString const &, QString const & );
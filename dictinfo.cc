@@ -5,9 +5,81 @@
 #include "config.hh"
 #include "dictionary.hh"
 
-DictInfo::DictInfo( Config::Class &cfg_, QWidget *parent ) :
+#include <QDir>
+#include <QFile>
+#include <QFileDialog>
+#include <QMessageBox>
+
+namespace {
+
+/// Returns the total size of the index files of the dictionary, the
+/// full-text search ones included
+qint64 indexSize( Dictionary::Class & dict )
+{
+    QFileInfoList files = QDir( Config::getIndexDir() ).entryInfoList(
+        QStringList( QString::fromUtf8( dict.getId().c_str() ) + "*" ), QDir::Files );
+
+    qint64 size = 0;
+    for( int x = 0; x < files.size(); ++x )
+        size += files[ x ].size();
+
+    return size;
+}
+
+QString sizeText( quint64 size )
+{
+    if( size < 1024 * 1024 )
+        return DictInfo::tr( "%1 KiB" ).arg( size / 1024.0, 0, 'f', 1 );
+
+    return DictInfo::tr( "%1 MiB" ).arg( size / 1048576.0, 0, 'f', 1 );
+}
+
+QString latencyText( Dictionary::Stats::Summary const & summary, Dictionary::Stats::Operation op )
+{
+    if( !summary.requests[ op ] )
+        return DictInfo::tr( "none yet" );
+
+    return DictInfo::tr( "%1, mean %2 ms, p95 %3 ms" )
+           .arg( summary.requests[ op ] )
+           .arg( summary.meanMs[ op ], 0, 'f', 1 )
+           .arg( summary.p95Ms[ op ], 0, 'f', 1 );
+}
+
+QString hitsText( Dictionary::Stats::Summary const & summary, Dictionary::Stats::Cache cache )
+{
+    double ratio = summary.hitRatio( cache );
+    if( ratio < 0 )
+        return DictInfo::tr( "not used" );
+
+    return DictInfo::tr( "%1% hits of %2 accesses" )
+           .arg( ratio * 100, 0, 'f', 1 )
+           .arg( summary.hits[ cache ] + summary.misses[ cache ] );
+}
+
+/// Quotes the field for CSV if needed
+QString csvField( QString const & str )
+{
+    if( !str.contains( ',' ) && !str.contains( '"' ) && !str.contains( '\n' ) && !str.contains( '\r' ) )
+        return str;
+
+    QString quoted = str;
+    quoted.replace( "\"", "\"\"" );
+    return "\"" + quoted + "\"";
+}
+
+QString csvRatio( Dictionary::Stats::Summary const & summary, Dictionary::Stats::Cache cache )
+{
+    double ratio = summary.hitRatio( cache );
+    return ratio < 0 ? QString() : QString::number( ratio, 'f', 4 );
+}
+
+}
+
+DictInfo::DictInfo( Config::Class &cfg_, std::vector< sptr< Dictionary::Class > > const & allDictionaries_,
+                    QWidget *parent ) :
     QDialog( parent),
-    cfg( cfg_)
+    cfg( cfg_),
+    allDictionaries( allDictionaries_ )
 {
     ui.setupUi( this );
     if( cfg.dictInfoGeometry.size() > 0 )
@@ -53,6 +125,24 @@ void DictInfo::showInfo( sptr<Dictionary::Class> dict )
     else
         ui.infoLabel->clear();
 
+    Dictionary::Stats::Summary summary = dict->getStats()->summary();
+    qint64 indexBytes = indexSize( *dict );
+
+    QStringList statistics;
+    statistics << tr( "Lookups served: %1" ).arg( summary.requests[ Dictionary::Stats::Article ] )
+               << tr( "Searches: %1" ).arg( latencyText( summary, Dictionary::Stats::Search ) )
+               << tr( "Articles: %1" ).arg( latencyText( summary, Dictionary::Stats::Article ) )
+               << tr( "Decompressed: %1" ).arg( sizeText( summary.decompressedBytes ) )
+               << tr( "Btree root node: %1" ).arg( hitsText( summary, Dictionary::Stats::BtreeNodes ) )
+               << tr( "Dictzip cache: %1" ).arg( hitsText( summary, Dictionary::Stats::Dictzip ) )
+               << tr( "Record block cache: %1" ).arg( hitsText( summary, Dictionary::Stats::RecordBlocks ) )
+               << tr( "Article cache: %1" ).arg( hitsText( summary, Dictionary::Stats::RenderedArticles ) )
+               << tr( "Resource cache: %1" ).arg( hitsText( summary, Dictionary::Stats::Resources ) )
+               << tr( "Article chunks read: %1" ).arg( summary.chunkReads )
+               << tr( "Index size on disk: %1" ).arg( indexBytes ? sizeText( indexBytes ) : tr( "none" ) );
+
+    ui.dictionaryStatistics->setPlainText( statistics.join( "\n" ) );
+
     setWindowIcon( dict->getIcon() );
 }
 
@@ -80,3 +170,52 @@ void DictInfo::on_headwordsButton_clicked()
 {
     done( SHOW_HEADWORDS );
 }
+
+void DictInfo::on_exportStatisticsButton_clicked()
+{
+    QString fileName = QFileDialog::getSaveFileName( this, tr( "Save statistics to file" ),
+                                                     QDir::homePath() + "/dictionary_statistics.csv",
+                                                     tr( "CSV files (*.csv);;All files (*.*)" ) );
+    if( fileName.isEmpty() )
+        return;
+
+    QFile file( fileName );
+    if( !file.open( QFile::WriteOnly | QIODevice::Text ) )
+    {
+        QMessageBox::critical( this, "GoldenDict", tr( "Can't write the file: %1" ).arg( file.errorString() ) );
+        return;
+    }
+
+    QString csv = "id,name,searches,search_mean_ms,search_p95_ms,articles,article_mean_ms,article_p95_ms,"
+                  "decompressed_bytes,btree_root_hit_ratio,dictzip_hit_ratio,record_block_hit_ratio,"
+                  "article_cache_hit_ratio,resource_cache_hit_ratio,chunk_reads,index_bytes\n";
+
+    for( size_t x = 0; x < allDictionaries.size(); ++x )
+    {
+        Dictionary::Class & dict = *allDictionaries[ x ];
+        Dictionary::Stats::Summary summary = dict.getStats()->summary();
+
+        QStringList fields;
+        fields << QString::fromUtf8( dict.getId().c_str() )
+               << csvField( QString::fromUtf8( dict.getName().c_str() ) );
+
+        for( int op = 0; op < Dictionary::Stats::OperationCount; ++op )
+            fields << QString::number( summary.requests[ op ] )
+                   << QString::number( summary.meanMs[ op ], 'f', 2 )
+                   << QString::number( summary.p95Ms[ op ], 'f', 2 );
+
+        fields << QString::number( summary.decompressedBytes );
+
+        for( int cache = 0; cache < Dictionary::Stats::CacheCount; ++cache )
+            fields << csvRatio( summary, (Dictionary::Stats::Cache) cache );
+
+        fields << QString::number( summary.chunkReads )
+               << QString::number( indexSize( dict ) );
+
+        csv += fields.join( "," ) + "\n";
+    }
+
+    QByteArray data = csv.toUtf8();
+    if( file.write( data ) != data.size() )
+        QMessageBox::critical( this, "GoldenDict", tr( "Can't write the file: %1" ).arg( file.errorString() ) );
+}
@@ -2,6 +2,7 @@
 #define DICTINFO_HH
 
 #include <QDialog>
+#include <vector>
 #include "ui_dictinfo.h"
 #include "sptr.hh"
 namespace Config { struct Class; }
@@ -21,18 +22,23 @@ public:
         SHOW_HEADWORDS
     };
 
-    DictInfo( Config::Class &cfg_, QWidget * parent = 0 );
+    /// The statistics of all the dictionaries given can be exported from
+    /// the dialog
+    DictInfo( Config::Class &cfg_, std::vector< sptr< Dictionary::Class > > const & allDictionaries_,
+              QWidget * parent = 0 );
     void showInfo( sptr< Dictionary::Class > dict );
 
 private:
     Ui::DictInfo ui;
     Config::Class &cfg;
+    std::vector< sptr< Dictionary::Class > > const & allDictionaries;
 private slots:
     void savePos( int );
     void on_editDictionary_clicked();
     void on_openFolder_clicked();
     void on_OKButton_clicked();
     void on_headwordsButton_clicked();
+    void on_exportStatisticsButton_clicked();
 };
 
 #endif // DICTINFO_HH
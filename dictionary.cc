@@ -30,6 +30,9 @@
 
 #include "qt4x5.hh"
 #include "zipfile.hh"
+#include "file.hh"
+#include "loadmanifest.hh"
+#include "gddebug.hh"
 
 namespace Dictionary {
 
@@ -41,7 +44,16 @@ bool Request::isFinished()
 void Request::update()
 {
     if ( !Qt4x5::AtomicInt::loadAcquire( isFinishedFlag ) )
+    {
+        int id = Qt4x5::AtomicInt::loadAcquire( traceId );
+        if ( id && !Qt4x5::AtomicInt::loadAcquire( traceUpdated ) )
+        {
+            traceUpdated.ref();
+            GdTrace::event( id, GdTrace::FirstUpdate );
+        }
+
         emit updated();
+    }
 }
 
 void Request::finish()
@@ -50,10 +62,76 @@ void Request::finish()
     {
         isFinishedFlag.ref();
 
+        GdTrace::event( Qt4x5::AtomicInt::loadAcquire( traceId ), GdTrace::Finished );
+
+        recordStats();
+
         emit finished();
     }
 }
 
+void Request::setTraceId( int id )
+{
+    if ( !id || Qt4x5::AtomicInt::loadAcquire( traceId ) )
+        return;
+
+    traceId.storeRelease( id );
+
+    // Instant requests are finished by the time they're tagged. Should the
+    // request finish just now, the second Finished event is ignored.
+    if ( isFinished() )
+        GdTrace::event( id, GdTrace::Finished );
+}
+
+void Request::traceCancel()
+{
+    GdTrace::event( Qt4x5::AtomicInt::loadAcquire( traceId ), GdTrace::Cancelled );
+
+    // The time a cancelled request takes says nothing of the dictionary
+    Mutex::Lock _( statsMutex );
+    stats.reset();
+}
+
+void Request::setStats( sptr< Stats > const & stats_, Stats::Operation operation, qint64 started )
+{
+    {
+        Mutex::Lock _( statsMutex );
+
+        stats = stats_;
+        statsOperation = operation;
+        statsStarted = started;
+    }
+
+    // Instant requests are finished by the time they get here
+    if ( isFinished() )
+        recordStats();
+}
+
+void Request::recordStats()
+{
+    sptr< Stats > s;
+    Stats::Operation operation;
+    qint64 duration;
+    {
+        Mutex::Lock _( statsMutex );
+
+        if ( !stats )
+            return;
+
+        s = stats;
+        stats.reset();
+        operation = statsOperation;
+        duration = Stats::now() - statsStarted;
+    }
+
+    s->addLatency( operation, duration );
+}
+
+Request::~Request()
+{
+    GdTrace::end( Qt4x5::AtomicInt::loadAcquire( traceId ) );
+}
+
 //void Request::setErrorString( QString const & str )
 //{
 //  //Mutex::Lock _( errorStringMutex );
@@ -109,11 +187,21 @@ void WordSearchRequest::addMatch( WordMatch const & match )
 
 ////////////// DataRequest
 
+namespace {
+
+/// The size of the chunks appendFile() reads
+size_t const StreamChunkSize = 64 * 1024;
+
+/// How much of the streamed data may be kept when the consumer is behind
+size_t const MaxPendingStreamData = 1024 * 1024;
+
+}
+
 long DataRequest::dataSize()
 {
     Mutex::Lock _( dataMutex );
 
-    return hasAnyData ? (long)data.size() : -1;
+    return hasAnyData ? (long)( releasedBytes + data.size() ) : -1;
 }
 
 void DataRequest::getDataSlice( size_t offset, size_t size, void * buffer )
@@ -124,10 +212,10 @@ THROW_SPEC( exSliceOutOfRange )
 
     Mutex::Lock _( dataMutex );
 
-    if ( offset + size > data.size() || !hasAnyData )
+    if ( offset < releasedBytes || offset - releasedBytes + size > data.size() || !hasAnyData )
         throw exSliceOutOfRange();
 
-    memcpy( buffer, &data[ offset ], size );
+    memcpy( buffer, &data[ offset - releasedBytes ], size );
 }
 
 vector< char > & DataRequest::getFullData() THROW_SPEC( exRequestUnfinished )
@@ -138,9 +226,115 @@ vector< char > & DataRequest::getFullData() THROW_SPEC( exRequestUnfinished )
     return data;
 }
 
+void DataRequest::releaseData( size_t offset )
+{
+    {
+        Mutex::Lock _( dataMutex );
+
+        if ( !streaming || offset <= releasedBytes )
+            return;
+
+        consumerReleases = true;
+
+        size_t count = std::min( offset - releasedBytes, data.size() );
+
+        // Moving the rest of the data is only worth it for a larger part of it
+        if ( count * 2 < data.size() && count < StreamChunkSize )
+            return;
+
+        data.erase( data.begin(), data.begin() + count );
+        releasedBytes += count;
+
+        // The producer only gets woken up once there's room for more
+        if ( !producerWaiting || data.size() >= MaxPendingStreamData )
+            return;
+
+        producerWaiting = false;
+    }
+
+    dataReleased.release();
+}
+
+void DataRequest::appendData( void const * buffer, size_t size, AtomicInt32 & isCancelled )
+{
+    for( ; ; )
+    {
+        if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+            return;
+
+        {
+            Mutex::Lock _( dataMutex );
+
+            streaming = true;
+
+            // Nobody may be releasing the data, like when it's used as a whole
+            // after the request has finished, so there's no waiting until
+            // the consumer shows up
+            if ( !consumerReleases || data.size() < MaxPendingStreamData )
+            {
+                data.insert( data.end(), (char const *) buffer, (char const *) buffer + size );
+                hasAnyData = true;
+                break;
+            }
+
+            producerWaiting = true;
+        }
+
+        // Wait for the consumer to catch up. The timeout lets the cancellation
+        // through.
+        dataReleased.tryAcquire( 1, 100 );
+    }
+
+    update();
+}
+
+bool DataRequest::appendFile( string const & fileName, AtomicInt32 & isCancelled )
+THROW_SPEC( std::exception )
+{
+    sptr< File::Class > file;
+
+    try
+    {
+        file = new File::Class( fileName, "rb" );
+    }
+    catch( File::exCantOpen & )
+    {
+        return false;
+    }
+
+    vector< char > chunk( StreamChunkSize );
+
+    {
+        // An empty file still exists
+        Mutex::Lock _( dataMutex );
+
+        streaming = true;
+        hasAnyData = true;
+    }
+
+    while( !Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+    {
+        size_t read = file->readRecords( &chunk.front(), 1, chunk.size() );
+
+        if ( read )
+            appendData( &chunk.front(), read, isCancelled );
+
+        if ( read < chunk.size() )
+        {
+            if ( !file->eof() )
+                throw File::exReadError();
+
+            break;
+        }
+    }
+
+    return true;
+}
+
 Class::Class( string const & id_, vector< string > const & dictionaryFiles_ ):
     id( id_ ), dictionaryFiles( dictionaryFiles_ ), dictionaryIconLoaded( false )
   , can_FTS( false), FTS_index_completed( false )
+  , statistics( new Stats )
 {
 }
 
@@ -157,6 +351,14 @@ THROW_SPEC( std::exception )
     return sptr<WordSearchRequest>(new WordSearchRequestInstant());
 }
 
+sptr< WordSearchRequest > Class::fuzzyMatch( wstring const & /*str*/,
+                                             unsigned /*maxDistance*/,
+                                             unsigned long /*maxResults*/ )
+THROW_SPEC( std::exception )
+{
+    return sptr< WordSearchRequest >( new WordSearchRequestInstant() );
+}
+
 sptr< WordSearchRequest > Class::findHeadwordsForSynonym( wstring const & )
 THROW_SPEC( std::exception )
 {
@@ -479,6 +681,19 @@ string makeDictionaryId( vector< string > const & dictionaryFiles ) throw()
 // be fixed in the future when it's needed.
 bool needToRebuildIndex( vector< string > const & dictionaryFiles,
                          string const & indexFile ) throw()
+{
+    if( LoadManifest::isIndexUpToDate( dictionaryFiles, indexFile ) )
+        return false;
+
+    if( isIndexOutdated( dictionaryFiles, indexFile ) )
+        return true;
+
+    LoadManifest::storeIndexUpToDate( dictionaryFiles, indexFile );
+    return false;
+}
+
+bool isIndexOutdated( vector< string > const & dictionaryFiles,
+                      string const & indexFile ) throw()
 {
     unsigned long lastModified = 0;
 
@@ -526,5 +741,26 @@ QString generateRandomDictionaryId()
                     QCryptographicHash::Md5 ).toHex() );
 }
 
+QThreadPool * streamingThreadPool()
+{
+    static QThreadPool pool;
+
+    return &pool;
+}
+
+QThreadPool * threadPoolForFiles( vector< string > const & fileNames )
+{
+    for( size_t x = 0; x < fileNames.size(); ++x )
+    {
+        QFileInfo fileInfo( FsEncoding::decode( fileNames[ x ].c_str() ) );
+
+        if ( fileInfo.isFile() )
+            return (quint64) fileInfo.size() > MaxPendingStreamData ? streamingThreadPool()
+                                                                    : QThreadPool::globalInstance();
+    }
+
+    return QThreadPool::globalInstance();
+}
+
 
 }
@@ -13,7 +13,9 @@
 #include "langcoder.hh"
 #include "wstring.hh"
 #include "qt4x5.hh"
+#include "dictstats.hh"
 #include <QObject>
+#include <QThreadPool>
 
 namespace Config { struct FullTextSearch; }
 
@@ -79,9 +81,25 @@ inline const QString & getErrorString() const
 /// or before it was called.
 virtual void cancel()=0;
 
-virtual ~Request()
+/// Attaches the trace record (see GdTrace in gddebug.hh) made by
+/// GdTrace::begin() right before the request was made, so that the time
+/// spent making it is accounted for too. An id of 0 does nothing.
+void setTraceId( int id );
+
+/// Records the cancellation of the request for tracing, and keeps it out of
+/// the statistics. Call it along with cancel().
+void traceCancel();
+
+/// Makes the request add its duration to the statistics given once it
+/// finishes. The start is the Stats::now() taken right before the request
+/// was made.
+void setStats( sptr< Stats > const &, Stats::Operation, qint64 started );
+
+Request(): statsOperation( Stats::Search ), statsStarted( 0 )
 {}
 
+virtual ~Request();
+
 signals:
 
 /// This signal is emitted when more data becomes available. Local
@@ -110,6 +128,18 @@ private:
 
 AtomicInt32 isFinishedFlag;
 
+AtomicInt32 traceId; // 0 when the request isn't traced
+AtomicInt32 traceUpdated;
+
+Mutex statsMutex;
+sptr< Stats > stats; // Reset once the duration is recorded
+Stats::Operation statsOperation;
+qint64 statsStarted;
+
+/// Adds the duration to the statistics, if there are any. Called once
+/// the request is finished.
+void recordStats();
+
 //Mutex errorStringMutex;
 QString errorString;
 };
@@ -193,10 +223,19 @@ public:
     THROW_SPEC( exSliceOutOfRange );
 
     /// Returns all the data read. Since no further locking can or would be
-    /// done, this can only be called after the request has finished.
+    /// done, this can only be called after the request has finished. If the
+    /// data was streamed and released with releaseData(), only what was left
+    /// is returned.
     vector< char > & getFullData() THROW_SPEC( exRequestUnfinished );
 
-    DataRequest(): hasAnyData( false ) {}
+    /// Tells that the data before the given offset was consumed and won't be
+    /// asked for anymore. Only has an effect on the requests streaming their
+    /// data with appendData(), which get throttled by the consumer from then
+    /// on, so that not too much of the data is held at once.
+    void releaseData( size_t offset );
+
+    DataRequest(): hasAnyData( false ), streaming( false ), consumerReleases( false ),
+        producerWaiting( false ), releasedBytes( 0 ) {}
 
 protected:
 
@@ -206,6 +245,27 @@ protected:
 
     bool hasAnyData; // With this being false, dataSize() always returns -1
     vector< char > data;
+
+    /// Appends a chunk to the data and makes it available at once, so that
+    /// large resources can be consumed while they're still being read. Blocks
+    /// while the consumer releasing the data is behind, so the requests whose
+    /// data may be released, such as resources, should be run in
+    /// streamingThreadPool(). Subclasses should call it without holding
+    /// dataMutex, and only use it for the data they won't modify afterwards.
+    void appendData( void const * buffer, size_t size, AtomicInt32 & isCancelled );
+
+    /// Streams the file given with appendData(), chunk by chunk. Returns false
+    /// if the file can't be opened.
+    bool appendFile( string const & fileName, AtomicInt32 & isCancelled )
+    THROW_SPEC( std::exception );
+
+private:
+
+    bool streaming; // The data was passed with appendData()
+    bool consumerReleases; // releaseData() was called at least once
+    bool producerWaiting; // appendData() waits for dataReleased
+    size_t releasedBytes; // How many bytes were dropped from the front of data
+    QSemaphore dataReleased;
 };
 
 /// A helper class for synchronous word search implementations.
@@ -251,12 +311,31 @@ enum Feature
     /// No features
     NoFeatures = 0,
     /// The dictionary is suitable to query when searching for compound expressions.
-    SuitableForCompoundSearching = 1
+    SuitableForCompoundSearching = 1,
+    /// The articles refer to the files made for the session, such as the
+    /// images or the videos extracted to the temporary directory, which are
+    /// removed along with the dictionary. Such articles can't be kept for
+    /// later.
+    ArticlesUseSessionFiles = 2
 };
 
 Q_DECLARE_FLAGS( Features, Feature )
 Q_DECLARE_OPERATORS_FOR_FLAGS( Features )
 
+/// Reads a dictionary's headwords in the order of its index, a few index
+/// entries at a time, so that they never have to be all in memory at once.
+class HeadwordIterator
+{
+public:
+
+    /// Appends the headwords of up to maxEntries next index entries to the
+    /// list. Returns false once there are no more entries to read.
+    virtual bool next( QStringList & headwords, unsigned maxEntries ) = 0;
+
+    virtual ~HeadwordIterator()
+    {}
+};
+
 /// A dictionary. Can be used to query words.
 class Class
 {
@@ -272,6 +351,7 @@ protected:
     bool can_FTS;
     AtomicInt32 FTS_index_completed;
     bool synonymSearchEnabled;
+    sptr< Stats > statistics;
 
     // Load user icon if it exist
     // By default set icon to empty
@@ -372,6 +452,15 @@ public:
                                                     unsigned maxSuffixVariation,
                                                     unsigned long maxResults ) THROW_SPEC( std::exception );
 
+    /// Looks up the headwords within the given edit distance of the word, to
+    /// help with its misspellings. The matches are to have the negated
+    /// distance as their weight. Not more than maxResults results should be
+    /// stored. The default implementation does nothing, returning an empty
+    /// result.
+    virtual sptr< WordSearchRequest > fuzzyMatch( wstring const &,
+                                                  unsigned maxDistance,
+                                                  unsigned long maxResults ) THROW_SPEC( std::exception );
+
     /// Finds known headwords for the given word, that is, the words for which
     /// the given word is a synonym. If a dictionary can't perform this operation,
     /// it should leave the default implementation which always returns an empty
@@ -451,10 +540,23 @@ public:
     virtual bool getHeadwords( QStringList & )
     { return false; }
 
+    /// Returns an iterator over the headwords in the index order, starting
+    /// with the first entry the given folded prefix could match and stopping
+    /// once past the entries it could. An empty prefix gives all headwords.
+    /// Returns an empty pointer if the dictionary can't provide one, in which
+    /// case getHeadwords() should be used.
+    virtual sptr< HeadwordIterator > getHeadwordIterator( wstring const & = wstring() )
+    { return sptr< HeadwordIterator >(); }
+
     /// Enable/disable search via synonyms
     void setSynonymSearchEnabled( bool enabled )
     { synonymSearchEnabled = enabled; }
 
+    /// Returns the runtime statistics of the dictionary. The requests made to
+    /// it are measured by their callers, see Request::setStats().
+    virtual sptr< Stats > getStats()
+    { return statistics; }
+
     virtual ~Class()
     {}
 };
@@ -489,10 +591,27 @@ string makeDictionaryId( vector< string > const & dictionaryFiles ) throw();
 bool needToRebuildIndex( vector< string > const & dictionaryFiles,
                          string const & indexFile ) throw();
 
+/// Does the same check as needToRebuildIndex(), but always against the file
+/// system. needToRebuildIndex() may instead rely on the load manifest while
+/// the dictionaries are being loaded at startup.
+bool isIndexOutdated( vector< string > const & dictionaryFiles,
+                      string const & indexFile ) throw();
+
 /// Returns a random dictionary id useful for interactively created
 /// dictionaries.
 QString generateRandomDictionaryId();
 
+/// Returns the thread pool to run the requests streaming their data with
+/// appendData() or appendFile() in. They may wait there for as long as the
+/// consumer is behind, which is up to the consumer, like a paused video, so
+/// they're kept out of the global pool the lookups run in.
+QThreadPool * streamingThreadPool();
+
+/// Returns the thread pool for the request streaming the first of the given
+/// files which exists. Only the files too large to be held at once can make
+/// the request wait for the consumer, so the rest go to the global pool.
+QThreadPool * threadPoolForFiles( vector< string > const & fileNames );
+
 }
 
 #endif
@@ -0,0 +1,253 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "dictstats.hh"
+#include "dictzip.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+
+namespace Dictionary {
+
+namespace {
+
+/// Started when the program starts, so now() needs no locking
+struct Clock
+{
+    QElapsedTimer timer;
+
+    Clock()
+    { timer.start(); }
+};
+
+Clock startClock;
+
+/// Reorders the samples as needed, returns 0 if there are none
+qint64 percentile95( std::vector< qint64 > & samples )
+{
+    if( samples.empty() )
+        return 0;
+
+    size_t rank = ( samples.size() * 95 + 99 ) / 100;
+    std::nth_element( samples.begin(), samples.begin() + ( rank - 1 ), samples.end() );
+    return samples[ rank - 1 ];
+}
+
+/// The hook for dictData::statsHook, with the Stats as the context
+void dictzipHook( void * context, int cacheHit, unsigned long decompressed )
+{
+    Stats * stats = static_cast< Stats * >( context );
+
+    stats->addCacheAccess( Stats::Dictzip, cacheHit != 0 );
+
+    if( decompressed )
+        stats->addDecompressed( decompressed );
+}
+
+}
+
+Stats::Summary::Summary():
+    chunkReads( 0 ), decompressedBytes( 0 )
+{
+    for( int x = 0; x < OperationCount; ++x )
+    {
+        requests[ x ] = 0;
+        meanMs[ x ] = p95Ms[ x ] = 0;
+    }
+
+    for( int x = 0; x < CacheCount; ++x )
+        hits[ x ] = misses[ x ] = 0;
+}
+
+double Stats::Summary::hitRatio( Cache cache ) const
+{
+    quint64 total = hits[ cache ] + misses[ cache ];
+
+    return total ? double( hits[ cache ] ) / total : -1;
+}
+
+Stats::Stats():
+    chunkReads( 0 ), decompressedBytes( 0 )
+{
+    for( int x = 0; x < OperationCount; ++x )
+    {
+        requests[ x ] = 0;
+        totalUs[ x ] = 0;
+        nextSample[ x ] = 0;
+    }
+
+    for( int x = 0; x < CacheCount; ++x )
+        hits[ x ] = misses[ x ] = 0;
+}
+
+qint64 Stats::now()
+{
+    return startClock.timer.nsecsElapsed() / 1000;
+}
+
+void Stats::addLatency( Operation operation, qint64 microseconds )
+{
+    Mutex::Lock _( mutex );
+
+    ++requests[ operation ];
+    totalUs[ operation ] += microseconds;
+
+    std::vector< qint64 > & ring = samples[ operation ];
+
+    if( ring.size() < SampleCount )
+        ring.push_back( microseconds );
+    else
+    {
+        ring[ nextSample[ operation ] ] = microseconds;
+        nextSample[ operation ] = ( nextSample[ operation ] + 1 ) % SampleCount;
+    }
+}
+
+void Stats::addCacheAccess( Cache cache, bool hit )
+{
+    Mutex::Lock _( mutex );
+
+    if( hit )
+        ++hits[ cache ];
+    else
+        ++misses[ cache ];
+}
+
+void Stats::addChunkRead( quint64 decompressed )
+{
+    Mutex::Lock _( mutex );
+
+    ++chunkReads;
+    decompressedBytes += decompressed;
+}
+
+void Stats::addDecompressed( quint64 bytes )
+{
+    Mutex::Lock _( mutex );
+
+    decompressedBytes += bytes;
+}
+
+void Stats::attach( dictData * dz )
+{
+    if( !dz )
+        return;
+
+    dz->statsHook = dictzipHook;
+    dz->statsContext = this;
+}
+
+void Stats::merge( Stats & other )
+{
+    quint64 otherRequests[ OperationCount ];
+    qint64 otherTotalUs[ OperationCount ];
+    std::vector< qint64 > otherSamples[ OperationCount ];
+    quint64 otherHits[ CacheCount ], otherMisses[ CacheCount ];
+    quint64 otherChunkReads, otherDecompressedBytes;
+
+    {
+        Mutex::Lock _( other.mutex );
+
+        for( int x = 0; x < OperationCount; ++x )
+        {
+            otherRequests[ x ] = other.requests[ x ];
+            otherTotalUs[ x ] = other.totalUs[ x ];
+            otherSamples[ x ] = other.orderedSamples( (Operation) x );
+        }
+
+        for( int x = 0; x < CacheCount; ++x )
+        {
+            otherHits[ x ] = other.hits[ x ];
+            otherMisses[ x ] = other.misses[ x ];
+        }
+
+        otherChunkReads = other.chunkReads;
+        otherDecompressedBytes = other.decompressedBytes;
+    }
+
+    Mutex::Lock _( mutex );
+
+    for( int x = 0; x < OperationCount; ++x )
+    {
+        requests[ x ] += otherRequests[ x ];
+        totalUs[ x ] += otherTotalUs[ x ];
+
+        // The other samples go before these, and only the last ones are kept
+        std::vector< qint64 > merged = otherSamples[ x ];
+        std::vector< qint64 > own = orderedSamples( (Operation) x );
+        merged.insert( merged.end(), own.begin(), own.end() );
+
+        if( merged.size() > SampleCount )
+            merged.erase( merged.begin(), merged.end() - SampleCount );
+
+        samples[ x ].swap( merged );
+        nextSample[ x ] = 0;
+    }
+
+    for( int x = 0; x < CacheCount; ++x )
+    {
+        hits[ x ] += otherHits[ x ];
+        misses[ x ] += otherMisses[ x ];
+    }
+
+    chunkReads += otherChunkReads;
+    decompressedBytes += otherDecompressedBytes;
+}
+
+std::vector< qint64 > Stats::orderedSamples( Operation operation ) const
+{
+    std::vector< qint64 > const & ring = samples[ operation ];
+
+    // Until the ring is full, the samples go in order
+    std::vector< qint64 > result( ring.begin() + nextSample[ operation ], ring.end() );
+    result.insert( result.end(), ring.begin(), ring.begin() + nextSample[ operation ] );
+
+    return result;
+}
+
+Stats::Summary Stats::summary()
+{
+    Summary result;
+    std::vector< qint64 > sorted[ OperationCount ];
+
+    {
+        Mutex::Lock _( mutex );
+
+        for( int x = 0; x < OperationCount; ++x )
+        {
+            result.requests[ x ] = requests[ x ];
+            result.meanMs[ x ] = requests[ x ] ? totalUs[ x ] / 1000.0 / requests[ x ] : 0;
+            sorted[ x ] = samples[ x ];
+        }
+
+        for( int x = 0; x < CacheCount; ++x )
+        {
+            result.hits[ x ] = hits[ x ];
+            result.misses[ x ] = misses[ x ];
+        }
+
+        result.chunkReads = chunkReads;
+        result.decompressedBytes = decompressedBytes;
+    }
+
+    for( int x = 0; x < OperationCount; ++x )
+        result.p95Ms[ x ] = percentile95( sorted[ x ] ) / 1000.0;
+
+    return result;
+}
+
+double Stats::p95Ms( Operation operation, quint64 minRequests )
+{
+    std::vector< qint64 > sorted;
+    {
+        Mutex::Lock _( mutex );
+
+        if( requests[ operation ] < minRequests || samples[ operation ].empty() )
+            return -1;
+
+        sorted = samples[ operation ];
+    }
+
+    return percentile95( sorted ) / 1000.0;
+}
+
+}
@@ -0,0 +1,122 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __DICTSTATS_HH_INCLUDED__
+#define __DICTSTATS_HH_INCLUDED__
+
+#include <QtGlobal>
+#include <vector>
+#include "mutex.hh"
+
+struct dictData;
+
+namespace Dictionary {
+
+/// Runtime performance counters of a dictionary, accumulated while it serves
+/// the lookups. They are kept in memory only and start over with every run.
+/// All the functions are thread-safe.
+class Stats
+{
+public:
+
+    enum Operation
+    {
+        Search,
+        Article,
+        OperationCount
+    };
+
+    enum Cache
+    {
+        /// The btree root node kept loaded, versus all the node reads
+        BtreeNodes,
+        /// The chunk cache of the dictzip reader
+        Dictzip,
+        /// The last record block kept unpacked by the MDict dictionaries
+        RecordBlocks,
+        /// The articles found in ArticleCache instead of being rendered
+        RenderedArticles,
+        /// The resources found in ResourceCache instead of being read
+        Resources,
+        CacheCount
+    };
+
+    /// The figures at some moment
+    struct Summary
+    {
+        quint64 requests[ OperationCount ];
+        double meanMs[ OperationCount ];
+        /// Computed over the last SampleCount requests only
+        double p95Ms[ OperationCount ];
+
+        quint64 hits[ CacheCount ], misses[ CacheCount ];
+
+        /// Blocks read from the chunked storage, which isn't cached
+        quint64 chunkReads;
+        /// The bytes unpacked by the btree, the chunked storage, dictzip and
+        /// the MDict record blocks
+        quint64 decompressedBytes;
+
+        Summary();
+
+        /// Returns the share of the accesses which were hits, from 0 to 1, or
+        /// a negative value if there were no accesses at all
+        double hitRatio( Cache ) const;
+    };
+
+    enum
+    {
+        SampleCount = 1024
+    };
+
+    Stats();
+
+    /// Returns the time in microseconds since some moment before it was first
+    /// called. The start of a request is to be taken with it, see
+    /// Request::setStats().
+    static qint64 now();
+
+    void addLatency( Operation, qint64 microseconds );
+
+    void addCacheAccess( Cache, bool hit );
+
+    /// Called by ChunkedStorage::Reader for every block read
+    void addChunkRead( quint64 decompressedBytes );
+
+    void addDecompressed( quint64 bytes );
+
+    /// Makes the dictzip reader given report its cache accesses and the
+    /// bytes it decompresses to these statistics. The reader must not
+    /// outlive them.
+    void attach( dictData * );
+
+    /// Adds the figures of the other statistics, which are taken to be the
+    /// earlier ones, to these
+    void merge( Stats & other );
+
+    Summary summary();
+
+    /// Returns the p95 latency of the operation, or a negative value if there
+    /// were fewer requests than given so far. Cheaper than summary().
+    double p95Ms( Operation, quint64 minRequests );
+
+private:
+
+    /// Returns the samples of the operation oldest first. The mutex must be
+    /// held.
+    std::vector< qint64 > orderedSamples( Operation ) const;
+
+    Mutex mutex;
+
+    quint64 requests[ OperationCount ];
+    qint64 totalUs[ OperationCount ];
+    std::vector< qint64 > samples[ OperationCount ]; // The last ones, as a ring
+    size_t nextSample[ OperationCount ];
+
+    quint64 hits[ CacheCount ], misses[ CacheCount ];
+    quint64 chunkReads;
+    quint64 decompressedBytes;
+};
+
+}
+
+#endif
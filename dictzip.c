@@ -718,6 +718,8 @@ char *dict_data_read_ (
             if (found) {
                 count = h->cache[target].count;
                 inBuffer = h->cache[target].inBuffer;
+                if (h->statsHook)
+                    h->statsHook( h->statsContext, 1, 0 );
             } else {
 #ifdef __WIN32
                 DWORD pos ;
@@ -793,6 +795,9 @@ char *dict_data_read_ (
 
                 h->cache[target].count = count;
                 h->cache[target].chunk = i;
+
+                if (h->statsHook)
+                    h->statsHook( h->statsContext, 0, count );
             }
 
             if (i == firstChunk) {
@@ -94,6 +94,12 @@ typedef struct dictData {
     int           stamp;
     dictCache     cache[DICT_CACHE_SIZE];
     char          errorString[ERR_STRING_SIZE];
+
+    /* If set, called for every chunk accessed, with the number of bytes
+       decompressed for it, which is 0 for the cache hits */
+    void          (*statsHook)( void *context, int cacheHit,
+                                unsigned long decompressed );
+    void          *statsContext;
 } dictData;
 
 
@@ -402,6 +402,7 @@ void DslDictionary::doDeferredInit()
             //Mutex::Lock _( idxMutex );
 
             chunks = sptr< ChunkedStorage::Reader >(new ChunkedStorage::Reader( idx, idxHeader.chunksOffset ));
+            chunks->setStats( statistics.get() );
 
             // Open the .dsl file
 
@@ -412,6 +413,8 @@ void DslDictionary::doDeferredInit()
                 throw exDictzipError( string( dz_error_str( error ) )
                                       + "(" + getDictionaryFilenames()[ 0 ] + ")" );
 
+            statistics->attach( dz );
+
             // Read the abrv, if any
 
             if ( idxHeader.hasAbrv )
@@ -1812,6 +1815,8 @@ class DslResourceRequest: public Dictionary::DataRequest
     DslDictionary & dict;
 
     string resourceName;
+    string fileName; // In the dictionary's directory
+    string filesDirFileName; // In its .files directory
 
     AtomicInt32 isCancelled;
     QSemaphore hasExited;
@@ -1821,9 +1826,19 @@ public:
     DslResourceRequest( DslDictionary & dict_,
                         string const & resourceName_ ):
         dict( dict_ ),
-        resourceName( resourceName_ )
+        resourceName( resourceName_ ),
+        fileName( FsEncoding::dirname( dict.getDictionaryFilenames()[ 0 ] ) +
+                  FsEncoding::separator() +
+                  FsEncoding::encode( resourceName ) ),
+        filesDirFileName( dict.getDictionaryFilenames()[ 0 ] + ".files" +
+                          FsEncoding::separator() +
+                          FsEncoding::encode( resourceName ) )
     {
-        QThreadPool::globalInstance()->start(
+        vector< string > fileNames;
+        fileNames.push_back( fileName );
+        fileNames.push_back( filesDirFileName );
+
+        Dictionary::threadPoolForFiles( fileNames )->start(
                     new DslResourceRequestRunnable( *this, hasExited ) );
     }
 
@@ -1863,15 +1878,23 @@ void DslResourceRequest::run()
         return;
     }
 
-    string n =
-            FsEncoding::dirname( dict.getDictionaryFilenames()[ 0 ] ) +
-            FsEncoding::separator() +
-            FsEncoding::encode( resourceName );
+    string n = fileName;
 
     GD_DPRINTF( "n is %s\n", n.c_str() );
 
     try
     {
+        if ( !Filetype::isNameOfTiff( resourceName ) )
+        {
+            // The files are passed on as they are, so they get streamed. Large
+            // sounds and videos then start playing before they are read in full.
+            if ( appendFile( n, isCancelled ) || appendFile( filesDirFileName, isCancelled ) )
+            {
+                finish();
+                return;
+            }
+        }
+
         try
         {
             Mutex::Lock _( dataMutex );
@@ -1880,9 +1903,7 @@ void DslResourceRequest::run()
         }
         catch( File::exCantOpen & )
         {
-            n = dict.getDictionaryFilenames()[ 0 ] + ".files" +
-                    FsEncoding::separator() +
-                    FsEncoding::encode( resourceName );
+            n = filesDirFileName;
 
             try
             {
@@ -94,6 +94,10 @@ public:
 
     ~EpwingDictionary();
 
+    /// The pictures and the sounds are extracted to cacheDirectory
+    virtual Dictionary::Features getFeatures() const
+    { return BtreeDictionary::getFeatures() | Dictionary::ArticlesUseSessionFiles; }
+
     virtual unsigned long getArticleCount() const
     { return idxHeader.articleCount; }
 
@@ -194,6 +198,8 @@ EpwingDictionary::EpwingDictionary( string const & id,
     idxHeader( idx.read< IdxHeader >() ),
     chunks( idx, idxHeader.chunksOffset )
 {
+    chunks.setStats( statistics.get() );
+
     vector< char > data( idxHeader.nameSize );
     idx.seek( sizeof( idxHeader ) );
     if( data.size() > 0 )
@@ -8,11 +8,18 @@
 #include "gddebug.hh"
 #include "folding.hh"
 #include "qt4x5.hh"
+#include "fsencoding.hh"
 
 #include <vector>
+#include <algorithm>
 #include <string>
+#include <math.h>
 
 #include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QFile>
+#include <QSemaphore>
 
 #if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
 #include <QRegularExpression>
@@ -64,6 +71,210 @@ namespace FtsHelpers
         return searchString;
     }
 
+    /// Tells whether a quantifier making the preceding item optional begins
+    /// at the position given
+    static bool optionalQuantifierAt( QString const & pattern, int pos )
+    {
+        if( pos >= pattern.size() )
+            return false;
+
+        if( pattern.at( pos ) == '*' || pattern.at( pos ) == '?' )
+            return true;
+
+        return pattern.at( pos ) == '{' && pattern.mid( pos + 1, 1 ) == "0";
+    }
+
+    /// Collects the literal parts of the regular expression, from the position
+    /// given up to the end of the group it's in, which every match of it has
+    /// to contain. The alternatives, the optional parts and the lookarounds
+    /// don't have to be matched, so nothing is collected from them. Returns
+    /// true if the group has alternatives, in which case nothing is collected.
+    static bool collectRegExpLiterals( QString const & pattern, int & pos, QStringList & literals )
+    {
+        QStringList found;
+        QString run;
+        bool alternation = false;
+
+        for( ; ; )
+        {
+            QChar ch = pos < pattern.size() ? pattern.at( pos ) : QChar( ')' );
+
+            bool quantifier = ch == '*' || ch == '+' || ch == '?';
+            bool optional = ch == '*' || ch == '?';
+            int quantifierEnd = pos + 1;
+
+            if( ch == '{' )
+            {
+                // A brace only makes a quantifier if it's followed by {n}, {n,}
+                // or {n,m}, and is taken as is otherwise
+                int end = pattern.indexOf( '}', pos );
+                QRegExp bounds( "\\d+(,\\d*)?" );
+
+                if( end > pos && bounds.exactMatch( pattern.mid( pos + 1, end - pos - 1 ) ) )
+                {
+                    quantifier = true;
+                    optional = pattern.at( pos + 1 ) == '0';
+                    quantifierEnd = end + 1;
+                }
+            }
+
+            if( quantifier )
+            {
+                // The character repeated is still required if it's there at
+                // least once, but the literal part can't go on past it
+                if( !run.isEmpty() )
+                {
+                    QChar last = run.at( run.size() - 1 );
+
+                    if( optional )
+                        run.chop( 1 );
+
+                    found.append( run );
+                    run = optional ? QString() : QString( last );
+                }
+
+                pos = quantifierEnd;
+
+                // Skip the lazy and possessive modifiers
+                if( pos < pattern.size() && ( pattern.at( pos ) == '?' || pattern.at( pos ) == '+' ) )
+                    pos++;
+
+                continue;
+            }
+
+            if( ch != '\\' && ch != '[' && ch != '(' && ch != ')' && ch != '|'
+                    && ch != '.' && ch != '^' && ch != '$' )
+            {
+                run.append( ch );
+                pos++;
+                continue;
+            }
+
+            // Anything else ends the literal part
+            found.append( run );
+            run.clear();
+
+            if( ch == ')' )
+                break;
+
+            pos++;
+
+            if( ch == '|' )
+                alternation = true;
+            else
+            if( ch == '\\' )
+            {
+                // The escaped characters are either classes or punctuation,
+                // neither of which makes an indexed word
+                QChar escaped = pos < pattern.size() ? pattern.at( pos++ ) : QChar();
+
+                if( escaped == 'x' || escaped == '0' )
+                {
+                    // A character code
+                    for( int n = 0; n < 4 && pos < pattern.size() && pattern.at( pos ).isLetterOrNumber(); n++ )
+                        pos++;
+                }
+                else
+                if( ( escaped == 'p' || escaped == 'P' ) && pos < pattern.size() && pattern.at( pos ) == '{' )
+                {
+                    int end = pattern.indexOf( '}', pos );
+                    pos = end < 0 ? pattern.size() : end + 1;
+                }
+            }
+            else
+            if( ch == '[' )
+            {
+                // A set matches a single unknown character
+                if( pos < pattern.size() && pattern.at( pos ) == '^' )
+                    pos++;
+                if( pos < pattern.size() && pattern.at( pos ) == ']' )
+                    pos++;
+
+                while( pos < pattern.size() && pattern.at( pos ) != ']' )
+                    pos += pattern.at( pos ) == '\\' ? 2 : 1;
+
+                pos++;
+            }
+            else
+            if( ch == '(' )
+            {
+                bool lookaround = false;
+
+                if( pos < pattern.size() && pattern.at( pos ) == '?' )
+                {
+                    if( pattern.mid( pos + 1, 1 ) == ":" )
+                        pos += 2;
+                    else
+                        lookaround = true;
+                }
+
+                QStringList groupLiterals;
+                bool groupAlternation = collectRegExpLiterals( pattern, pos, groupLiterals );
+
+                if( pos < pattern.size() )
+                    pos++; // The closing bracket
+
+                if( !lookaround && !groupAlternation && !optionalQuantifierAt( pattern, pos ) )
+                    found += groupLiterals;
+            }
+        }
+
+        if( !alternation )
+            literals += found;
+
+        return alternation;
+    }
+
+    /// Collects the literal parts of the search string, which every match of
+    /// it has to contain
+    static QStringList requiredLiterals( QString const & str, int searchMode )
+    {
+        QStringList literals;
+
+        if( searchMode == FTS::RegExp )
+        {
+            int pos = 0;
+            collectRegExpLiterals( str, pos, literals );
+
+            // An unbalanced closing bracket has stopped the parsing, so there
+            // might be alternatives past it
+            if( pos < str.size() )
+                literals.clear();
+        }
+        else
+        {
+            QString run;
+
+            for( int x = 0; x < str.size(); x++ )
+            {
+                QChar ch = str.at( x );
+
+                if( ch == '\\' && x + 1 < str.size() )
+                    run.append( str.at( ++x ) );
+                else
+                if( ch == '*' || ch == '?' || ch == '[' )
+                {
+                    literals.append( run );
+                    run.clear();
+
+                    if( ch == '[' )
+                    {
+                        // Skip the set, it matches a single unknown character
+                        while( x + 1 < str.size() && str.at( x + 1 ) != ']' )
+                            x++;
+                        x++;
+                    }
+                }
+                else
+                    run.append( ch );
+            }
+
+            literals.append( run );
+        }
+
+        return literals;
+    }
+
     bool parseSearchString( QString const & str, QStringList & indexWords,
                             QStringList & searchWords,
                             QRegExp & searchRegExp, int searchMode,
@@ -75,8 +286,6 @@ namespace FtsHelpers
         indexWords.clear();
         QRegExp spacesRegExp( "\\W+" );
         QRegExp wordRegExp( QString( "\\w{" ) + QString::number( FTS::MinimumWordSize ) + ",}" );
-        QRegExp setsRegExp( "\\[[^\\]]+\\]", Qt::CaseInsensitive, QRegExp::RegExp2 );
-        QRegExp regexRegExp( "\\\\[afnrtvdDwWsSbB]|\\\\x([0-9A-Fa-f]{4})|\\\\0([0-7]{3})", Qt::CaseSensitive, QRegExp::RegExp2 );
 
         hasCJK = false;
         for( int x = 0; x < str.size(); x++ )
@@ -114,18 +323,12 @@ namespace FtsHelpers
         }
         else
         {
-            // Make words list for index search
+            // Make words list for index search. Only the words every match
+            // has to contain can narrow the search down. If there are none,
+            // all the articles get searched through.
 
-            QString tmp = str;
-
-            // Remove RegExp commands
-            if( searchMode == FTS::RegExp )
-                tmp.replace( regexRegExp, " " );
-
-            // Remove all symbol sets
-            tmp.replace( setsRegExp, " " );
-
-            QStringList list = tmp.normalized( QString::NormalizationForm_C )
+            QStringList list = requiredLiterals( str, searchMode ).join( " " )
+                    .normalized( QString::NormalizationForm_C )
                     .toLower().split( spacesRegExp, QString::SkipEmptyParts );
 
             if( hasCJK )
@@ -295,6 +498,255 @@ namespace FtsHelpers
         }
     }
 
+    namespace
+    {
+        // Number of the full-text searches running at the moment
+        AtomicInt32 searchesRunning;
+
+        class SearchRunning
+        {
+        public:
+            SearchRunning()
+            { searchesRunning.ref(); }
+
+            ~SearchRunning()
+            { searchesRunning.deref(); }
+        };
+
+        /// Leaves the disk to the searches running, if any, until they end
+        void waitForSearches( AtomicInt32 & isCancelled )
+        {
+            QSemaphore pause;
+
+            while( Qt4x5::AtomicInt::loadAcquire( searchesRunning )
+                   && !Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                pause.tryAcquire( 1, 50 );
+        }
+    }
+
+    /// Parses the articles fetched in bulk for the full-text search index
+    class FtsIndexArticleHandler: public BtreeIndexing::ArticleTextHandler
+    {
+        QMap< QString, QVector< uint32_t > > & ftsWords;
+        bool needHandleBrackets;
+        AtomicInt32 & isCancelled;
+        uint64_t & totalLength;
+        QString articleStr;
+        unsigned articlesHandled;
+
+        // The searches running are checked for after that many articles
+        enum { SearchesCheckInterval = 64 };
+
+    public:
+
+        FtsIndexArticleHandler( QMap< QString, QVector< uint32_t > > & ftsWords_,
+                                bool needHandleBrackets_, AtomicInt32 & isCancelled_,
+                                uint64_t & totalLength_ ):
+            ftsWords( ftsWords_ ), needHandleBrackets( needHandleBrackets_ ),
+            isCancelled( isCancelled_ ), totalLength( totalLength_ ), articlesHandled( 0 )
+        {}
+
+        virtual bool handleArticleText( uint32_t articleAddress, QString const &,
+                                        QString const & text )
+        {
+            if( ++articlesHandled % SearchesCheckInterval == 0 )
+                waitForSearches( isCancelled );
+
+            if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                return false;
+
+            totalLength += text.size();
+
+            articleStr = text;
+            parseArticleForFts( articleAddress, articleStr, ftsWords, needHandleBrackets );
+
+            return true;
+        }
+    };
+
+    /// Hands out article texts in the order of the given offsets, fetching
+    /// them from the dictionary ahead of time in batches
+    class ArticleTextPrefetcher: public BtreeIndexing::ArticleTextHandler
+    {
+        BtreeIndexing::BtreeDictionary & dict;
+        QVector< uint32_t > const & offsets;
+        int fetchedEnd;
+        QHash< uint32_t, QPair< QString, QString > > fetched;
+
+        enum { BatchSize = 256 };
+
+    public:
+
+        ArticleTextPrefetcher( BtreeIndexing::BtreeDictionary & dict_,
+                               QVector< uint32_t > const & offsets_ ):
+            dict( dict_ ), offsets( offsets_ ), fetchedEnd( 0 )
+        {}
+
+        /// Retrieves the article for offsets[ index ]. The indices are expected
+        /// to go in increasing order.
+        void get( int index, QString & headword, QString & text )
+        {
+            if( index >= fetchedEnd )
+            {
+                fetched.clear();
+                fetchedEnd = qMin( index + BatchSize, offsets.size() );
+                dict.getArticleTexts( offsets.mid( index, fetchedEnd - index ), *this );
+            }
+
+            QPair< QString, QString > const & article = fetched[ offsets.at( index ) ];
+            headword = article.first;
+            text = article.second;
+        }
+
+        virtual bool handleArticleText( uint32_t articleAddress, QString const & headword,
+                                        QString const & text )
+        {
+            fetched.insert( articleAddress, QPair< QString, QString >( headword, text ) );
+            return true;
+        }
+    };
+
+    static bool linkOffsetLess( BtreeIndexing::WordArticleLink const & first,
+                                BtreeIndexing::WordArticleLink const & second )
+    {
+        return first.articleOffset < second.articleOffset;
+    }
+
+    void writeHeadwordMap( File::Class & ftsIdx, BtreeIndexing::BtreeDictionary * dict,
+                           FtsIdxHeader & ftsIdxHeader, AtomicInt32 & isCancelled )
+    {
+        QVector< BtreeIndexing::WordArticleLink > links;
+        links.reserve( dict->getArticleCount() );
+
+        // With the offsets collected, only the first headword of an article
+        // is listed, the one getHeadwordsFromOffsets() would find
+        QSet< uint32_t > setOfOffsets;
+        setOfOffsets.reserve( dict->getArticleCount() );
+
+        dict->findArticleLinks( &links, &setOfOffsets, 0, &isCancelled );
+
+        if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+            throw exUserAbort();
+
+        setOfOffsets.clear();
+
+        std::sort( links.begin(), links.end(), linkOffsetLess );
+
+        ftsIdxHeader.headwordsOffset = ftsIdx.tell();
+        ftsIdxHeader.headwordCount = links.size();
+
+        // The table comes first, then the headwords
+
+        vector< FtsHeadwordEntry > entries( links.size() );
+        uint32_t headwordOffset = ftsIdxHeader.headwordsOffset + entries.size() * sizeof( FtsHeadwordEntry );
+
+        for( int x = 0; x < links.size(); x++ )
+        {
+            entries[ x ].articleOffset = links[ x ].articleOffset;
+            entries[ x ].headwordOffset = headwordOffset;
+            headwordOffset += sizeof( uint32_t ) + links[ x ].word.size();
+        }
+
+        if( !entries.empty() )
+            ftsIdx.write( &entries.front(), entries.size() * sizeof( FtsHeadwordEntry ) );
+
+        for( int x = 0; x < links.size(); x++ )
+        {
+            ftsIdx.write( (uint32_t) links[ x ].word.size() );
+            ftsIdx.write( links[ x ].word.data(), links[ x ].word.size() );
+        }
+    }
+
+    /// Reads the words of the articles indexed by an interrupted run into
+    /// ftsWords. Returns false if there's no checkpoint fitting the header
+    /// given, which then gets the progress read filled in otherwise.
+    static bool loadCheckpoint( string const & fileName, BtreeIndexing::BtreeDictionary * dict,
+                                FtsCheckpointHeader & header,
+                                QMap< QString, QVector< uint32_t > > & ftsWords )
+    {
+        if( !File::exists( fileName )
+                || Dictionary::isIndexOutdated( dict->getDictionaryFilenames(), fileName ) )
+            return false;
+
+        try
+        {
+            File::Class checkpoint( fileName, "rb" );
+
+            FtsCheckpointHeader stored;
+
+            if( checkpoint.readRecords( &stored, sizeof( stored ), 1 ) != 1
+                    || stored.signature != header.signature
+                    || stored.formatVersion != header.formatVersion
+                    || stored.indexBtreeMaxElements != header.indexBtreeMaxElements
+                    || stored.indexRootOffset != header.indexRootOffset
+                    || stored.articleCount != header.articleCount
+                    || stored.articlesDone > stored.articleCount )
+                return false;
+
+            while( checkpoint.tell() < stored.dataEnd )
+            {
+                uint32_t wordCount = checkpoint.read< uint32_t >();
+
+                for( uint32_t x = 0; x < wordCount; x++ )
+                {
+                    string word( checkpoint.read< uint32_t >(), 0 );
+                    if( !word.empty() )
+                        checkpoint.read( &word[ 0 ], word.size() );
+
+                    QVector< uint32_t > & offsets = ftsWords[ QString::fromUtf8( word.data(), word.size() ) ];
+                    int size = offsets.size();
+
+                    offsets.resize( size + checkpoint.read< uint32_t >() );
+                    if( offsets.size() > size )
+                        checkpoint.read( offsets.data() + size, ( offsets.size() - size ) * sizeof( uint32_t ) );
+                }
+            }
+
+            header.articlesDone = stored.articlesDone;
+            header.dataEnd = stored.dataEnd;
+            header.lengthDone = stored.lengthDone;
+
+            return true;
+        }
+        catch( std::exception & e )
+        {
+            gdWarning( "FTS: Can't resume from the checkpoint \"%s\", error: %s\n",
+                       fileName.c_str(), e.what() );
+            ftsWords.clear();
+            return false;
+        }
+    }
+
+    /// Appends the words of a batch of articles just indexed to the checkpoint
+    /// and marks them done
+    static void saveCheckpoint( File::Class & checkpoint, FtsCheckpointHeader & header,
+                                QMap< QString, QVector< uint32_t > > const & words,
+                                uint32_t articlesDone )
+    {
+        checkpoint.seek( header.dataEnd );
+
+        checkpoint.write( (uint32_t) words.size() );
+
+        for( QMap< QString, QVector< uint32_t > >::const_iterator it = words.constBegin();
+             it != words.constEnd(); ++it )
+        {
+            QByteArray word = it.key().toUtf8();
+
+            checkpoint.write( (uint32_t) word.size() );
+            checkpoint.write( word.constData(), word.size() );
+            checkpoint.write( (uint32_t) it.value().size() );
+            checkpoint.write( it.value().constData(), it.value().size() * sizeof( uint32_t ) );
+        }
+
+        header.dataEnd = checkpoint.tell();
+        header.articlesDone = articlesDone;
+
+        // The header only gets updated once the batch is there in full
+        checkpoint.rewind();
+        checkpoint.writeRecords( &header, sizeof( header ), 1 );
+        checkpoint.file().flush();
+    }
+
     void makeFTSIndex( BtreeIndexing::BtreeDictionary * dict, AtomicInt32 & isCancelled )
     {
         Mutex::Lock _( dict->getFtsMutex() );
@@ -351,19 +803,69 @@ namespace FtsHelpers
             needHandleBrackets = name.endsWith( ".dsl" ) || name.endsWith( "dsl.dz" );
         }
 
-        // index articles for full-text search
-        for( int i = 0; i < offsets.size(); i++ )
+        // index articles for full-text search, picking up where an interrupted
+        // run has left off
+
+        string checkpointName = dict->ftsIndexName() + "_PART";
+
+        FtsCheckpointHeader checkpointHeader;
+        memset( &checkpointHeader, 0, sizeof( checkpointHeader ) );
+
+        BtreeIndexing::IndexInfo indexInfo = dict->getIndexInfo();
+
+        checkpointHeader.signature = FtsCheckpointSignature;
+        checkpointHeader.formatVersion = FtsHelpers::CurrentFtsFormatVersion + dict->getFtsIndexVersion();
+        checkpointHeader.indexBtreeMaxElements = indexInfo.btreeMaxElements;
+        checkpointHeader.indexRootOffset = indexInfo.rootOffset;
+        checkpointHeader.articleCount = offsets.size();
+
         {
-            if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
-                throw exUserAbort();
+            bool resumed = loadCheckpoint( checkpointName, dict, checkpointHeader, ftsWords );
+
+            if( resumed )
+                gdDebug( "FTS: Resuming the full-text index of \"%s\" from article %u of %u\n",
+                         dict->getName().c_str(), checkpointHeader.articlesDone,
+                         checkpointHeader.articleCount );
 
-            QString headword, articleStr;
+            File::Class checkpoint( checkpointName, resumed ? "r+b" : "wb" );
+
+            if( !resumed )
+            {
+                checkpointHeader.dataEnd = sizeof( checkpointHeader );
+                checkpoint.writeRecords( &checkpointHeader, sizeof( checkpointHeader ), 1 );
+            }
 
-            dict->getArticleText( offsets.at( i ), headword, articleStr );
+            for( int start = checkpointHeader.articlesDone; start < offsets.size();
+                 start += FtsCheckpointArticles )
+            {
+                QMap< QString, QVector< uint32_t > > batchWords;
+                uint64_t batchLength = 0;
+
+                {
+                    FtsIndexArticleHandler handler( batchWords, needHandleBrackets, isCancelled,
+                                                    batchLength );
+                    dict->getArticleTexts( offsets.mid( start, FtsCheckpointArticles ), handler );
+                }
+
+                // A batch left incomplete isn't saved
+                if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                    throw exUserAbort();
 
-            parseArticleForFts( offsets.at( i ), articleStr, ftsWords, needHandleBrackets );
+                checkpointHeader.lengthDone += batchLength;
+
+                saveCheckpoint( checkpoint, checkpointHeader, batchWords,
+                                qMin( start + (int) FtsCheckpointArticles, offsets.size() ) );
+
+                for( QMap< QString, QVector< uint32_t > >::const_iterator it = batchWords.constBegin();
+                     it != batchWords.constEnd(); ++it )
+                    ftsWords[ it.key() ] += it.value();
+            }
         }
 
+        // For the BM25 ranking of the hits
+        ftsIdxHeader.articleCount = offsets.size();
+        ftsIdxHeader.totalArticleLength = checkpointHeader.lengthDone;
+
         // Free memory
         offsets.clear();
 
@@ -398,11 +900,73 @@ namespace FtsHelpers
         ftsIdxHeader.indexBtreeMaxElements = ftsIdxInfo.btreeMaxElements;
         ftsIdxHeader.indexRootOffset = ftsIdxInfo.rootOffset;
 
+        writeHeadwordMap( ftsIdx, dict, ftsIdxHeader, isCancelled );
+
         ftsIdxHeader.signature = FtsHelpers::FtsSignature;
         ftsIdxHeader.formatVersion = FtsHelpers::CurrentFtsFormatVersion + dict->getFtsIndexVersion();
 
         ftsIdx.rewind();
         ftsIdx.writeRecords( &ftsIdxHeader, sizeof(ftsIdxHeader), 1 );
+
+        QFile::remove( FsEncoding::decode( checkpointName.c_str() ) );
+    }
+
+    bool FtsHeadwordMap::getHeadwords( QList< uint32_t > const & offsets,
+                                       QVector< QString > & headwords,
+                                       AtomicInt32 & isCancelled )
+    THROW_SPEC( std::exception )
+    {
+        if( !headwordCount )
+            return false;
+
+        QVector< QString > found;
+        found.reserve( offsets.size() );
+
+        Mutex::Lock _( ftsIdxMutex );
+
+        for( int i = 0; i < offsets.size(); i++ )
+        {
+            if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                return false;
+
+            // Binary search in the table on disk
+            uint32_t low = 0, high = headwordCount;
+            FtsHeadwordEntry entry;
+
+            while( low < high )
+            {
+                uint32_t middle = low + ( high - low ) / 2;
+
+                ftsIdx.seek( headwordsOffset + middle * sizeof( FtsHeadwordEntry ) );
+                ftsIdx.read( entry );
+
+                if( entry.articleOffset < offsets.at( i ) )
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+
+            if( low == headwordCount )
+                return false;
+
+            ftsIdx.seek( headwordsOffset + low * sizeof( FtsHeadwordEntry ) );
+            ftsIdx.read( entry );
+
+            if( entry.articleOffset != offsets.at( i ) )
+                return false;
+
+            ftsIdx.seek( entry.headwordOffset );
+
+            string headword( ftsIdx.read< uint32_t >(), 0 );
+            if( !headword.empty() )
+                ftsIdx.read( &headword[ 0 ], headword.size() );
+
+            found.append( QString::fromUtf8( headword.data(), headword.size() ) );
+        }
+
+        headwords += found;
+
+        return true;
     }
 
     bool isCJKChar( ushort ch )
@@ -415,11 +979,114 @@ namespace FtsHelpers
         return false;
     }
 
+    namespace
+    {
+        // Okapi BM25 parameters
+        double const TermFrequencySaturation = 1.2; // k1
+        double const LengthNormalization = 0.75; // b
+
+        // The hits are passed on in batches of that many
+        int const PublishBatchSize = 25;
+    }
+
     void FTSResultsRequestRunnable::run()
     {
         r.run();
     }
 
+    double FTSResultsRequest::score( QString const & articleText )
+    {
+        // Without the FTS index the average length isn't known, and the
+        // lengths are left out of the ranking
+        double lengthRatio = averageLength > 0 ? articleText.size() / averageLength : 1;
+        double result = 0;
+
+        for( int x = 0; x < scoringTerms.size(); x++ )
+        {
+            int frequency = articleText.count( scoringTerms.at( x ), scoringCase );
+            if( !frequency )
+                continue;
+
+            double idf = 1;
+
+            QHash< QString, int >::const_iterator it = documentCounts.constFind( scoringTerms.at( x ).toLower() );
+            if( it != documentCounts.constEnd() )
+                idf = log( 1 + ( articleCount - it.value() + 0.5 ) / ( it.value() + 0.5 ) );
+
+            result += idf * frequency * ( TermFrequencySaturation + 1 )
+                      / ( frequency + TermFrequencySaturation
+                                      * ( 1 - LengthNormalization + LengthNormalization * lengthRatio ) );
+        }
+
+        return result;
+    }
+
+    void FTSResultsRequest::addHeadword( FTS::FtsHeadword const & headword )
+    {
+        foundHeadwords.append( headword );
+
+        if( foundHeadwords.size() >= PublishBatchSize )
+            publishHeadwords();
+    }
+
+    void FTSResultsRequest::publishHeadwords()
+    {
+        if( foundHeadwords.isEmpty() )
+            return;
+
+        QByteArray batch = FTS::serializeHeadwords( foundHeadwords );
+        foundHeadwords.clear();
+
+        appendData( batch.constData(), batch.size(), isCancelled );
+    }
+
+    void FTSResultsRequest::resolveHeadwords( QList< uint32_t > & offsets,
+                                              QVector< QStringList > & hiliteRegExps,
+                                              QVector< double > & scores,
+                                              QString const & id )
+    {
+        QVector< QString > headwords;
+
+        if( !headwordMap || !headwordMap->getHeadwords( offsets, headwords, isCancelled ) )
+        {
+            // The headwords come in the order of the index here, so the
+            // highlights and the scores are matched to them by the articles
+            QHash< uint32_t, int > hits;
+            for( int x = 0; x < offsets.size(); x++ )
+                hits.insert( offsets.at( x ), x );
+
+            QVector< uint32_t > headwordOffsets;
+            headwords.clear();
+            dict.getHeadwordsFromOffsets( offsets, headwords, &isCancelled, &headwordOffsets );
+
+            QVector< QStringList > foundHiliteRegExps( headwords.size() );
+            QVector< double > foundScores( headwords.size() );
+
+            for( int x = 0; x < headwordOffsets.size(); x++ )
+            {
+                int hit = hits.value( headwordOffsets.at( x ), -1 );
+
+                if( hit >= 0 && hit < hiliteRegExps.size() )
+                    foundHiliteRegExps[ x ] = hiliteRegExps.at( hit );
+                if( hit >= 0 && hit < scores.size() )
+                    foundScores[ x ] = scores.at( hit );
+            }
+
+            hiliteRegExps = foundHiliteRegExps;
+            scores = foundScores;
+        }
+
+        for( int x = 0; x < headwords.size(); x++ )
+            addHeadword( FTS::FtsHeadword( headwords.at( x ), id,
+                                           x < hiliteRegExps.size() ? hiliteRegExps.at( x ) : QStringList(),
+                                           matchCase,
+                                           x < scores.size() ? scores.at( x ) : 0 ) );
+
+        offsets.clear();
+        hiliteRegExps.clear();
+        scores.clear();
+    }
+
     void FTSResultsRequest::checkArticles( QVector< uint32_t > const & offsets,
                                            QStringList const & words,
                                            QRegExp const & searchRegexp )
@@ -428,8 +1095,10 @@ namespace FtsHelpers
         QString headword, articleText;
         QList< uint32_t > offsetsForHeadwords;
         QVector< QStringList > hiliteRegExps;
+        QVector< double > scores;
 
         QString id = QString::fromUtf8( dict.getId().c_str() );
+        ArticleTextPrefetcher prefetcher( dict, offsets );
         bool needHandleBrackets;
         {
             QString name = QString::fromUtf8( dict.getDictionaryFilenames()[ 0 ].c_str() ).toLower();
@@ -470,7 +1139,7 @@ namespace FtsHelpers
                 if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
                     break;
 
-                dict.getArticleText( offsets.at( i ), headword, articleText );
+                prefetcher.get( i, headword, articleText );
                 articleText = articleText.normalized( QString::NormalizationForm_C );
 
                 if( ignoreDiacritics )
@@ -483,9 +1152,18 @@ namespace FtsHelpers
 #endif
                 {
                     if( headword.isEmpty() )
+                    {
                         offsetsForHeadwords.append( offsets.at( i ) );
+                        hiliteRegExps.append( QStringList() );
+                        scores.append( score( articleText ) );
+
+                        // With the FTS index map the lookups are cheap, so
+                        // the hits can be passed on while searching
+                        if( headwordMap && offsetsForHeadwords.size() >= PublishBatchSize )
+                            resolveHeadwords( offsetsForHeadwords, hiliteRegExps, scores, id );
+                    }
                     else
-                        foundHeadwords->append( FTS::FtsHeadword( headword, id, QStringList(), matchCase ) );
+                        addHeadword( FTS::FtsHeadword( headword, id, QStringList(), matchCase, score( articleText ) ) );
 
                     results++;
                     if( maxResults > 0 && results >= maxResults )
@@ -532,7 +1210,7 @@ namespace FtsHelpers
                         wordsList[ i ].second = true;
                 }
 
-                dict.getArticleText( offsets.at( i ), headword, articleText );
+                prefetcher.get( i, headword, articleText );
 
                 articleText = articleText.normalized( QString::NormalizationForm_C );
 
@@ -769,9 +1447,13 @@ namespace FtsHelpers
                     {
                         offsetsForHeadwords.append( offsets.at( i ) );
                         hiliteRegExps.append( hiliteReg );
+                        scores.append( score( articleText ) );
+
+                        if( headwordMap && offsetsForHeadwords.size() >= PublishBatchSize )
+                            resolveHeadwords( offsetsForHeadwords, hiliteRegExps, scores, id );
                     }
                     else
-                        foundHeadwords->append( FTS::FtsHeadword( headword, id, hiliteReg, matchCase ) );
+                        addHeadword( FTS::FtsHeadword( headword, id, hiliteReg, matchCase, score( articleText ) ) );
 
                     results++;
                     if( maxResults > 0 && results >= maxResults )
@@ -780,12 +1462,7 @@ namespace FtsHelpers
             }
         }
         if( !offsetsForHeadwords.isEmpty() )
-        {
-            QVector< QString > headwords;
-            dict.getHeadwordsFromOffsets( offsetsForHeadwords, headwords, &isCancelled );
-            for( int x = 0; x < headwords.size(); x++ )
-                foundHeadwords->append( FTS::FtsHeadword( headwords.at( x ), id, x < hiliteRegExps.size() ? hiliteRegExps.at( x ) : QStringList(), matchCase ) );
-        }
+            resolveHeadwords( offsetsForHeadwords, hiliteRegExps, scores, id );
     }
 
     void FTSResultsRequest::indexSearch( BtreeIndexing::BtreeIndex & ftsIndex,
@@ -835,6 +1512,8 @@ namespace FtsHelpers
 
             links.clear();
 
+            documentCounts[ indexWords.at( i ) ] = tmp.size();
+
             if( i == 0 )
                 setOfOffsets = tmp;
             else
@@ -1035,49 +1714,59 @@ namespace FtsHelpers
         if( indexWords.isEmpty() )
             return;
 
-        links.reserve( wordsInIndex );
-        ftsIndex.findArticleLinks( &links, 0, 0, &isCancelled );
-
         QVector< QSet< uint32_t > > allWordsLinks;
         allWordsLinks.resize( indexWords.size() );
 
-        for( int x = 0; x < links.size(); x++ )
+        if( !trigramIndexSearch( ftsIndex, chunks, indexWords, allWordsLinks ) )
         {
-            if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
-                return;
+            // Go through all the words of the index then
 
-            QString word = QString::fromUtf8( links[ x ].word.data(), links[ x ].word.size() );
-
-            if( ignoreDiacritics )
-                word = gd::toQString( Folding::applyDiacriticsOnly( gd::toWString( word ) ) );
+            links.reserve( wordsInIndex );
+            ftsIndex.findArticleLinks( &links, 0, 0, &isCancelled );
 
-            for( int i = 0; i < indexWords.size(); i++ )
+            for( int x = 0; x < links.size(); x++ )
             {
-                if( word.length() >= indexWords.at( i ).length() && word.contains( indexWords.at( i ) ) )
+                if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                    return;
+
+                QString word = QString::fromUtf8( links[ x ].word.data(), links[ x ].word.size() );
+
+                if( ignoreDiacritics )
+                    word = gd::toQString( Folding::applyDiacriticsOnly( gd::toWString( word ) ) );
+
+                for( int i = 0; i < indexWords.size(); i++ )
                 {
-                    vector< char > chunk;
-                    char * linksPtr;
+                    if( word.length() >= indexWords.at( i ).length() && word.contains( indexWords.at( i ) ) )
                     {
-                        Mutex::Lock _( dict.getFtsMutex() );
-                        linksPtr = chunks->getBlock( links[ x ].articleOffset, chunk );
-                    }
+                        vector< char > chunk;
+                        char * linksPtr;
+                        {
+                            Mutex::Lock _( dict.getFtsMutex() );
+                            linksPtr = chunks->getBlock( links[ x ].articleOffset, chunk );
+                        }
 
-                    memcpy( &size, linksPtr, sizeof(uint32_t) );
-                    linksPtr += sizeof(uint32_t);
-                    for( uint32_t y = 0; y < size; y++ )
-                    {
-                        allWordsLinks[ i ].insert( *( reinterpret_cast< uint32_t * >( linksPtr ) ) );
+                        memcpy( &size, linksPtr, sizeof(uint32_t) );
                         linksPtr += sizeof(uint32_t);
+                        for( uint32_t y = 0; y < size; y++ )
+                        {
+                            allWordsLinks[ i ].insert( *( reinterpret_cast< uint32_t * >( linksPtr ) ) );
+                            linksPtr += sizeof(uint32_t);
+                        }
+                        break;
                     }
-                    break;
                 }
             }
+
+            links.clear();
         }
 
-        links.clear();
+        if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+            return;
 
         for( int i = 0; i < allWordsLinks.size(); i++ )
         {
+            documentCounts[ indexWords.at( i ) ] = allWordsLinks.at( i ).size();
+
             if( i == 0 )
                 setOfOffsets = allWordsLinks.at( i );
             else
@@ -1107,6 +1796,106 @@ namespace FtsHelpers
         checkArticles( offsets, searchWords, regexp );
     }
 
+    void FTSResultsRequest::readArticleOffsets( sptr< ChunkedStorage::Reader > chunks,
+                                                uint32_t chunkOffset,
+                                                QSet< uint32_t > & offsets )
+    {
+        vector< char > chunk;
+        char * linksPtr;
+        {
+            Mutex::Lock _( dict.getFtsMutex() );
+            linksPtr = chunks->getBlock( chunkOffset, chunk );
+        }
+
+        uint32_t size;
+        memcpy( &size, linksPtr, sizeof(uint32_t) );
+        linksPtr += sizeof(uint32_t);
+
+        for( uint32_t y = 0; y < size; y++ )
+        {
+            uint32_t offset;
+            memcpy( &offset, linksPtr, sizeof(uint32_t) );
+            offsets.insert( offset );
+            linksPtr += sizeof(uint32_t);
+        }
+    }
+
+    sptr< NgramIndexing::NgramIndex > FTSResultsRequest::getWordsNgramIndex( BtreeIndexing::BtreeIndex & ftsIndex )
+    {
+        // It's checked against the FTS index file, so that it's never used
+        // for the words of another build of the FTS index
+        BtreeIndexing::IndexInfo info = ftsIndex.getIndexInfo();
+
+        return dict.ftsNgramIdx.get( dict.ftsIndexName() + "_NGR", dict.ftsIndexName(),
+                                     info.btreeMaxElements, info.rootOffset );
+    }
+
+    bool FTSResultsRequest::trigramIndexSearch( BtreeIndexing::BtreeIndex & ftsIndex,
+                                                sptr< ChunkedStorage::Reader > chunks,
+                                                QStringList const & indexWords,
+                                                QVector< QSet< uint32_t > > & allWordsLinks )
+    {
+        // The trigrams are the ones of the folded forms, so the words found by
+        // them still have to be checked
+        vector< vector< uint64_t > > trigrams( indexWords.size() );
+
+        for( int i = 0; i < indexWords.size(); i++ )
+            if( !NgramIndexing::NgramIndex::patternTrigrams( Folding::apply( gd::toWString( indexWords.at( i ) ) ),
+                                                             trigrams[ i ] ) )
+                return false;
+
+        sptr< NgramIndexing::NgramIndex > ngramIdx = getWordsNgramIndex( ftsIndex );
+
+        if( !ngramIdx.get() )
+            return false;
+
+        try
+        {
+            vector< uint32_t > candidates;
+
+            for( int i = 0; i < indexWords.size(); i++ )
+            {
+                ngramIdx->findCandidates( trigrams[ i ], candidates, isCancelled );
+
+                for( size_t x = 0; x < candidates.size(); x++ )
+                {
+                    if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                        return true;
+
+                    gd::wstring word = ngramIdx->getHeadword( candidates[ x ] );
+                    QString str = gd::toQString( word );
+
+                    QString matched = ignoreDiacritics ?
+                                gd::toQString( Folding::applyDiacriticsOnly( word ) ) : str;
+
+                    if( !matched.contains( indexWords.at( i ) ) )
+                        continue;
+
+                    // The lookup gives all the words folded the same way
+                    vector< BtreeIndexing::WordArticleLink > links = ftsIndex.findArticles( word );
+                    QByteArray utf8 = str.toUtf8();
+
+                    for( size_t y = 0; y < links.size(); y++ )
+                        if( links[ y ].word.size() == (size_t) utf8.size()
+                                && memcmp( links[ y ].word.data(), utf8.constData(), utf8.size() ) == 0 )
+                            readArticleOffsets( chunks, links[ y ].articleOffset, allWordsLinks[ i ] );
+                }
+            }
+        }
+        catch( std::exception & e )
+        {
+            gdWarning( "FTS: Trigram index searching failed: \"%s\", error: %s\n",
+                       dict.getName().c_str(), e.what() );
+
+            for( int i = 0; i < allWordsLinks.size(); i++ )
+                allWordsLinks[ i ].clear();
+
+            return false;
+        }
+
+        return true;
+    }
+
     void FTSResultsRequest::fullSearch( QStringList & searchWords, QRegExp & regexp )
     {
         // Whole file survey
@@ -1147,6 +1936,8 @@ namespace FtsHelpers
 
     void FTSResultsRequest::run()
     {
+        SearchRunning _;
+
         string err;
         if ( !dict.ensureInitDone(&err) )
         {
@@ -1167,6 +1958,18 @@ namespace FtsHelpers
                 return;
             }
 
+            // The hits get ranked by the words searched for. The patterns can
+            // only be ranked by the literal words taken from them.
+            if( searchMode == FTS::WholeWords || searchMode == FTS::PlainText )
+            {
+                scoringTerms = searchWords;
+                scoringCase = matchCase ? Qt::CaseSensitive : Qt::CaseInsensitive;
+            }
+            else
+                scoringTerms = indexWords;
+
+            articleCount = dict.getArticleCount();
+
             if( dict.haveFTSIndex() && !indexWords.isEmpty() )
             {
                 FtsIdxHeader ftsIdxHeader;
@@ -1182,6 +1985,12 @@ namespace FtsHelpers
 
                     wordsInIndex = ftsIdxHeader.wordCount;
 
+                    if( ftsIdxHeader.articleCount )
+                    {
+                        articleCount = ftsIdxHeader.articleCount;
+                        averageLength = (double) ftsIdxHeader.totalArticleLength / ftsIdxHeader.articleCount;
+                    }
+
                     ftsIndex.openIndex( BtreeIndexing::IndexInfo( ftsIdxHeader.indexBtreeMaxElements,
                                                                   ftsIdxHeader.indexRootOffset ),
                                         ftsIdx, dict.getFtsMutex() );
@@ -1189,6 +1998,9 @@ namespace FtsHelpers
                     chunks = sptr< ChunkedStorage::Reader >(new ChunkedStorage::Reader( ftsIdx, ftsIdxHeader.chunksOffset ));
                 }
 
+                FtsHeadwordMap map( ftsIdx, dict.getFtsMutex(), ftsIdxHeader );
+                headwordMap = &map;
+
                 if( hasCJK )
                     combinedIndexSearch( ftsIndex, chunks, indexWords, searchWords, searchRegExp );
                 else
@@ -1198,23 +2010,20 @@ namespace FtsHelpers
                     else
                         fullIndexSearch( ftsIndex, chunks, indexWords, searchWords, searchRegExp );
                 }
+
+                headwordMap = 0;
             }
             else
             {
                 fullSearch( searchWords, searchRegExp );
             }
 
-            if( foundHeadwords && foundHeadwords->size() > 0 )
-            {
-                Mutex::Lock _( dataMutex );
-                data.resize( sizeof( foundHeadwords ) );
-                memcpy( &data.front(), &foundHeadwords, sizeof( foundHeadwords ) );
-                foundHeadwords = 0;
-                hasAnyData = true;
-            }
+            publishHeadwords();
         }
         catch( std::exception &ex )
         {
+            headwordMap = 0;
+
             gdWarning( "FTS: Failed full-text search for \"%s\", reason: %s\n",
                        dict.getName().c_str(), ex.what() );
             // Results not loaded -- we don't set the hasAnyData flag then
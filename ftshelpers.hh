@@ -2,6 +2,7 @@
 #define __FTSHELPERS_HH_INCLUDED__
 
 #include <QThreadPool>
+#include <QHash>
 
 #include "btreeidx.hh"
 #include "fulltextsearch.hh"
@@ -15,7 +16,12 @@ namespace FtsHelpers
 enum
 {
     FtsSignature = 0x58535446, // FTSX on little-endian, XSTF on big-endian
-    CurrentFtsFormatVersion = 2 + BtreeIndexing::FormatVersion,
+    CurrentFtsFormatVersion = 4 + BtreeIndexing::FormatVersion,
+
+    FtsCheckpointSignature = 0x50535446, // FTSP on little-endian, PSTF on big-endian
+
+    // The progress of making an FTS index is saved after that many articles
+    FtsCheckpointArticles = 10000
 };
 
 #pragma pack(push,1)
@@ -28,6 +34,44 @@ struct FtsIdxHeader
     uint32_t indexBtreeMaxElements; // Two fields from IndexInfo
     uint32_t indexRootOffset;
     uint32_t wordCount; // Number of unique words this dictionary has
+    uint32_t headwordsOffset; // The offset to the table of FtsHeadwordEntry
+    uint32_t headwordCount; // Number of the FtsHeadwordEntry records
+    uint32_t articleCount; // Number of the articles indexed
+    uint64_t totalArticleLength; // Sum of their texts' lengths, in characters
+}
+#ifndef _MSC_VER
+__attribute__((packed))
+#endif
+;
+
+/// An entry of the map from the article offsets to the headwords of the
+/// articles. The table is sorted by the article offsets, and the headwords
+/// follow it, each stored as [uint32_t size][utf8 text].
+struct FtsHeadwordEntry
+{
+    uint32_t articleOffset;
+    uint32_t headwordOffset; // The offset to the headword in the file
+}
+#ifndef _MSC_VER
+__attribute__((packed))
+#endif
+;
+
+/// The header of the file keeping the progress of an FTS index being made,
+/// so that it can be resumed after being cancelled or the program restarted.
+/// The words of each batch of articles indexed follow it, each stored as
+/// [uint32_t size][utf8 text][uint32_t count][count article offsets],
+/// preceded by the number of the words in the batch.
+struct FtsCheckpointHeader
+{
+    uint32_t signature; // FTSP
+    uint32_t formatVersion; // The version of the FTS index being made
+    uint32_t indexBtreeMaxElements; // Two fields from IndexInfo of the main
+    uint32_t indexRootOffset;       // index, which change when it's rebuilt
+    uint32_t articleCount; // Number of the articles to index
+    uint32_t articlesDone; // Number of the articles indexed so far
+    uint32_t dataEnd; // The end of the last batch written completely
+    uint64_t lengthDone; // Sum of the indexed articles' lengths, in characters
 }
 #ifndef _MSC_VER
 __attribute__((packed))
@@ -36,6 +80,30 @@ __attribute__((packed))
 
 #pragma pack(pop)
 
+/// Resolves the article offsets found by the full-text search to their
+/// headwords, using the map stored in the FTS index. That saves walking the
+/// whole btree index of the dictionary, which getHeadwordsFromOffsets() does.
+class FtsHeadwordMap
+{
+    File::Class & ftsIdx;
+    Mutex & ftsIdxMutex;
+    uint32_t headwordsOffset, headwordCount;
+
+public:
+
+    FtsHeadwordMap( File::Class & ftsIdx_, Mutex & ftsIdxMutex_, FtsIdxHeader const & header ):
+        ftsIdx( ftsIdx_ ), ftsIdxMutex( ftsIdxMutex_ ),
+        headwordsOffset( header.headwordsOffset ), headwordCount( header.headwordCount )
+    {}
+
+    /// Appends the headwords of the articles given, in the same order. Returns
+    /// false if any of them are missing from the map, in which case nothing is
+    /// appended.
+    bool getHeadwords( QList< uint32_t > const & offsets, QVector< QString > & headwords,
+                       AtomicInt32 & isCancelled )
+    THROW_SPEC( std::exception );
+};
+
 bool ftsIndexIsOldOrBad( std::string const & indexFile,
                          BtreeIndexing::BtreeDictionary * dict );
 
@@ -50,8 +118,17 @@ void parseArticleForFts( uint32_t articleAddress, QString & articleText,
                          QMap< QString, QVector< uint32_t > > & words,
                          bool handleRoundBrackets = false );
 
+/// Makes the FTS index of the dictionary. The progress is saved every
+/// FtsCheckpointArticles articles, and an interrupted run picks up from there.
+/// While any full-text searches are running, it waits for them to end.
 void makeFTSIndex( BtreeIndexing::BtreeDictionary * dict, AtomicInt32 & isCancelled );
 
+/// Writes the map from the article offsets to the headwords at the current
+/// position of the FTS index being made, filling in the header fields for it.
+/// Throws an exception if cancelled.
+void writeHeadwordMap( File::Class & ftsIdx, BtreeIndexing::BtreeDictionary * dict,
+                       FtsIdxHeader & ftsIdxHeader, AtomicInt32 & isCancelled );
+
 bool isCJKChar( ushort ch );
 
 class FTSResultsRequest;
@@ -93,7 +170,29 @@ class FTSResultsRequest : public Dictionary::DataRequest
     AtomicInt32 isCancelled;
     QSemaphore hasExited;
 
-    QList< FTS::FtsHeadword > * foundHeadwords;
+    QList< FTS::FtsHeadword > foundHeadwords; // Not passed on yet
+
+    FtsHeadwordMap * headwordMap; // Set while searching with the FTS index
+
+    // Okapi BM25 ranking
+    QStringList scoringTerms;
+    Qt::CaseSensitivity scoringCase;
+    QHash< QString, int > documentCounts; // Articles having an index word, by the word
+    double articleCount; // Of the dictionary, or of the FTS index if used
+    double averageLength; // Of the articles in the FTS index; 0 if unknown
+
+    /// Returns the BM25 score of the article's text for scoringTerms
+    double score( QString const & articleText );
+
+    /// Queues the hit, passing the queued ones on once there are enough of them
+    void addHeadword( FTS::FtsHeadword const & );
+
+    /// Passes the queued hits on to the consumer
+    void publishHeadwords();
+
+    /// Looks up the headwords of the articles found and queues them as hits
+    void resolveHeadwords( QList< uint32_t > & offsets, QVector< QStringList > & hiliteRegExps,
+                           QVector< double > & scores, QString const & id );
 
     void checkArticles( QVector< uint32_t > const & offsets,
                         QStringList const & words,
@@ -118,6 +217,23 @@ class FTSResultsRequest : public Dictionary::DataRequest
 
     void fullSearch( QStringList & searchWords, QRegExp & regexp );
 
+    /// Returns the trigram index of the words of the FTS index, or an empty
+    /// pointer if there's no up-to-date one, which then starts being built
+    /// in the background
+    sptr< NgramIndexing::NgramIndex > getWordsNgramIndex( BtreeIndexing::BtreeIndex & ftsIndex );
+
+    /// Finds the articles having the words of the FTS index which contain
+    /// each of the index words, looking the words up by their trigrams rather
+    /// than going through all of them. Returns false if that can't be done.
+    bool trigramIndexSearch( BtreeIndexing::BtreeIndex & ftsIndex,
+                             sptr< ChunkedStorage::Reader > chunks,
+                             QStringList const & indexWords,
+                             QVector< QSet< uint32_t > > & allWordsLinks );
+
+    /// Adds the offsets of the articles from the FTS index chunk given
+    void readArticleOffsets( sptr< ChunkedStorage::Reader > chunks, uint32_t chunkOffset,
+                             QSet< uint32_t > & offsets );
+
 public:
 
     FTSResultsRequest( BtreeIndexing::BtreeDictionary & dict_, QString const & searchString_,
@@ -132,12 +248,15 @@ public:
         hasCJK( false ),
         ignoreWordsOrder( ignoreWordsOrder_ ),
         ignoreDiacritics( ignoreDiacritics_ ),
-        wordsInIndex( 0 )
+        wordsInIndex( 0 ),
+        headwordMap( 0 ),
+        scoringCase( Qt::CaseInsensitive ),
+        articleCount( 0 ),
+        averageLength( 0 )
     {
         if( ignoreDiacritics_ )
             searchString = gd::toQString( Folding::applyDiacriticsOnly( gd::toWString( searchString_ ) ) );
 
-        foundHeadwords = new QList< FTS::FtsHeadword >;
         QThreadPool::globalInstance()->start(
                     new FTSResultsRequestRunnable( *this, hasExited ), -100 );
     }
@@ -152,8 +271,6 @@ public:
     ~FTSResultsRequest()
     {
         isCancelled.ref();
-        if( foundHeadwords )
-            delete foundHeadwords;
         hasExited.acquire();
     }
 };
@@ -11,8 +11,14 @@
 #include <QThreadPool>
 #include <QIntValidator>
 #include <QMessageBox>
+#include <QFile>
+#include <QThread>
+#include <QDataStream>
+#include <QHash>
 #include <qalgorithms.h>
 
+#include <string.h>
+
 #if ( QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 ) ) && defined( Q_OS_WIN32 )
 
 #include "initializing.hh"
@@ -32,10 +38,242 @@ enum
     MaxArticlesPerDictionary = 10000
 };
 
+// The hits scoring at least that part of the best score are the well-ranked ones
+double const WellRankedScoreRatio = 0.5;
+
+QByteArray serializeHeadwords( QList< FtsHeadword > const & headwords )
+{
+    // Each batch is its size followed by the hits, so the consumer can tell
+    // whether it has got the whole of it
+    QByteArray batch( sizeof( quint32 ), 0 );
+
+    {
+        QDataStream out( &batch, QIODevice::WriteOnly | QIODevice::Append );
+
+        out << (quint32) headwords.size();
+
+        for( int x = 0; x < headwords.size(); x++ )
+        {
+            FtsHeadword const & h = headwords.at( x );
+            out << h.headword << h.dictIDs << h.foundHiliteRegExps << h.matchCase << h.score;
+        }
+    }
+
+    quint32 size = batch.size() - sizeof( quint32 );
+    memcpy( batch.data(), &size, sizeof( size ) );
+
+    return batch;
+}
+
+void deserializeHeadwords( Dictionary::DataRequest & req, qint64 & offset,
+                           QList< FtsHeadword > & headwords )
+THROW_SPEC( std::exception )
+{
+    for( ; ; )
+    {
+        qint64 available = req.dataSize();
+        quint32 size;
+
+        if( available < offset + (qint64) sizeof( size ) )
+            return;
+
+        req.getDataSlice( offset, sizeof( size ), &size );
+
+        if( available < offset + (qint64) sizeof( size ) + size )
+            return;
+
+        QByteArray batch( size, 0 );
+        req.getDataSlice( offset + sizeof( size ), size, batch.data() );
+        offset += sizeof( size ) + size;
+
+        QDataStream in( batch );
+
+        quint32 count;
+        in >> count;
+
+        for( quint32 x = 0; x < count && in.status() == QDataStream::Ok; x++ )
+        {
+            FtsHeadword h( QString(), QString(), QStringList(), false );
+            in >> h.headword >> h.dictIDs >> h.foundHiliteRegExps >> h.matchCase >> h.score;
+            headwords.append( h );
+        }
+    }
+}
+
+/// SearchCoordinator
+
+void SearchCoordinator::start( std::vector< sptr< Dictionary::Class > > const & dicts,
+                               QString const & searchString, int searchMode, bool matchCase,
+                               int distanceBetweenWords, int maxResultsPerDict,
+                               bool ignoreWordsOrder, bool ignoreDiacritics )
+{
+    scores.clear();
+    wellRankedFound = false;
+
+    // The requests run in the global thread pool, so the dictionaries are
+    // searched at once as far as there are threads for them
+
+    for( unsigned x = 0; x < dicts.size(); ++x )
+    {
+        Search search;
+        search.req = dicts[ x ]->getSearchResults( searchString, searchMode, matchCase,
+                                                   distanceBetweenWords, maxResultsPerDict,
+                                                   ignoreWordsOrder, ignoreDiacritics );
+        search.readOffset = 0;
+
+        connect( search.req.get(), SIGNAL( updated() ),
+                 this, SLOT( searchUpdated() ), Qt::QueuedConnection );
+        connect( search.req.get(), SIGNAL( finished() ),
+                 this, SLOT( searchUpdated() ), Qt::QueuedConnection );
+
+        searches.push_back( search );
+    }
+
+    searchUpdated(); // Handle any ones which have already finished
+}
+
+void SearchCoordinator::cancel()
+{
+    for( std::list< Search >::iterator it = searches.begin(); it != searches.end(); ++it )
+        if( !it->req->isFinished() )
+            it->req->cancel();
+}
+
+void SearchCoordinator::searchUpdated()
+{
+    if( searches.empty() )
+        return;
+
+    QList< FtsHeadword > headwords;
+
+    for( std::list< Search >::iterator it = searches.begin(); it != searches.end(); )
+    {
+        // Check it before reading, so that nothing appended in between is lost
+        bool isFinished = it->req->isFinished();
+
+        try
+        {
+            deserializeHeadwords( *it->req, it->readOffset, headwords );
+        }
+        catch( std::exception & e )
+        {
+            gdWarning( "getDataSlice error: %s\n", e.what() );
+        }
+
+        if( isFinished )
+        {
+            GD_DPRINTF( "one finished.\n" );
+            searches.erase( it++ );
+        }
+        else
+            ++it;
+    }
+
+    if( !headwords.isEmpty() )
+    {
+        for( int x = 0; x < headwords.size(); x++ )
+            scores.append( headwords.at( x ).score );
+
+        emit resultsAvailable( headwords );
+
+        checkRanking();
+    }
+
+    if( searches.empty() )
+        emit finished();
+}
+
+void SearchCoordinator::checkRanking()
+{
+    if( wellRankedFound || scores.size() < MaxWellRankedResults )
+        return;
+
+    double best = 0;
+    for( int x = 0; x < scores.size(); x++ )
+        best = qMax( best, scores.at( x ) );
+
+    if( best <= 0 )
+        return; // Nothing to rank the hits by
+
+    int wellRanked = 0;
+    for( int x = 0; x < scores.size(); x++ )
+        if( scores.at( x ) >= best * WellRankedScoreRatio )
+            wellRanked++;
+
+    if( wellRanked >= MaxWellRankedResults )
+    {
+        // The dictionaries are scanned in the order of their articles, so the
+        // ones left might still have better hits. That's the price of not
+        // waiting for all of them.
+        wellRankedFound = true;
+        cancel();
+    }
+}
+
+namespace
+{
+
+/// The file keeping the id of the dictionary being indexed, so that the
+/// progress saved for it gets used first if indexing is interrupted
+QString buildingFileName()
+{
+    return Config::getIndexDir() + "fts_building";
+}
+
+QString loadBuilding()
+{
+    QFile file( buildingFileName() );
+    if( !file.open( QFile::ReadOnly ) )
+        return QString();
+
+    return QString::fromUtf8( file.readAll() ).trimmed();
+}
+
+void saveBuilding( QString const & id )
+{
+    if( id.isEmpty() )
+    {
+        QFile::remove( buildingFileName() );
+        return;
+    }
+
+    QFile file( buildingFileName() );
+    if( file.open( QFile::WriteOnly | QFile::Truncate ) )
+        file.write( id.toUtf8() );
+}
+
+}
+
 void Indexing::run()
 {
+    // Indexing is a background job, so it yields the processor to everything
+    // else. The pool threads get reused, hence the priority gets restored.
+    QThread::Priority oldPriority = QThread::currentThread()->priority();
+    QThread::currentThread()->setPriority( QThread::LowestPriority );
+
     try
     {
+        QString interrupted = loadBuilding();
+
+        // Zeroth iteration - the dictionary left unfinished last time, if any
+        for( size_t x = 0; x < dictionaries.size() && !interrupted.isEmpty(); x++ )
+        {
+            if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                break;
+
+            if( QString::fromUtf8( dictionaries.at( x )->getId().c_str() ) == interrupted
+                    && dictionaries.at( x )->canFTS()
+                    && !dictionaries.at( x )->haveFTSIndex() )
+            {
+                emit sendNowIndexingName( QString::fromUtf8( dictionaries.at( x )->getName().c_str() ) );
+                dictionaries.at( x )->makeFTSIndex( isCancelled, false );
+
+                // Only an interrupted one is to be resumed first next time
+                if( dictionaries.at( x )->haveFTSIndex() || !Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                    saveBuilding( QString() );
+            }
+        }
+
         // First iteration - dictionaries with no more MaxDictionarySizeForFastSearch articles
         for( size_t x = 0; x < dictionaries.size(); x++ )
         {
@@ -46,7 +284,12 @@ void Indexing::run()
                     &&!dictionaries.at( x )->haveFTSIndex() )
             {
                 emit sendNowIndexingName( QString::fromUtf8( dictionaries.at( x )->getName().c_str() ) );
+                saveBuilding( QString::fromUtf8( dictionaries.at( x )->getId().c_str() ) );
                 dictionaries.at( x )->makeFTSIndex( isCancelled, true );
+
+                // Only an interrupted one is to be resumed first next time
+                if( dictionaries.at( x )->haveFTSIndex() || !Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                    saveBuilding( QString() );
             }
         }
 
@@ -60,7 +303,12 @@ void Indexing::run()
                     &&!dictionaries.at( x )->haveFTSIndex() )
             {
                 emit sendNowIndexingName( QString::fromUtf8( dictionaries.at( x )->getName().c_str() ) );
+                saveBuilding( QString::fromUtf8( dictionaries.at( x )->getId().c_str() ) );
                 dictionaries.at( x )->makeFTSIndex( isCancelled, false );
+
+                // Only an interrupted one is to be resumed first next time
+                if( dictionaries.at( x )->haveFTSIndex() || !Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+                    saveBuilding( QString() );
             }
         }
     }
@@ -68,6 +316,10 @@ void Indexing::run()
     {
         gdWarning( "Exception occured while full-text search: %s", ex.what() );
     }
+
+    QThread::currentThread()->setPriority( oldPriority == QThread::InheritPriority ?
+                                           QThread::NormalPriority : oldPriority );
+
     emit sendNowIndexingName( QString() );
 }
 
@@ -144,6 +396,11 @@ FullTextSearchDialog::FullTextSearchDialog( QWidget * parent,
 {
     ui.setupUi( this );
 
+    connect( &searchCoordinator, SIGNAL( resultsAvailable( QList< FTS::FtsHeadword > ) ),
+             this, SLOT( searchResultsAvailable( QList< FTS::FtsHeadword > ) ) );
+    connect( &searchCoordinator, SIGNAL( finished() ),
+             this, SLOT( searchFinished() ) );
+
     setAttribute( Qt::WA_DeleteOnClose, false );
     setWindowFlags( windowFlags() & ~Qt::WindowContextHelpButtonHint );
 
@@ -280,14 +537,11 @@ FullTextSearchDialog::~FullTextSearchDialog()
 
 void FullTextSearchDialog::stopSearch()
 {
-    if( !searchReqs.empty() )
+    if( searchCoordinator.isRunning() )
     {
-        for( std::list< sptr< Dictionary::DataRequest > >::iterator it = searchReqs.begin();
-             it != searchReqs.end(); ++it )
-            if( !(*it)->isFinished() )
-                (*it)->cancel();
+        searchCoordinator.cancel();
 
-        while( searchReqs.size() )
+        while( searchCoordinator.isRunning() )
             QApplication::processEvents();
     }
 }
@@ -418,83 +672,33 @@ void FullTextSearchDialog::accept()
 
     // Make search requests
 
-    for( unsigned x = 0; x < activeDicts.size(); ++x )
-    {
-        sptr< Dictionary::DataRequest > req = activeDicts[ x ]->getSearchResults(
-                    ui.searchLine->text(),
-                    mode,
-                    ui.matchCase->isChecked(),
-                    distanceBetweenWords,
-                    maxResultsPerDict,
-                    ignoreWordsOrder,
-                    ignoreDiacritics
-                    );
-        connect( req.get(), SIGNAL( finished() ),
-                 this, SLOT( searchReqFinished() ), Qt::QueuedConnection );
-
-        searchReqs.push_back( req );
-    }
+    searchCoordinator.start( activeDicts,
+                             ui.searchLine->text(),
+                             mode,
+                             ui.matchCase->isChecked(),
+                             distanceBetweenWords,
+                             maxResultsPerDict,
+                             ignoreWordsOrder,
+                             ignoreDiacritics );
+}
 
-    searchReqFinished(); // Handle any ones which have already finished
+void FullTextSearchDialog::searchResultsAvailable( QList< FtsHeadword > const & headwords )
+{
+    model->addResults( QModelIndex(), headwords );
+    ui.articlesFoundLabel->setText( tr( "Articles found: " )
+                                    + QString::number( results.size() ) );
 }
 
-void FullTextSearchDialog::searchReqFinished()
+void FullTextSearchDialog::searchFinished()
 {
-    while ( searchReqs.size() )
-    {
-        std::list< sptr< Dictionary::DataRequest > >::iterator it;
-        for( it = searchReqs.begin(); it != searchReqs.end(); ++it )
-        {
-            if ( (*it)->isFinished() )
-            {
-                GD_DPRINTF( "one finished.\n" );
-
-                const QString &errorString = (*it)->getErrorString();
-
-                if ( (*it)->dataSize() >= 0 || !errorString.isEmpty() )
-                {
-                    QList< FtsHeadword > * headwords;
-                    if( (unsigned)(*it)->dataSize() >= sizeof( headwords ) )
-                    {
-                        try
-                        {
-                            (*it)->getDataSlice( 0, sizeof( headwords ), &headwords );
-                            model->addResults( QModelIndex(), *headwords );
-                            delete headwords;
-                            ui.articlesFoundLabel->setText( tr( "Articles found: " )
-                                                            + QString::number( results.size() ) );
-                        }
-                        catch( std::exception & e )
-                        {
-                            gdWarning( "getDataSlice error: %s\n", e.what() );
-                        }
-                    }
-
-                }
-                break;
-            }
-        }
-        if( it != searchReqs.end() )
-        {
-            GD_DPRINTF( "erasing..\n" );
-            searchReqs.erase( it );
-            GD_DPRINTF( "erase done..\n" );
-            continue;
-        }
-        else
-            break;
-    }
-    if ( searchReqs.empty() )
-    {
-        ui.searchProgressBar->hide();
-        ui.OKButton->setEnabled( true );
-        QApplication::beep();
-    }
+    ui.searchProgressBar->hide();
+    ui.OKButton->setEnabled( true );
+    QApplication::beep();
 }
 
 void FullTextSearchDialog::reject()
 {
-    if( !searchReqs.empty() )
+    if( searchCoordinator.isRunning() )
         stopSearch();
     else
     {
@@ -641,31 +845,63 @@ QVariant HeadwordsListModel::data( QModelIndex const & index, int role ) const
 void HeadwordsListModel::addResults(const QModelIndex & parent, QList< FtsHeadword > const & hws )
 {
     Q_UNUSED( parent );
-    beginResetModel();
-
-    QList< FtsHeadword > temp;
 
+    // Every hit is put into its place in the list ordered by relevance, so
+    // that neither the list nor the view are redone for each batch. The same
+    // headwords coming from several dictionaries are found by their
+    // case-folded forms.
     for( int x = 0; x < hws.length(); x++ )
     {
-        QList< FtsHeadword >::iterator it = qBinaryFind( headwords.begin(), headwords.end(), hws.at( x ) );
-        if( it != headwords.end() )
+        FtsHeadword const & hw = hws.at( x );
+        QString key = hw.headword.toCaseFolded();
+
+        QHash< QString, QPair< QString, double > >::iterator it = sortKeys.find( key );
+        if( it == sortKeys.end() )
         {
-            it->dictIDs.push_back( hws.at( x ).dictIDs.front() );
-            for( QStringList::const_iterator itr = it->foundHiliteRegExps.constBegin();
-                 itr != it->foundHiliteRegExps.constEnd(); ++itr )
+            int row = lowerBound( hw.headword, hw.score, headwords.size() );
+
+            beginInsertRows( QModelIndex(), row, row );
+            headwords.insert( row, hw );
+            endInsertRows();
+
+            sortKeys.insert( key, qMakePair( hw.headword, hw.score ) );
+            continue;
+        }
+
+        int row = lowerBound( it.value().first, it.value().second, headwords.size() );
+        while( row < headwords.size() - 1 && headwords.at( row ).headword != it.value().first )
+            row++;
+
+        FtsHeadword & found = headwords[ row ];
+
+        found.dictIDs.push_back( hw.dictIDs.front() );
+        for( QStringList::const_iterator itr = hw.foundHiliteRegExps.constBegin();
+             itr != hw.foundHiliteRegExps.constEnd(); ++itr )
+        {
+            if( !found.foundHiliteRegExps.contains( *itr ) )
+                found.foundHiliteRegExps.append( *itr );
+        }
+
+        if( hw.score > found.score )
+        {
+            // It's more relevant now, so it moves up
+            found.score = hw.score;
+            it.value().second = hw.score;
+
+            int to = lowerBound( found.headword, found.score, row );
+            if( to != row )
             {
-                if( !it->foundHiliteRegExps.contains( *itr ) )
-                    it->foundHiliteRegExps.append( *itr );
+                beginMoveRows( QModelIndex(), row, row, QModelIndex(), to );
+                headwords.move( row, to );
+                endMoveRows();
+
+                row = to;
             }
         }
-        else
-            temp.append( hws.at( x ) );
-    }
 
-    headwords.append( temp );
-    qSort( headwords );
+        emit dataChanged( index( row ), index( row ) );
+    }
 
-    endResetModel();
     emit contentChanged();
 }
 
@@ -674,6 +910,7 @@ bool HeadwordsListModel::clear()
     beginResetModel();
 
     headwords.clear();
+    sortKeys.clear();
 
     endResetModel();
 
@@ -693,6 +930,14 @@ int HeadwordsListModel::getDictIndex( QString const & id ) const
     return -1;
 }
 
+int HeadwordsListModel::lowerBound( QString const & headword, double score, int end ) const
+{
+    FtsHeadword probe( headword, QString(), QStringList(), false, score );
+
+    return qLowerBound( headwords.constBegin(), headwords.constBegin() + end,
+                        probe, FtsHeadword::moreRelevant ) - headwords.constBegin();
+}
+
 QString FtsHeadword::trimQuotes( QString const & str ) const
 {
     QString trimmed( str );
@@ -709,6 +954,14 @@ QString FtsHeadword::trimQuotes( QString const & str ) const
     return trimmed;
 }
 
+bool FtsHeadword::moreRelevant( FtsHeadword const & first, FtsHeadword const & second )
+{
+    if( first.score != second.score )
+        return first.score > second.score;
+
+    return first < second;
+}
+
 bool FtsHeadword::operator <( FtsHeadword const & other ) const
 {
     QString first = trimQuotes( headword );
@@ -4,8 +4,13 @@
 #include <QStringList>
 #include <QRegExp>
 #include <QAbstractListModel>
+#include <QHash>
+#include <QPair>
 #include <QAction>
 #include <QRunnable>
+#include <QVector>
+
+#include <list>
 
 #include "ui_fulltextsearch.h"
 #include "instances.hh"
@@ -24,7 +29,11 @@ enum {
 
     // Maxumum match length for highlight search results
     // (QWebPage::findText() crashes on too long strings)
-    MaxMatchLengthForHighlightResults = 500
+    MaxMatchLengthForHighlightResults = 500,
+
+    // Once that many hits score well, the dictionaries still being searched
+    // are left alone
+    MaxWellRankedResults = 1000
 };
 
 enum SearchMode
@@ -41,12 +50,14 @@ struct FtsHeadword
     QStringList dictIDs;
     QStringList foundHiliteRegExps;
     bool matchCase;
+    double score; // BM25 relevance, the higher the better
 
     FtsHeadword( QString const & headword_, QString const & dictid_,
-                 QStringList hilites, bool match_case ) :
+                 QStringList hilites, bool match_case, double score_ = 0 ) :
         headword( headword_ ),
         foundHiliteRegExps( hilites ),
-        matchCase( match_case )
+        matchCase( match_case ),
+        score( score_ )
     {
         dictIDs.append( dictid_ );
     }
@@ -55,6 +66,9 @@ struct FtsHeadword
 
     bool operator <( FtsHeadword const & other ) const;
 
+    /// Orders by the score, the best first, and then alphabetically
+    static bool moreRelevant( FtsHeadword const & first, FtsHeadword const & second );
+
     bool operator ==( FtsHeadword const & other ) const
     { return headword.compare( other.headword, Qt::CaseInsensitive ) == 0; }
 
@@ -62,6 +76,65 @@ struct FtsHeadword
     { return headword.compare( other.headword, Qt::CaseInsensitive ) != 0; }
 };
 
+/// Packs the hits into a batch to be appended to a search request's data
+QByteArray serializeHeadwords( QList< FtsHeadword > const & );
+
+/// Unpacks the complete batches of hits in the request's data beginning at
+/// the offset given, and moves the offset past them
+void deserializeHeadwords( Dictionary::DataRequest &, qint64 & offset,
+                           QList< FtsHeadword > & )
+THROW_SPEC( std::exception );
+
+/// Runs the searches in all the dictionaries at once, passing their hits on
+/// as they come. Once enough of the hits score well compared to the best
+/// one, the searches still running are cancelled.
+class SearchCoordinator : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    SearchCoordinator( QObject * parent = 0 ):
+        QObject( parent ), wellRankedFound( false )
+    {}
+
+    ~SearchCoordinator()
+    { cancel(); }
+
+    void start( std::vector< sptr< Dictionary::Class > > const & dicts,
+                QString const & searchString, int searchMode, bool matchCase,
+                int distanceBetweenWords, int maxResultsPerDict,
+                bool ignoreWordsOrder, bool ignoreDiacritics );
+
+    /// Cancels the searches still running. They're only gone once finished()
+    /// has been emitted.
+    void cancel();
+
+    bool isRunning() const
+    { return !searches.empty(); }
+
+signals:
+    void resultsAvailable( QList< FTS::FtsHeadword > const & );
+    void finished();
+
+private slots:
+    void searchUpdated();
+
+private:
+
+    struct Search
+    {
+        sptr< Dictionary::DataRequest > req;
+        qint64 readOffset; // Of the first batch not read yet
+    };
+
+    std::list< Search > searches;
+    QVector< double > scores; // Of all the hits passed on
+    bool wellRankedFound;
+
+    void checkRanking();
+};
+
 class Indexing : public QObject, public QRunnable
 {
     Q_OBJECT
@@ -157,8 +230,16 @@ private:
     QList< FtsHeadword > & headwords;
     std::vector< sptr< Dictionary::Class > > const & dictionaries;
 
+    /// The headwords and the scores the rows are ordered by, by the
+    /// case-folded headwords
+    QHash< QString, QPair< QString, double > > sortKeys;
+
     int getDictIndex( QString const & id ) const;
 
+    /// Returns the first of the rows before 'end' which isn't more relevant
+    /// than the headword with the score given
+    int lowerBound( QString const & headword, double score, int end ) const;
+
 signals:
     void contentChanged();
 };
@@ -175,7 +256,7 @@ class FullTextSearchDialog : public QDialog
     bool ignoreWordsOrder;
     bool ignoreDiacritics;
 
-    std::list< sptr< Dictionary::DataRequest > > searchReqs;
+    SearchCoordinator searchCoordinator;
 
     FtsIndexing & ftsIdx;
 
@@ -216,7 +297,8 @@ private slots:
     void setLimitsUsing();
     void ignoreWordsOrderClicked();
     void ignoreDiacriticsClicked();
-    void searchReqFinished();
+    void searchResultsAvailable( QList< FTS::FtsHeadword > const & );
+    void searchFinished();
     void reject();
     void itemClicked( QModelIndex const & idx );
     void updateDictionaries();
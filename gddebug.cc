@@ -2,6 +2,14 @@
  * Part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
 
 #include "gddebug.hh"
+#include "mutex.hh"
+#include "qt4x5.hh"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <deque>
+#include <map>
 
 #ifdef GD_LOG_MSGOUT
 #include <QTextCodec>
@@ -60,3 +68,306 @@ void gdDebug(const char *msg, ...)
     va_end(ap);
 }
 #endif
+
+namespace GdTrace {
+
+namespace {
+
+/// A traced request. Times are in microseconds since tracing was first
+/// turned on, -1 meaning the event hasn't happened.
+struct Record
+{
+    int id;
+    std::string dictId, dictName;
+    char const * phase;
+    qint64 start, firstUpdate, finish;
+    bool cancelled;
+};
+
+/// The number of the finished requests to keep. The older ones get dropped.
+size_t const MaxFinishedRecords = 200000;
+
+AtomicInt32 enabled;
+Mutex traceMutex;
+QElapsedTimer clock;
+int lastId = 0;
+std::map< int, Record > pendingRecords;
+std::deque< Record > finishedRecords;
+
+qint64 now()
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+/// Moves the record to the finished ones. Called with traceMutex locked.
+void finishRecord( std::map< int, Record >::iterator i, bool cancelled )
+{
+    i->second.finish = now();
+    i->second.cancelled = i->second.cancelled || cancelled;
+
+    finishedRecords.push_back( i->second );
+    pendingRecords.erase( i );
+
+    if( finishedRecords.size() > MaxFinishedRecords )
+        finishedRecords.pop_front();
+}
+
+QByteArray jsonString( std::string const & str )
+{
+    QByteArray result = "\"";
+
+    for( size_t x = 0; x < str.size(); ++x )
+    {
+        unsigned char c = str[ x ];
+
+        if( c == '"' || c == '\\' )
+            result += '\\';
+
+        if( c < 0x20 )
+            result += "\\u00" + QByteArray::number( c, 16 ).rightJustified( 2, '0' );
+        else
+            result += char( c );
+    }
+
+    return result + '"';
+}
+
+/// Writes the begin and end events of the request. The async events are
+/// used, as the requests to a dictionary often overlap.
+void writeRecord( QByteArray & out, Record const & r, int lane, qint64 currentTime )
+{
+    QByteArray common = ",\"cat\":\"request\",\"id\":" + QByteArray::number( r.id )
+                        + ",\"pid\":1,\"tid\":" + QByteArray::number( lane );
+
+    out += ",\n{\"name\":" + jsonString( r.phase ) + ",\"ph\":\"b\",\"ts\":"
+           + QByteArray::number( r.start ) + common
+           + ",\"args\":{\"dictionary\":" + jsonString( r.dictName ) + "}}";
+
+    if( r.firstUpdate >= 0 )
+        out += ",\n{\"name\":\"first update\",\"ph\":\"n\",\"ts\":"
+               + QByteArray::number( r.firstUpdate ) + common + "}";
+
+    out += ",\n{\"name\":" + jsonString( r.phase ) + ",\"ph\":\"e\",\"ts\":"
+           + QByteArray::number( r.finish >= 0 ? r.finish : currentTime ) + common
+           + ",\"args\":{\"cancelled\":" + ( r.cancelled ? "true" : "false" )
+           + ",\"unfinished\":" + ( r.finish < 0 ? "true" : "false" ) + "}}";
+}
+
+bool slowerInTotal( Latency const & a, Latency const & b )
+{
+    return a.totalMs > b.totalMs;
+}
+
+}
+
+void setEnabled( bool enable )
+{
+    Mutex::Lock _( traceMutex );
+
+    if( enable && !clock.isValid() )
+        clock.start();
+
+    enabled.storeRelease( enable ? 1 : 0 );
+}
+
+bool isEnabled()
+{
+    return Qt4x5::AtomicInt::loadAcquire( enabled );
+}
+
+int begin( std::string const & dictId, std::string const & dictName, char const * phase )
+{
+    if( !Qt4x5::AtomicInt::loadAcquire( enabled ) )
+        return 0;
+
+    Mutex::Lock _( traceMutex );
+
+    if( ++lastId <= 0 )
+        lastId = 1;
+
+    Record & r = pendingRecords[ lastId ];
+    r.id = lastId;
+    r.dictId = dictId;
+    r.dictName = dictName;
+    r.phase = phase;
+    r.start = now();
+    r.firstUpdate = -1;
+    r.finish = -1;
+    r.cancelled = false;
+
+    return lastId;
+}
+
+void event( int id, Event e )
+{
+    if( !id )
+        return;
+
+    Mutex::Lock _( traceMutex );
+
+    std::map< int, Record >::iterator i = pendingRecords.find( id );
+    if( i == pendingRecords.end() )
+        return;
+
+    switch( e )
+    {
+        case FirstUpdate:
+            if( i->second.firstUpdate < 0 )
+                i->second.firstUpdate = now();
+            break;
+        case Cancelled:
+            i->second.cancelled = true;
+            break;
+        case Finished:
+            finishRecord( i, false );
+            break;
+    }
+}
+
+void end( int id )
+{
+    if( !id )
+        return;
+
+    Mutex::Lock _( traceMutex );
+
+    std::map< int, Record >::iterator i = pendingRecords.find( id );
+    if( i != pendingRecords.end() )
+        finishRecord( i, true );
+}
+
+void clear()
+{
+    Mutex::Lock _( traceMutex );
+
+    pendingRecords.clear();
+    finishedRecords.clear();
+}
+
+bool dump( QString const & fileName )
+{
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                     "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GoldenDict\"}},\n"
+                     "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Lookups\"}}";
+
+    {
+        Mutex::Lock _( traceMutex );
+
+        qint64 currentTime = clock.isValid() ? now() : 0;
+
+        // Every dictionary gets a track of its own, the ones without any
+        // dictionary go to the first one
+        std::map< std::string, int > lanes;
+        lanes[ std::string() ] = 0;
+
+        std::vector< Record const * > records;
+        records.reserve( finishedRecords.size() + pendingRecords.size() );
+
+        for( std::deque< Record >::const_iterator i = finishedRecords.begin(); i != finishedRecords.end(); ++i )
+            records.push_back( &*i );
+        for( std::map< int, Record >::const_iterator i = pendingRecords.begin(); i != pendingRecords.end(); ++i )
+            records.push_back( &i->second );
+
+        for( size_t x = 0; x < records.size(); ++x )
+        {
+            Record const & r = *records[ x ];
+
+            std::map< std::string, int >::iterator lane = lanes.find( r.dictId );
+            if( lane == lanes.end() )
+            {
+                lane = lanes.insert( std::make_pair( r.dictId, (int) lanes.size() ) ).first;
+
+                out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                       + QByteArray::number( lane->second ) + ",\"args\":{\"name\":"
+                       + jsonString( r.dictName ) + "}}";
+            }
+
+            writeRecord( out, r, lane->second, currentTime );
+        }
+    }
+
+    out += "\n]}\n";
+
+    QFile file( fileName );
+    if( !file.open( QFile::WriteOnly | QFile::Truncate ) )
+        return false;
+
+    return file.write( out ) == out.size();
+}
+
+std::vector< Latency > latencies()
+{
+    typedef std::pair< std::string, std::string > Key; // Dictionary id and phase
+    std::map< Key, Latency > sums;
+    std::map< Key, std::vector< qint64 > > durations;
+
+    {
+        Mutex::Lock _( traceMutex );
+
+        for( std::deque< Record >::const_iterator i = finishedRecords.begin(); i != finishedRecords.end(); ++i )
+        {
+            Key key( i->dictId, i->phase );
+            Latency & l = sums[ key ];
+
+            if( !l.phase )
+            {
+                l.dictId = i->dictId;
+                l.dictName = i->dictName;
+                l.phase = i->phase;
+            }
+
+            if( i->cancelled )
+                ++l.cancelled;
+            else
+            {
+                ++l.finished;
+                durations[ key ].push_back( i->finish - i->start );
+            }
+        }
+
+        for( std::map< int, Record >::const_iterator i = pendingRecords.begin(); i != pendingRecords.end(); ++i )
+        {
+            Latency & l = sums[ Key( i->second.dictId, i->second.phase ) ];
+
+            if( !l.phase )
+            {
+                l.dictId = i->second.dictId;
+                l.dictName = i->second.dictName;
+                l.phase = i->second.phase;
+            }
+
+            ++l.pending;
+        }
+    }
+
+    std::vector< Latency > result;
+    result.reserve( sums.size() );
+
+    for( std::map< Key, Latency >::iterator i = sums.begin(); i != sums.end(); ++i )
+    {
+        std::vector< qint64 > & d = durations[ i->first ];
+        Latency & l = i->second;
+
+        if( !d.empty() )
+        {
+            std::sort( d.begin(), d.end() );
+
+            qint64 total = 0;
+            for( size_t x = 0; x < d.size(); ++x )
+                total += d[ x ];
+
+            l.totalMs = total / 1000.0;
+            l.averageMs = l.totalMs / d.size();
+            l.p95Ms = d[ ( d.size() * 95 + 99 ) / 100 - 1 ] / 1000.0;
+            l.maxMs = d.back() / 1000.0;
+        }
+
+        result.push_back( l );
+    }
+
+    std::sort( result.begin(), result.end(), slowerInTotal );
+
+    return result;
+}
+
+}
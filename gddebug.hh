@@ -2,6 +2,9 @@
 #define __GDDEBUG_HH_INCLUDED__
 
 #include <QFile>
+#include <QString>
+#include <string>
+#include <vector>
 
 #ifdef NO_CONSOLE
 #define GD_DPRINTF(...) do {} while( 0 )
@@ -29,4 +32,60 @@ extern QFile * logFilePtr;
 #define gdDebug(...) do {} while( 0 )
 #endif
 
+/// Tracing of the dictionary requests. When it is on, the requests tagged
+/// with Dictionary::Request::setTraceId() record when they were created,
+/// first updated, cancelled and finished. The records can be dumped in the
+/// Chrome trace event format, which chrome://tracing and Perfetto open, and
+/// summed up per dictionary. Tracing is off by default, and then costs a
+/// single check per request.
+namespace GdTrace {
+
+enum Event
+{
+    FirstUpdate,
+    Cancelled,
+    Finished
+};
+
+void setEnabled( bool );
+bool isEnabled();
+
+/// Starts tracing a request about to be made. The phase should be a string
+/// literal. Returns the id to pass to Dictionary::Request::setTraceId(), or
+/// 0 if tracing is off. If no request gets made after all, pass it to end().
+int begin( std::string const & dictId, std::string const & dictName, char const * phase );
+
+/// Records the event of the traced request
+void event( int id, Event );
+
+/// Called when the request is destroyed. If it hasn't finished, it is
+/// considered cancelled.
+void end( int id );
+
+/// Forgets all the requests recorded so far
+void clear();
+
+/// Writes all the requests recorded, in the Chrome trace event format.
+/// Returns false if the file couldn't be written.
+bool dump( QString const & fileName );
+
+/// Latencies of the requests made to a dictionary in one phase
+struct Latency
+{
+    std::string dictId, dictName;
+    char const * phase;
+    unsigned finished, cancelled, pending;
+    double averageMs, p95Ms, maxMs, totalMs;
+
+    Latency(): phase( 0 ), finished( 0 ), cancelled( 0 ), pending( 0 ),
+        averageMs( 0 ), p95Ms( 0 ), maxMs( 0 ), totalMs( 0 )
+    {}
+};
+
+/// Sums up the requests recorded, per dictionary and phase, the slowest
+/// ones in total going first
+std::vector< Latency > latencies();
+
+}
+
 #endif // __GDDEBUG_HH_INCLUDED__
@@ -525,6 +525,8 @@ GlsDictionary::GlsDictionary( string const & id,
     dz( 0 ),
     chunks( idx, idxHeader.chunksOffset )
 {
+    chunks.setStats( statistics.get() );
+
     // Open the .gls file
 
     DZ_ERRORS error;
@@ -534,6 +536,8 @@ GlsDictionary::GlsDictionary( string const & id,
         throw exDictzipError( string( dz_error_str( error ) )
                               + "(" + getDictionaryFilenames()[ 0 ] + ")" );
 
+    statistics->attach( dz );
+
     // Read the dictionary name
 
     idx.seek( sizeof( idxHeader ) );
@@ -243,6 +243,7 @@ HEADERS += folding.hh \
     mainwindow.hh \
     sptr.hh \
     dictionary.hh \
+    dictstats.hh \
     ex.hh \
     config.hh \
     sources.hh \
@@ -254,6 +255,7 @@ HEADERS += folding.hh \
     article_netmgr.hh \
     dictzip.h \
     btreeidx.hh \
+    ngramidx.hh \
     stardict.hh \
     chunkedstorage.hh \
     xdxf2html.hh \
@@ -268,6 +270,9 @@ HEADERS += folding.hh \
     groups_widgets.hh \
     instances.hh \
     article_maker.hh \
+    articlecache.hh \
+    articleprefetcher.hh \
+    resourcecache.hh \
     scanpopup.hh \
     articleview.hh \
     audioplayerinterface.hh \
@@ -296,6 +301,8 @@ HEADERS += folding.hh \
     langcoder.hh \
     editdictionaries.hh \
     loaddictionaries.hh \
+    loadmanifest.hh \
+    lazydictionary.hh \
     transliteration.hh \
     romaji.hh \
     belarusiantranslit.hh \
@@ -348,12 +355,15 @@ HEADERS += folding.hh \
     gestures.hh \
     tiff.hh \
     dictheadwords.hh \
+    requesttrace.hh \
     fulltextsearch.hh \
     ftshelpers.hh \
     dictserver.hh \
     helpwindow.hh \
     slob.hh \
     ripemd.hh \
+    resourceindex.hh \
+    htmlrewriter.hh \
     gls.hh \
     splitfile.hh \
     favoritespanewidget.hh \
@@ -379,6 +389,7 @@ FORMS += groups.ui \
 SOURCES += folding.cc \
     main.cc \
     dictionary.cc \
+    dictstats.cc \
     config.cc \
     sources.cc \
     mainwindow.cc \
@@ -390,6 +401,7 @@ SOURCES += folding.cc \
     article_netmgr.cc \
     dictzip.c \
     btreeidx.cc \
+    ngramidx.cc \
     stardict.cc \
     chunkedstorage.cc \
     xdxf2html.cc \
@@ -404,6 +416,9 @@ SOURCES += folding.cc \
     groups_widgets.cc \
     instances.cc \
     article_maker.cc \
+    articlecache.cc \
+    articleprefetcher.cc \
+    resourcecache.cc \
     scanpopup.cc \
     articleview.cc \
     audioplayerfactory.cc \
@@ -429,6 +444,8 @@ SOURCES += folding.cc \
     langcoder.cc \
     editdictionaries.cc \
     loaddictionaries.cc \
+    loadmanifest.cc \
+    lazydictionary.cc \
     transliteration.cc \
     romaji.cc \
     belarusiantranslit.cc \
@@ -479,12 +496,15 @@ SOURCES += folding.cc \
     gestures.cc \
     tiff.cc \
     dictheadwords.cc \
+    requesttrace.cc \
     fulltextsearch.cc \
     ftshelpers.cc \
     dictserver.cc \
     helpwindow.cc \
     slob.cc \
     ripemd.cc \
+    resourceindex.cc \
+    htmlrewriter.cc \
     gls.cc \
     splitfile.cc \
     favoritespanewidget.cc \
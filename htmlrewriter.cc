@@ -0,0 +1,385 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "htmlrewriter.hh"
+
+#include <string.h>
+
+namespace HtmlRewriter {
+
+namespace {
+
+inline bool isSpace( QChar ch )
+{
+    ushort c = ch.unicode();
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+inline bool isNameChar( QChar ch )
+{
+    ushort c = ch.unicode();
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' )
+            || c == '-' || c == '_' || c == ':';
+}
+
+inline bool isLetter( QChar ch )
+{
+    ushort c = ch.unicode();
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' );
+}
+
+inline void appendRange( QString & out, QChar const * str, int size )
+{
+    if ( size > 0 )
+        out.append( QString::fromRawData( str, size ) );
+}
+
+/// Compares the given range to a lower-case latin1 string case-insensitively
+bool equalsLower( QChar const * str, int size, char const * lower )
+{
+    int len = strlen( lower );
+    if ( size != len )
+        return false;
+
+    for ( int x = 0; x < len; ++x )
+    {
+        ushort c = str[ x ].unicode();
+        if ( c >= 'A' && c <= 'Z' )
+            c += 'a' - 'A';
+        if ( c != ( uchar )lower[ x ] )
+            return false;
+    }
+
+    return true;
+}
+
+}
+
+void Tag::reset( QChar const * source_, int begin_ )
+{
+    source = source_;
+    begin = end = begin_;
+    tagName.clear();
+    attributes.clear();
+    prefix.clear();
+    modified = false;
+}
+
+int Tag::findAttribute( char const * name ) const
+{
+    for ( int x = 0; x < attributes.size(); ++x )
+    {
+        Attribute const & attr = attributes[ x ];
+        if ( !attr.removed && equalsLower( source + attr.nameBegin, attr.nameEnd - attr.nameBegin, name ) )
+            return x;
+    }
+
+    return -1;
+}
+
+QString Tag::attributeName( int index ) const
+{
+    Attribute const & attr = attributes[ index ];
+    return QString( source + attr.nameBegin, attr.nameEnd - attr.nameBegin ).toLower();
+}
+
+QString Tag::attributeValue( int index ) const
+{
+    Attribute const & attr = attributes[ index ];
+    if ( attr.modified )
+        return attr.newValue;
+    return QString( source + attr.valueBegin, attr.valueEnd - attr.valueBegin );
+}
+
+QString Tag::attributeValue( char const * name ) const
+{
+    int index = findAttribute( name );
+    return index < 0 ? QString() : attributeValue( index );
+}
+
+void Tag::setAttributeValue( int index, QString const & value )
+{
+    Attribute & attr = attributes[ index ];
+    attr.newValue = value;
+    attr.modified = true;
+    modified = true;
+}
+
+void Tag::removeAttribute( int index )
+{
+    attributes[ index ].removed = true;
+    modified = true;
+}
+
+void Tag::prepend( QString const & text )
+{
+    prefix += text;
+}
+
+void Tag::writeTo( QString & out ) const
+{
+    out += prefix;
+
+    if ( !modified )
+    {
+        appendRange( out, source + begin, end - begin );
+        return;
+    }
+
+    int pos = begin;
+
+    for ( int x = 0; x < attributes.size(); ++x )
+    {
+        Attribute const & attr = attributes[ x ];
+
+        if ( attr.removed )
+        {
+            appendRange( out, source + pos, attr.nameBegin - pos );
+            pos = attr.rawValueEnd;
+        }
+        else
+        if ( attr.modified )
+        {
+            QChar quote = attr.quote.isNull() ? QChar( '"' ) : attr.quote;
+
+            if ( attr.hasValue )
+            {
+                appendRange( out, source + pos, attr.rawValueBegin - pos );
+                pos = attr.rawValueEnd;
+            }
+            else
+            {
+                appendRange( out, source + pos, attr.nameEnd - pos );
+                out += QChar( '=' );
+                pos = attr.nameEnd;
+            }
+
+            out += quote;
+            out += attr.newValue;
+            out += quote;
+        }
+    }
+
+    appendRange( out, source + pos, end - pos );
+}
+
+QString rewrite( QString const & html, Handler & handler )
+{
+    QChar const * data = html.constData();
+    int const size = html.size();
+
+    QString result;
+    result.reserve( size + size / 8 );
+
+    // Everything before this position is already in the result
+    int copied = 0;
+    int pos = 0;
+
+    Tag tag;
+
+    for ( ; ; )
+    {
+        pos = html.indexOf( QChar( '<' ), pos );
+        if ( pos < 0 )
+            break;
+
+        int tagBegin = pos;
+        int p = pos + 1;
+
+        // Skip comments altogether
+        if ( size - p >= 3 && data[ p ] == '!' && data[ p + 1 ] == '-' && data[ p + 2 ] == '-' )
+        {
+            int commentEnd = html.indexOf( QLatin1String( "-->" ), p + 3 );
+            if ( commentEnd < 0 )
+                break;
+            pos = commentEnd + 3;
+            continue;
+        }
+
+        while ( p < size && isSpace( data[ p ] ) )
+            ++p;
+
+        bool isEndTag = false;
+        if ( p < size && data[ p ] == '/' )
+        {
+            isEndTag = true;
+            ++p;
+            while ( p < size && isSpace( data[ p ] ) )
+                ++p;
+        }
+
+        int nameBegin = p;
+        while ( p < size && isNameChar( data[ p ] ) )
+            ++p;
+
+        if ( p == nameBegin || !isLetter( data[ nameBegin ] ) )
+        {
+            // Not a tag, just a stray '<'
+            pos = tagBegin + 1;
+            continue;
+        }
+
+        tag.reset( data, tagBegin );
+        tag.tagName = QString( data + nameBegin, p - nameBegin ).toLower();
+
+        // Parse the attributes
+        bool closed = false;
+        while ( p < size )
+        {
+            QChar ch = data[ p ];
+
+            if ( ch == '>' )
+            {
+                ++p;
+                closed = true;
+                break;
+            }
+
+            if ( isSpace( ch ) || ch == '/' )
+            {
+                ++p;
+                continue;
+            }
+
+            Tag::Attribute attr;
+            attr.nameBegin = p;
+            while ( p < size && !isSpace( data[ p ] ) && data[ p ] != '='
+                    && data[ p ] != '>' && data[ p ] != '/' )
+                ++p;
+            if ( p == attr.nameBegin )
+                ++p; // Stray '=' -- make sure we always advance
+            attr.nameEnd = p;
+
+            int q = p;
+            while ( q < size && isSpace( data[ q ] ) )
+                ++q;
+
+            attr.hasValue = q < size && data[ q ] == '=';
+            attr.modified = attr.removed = false;
+
+            if ( attr.hasValue )
+            {
+                ++q;
+                while ( q < size && isSpace( data[ q ] ) )
+                    ++q;
+
+                attr.rawValueBegin = q;
+
+                if ( q < size && ( data[ q ] == '"' || data[ q ] == '\'' ) )
+                {
+                    attr.quote = data[ q ];
+                    attr.valueBegin = q + 1;
+                    int valueEnd = html.indexOf( attr.quote, q + 1 );
+                    if ( valueEnd < 0 )
+                        valueEnd = size;
+                    attr.valueEnd = valueEnd;
+                    p = valueEnd < size ? valueEnd + 1 : size;
+                }
+                else
+                {
+                    attr.valueBegin = q;
+                    while ( q < size && !isSpace( data[ q ] ) && data[ q ] != '>' )
+                        ++q;
+                    attr.valueEnd = q;
+                    p = q;
+                }
+
+                attr.rawValueEnd = p;
+            }
+            else
+            {
+                attr.valueBegin = attr.valueEnd = attr.nameEnd;
+                attr.rawValueBegin = attr.rawValueEnd = attr.nameEnd;
+            }
+
+            tag.attributes.push_back( attr );
+        }
+
+        if ( !closed )
+            break; // Unterminated tag, leave the rest as it is
+
+        tag.end = p;
+        pos = p;
+
+        if ( isEndTag )
+        {
+            handler.handleEndTag( tag.tagName );
+            continue;
+        }
+
+        handler.handleStartTag( tag );
+
+        if ( tag.modified || !tag.prefix.isEmpty() )
+        {
+            appendRange( result, data + copied, tagBegin - copied );
+            tag.writeTo( result );
+            copied = tag.end;
+        }
+
+        // Raw text elements -- their contents aren't html
+        if ( tag.tagName == QLatin1String( "script" ) || tag.tagName == QLatin1String( "style" ) )
+        {
+            int rawEnd = html.indexOf( QLatin1String( "</" ) + tag.tagName, pos, Qt::CaseInsensitive );
+            if ( rawEnd < 0 )
+                break;
+            pos = rawEnd;
+        }
+    }
+
+    if ( copied == 0 )
+        return html;
+
+    appendRange( result, data + copied, size - copied );
+    return result;
+}
+
+bool hasScheme( QString const & url, char const * const schemes[] )
+{
+    int start = 0;
+    while ( start < url.size() && isSpace( url[ start ] ) )
+        ++start;
+
+    for ( int x = 0; schemes[ x ]; ++x )
+    {
+        int len = strlen( schemes[ x ] );
+        if ( url.size() - start >= len
+             && equalsLower( url.constData() + start, len, schemes[ x ] ) )
+            return true;
+    }
+
+    return false;
+}
+
+bool hasAnyScheme( QString const & url )
+{
+    int n = url.indexOf( QLatin1String( "://" ) );
+    if ( n <= 0 )
+        return false;
+
+    for ( int x = 0; x < n; ++x )
+    {
+        QChar ch = url[ x ];
+        if ( !ch.isLetterOrNumber() && ch != '_' )
+            return false;
+    }
+
+    return true;
+}
+
+QString linkedPageName( QString const & url )
+{
+    QString name = url.mid( url.lastIndexOf( '/' ) + 1 );
+
+    static char const * const extensions[] = { ".html", ".htm", ".shtml", ".shtm", 0 };
+    for ( int x = 0; extensions[ x ]; ++x )
+    {
+        if ( name.endsWith( QLatin1String( extensions[ x ] ), Qt::CaseInsensitive ) )
+        {
+            name.chop( strlen( extensions[ x ] ) );
+            break;
+        }
+    }
+
+    return name;
+}
+
+}
@@ -0,0 +1,122 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __HTMLREWRITER_HH_INCLUDED__
+#define __HTMLREWRITER_HH_INCLUDED__
+
+#include <QString>
+#include <QVector>
+
+/// A single-pass rewriter for the html coming from the dictionaries. The
+/// html is scanned once, each tag is handed over to a Handler which may
+/// change its attributes, and the result is assembled on the fly. The parts
+/// which weren't touched are copied over as is, so the rewriting doesn't
+/// depend on the number of patterns to apply. Used by the formats which
+/// carry html articles (mdx, slob, zim) to fix up their links.
+namespace HtmlRewriter {
+
+class Handler;
+
+/// Passes each tag of the html to the handler and returns the html with all
+/// the changes made by the handler applied. Comments, as well as the
+/// contents of the <script> and <style> elements, are copied as is.
+QString rewrite( QString const & html, Handler & handler );
+
+/// A start tag, as seen by the Handler. Attribute values are raw, i.e. no
+/// entities get decoded.
+class Tag
+{
+    friend QString rewrite( QString const &, Handler & );
+
+    struct Attribute
+    {
+        int nameBegin, nameEnd;
+        // The value itself, and the value along with its quotes
+        int valueBegin, valueEnd;
+        int rawValueBegin, rawValueEnd;
+        bool hasValue;
+        QChar quote;
+
+        bool modified, removed;
+        QString newValue;
+    };
+
+    QChar const * source;
+    int begin, end;
+    QString tagName;
+    QVector< Attribute > attributes;
+    QString prefix;
+    bool modified;
+
+public:
+
+    Tag(): source( 0 ), begin( 0 ), end( 0 ), modified( false )
+    {}
+
+    /// The tag name, in lower case.
+    QString const & name() const
+    { return tagName; }
+
+    /// Returns the index of the attribute with the given name (matched
+    /// case-insensitively), or -1 if there's no such attribute.
+    int findAttribute( char const * name ) const;
+
+    int attributeCount() const
+    { return attributes.size(); }
+
+    /// The attribute name, in lower case.
+    QString attributeName( int index ) const;
+
+    QString attributeValue( int index ) const;
+
+    /// Shortcut for finding the attribute and getting its value. Returns an
+    /// empty string when there's no such attribute.
+    QString attributeValue( char const * name ) const;
+
+    /// Replaces the value of the attribute. The value is written out raw, in
+    /// the original quotes (double quotes for the unquoted values).
+    void setAttributeValue( int index, QString const & value );
+
+    void removeAttribute( int index );
+
+    /// Adds some text to be put right before the tag.
+    void prepend( QString const & text );
+
+    bool isModified() const
+    { return modified; }
+
+private:
+
+    void reset( QChar const * source_, int begin_ );
+    void writeTo( QString & out ) const;
+};
+
+class Handler
+{
+public:
+
+    virtual ~Handler()
+    {}
+
+    /// Called for each start tag found.
+    virtual void handleStartTag( Tag & tag ) = 0;
+
+    /// Called for each end tag found, with its name in lower case.
+    virtual void handleEndTag( QString const & name )
+    { Q_UNUSED( name ); }
+};
+
+/// Returns true if the url starts with any of the given schemes (e.g.
+/// "http://", "data:"), matched case-insensitively. Leading whitespace is
+/// ignored. The list is terminated by 0.
+bool hasScheme( QString const & url, char const * const schemes[] );
+
+/// Returns true if the url starts with any "scheme://" prefix.
+bool hasAnyScheme( QString const & url );
+
+/// Turns the url of a linked page into the word to look up: drops the
+/// directories and the .htm/.html/.shtml extension, if there's any.
+QString linkedPageName( QString const & url );
+
+}
+
+#endif
@@ -0,0 +1,456 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+/// A benchmark of the index building. It generates synthetic dictionaries
+/// of every supported format, then indexes each of them from scratch,
+/// reporting the time, the size of the index and the memory used. Every
+/// format is indexed by a child process of its own, so the peak memory
+/// figures don't mix. The "check" mode checks the indexed headwords instead,
+/// outside of the measured runs. Build it with indexbench.pro.
+
+#include <QApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QProcess>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "config.hh"
+#include "dictionary.hh"
+#include "fsencoding.hh"
+#include "syntheticdict.hh"
+#include "dsl.hh"
+#include "stardict.hh"
+#include "xdxf.hh"
+#include "mdx.hh"
+#include "dictdfiles.hh"
+
+using std::vector;
+using std::string;
+
+namespace {
+
+/// Returns the peak resident set size of the process, in kilobytes
+long peakRss()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS pmc;
+    if( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+        return long( pmc.PeakWorkingSetSize / 1024 );
+    return 0;
+#else
+    struct rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+        return 0;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024; // Bytes there
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+/// Returns the user and system time used by the process, in milliseconds
+qint64 cpuTime()
+{
+#ifdef Q_OS_WIN
+    FILETIME creation, exit, kernel, user;
+    if( !GetProcessTimes( GetCurrentProcess(), &creation, &exit, &kernel, &user ) )
+        return 0;
+
+    // In 100 ns units
+    quint64 k = ( quint64( kernel.dwHighDateTime ) << 32 ) | kernel.dwLowDateTime;
+    quint64 u = ( quint64( user.dwHighDateTime ) << 32 ) | user.dwLowDateTime;
+    return qint64( ( k + u ) / 10000 );
+#else
+    struct rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+        return 0;
+
+    return qint64( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * 1000
+           + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1000;
+#endif
+}
+
+class SilentInitializing: public Dictionary::Initializing
+{
+public:
+    virtual void indexingDictionary( string const & ) throw()
+    {}
+};
+
+/// Removes everything from the directory, creating it if necessary
+bool makeEmptyDir( QString const & path )
+{
+    QDir dir( path );
+
+    if( !dir.exists() )
+        return QDir().mkpath( path );
+
+    QFileInfoList files = dir.entryInfoList( QDir::Files | QDir::Hidden );
+    for( int x = 0; x < files.size(); ++x )
+        if( !dir.remove( files[ x ].fileName() ) )
+            return false;
+
+    return true;
+}
+
+qint64 directorySize( QString const & path )
+{
+    qint64 size = 0;
+
+    QFileInfoList files = QDir( path ).entryInfoList( QDir::Files | QDir::Hidden );
+    for( int x = 0; x < files.size(); ++x )
+        size += files[ x ].size();
+
+    return size;
+}
+
+QString indexDirFor( SyntheticDict::Format format, QString const & dataDir )
+{
+    return dataDir + "/index-" + SyntheticDict::formatName( format );
+}
+
+/// Makes the dictionaries of the given format found in the data directory,
+/// indexing them into the index directory unless they're indexed already.
+/// Returns false, having told why, if that fails.
+bool makeDictionaries( SyntheticDict::Format format, QString const & dataDir,
+                       vector< sptr< Dictionary::Class > > & dictionaries )
+{
+    QString sourceDir = dataDir + "/" + SyntheticDict::formatName( format );
+
+    vector< string > files;
+    QFileInfoList sources = QDir( sourceDir ).entryInfoList( QDir::Files, QDir::Name );
+    for( int x = 0; x < sources.size(); ++x )
+        files.push_back( FsEncoding::encode( QDir::toNativeSeparators( sources[ x ].absoluteFilePath() ) ) );
+
+    if( files.empty() )
+    {
+        fprintf( stderr, "No dictionary files in %s\n", sourceDir.toLocal8Bit().data() );
+        return false;
+    }
+
+    QString indexDir = indexDirFor( format, dataDir );
+
+    if( !QDir().mkpath( indexDir ) )
+    {
+        fprintf( stderr, "Can't make the index directory %s\n", indexDir.toLocal8Bit().data() );
+        return false;
+    }
+
+    string indicesDir = FsEncoding::encode( QDir::toNativeSeparators( indexDir ) + QDir::separator() );
+
+    // The same settings a fresh configuration would have
+    Config::Class cfg;
+    SilentInitializing initializing;
+
+    try
+    {
+        switch( format )
+        {
+            case SyntheticDict::Dsl:
+                dictionaries = Dsl::makeDictionaries( files, indicesDir, initializing,
+                                                      cfg.maxPictureWidth, cfg.maxHeadwordSize );
+                break;
+            case SyntheticDict::StarDict:
+                dictionaries = Stardict::makeDictionaries( files, indicesDir, initializing,
+                                                           cfg.maxHeadwordsToExpand );
+                break;
+            case SyntheticDict::Xdxf:
+                dictionaries = Xdxf::makeDictionaries( files, indicesDir, initializing );
+                break;
+            case SyntheticDict::Mdx:
+                dictionaries = Mdx::makeDictionaries( files, indicesDir, initializing );
+                break;
+            case SyntheticDict::Dictd:
+                dictionaries = DictdFiles::makeDictionaries( files, indicesDir, initializing );
+                break;
+            default:
+                break;
+        }
+    }
+    catch( std::exception & e )
+    {
+        fprintf( stderr, "Indexing failed: %s\n", e.what() );
+        return false;
+    }
+
+    return true;
+}
+
+/// Indexes the dictionary of the given format found in the data directory,
+/// then prints a single line with the results. Runs in the child process.
+int indexOne( SyntheticDict::Format format, QString const & dataDir )
+{
+    QString indexDir = indexDirFor( format, dataDir );
+
+    if( !makeEmptyDir( indexDir ) )
+    {
+        fprintf( stderr, "Can't clean up the index directory %s\n", indexDir.toLocal8Bit().data() );
+        return 1;
+    }
+
+    vector< sptr< Dictionary::Class > > dictionaries;
+
+    long rssBefore = peakRss();
+    qint64 cpuBefore = cpuTime();
+    QElapsedTimer timer;
+    timer.start();
+
+    if( !makeDictionaries( format, dataDir, dictionaries ) )
+        return 1;
+
+    qint64 wallMs = timer.elapsed();
+    qint64 cpuMs = cpuTime() - cpuBefore;
+
+    quint64 words = 0;
+    for( size_t x = 0; x < dictionaries.size(); ++x )
+        words += dictionaries[ x ]->getWordCount();
+
+    dictionaries.clear();
+
+    printf( "%s %lld %lld %lld %ld %ld %llu\n", SyntheticDict::formatName( format ),
+            (long long) wallMs, (long long) cpuMs, (long long) directorySize( indexDir ),
+            peakRss(), rssBefore, (unsigned long long) words );
+
+    return 0;
+}
+
+/// Checks that the headword iterator of the dictionaries of the given format
+/// gives the same headwords as getHeadwords() does. The phrases are indexed
+/// by each of their trailing words too, yet they have to be given just once.
+/// It's kept apart from the measured runs, as it holds all the headwords.
+int checkHeadwords( SyntheticDict::Format format, QString const & dataDir )
+{
+    vector< sptr< Dictionary::Class > > dictionaries;
+
+    if( !makeDictionaries( format, dataDir, dictionaries ) )
+        return 1;
+
+    for( size_t x = 0; x < dictionaries.size(); ++x )
+    {
+        sptr< Dictionary::HeadwordIterator > iterator = dictionaries[ x ]->getHeadwordIterator();
+        if( !iterator )
+            continue;
+
+        QStringList iterated, collected;
+        while( iterator->next( iterated, 1024 ) )
+            ;
+
+        dictionaries[ x ]->getHeadwords( collected );
+
+        if( iterated.size() != collected.size()
+            || iterated.toSet() != collected.toSet() )
+        {
+            fprintf( stderr, "%s: the headword iterator gives %d headwords, %d expected\n",
+                     SyntheticDict::formatName( format ), iterated.size(), collected.size() );
+            return 1;
+        }
+    }
+
+    printf( "%s: %d headword lists agree\n", SyntheticDict::formatName( format ),
+            int( dictionaries.size() ) );
+
+    return 0;
+}
+
+void usage()
+{
+    fprintf( stderr,
+             "Usage:\n"
+             "  gdindexbench generate <dir> [--entries <n>] [--seed <n>] [--cjk <percent>]\n"
+             "               [--diacritics <percent>] [--phrases <percent>] [--article-words <n>]\n"
+             "               [--formats <format,...>]\n"
+             "  gdindexbench index <dir> [--formats <format,...>] [--csv]\n"
+             "  gdindexbench check <dir> [--formats <format,...>]\n"
+             "Formats: dsl, stardict, xdxf, mdx, dictd\n" );
+}
+
+}
+
+int main( int argc, char ** argv )
+{
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
+    // Some formats render bits of html while indexing, but no windows are
+    // ever shown
+    if( qgetenv( "QT_QPA_PLATFORM" ).isEmpty() )
+        qputenv( "QT_QPA_PLATFORM", "offscreen" );
+#endif
+
+    QApplication app( argc, argv );
+
+    QStringList args = app.arguments();
+
+    if( args.size() == 4 && args[ 1 ] == "index-one" )
+    {
+        SyntheticDict::Format format;
+        if( !SyntheticDict::findFormat( args[ 3 ], format ) )
+            return 1;
+
+        return indexOne( format, args[ 2 ] );
+    }
+
+    if( args.size() < 3
+        || ( args[ 1 ] != "generate" && args[ 1 ] != "index" && args[ 1 ] != "check" ) )
+    {
+        usage();
+        return 1;
+    }
+
+    bool generating = args[ 1 ] == "generate";
+    bool checking = args[ 1 ] == "check";
+    QString dataDir = QDir( args[ 2 ] ).absolutePath();
+    SyntheticDict::Options options;
+    vector< SyntheticDict::Format > formats;
+    bool csv = false;
+
+    for( int x = 3; x < args.size(); ++x )
+    {
+        QString value = x + 1 < args.size() ? args[ x + 1 ] : QString();
+
+        if( args[ x ] == "--csv" && !generating && !checking )
+        {
+            csv = true;
+            continue;
+        }
+
+        if( value.isEmpty() )
+        {
+            usage();
+            return 1;
+        }
+
+        ++x;
+
+        if( args[ x - 1 ] == "--formats" )
+        {
+            QStringList names = value.split( ',' );
+            for( int n = 0; n < names.size(); ++n )
+            {
+                SyntheticDict::Format format;
+                if( !SyntheticDict::findFormat( names[ n ].trimmed(), format ) )
+                {
+                    usage();
+                    return 1;
+                }
+                formats.push_back( format );
+            }
+        }
+        else
+        if( generating && args[ x - 1 ] == "--entries" )
+            options.entries = value.toUInt();
+        else
+        if( generating && args[ x - 1 ] == "--seed" )
+            options.seed = value.toUInt();
+        else
+        if( generating && args[ x - 1 ] == "--cjk" )
+            options.cjkPercent = value.toInt();
+        else
+        if( generating && args[ x - 1 ] == "--diacritics" )
+            options.diacriticsPercent = value.toInt();
+        else
+        if( generating && args[ x - 1 ] == "--phrases" )
+            options.phrasePercent = value.toInt();
+        else
+        if( generating && args[ x - 1 ] == "--article-words" )
+            options.articleWords = value.toUInt();
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    if( formats.empty() )
+        for( int x = 0; x < SyntheticDict::FormatCount; ++x )
+            formats.push_back( (SyntheticDict::Format) x );
+
+    if( generating )
+    {
+        for( size_t x = 0; x < formats.size(); ++x )
+        {
+            QString dir = dataDir + "/" + SyntheticDict::formatName( formats[ x ] );
+
+            try
+            {
+                if( !makeEmptyDir( dir ) )
+                    throw SyntheticDict::exCantWrite( dir.toUtf8().data() );
+
+                QElapsedTimer timer;
+                timer.start();
+
+                SyntheticDict::generate( formats[ x ], options, dir );
+
+                printf( "%s: %u entries, %.1f MiB in %.1f s\n", SyntheticDict::formatName( formats[ x ] ),
+                        options.entries, directorySize( dir ) / 1048576.0, timer.elapsed() / 1000.0 );
+            }
+            catch( std::exception & e )
+            {
+                fprintf( stderr, "%s: %s\n", SyntheticDict::formatName( formats[ x ] ), e.what() );
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    if( checking )
+    {
+        int result = 0;
+
+        for( size_t x = 0; x < formats.size(); ++x )
+            if( checkHeadwords( formats[ x ], dataDir ) )
+                result = 1;
+
+        return result;
+    }
+
+    if( csv )
+        printf( "format,words,wall_ms,cpu_ms,index_kib,peak_rss_kib,rss_growth_kib\n" );
+    else
+        printf( "%-10s %10s %10s %10s %12s %12s %12s\n", "format", "words", "wall, ms", "cpu, ms",
+                "index, KiB", "peak, KiB", "growth, KiB" );
+
+    int result = 0;
+
+    for( size_t x = 0; x < formats.size(); ++x )
+    {
+        char const * name = SyntheticDict::formatName( formats[ x ] );
+
+        QProcess child;
+        child.setProcessChannelMode( QProcess::ForwardedErrorChannel );
+        child.start( app.applicationFilePath(), QStringList() << "index-one" << dataDir << name );
+
+        QStringList fields;
+        if( child.waitForFinished( -1 ) && child.exitStatus() == QProcess::NormalExit
+            && child.exitCode() == 0 )
+            fields = QString::fromLatin1( child.readAllStandardOutput() ).trimmed().split( ' ' );
+
+        if( fields.size() != 7 )
+        {
+            fprintf( stderr, "%s: indexing failed\n", name );
+            result = 1;
+            continue;
+        }
+
+        long long wallMs = fields[ 1 ].toLongLong(), cpuMs = fields[ 2 ].toLongLong();
+        long long indexKib = fields[ 3 ].toLongLong() / 1024;
+        long peak = fields[ 4 ].toLong(), growth = peak - fields[ 5 ].toLong();
+        unsigned long long words = fields[ 6 ].toULongLong();
+
+        printf( csv ? "%s,%llu,%lld,%lld,%lld,%ld,%ld\n" : "%-10s %10llu %10lld %10lld %12lld %12ld %12ld\n",
+                name, words, wallMs, cpuMs, indexKib, peak, growth );
+    }
+
+    return result;
+}
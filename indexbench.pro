@@ -0,0 +1,33 @@
+#-------------------------------------------------
+#
+# Index building benchmark. Generates synthetic dictionaries
+# and times building their indices:
+#
+#   gdindexbench generate data --entries 100000
+#   gdindexbench index data
+#
+# Built from the same sources as GoldenDict, with main.cc
+# replaced by indexbench.cc
+#
+#-------------------------------------------------
+
+include( goldendict.pro )
+
+TARGET = gdindexbench
+
+SOURCES -= main.cc
+SOURCES += indexbench.cc \
+    syntheticdict.cc
+HEADERS += syntheticdict.hh
+
+CONFIG += console
+CONFIG -= app_bundle
+
+OBJECTS_DIR = build/indexbench
+UI_DIR = build/indexbench
+MOC_DIR = build/indexbench
+RCC_DIR = build/indexbench
+
+win32 {
+    LIBS += -lpsapi
+}
@@ -0,0 +1,828 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "lazydictionary.hh"
+#include "gddebug.hh"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QIcon>
+#include <QPixmap>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+namespace LazyDictionary {
+
+namespace {
+
+/// Renders the icon to a PNG image, at the size it's shown at the most
+QByteArray iconToPng( QIcon const & icon )
+{
+    QByteArray result;
+
+    if( icon.isNull() )
+        return result;
+
+    QList< QSize > sizes = icon.availableSizes();
+    QSize size = sizes.isEmpty() ? QSize( 32, 32 ) : sizes.last();
+
+    QBuffer buffer( &result );
+    buffer.open( QIODevice::WriteOnly );
+    icon.pixmap( size ).save( &buffer, "PNG" );
+
+    return result;
+}
+
+QIcon pngToIcon( QByteArray const & png )
+{
+    QPixmap pixmap;
+
+    if( png.isEmpty() || !pixmap.loadFromData( png, "PNG" ) )
+        return QIcon();
+
+    return QIcon( pixmap );
+}
+
+void writeStrings( QDataStream & out, vector< string > const & strings )
+{
+    out << (quint32) strings.size();
+    for( size_t x = 0; x < strings.size(); ++x )
+        out << QByteArray( strings[ x ].data(), strings[ x ].size() );
+}
+
+void readStrings( QDataStream & in, vector< string > & strings )
+{
+    quint32 count;
+    in >> count;
+
+    strings.clear();
+    for( quint32 x = 0; x < count && in.status() == QDataStream::Ok; ++x )
+    {
+        QByteArray str;
+        in >> str;
+        strings.push_back( string( str.constData(), str.size() ) );
+    }
+}
+
+class WarmUpRunnable: public QRunnable
+{
+    // Holding the dictionaries keeps them alive even if they get reloaded
+    // in the meantime
+    vector< sptr< Dictionary::Class > > proxies;
+
+public:
+
+    WarmUpRunnable( vector< sptr< Dictionary::Class > > const & proxies_ ):
+        proxies( proxies_ )
+    {}
+
+    virtual void run()
+    {
+        for( size_t x = 0; x < proxies.size(); ++x )
+            static_cast< Proxy * >( proxies[ x ].get() )->open();
+    }
+};
+
+/// Opens the proxy for the requests deferred on the GUI thread
+class OpenRunnable: public QRunnable
+{
+    Proxy & proxy;
+    QSemaphore & hasExited;
+
+public:
+
+    OpenRunnable( Proxy & proxy_, QSemaphore & hasExited_ ):
+        proxy( proxy_ ), hasExited( hasExited_ )
+    {}
+
+    ~OpenRunnable()
+    {
+        hasExited.release();
+    }
+
+    virtual void run()
+    {
+        proxy.open();
+    }
+};
+
+class PrefixMatchCall: public WordSearchCall
+{
+    gd::wstring word;
+    unsigned long maxResults;
+
+public:
+
+    PrefixMatchCall( gd::wstring const & word_, unsigned long maxResults_ ):
+        word( word_ ), maxResults( maxResults_ )
+    {}
+
+    virtual sptr< Dictionary::WordSearchRequest > makeIn( Proxy & proxy )
+    { return proxy.prefixMatch( word, maxResults ); }
+};
+
+class StemmedMatchCall: public WordSearchCall
+{
+    gd::wstring word;
+    unsigned minLength, maxSuffixVariation;
+    unsigned long maxResults;
+
+public:
+
+    StemmedMatchCall( gd::wstring const & word_, unsigned minLength_,
+                      unsigned maxSuffixVariation_, unsigned long maxResults_ ):
+        word( word_ ), minLength( minLength_ ),
+        maxSuffixVariation( maxSuffixVariation_ ), maxResults( maxResults_ )
+    {}
+
+    virtual sptr< Dictionary::WordSearchRequest > makeIn( Proxy & proxy )
+    { return proxy.stemmedMatch( word, minLength, maxSuffixVariation, maxResults ); }
+};
+
+class FuzzyMatchCall: public WordSearchCall
+{
+    gd::wstring word;
+    unsigned maxDistance;
+    unsigned long maxResults;
+
+public:
+
+    FuzzyMatchCall( gd::wstring const & word_, unsigned maxDistance_,
+                    unsigned long maxResults_ ):
+        word( word_ ), maxDistance( maxDistance_ ), maxResults( maxResults_ )
+    {}
+
+    virtual sptr< Dictionary::WordSearchRequest > makeIn( Proxy & proxy )
+    { return proxy.fuzzyMatch( word, maxDistance, maxResults ); }
+};
+
+class FindHeadwordsForSynonymCall: public WordSearchCall
+{
+    gd::wstring word;
+
+public:
+
+    FindHeadwordsForSynonymCall( gd::wstring const & word_ ):
+        word( word_ )
+    {}
+
+    virtual sptr< Dictionary::WordSearchRequest > makeIn( Proxy & proxy )
+    { return proxy.findHeadwordsForSynonym( word ); }
+};
+
+class GetArticleCall: public DataCall
+{
+    gd::wstring word;
+    vector< gd::wstring > alts;
+    gd::wstring context;
+    bool ignoreDiacritics;
+
+public:
+
+    GetArticleCall( gd::wstring const & word_, vector< gd::wstring > const & alts_,
+                    gd::wstring const & context_, bool ignoreDiacritics_ ):
+        word( word_ ), alts( alts_ ), context( context_ ),
+        ignoreDiacritics( ignoreDiacritics_ )
+    {}
+
+    virtual sptr< Dictionary::DataRequest > makeIn( Proxy & proxy )
+    { return proxy.getArticle( word, alts, context, ignoreDiacritics ); }
+};
+
+class GetResourceCall: public DataCall
+{
+    string name;
+
+public:
+
+    GetResourceCall( string const & name_ ):
+        name( name_ )
+    {}
+
+    virtual sptr< Dictionary::DataRequest > makeIn( Proxy & proxy )
+    { return proxy.getResource( name ); }
+};
+
+class GetSearchResultsCall: public DataCall
+{
+    QString searchString;
+    int searchMode;
+    bool matchCase;
+    int distanceBetweenWords;
+    int maxArticlesPerDictionary;
+    bool ignoreWordsOrder;
+    bool ignoreDiacritics;
+
+public:
+
+    GetSearchResultsCall( QString const & searchString_, int searchMode_, bool matchCase_,
+                          int distanceBetweenWords_, int maxArticlesPerDictionary_,
+                          bool ignoreWordsOrder_, bool ignoreDiacritics_ ):
+        searchString( searchString_ ), searchMode( searchMode_ ), matchCase( matchCase_ ),
+        distanceBetweenWords( distanceBetweenWords_ ),
+        maxArticlesPerDictionary( maxArticlesPerDictionary_ ),
+        ignoreWordsOrder( ignoreWordsOrder_ ), ignoreDiacritics( ignoreDiacritics_ )
+    {}
+
+    virtual sptr< Dictionary::DataRequest > makeIn( Proxy & proxy )
+    {
+        return proxy.getSearchResults( searchString, searchMode, matchCase,
+                                       distanceBetweenWords, maxArticlesPerDictionary,
+                                       ignoreWordsOrder, ignoreDiacritics );
+    }
+};
+
+}
+
+Snapshot::Snapshot():
+    langFrom( 0 ), langTo( 0 ), articleCount( 0 ), wordCount( 0 ),
+    features( Dictionary::NoFeatures ), isLocal( true ),
+    canFTS( false ), haveFTSIndex( false )
+{
+}
+
+Snapshot::Snapshot( Dictionary::Class & dict ):
+    id( dict.getId() ), name( dict.getName() ),
+    files( dict.getDictionaryFilenames() ),
+    langFrom( dict.getLangFrom() ), langTo( dict.getLangTo() ),
+    articleCount( dict.getArticleCount() ), wordCount( dict.getWordCount() ),
+    features( int( dict.getFeatures() ) ), isLocal( dict.isLocalDictionary() ),
+    canFTS( dict.canFTS() ), haveFTSIndex( dict.haveFTSIndex() ),
+    icon( iconToPng( dict.getIcon() ) ),
+    nativeIcon( iconToPng( dict.getNativeIcon() ) ),
+    mainFilename( dict.getMainFilename() ),
+    description( dict.getDescription() )
+{
+}
+
+QDataStream & operator << ( QDataStream & out, Snapshot const & s )
+{
+    out << QByteArray( s.id.data(), s.id.size() )
+        << QByteArray( s.name.data(), s.name.size() );
+    writeStrings( out, s.files );
+    out << s.langFrom << s.langTo << s.articleCount << s.wordCount
+        << s.features << s.isLocal << s.canFTS << s.haveFTSIndex
+        << s.icon << s.nativeIcon << s.mainFilename << s.description;
+
+    return out;
+}
+
+QDataStream & operator >> ( QDataStream & in, Snapshot & s )
+{
+    QByteArray id, name;
+    in >> id >> name;
+    s.id = string( id.constData(), id.size() );
+    s.name = string( name.constData(), name.size() );
+    readStrings( in, s.files );
+    in >> s.langFrom >> s.langTo >> s.articleCount >> s.wordCount
+       >> s.features >> s.isLocal >> s.canFTS >> s.haveFTSIndex
+       >> s.icon >> s.nativeIcon >> s.mainFilename >> s.description;
+
+    return in;
+}
+
+Proxy::Proxy( Snapshot const & snapshot_, sptr< Factory > const & factory_ ):
+    Dictionary::Class( snapshot_.id, snapshot_.files ),
+    snapshot( snapshot_ ),
+    factory( factory_ ),
+    openFailed( false ),
+    openRunnableStarted( false ),
+    haveFtsParameters( false )
+{
+    setDictionaryName( snapshot.name );
+
+    dictionaryDescription = snapshot.description;
+
+    can_FTS = snapshot.canFTS;
+    if( snapshot.haveFTSIndex )
+        FTS_index_completed.ref();
+}
+
+Proxy::~Proxy()
+{
+    bool wait;
+
+    {
+        Mutex::Lock _( openMutex );
+        wait = openRunnableStarted;
+    }
+
+    // The runnable refers to the proxy
+    if( wait )
+        openRunnableExited.acquire();
+}
+
+bool Proxy::isOpen()
+{
+    Mutex::Lock _( openMutex );
+    return real || openFailed;
+}
+
+sptr< Dictionary::Class > Proxy::open()
+{
+    {
+        Mutex::Lock _( openMutex );
+
+        if( real || openFailed )
+            return real;
+    }
+
+    // Only one thread opens it at a time. openMutex isn't held meanwhile, so
+    // that the GUI thread can tell it isn't open yet without waiting.
+    Mutex::Lock opening( openingMutex );
+
+    {
+        Mutex::Lock _( openMutex );
+
+        if( real || openFailed )
+            return real;
+    }
+
+    sptr< Dictionary::Class > dict;
+
+    try
+    {
+        dict = factory->open( snapshot );
+    }
+    catch( std::exception & e )
+    {
+        gdWarning( "Can't open dictionary \"%s\": %s\n", snapshot.name.c_str(), e.what() );
+    }
+
+    if( dict )
+    {
+        GD_DPRINTF( "Opened dictionary \"%s\" on demand\n", snapshot.name.c_str() );
+
+        dict->deferredInit();
+    }
+
+    Mutex::Lock _( openMutex );
+
+    if( dict )
+    {
+        if( haveFtsParameters )
+            dict->setFTSParameters( ftsParameters );
+
+        dict->setSynonymSearchEnabled( synonymSearchEnabled );
+
+        // What was served before it got opened still counts
+        dict->getStats()->merge( *statistics );
+
+        real = dict;
+
+        syncFtsState();
+    }
+    else
+        openFailed = true;
+
+    // The deferred requests carry on on the GUI thread
+    for( std::list< QObject * >::const_iterator i = waitingRequests.begin();
+         i != waitingRequests.end(); ++i )
+        QMetaObject::invokeMethod( *i, "proxyOpened", Qt::QueuedConnection );
+
+    waitingRequests.clear();
+
+    return real;
+}
+
+bool Proxy::mustDefer()
+{
+    QCoreApplication * app = QCoreApplication::instance();
+
+    return app && QThread::currentThread() == app->thread() && !isOpen();
+}
+
+void Proxy::notifyWhenOpen( QObject * request )
+{
+    Mutex::Lock _( openMutex );
+
+    if( real || openFailed )
+    {
+        // It got opened in the meantime
+        QMetaObject::invokeMethod( request, "proxyOpened", Qt::QueuedConnection );
+        return;
+    }
+
+    waitingRequests.push_back( request );
+
+    startOpening();
+}
+
+void Proxy::startOpening()
+{
+    if( !openRunnableStarted )
+    {
+        // If it's being warmed up already, the runnable just waits for it
+        openRunnableStarted = true;
+        QThreadPool::globalInstance()->start( new OpenRunnable( *this, openRunnableExited ) );
+    }
+}
+
+void Proxy::forgetRequest( QObject * request )
+{
+    Mutex::Lock _( openMutex );
+
+    waitingRequests.remove( request );
+}
+
+void Proxy::syncFtsState()
+{
+    can_FTS = real->canFTS();
+
+    if( real->haveFTSIndex() && !haveFTSIndex() )
+        FTS_index_completed.ref();
+}
+
+sptr< Dictionary::WordSearchRequest > Proxy::prefixMatch( gd::wstring const & word,
+                                                          unsigned long maxResults )
+THROW_SPEC( std::exception )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::WordSearchRequest >(
+            new DeferredWordSearchRequest( *this, new PrefixMatchCall( word, maxResults ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::WordSearchRequest >( new Dictionary::WordSearchRequestInstant() );
+
+    dict->setSynonymSearchEnabled( synonymSearchEnabled );
+    return dict->prefixMatch( word, maxResults );
+}
+
+sptr< Dictionary::WordSearchRequest > Proxy::stemmedMatch( gd::wstring const & word,
+                                                           unsigned minLength,
+                                                           unsigned maxSuffixVariation,
+                                                           unsigned long maxResults )
+THROW_SPEC( std::exception )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::WordSearchRequest >(
+            new DeferredWordSearchRequest( *this, new StemmedMatchCall( word, minLength,
+                                                                        maxSuffixVariation,
+                                                                        maxResults ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::WordSearchRequest >( new Dictionary::WordSearchRequestInstant() );
+
+    return dict->stemmedMatch( word, minLength, maxSuffixVariation, maxResults );
+}
+
+sptr< Dictionary::WordSearchRequest > Proxy::fuzzyMatch( gd::wstring const & word,
+                                                         unsigned maxDistance,
+                                                         unsigned long maxResults )
+THROW_SPEC( std::exception )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::WordSearchRequest >(
+            new DeferredWordSearchRequest( *this, new FuzzyMatchCall( word, maxDistance, maxResults ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::WordSearchRequest >( new Dictionary::WordSearchRequestInstant() );
+
+    return dict->fuzzyMatch( word, maxDistance, maxResults );
+}
+
+sptr< Dictionary::WordSearchRequest > Proxy::findHeadwordsForSynonym( gd::wstring const & word )
+THROW_SPEC( std::exception )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::WordSearchRequest >(
+            new DeferredWordSearchRequest( *this, new FindHeadwordsForSynonymCall( word ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::WordSearchRequest >( new Dictionary::WordSearchRequestInstant() );
+
+    dict->setSynonymSearchEnabled( synonymSearchEnabled );
+    return dict->findHeadwordsForSynonym( word );
+}
+
+sptr< Dictionary::DataRequest > Proxy::getArticle( gd::wstring const & word,
+                                                   vector< gd::wstring > const & alts,
+                                                   gd::wstring const & context,
+                                                   bool ignoreDiacritics )
+THROW_SPEC( std::exception )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::DataRequest >(
+            new DeferredDataRequest( *this, new GetArticleCall( word, alts, context,
+                                                                ignoreDiacritics ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::DataRequest >( new Dictionary::DataRequestInstant( false ) );
+
+    dict->setSynonymSearchEnabled( synonymSearchEnabled );
+    return dict->getArticle( word, alts, context, ignoreDiacritics );
+}
+
+sptr< Dictionary::DataRequest > Proxy::getResource( string const & name )
+THROW_SPEC( std::exception )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::DataRequest >(
+            new DeferredDataRequest( *this, new GetResourceCall( name ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::DataRequest >( new Dictionary::DataRequestInstant( false ) );
+
+    return dict->getResource( name );
+}
+
+sptr< Dictionary::DataRequest > Proxy::getSearchResults( QString const & searchString,
+                                                         int searchMode, bool matchCase,
+                                                         int distanceBetweenWords,
+                                                         int maxArticlesPerDictionary,
+                                                         bool ignoreWordsOrder,
+                                                         bool ignoreDiacritics )
+{
+    if( mustDefer() )
+        return sptr< Dictionary::DataRequest >(
+            new DeferredDataRequest( *this, new GetSearchResultsCall( searchString, searchMode,
+                                                                      matchCase,
+                                                                      distanceBetweenWords,
+                                                                      maxArticlesPerDictionary,
+                                                                      ignoreWordsOrder,
+                                                                      ignoreDiacritics ) ) );
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::DataRequest >( new Dictionary::DataRequestInstant( false ) );
+
+    return dict->getSearchResults( searchString, searchMode, matchCase,
+                                   distanceBetweenWords, maxArticlesPerDictionary,
+                                   ignoreWordsOrder, ignoreDiacritics );
+}
+
+QString const & Proxy::getDescription()
+{
+    // The dialogs showing it shouldn't wait for the dictionary to open
+    if( mustDefer() )
+        return dictionaryDescription;
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return dictionaryDescription;
+
+    return dict->getDescription();
+}
+
+QString Proxy::getMainFilename()
+{
+    if( mustDefer() )
+        return snapshot.mainFilename;
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return snapshot.mainFilename;
+
+    return dict->getMainFilename();
+}
+
+void Proxy::makeFTSIndex( AtomicInt32 & isCancelled, bool firstIteration )
+{
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return;
+
+    dict->makeFTSIndex( isCancelled, firstIteration );
+
+    Mutex::Lock _( openMutex );
+    syncFtsState();
+}
+
+void Proxy::setFTSParameters( Config::FullTextSearch const & fts )
+{
+    Mutex::Lock _( openMutex );
+
+    ftsParameters = fts;
+    haveFtsParameters = true;
+
+    if( real )
+    {
+        real->setFTSParameters( fts );
+        syncFtsState();
+    }
+    else
+    {
+        // Whether the dictionary's size and type are eligible can only be
+        // told by the dictionary itself, so rely on what it said last time
+        can_FTS = fts.enabled && snapshot.canFTS;
+    }
+}
+
+bool Proxy::getHeadwords( QStringList & headwords )
+{
+    // The callers on the GUI thread are expected to wait for isReady()
+    if( mustDefer() )
+    {
+        Mutex::Lock _( openMutex );
+        startOpening();
+        return false;
+    }
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return false;
+
+    return dict->getHeadwords( headwords );
+}
+
+sptr< Dictionary::HeadwordIterator > Proxy::getHeadwordIterator( gd::wstring const & foldedPrefix )
+{
+    if( mustDefer() )
+    {
+        Mutex::Lock _( openMutex );
+        startOpening();
+        return sptr< Dictionary::HeadwordIterator >();
+    }
+
+    sptr< Dictionary::Class > dict = open();
+    if( !dict )
+        return sptr< Dictionary::HeadwordIterator >();
+
+    return dict->getHeadwordIterator( foldedPrefix );
+}
+
+sptr< Dictionary::Stats > Proxy::getStats()
+{
+    // No need to open the dictionary just for that. Its own counters get
+    // what the proxy has counted once it's open.
+    Mutex::Lock _( openMutex );
+    return real ? real->getStats() : statistics;
+}
+
+void Proxy::loadIcon() throw()
+{
+    if( dictionaryIconLoaded )
+        return;
+
+    dictionaryIcon = pngToIcon( snapshot.icon );
+    dictionaryNativeIcon = pngToIcon( snapshot.nativeIcon );
+
+    if( dictionaryNativeIcon.isNull() )
+        dictionaryNativeIcon = dictionaryIcon;
+
+    dictionaryIconLoaded = true;
+}
+
+DeferredWordSearchRequest::DeferredWordSearchRequest( Proxy & proxy_, WordSearchCall * call_ ):
+    proxy( proxy_ ), call( call_ ), isCancelled( false )
+{
+    proxy.notifyWhenOpen( this );
+}
+
+DeferredWordSearchRequest::~DeferredWordSearchRequest()
+{
+    proxy.forgetRequest( this );
+}
+
+void DeferredWordSearchRequest::cancel()
+{
+    isCancelled = true;
+
+    if( request )
+        request->cancel();
+    else
+        finish();
+}
+
+void DeferredWordSearchRequest::proxyOpened()
+{
+    if( isCancelled )
+        return;
+
+    try
+    {
+        request = call->makeIn( proxy );
+    }
+    catch( std::exception & e )
+    {
+        setErrorString( QString::fromUtf8( e.what() ) );
+        finish();
+        return;
+    }
+
+    connect( request.get(), SIGNAL( finished() ),
+             this, SLOT( requestFinished() ), Qt::QueuedConnection );
+
+    requestFinished(); // In case it has finished already
+}
+
+void DeferredWordSearchRequest::requestFinished()
+{
+    if( isFinished() || !request->isFinished() )
+        return;
+
+    {
+        Mutex::Lock _( dataMutex );
+
+        matches = request->getAllMatches();
+        uncertain = request->isUncertain();
+    }
+
+    setErrorString( request->getErrorString() );
+
+    finish();
+}
+
+DeferredDataRequest::DeferredDataRequest( Proxy & proxy_, DataCall * call_ ):
+    proxy( proxy_ ), call( call_ ), isCancelled( false )
+{
+    proxy.notifyWhenOpen( this );
+}
+
+DeferredDataRequest::~DeferredDataRequest()
+{
+    proxy.forgetRequest( this );
+}
+
+void DeferredDataRequest::cancel()
+{
+    isCancelled = true;
+
+    if( request )
+        request->cancel();
+    else
+        finish();
+}
+
+void DeferredDataRequest::proxyOpened()
+{
+    if( isCancelled )
+        return;
+
+    try
+    {
+        request = call->makeIn( proxy );
+    }
+    catch( std::exception & e )
+    {
+        setErrorString( QString::fromUtf8( e.what() ) );
+        finish();
+        return;
+    }
+
+    connect( request.get(), SIGNAL( finished() ),
+             this, SLOT( requestFinished() ), Qt::QueuedConnection );
+
+    requestFinished(); // In case it has finished already
+}
+
+void DeferredDataRequest::requestFinished()
+{
+    if( isFinished() || !request->isFinished() )
+        return;
+
+    if( request->dataSize() >= 0 )
+    {
+        Mutex::Lock _( dataMutex );
+
+        data = request->getFullData();
+        hasAnyData = true;
+    }
+
+    setErrorString( request->getErrorString() );
+
+    finish();
+}
+
+bool isReady( Dictionary::Class & dict, QObject * receiver )
+{
+    Proxy * proxy = dynamic_cast< Proxy * >( &dict );
+    if( !proxy || proxy->isOpen() )
+        return true;
+
+    proxy->notifyWhenOpen( receiver );
+
+    return false;
+}
+
+void stopWaiting( Dictionary::Class & dict, QObject * receiver )
+{
+    Proxy * proxy = dynamic_cast< Proxy * >( &dict );
+    if( proxy )
+        proxy->forgetRequest( receiver );
+}
+
+void warmUp( vector< sptr< Dictionary::Class > > const & dictionaries )
+{
+    vector< sptr< Dictionary::Class > > proxies;
+
+    for( size_t x = 0; x < dictionaries.size(); ++x )
+    {
+        Proxy * proxy = dynamic_cast< Proxy * >( dictionaries[ x ].get() );
+        if( proxy && !proxy->isOpen() )
+            proxies.push_back( dictionaries[ x ] );
+    }
+
+    if( proxies.empty() )
+        return;
+
+    QThreadPool::globalInstance()->start( new WarmUpRunnable( proxies ) );
+}
+
+}
@@ -0,0 +1,275 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __LAZYDICTIONARY_HH_INCLUDED__
+#define __LAZYDICTIONARY_HH_INCLUDED__
+
+#include "dictionary.hh"
+#include "config.hh"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QSemaphore>
+
+#include <list>
+
+/// Stand-ins for file-based dictionaries. They serve the dictionary's
+/// metadata remembered from the previous run and only open the real
+/// dictionary when it is actually searched in, so that neither the startup
+/// time nor the number of open files grows with the size of the library.
+namespace LazyDictionary {
+
+using std::string;
+using std::vector;
+
+/// What is known about a dictionary without opening it
+struct Snapshot
+{
+    string id;
+    string name;
+    vector< string > files;
+    quint32 langFrom, langTo;
+    quint64 articleCount, wordCount;
+    qint32 features;
+    bool isLocal;
+    bool canFTS, haveFTSIndex;
+    QByteArray icon, nativeIcon; // PNG images, empty if there's none
+    QString mainFilename, description;
+
+    Snapshot();
+
+    /// Takes a snapshot of the given dictionary. Since it renders the
+    /// icons, it must be called from the GUI thread.
+    explicit Snapshot( Dictionary::Class & );
+};
+
+QDataStream & operator << ( QDataStream &, Snapshot const & );
+QDataStream & operator >> ( QDataStream &, Snapshot & );
+
+/// Opens the real dictionaries behind the proxies
+class Factory
+{
+public:
+
+    /// Makes the dictionary the snapshot was taken from. Returns an empty
+    /// pointer if it can't be made anymore.
+    virtual sptr< Dictionary::Class > open( Snapshot const & ) = 0;
+
+    virtual ~Factory()
+    {}
+};
+
+/// A dictionary which answers from a snapshot until it has to search, at
+/// which point it opens the real dictionary and forwards everything to it.
+/// Opening may take a while, up to reindexing the dictionary if its files
+/// have changed, so the requests made on the GUI thread before it's open
+/// are deferred until it gets opened in the background.
+class Proxy: public Dictionary::Class
+{
+    Snapshot snapshot;
+    sptr< Factory > factory;
+
+    Mutex openMutex;
+    sptr< Dictionary::Class > real;
+    bool openFailed;
+
+    Mutex openingMutex; // Held while the real dictionary is being opened
+
+    bool openRunnableStarted;
+    QSemaphore openRunnableExited;
+    std::list< QObject * > waitingRequests; // The deferred ones
+
+    bool haveFtsParameters;
+    Config::FullTextSearch ftsParameters;
+
+public:
+
+    Proxy( Snapshot const &, sptr< Factory > const & );
+
+    ~Proxy();
+
+    /// Returns true if the real dictionary was opened already, or failed to
+    /// open
+    bool isOpen();
+
+    /// Opens the real dictionary, unless it's open already, and returns it.
+    /// Returns an empty pointer if the dictionary can't be opened.
+    sptr< Dictionary::Class > open();
+
+    virtual Dictionary::Features getFeatures() const
+    { return Dictionary::Features( QFlag( snapshot.features ) ); }
+
+    virtual unsigned long getArticleCount() const
+    { return snapshot.articleCount; }
+
+    virtual unsigned long getWordCount() const
+    { return snapshot.wordCount; }
+
+    virtual quint32 getLangFrom() const
+    { return snapshot.langFrom; }
+
+    virtual quint32 getLangTo() const
+    { return snapshot.langTo; }
+
+    virtual bool isLocalDictionary()
+    { return snapshot.isLocal; }
+
+    virtual sptr< Dictionary::WordSearchRequest > prefixMatch( gd::wstring const &,
+                                                               unsigned long maxResults )
+    THROW_SPEC( std::exception );
+
+    virtual sptr< Dictionary::WordSearchRequest > stemmedMatch( gd::wstring const &,
+                                                                unsigned minLength,
+                                                                unsigned maxSuffixVariation,
+                                                                unsigned long maxResults )
+    THROW_SPEC( std::exception );
+
+    virtual sptr< Dictionary::WordSearchRequest > fuzzyMatch( gd::wstring const &,
+                                                              unsigned maxDistance,
+                                                              unsigned long maxResults )
+    THROW_SPEC( std::exception );
+
+    virtual sptr< Dictionary::WordSearchRequest > findHeadwordsForSynonym( gd::wstring const & )
+    THROW_SPEC( std::exception );
+
+    virtual sptr< Dictionary::DataRequest > getArticle( gd::wstring const &,
+                                                        vector< gd::wstring > const & alts,
+                                                        gd::wstring const & context,
+                                                        bool ignoreDiacritics )
+    THROW_SPEC( std::exception );
+
+    virtual sptr< Dictionary::DataRequest > getResource( string const & name )
+    THROW_SPEC( std::exception );
+
+    virtual sptr< Dictionary::DataRequest > getSearchResults( QString const & searchString,
+                                                              int searchMode, bool matchCase,
+                                                              int distanceBetweenWords,
+                                                              int maxArticlesPerDictionary,
+                                                              bool ignoreWordsOrder,
+                                                              bool ignoreDiacritics );
+
+    virtual QString const & getDescription();
+
+    virtual QString getMainFilename();
+
+    virtual void makeFTSIndex( AtomicInt32 & isCancelled, bool firstIteration );
+
+    virtual void setFTSParameters( Config::FullTextSearch const & );
+
+    virtual bool getHeadwords( QStringList & headwords );
+
+    virtual sptr< Dictionary::HeadwordIterator > getHeadwordIterator( gd::wstring const & foldedPrefix );
+
+    virtual sptr< Dictionary::Stats > getStats();
+
+    /// Makes the object's proxyOpened() slot get invoked once the dictionary
+    /// is open, opening it in the background if needed
+    void notifyWhenOpen( QObject * );
+
+    /// Called by the objects waiting for the dictionary being destroyed
+    void forgetRequest( QObject * );
+
+protected:
+
+    virtual void loadIcon() throw();
+
+private:
+
+    /// Brings the flags the base class keeps in sync with the real dictionary
+    void syncFtsState();
+
+    /// Returns true if the request has to be deferred, which is on the GUI
+    /// thread while the dictionary isn't open yet
+    bool mustDefer();
+
+    /// Starts opening the dictionary in the background, unless it's done
+    /// already. openMutex must be held.
+    void startOpening();
+};
+
+/// A search made in a proxy, to be made again once it's open
+class WordSearchCall
+{
+public:
+
+    virtual sptr< Dictionary::WordSearchRequest > makeIn( Proxy & ) = 0;
+
+    virtual ~WordSearchCall()
+    {}
+};
+
+/// A data request made to a proxy, to be made again once it's open
+class DataCall
+{
+public:
+
+    virtual sptr< Dictionary::DataRequest > makeIn( Proxy & ) = 0;
+
+    virtual ~DataCall()
+    {}
+};
+
+/// The search made in a proxy on the GUI thread before it's open. It's made
+/// again once the proxy is open, passing its results on. This should really
+/// be private, but we need it to be handled by moc.
+class DeferredWordSearchRequest: public Dictionary::WordSearchRequest
+{
+    Q_OBJECT
+
+    Proxy & proxy;
+    sptr< WordSearchCall > call;
+    sptr< Dictionary::WordSearchRequest > request;
+    bool isCancelled;
+
+public:
+
+    DeferredWordSearchRequest( Proxy &, WordSearchCall * );
+
+    ~DeferredWordSearchRequest();
+
+    virtual void cancel();
+
+private slots:
+
+    void proxyOpened();
+    void requestFinished();
+};
+
+/// The same as DeferredWordSearchRequest, for the data requests
+class DeferredDataRequest: public Dictionary::DataRequest
+{
+    Q_OBJECT
+
+    Proxy & proxy;
+    sptr< DataCall > call;
+    sptr< Dictionary::DataRequest > request;
+    bool isCancelled;
+
+public:
+
+    DeferredDataRequest( Proxy &, DataCall * );
+
+    ~DeferredDataRequest();
+
+    virtual void cancel();
+
+private slots:
+
+    void proxyOpened();
+    void requestFinished();
+};
+
+/// Returns true if the dictionary can serve its headwords on the GUI thread
+/// right away, which is unless it's a proxy not open yet. Such a proxy gets
+/// opened in the background, and the receiver's proxyOpened() slot is invoked
+/// once it's open. A receiver destroyed before that must call stopWaiting().
+bool isReady( Dictionary::Class &, QObject * receiver );
+
+void stopWaiting( Dictionary::Class &, QObject * receiver );
+
+/// Opens, in the background, the proxies among the given dictionaries which
+/// are not open yet, so that the first search in them doesn't have to wait.
+void warmUp( vector< sptr< Dictionary::Class > > const & );
+
+}
+
+#endif
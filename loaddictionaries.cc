@@ -50,6 +50,8 @@
 #endif
 #include "gddebug.hh"
 #include "fsencoding.hh"
+#include "loadmanifest.hh"
+#include "lazydictionary.hh"
 #ifdef GD_XDXF_SUPPORT
 #include "xdxf.hh"
 #endif
@@ -90,6 +92,13 @@
 #include <QEventLoop>
 #include <QApplication>
 
+#include <QSemaphore>
+#include <QRunnable>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <deque>
+#include <map>
 #include <set>
 
 using std::set;
@@ -147,6 +156,202 @@ public:
     ~DictNameFilter(){}
 };
 
+namespace {
+
+/// The settings the file-based dictionaries are made with
+struct FileDictionaryParams
+{
+    unsigned maxHeadwordsToExpand;
+    int maxPictureWidth;
+    unsigned maxHeadwordSize;
+
+    FileDictionaryParams( Config::Class const & cfg ):
+        maxHeadwordsToExpand( cfg.maxHeadwordsToExpand ),
+        maxPictureWidth( cfg.maxPictureWidth ),
+        maxHeadwordSize( cfg.maxHeadwordSize )
+    {}
+};
+
+/// Makes all the file-based dictionaries found among the given files
+void makeFileDictionaries( vector< string > const & allFiles,
+                           FileDictionaryParams const & params,
+                           Dictionary::Initializing & initializing,
+                           vector< sptr< Dictionary::Class > > & dictionaries )
+{
+#ifdef GD_BGL_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > bglDictionaries =
+                Bgl::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), bglDictionaries.begin(),
+                             bglDictionaries.end() );
+    }
+#endif
+#ifdef GD_STARDICT_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > stardictDictionaries =
+                Stardict::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing, params.maxHeadwordsToExpand );
+
+        dictionaries.insert( dictionaries.end(), stardictDictionaries.begin(),
+                             stardictDictionaries.end() );
+    }
+#endif
+#ifdef GD_LSA_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > lsaDictionaries =
+                Lsa::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), lsaDictionaries.begin(),
+                             lsaDictionaries.end() );
+    }
+#endif
+#ifdef GD_DSL_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > dslDictionaries =
+                Dsl::makeDictionaries(
+                    allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing, params.maxPictureWidth, params.maxHeadwordSize );
+
+        dictionaries.insert( dictionaries.end(), dslDictionaries.begin(),
+                             dslDictionaries.end() );
+    }
+#endif
+#ifdef GD_DICTD_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > dictdDictionaries =
+                DictdFiles::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), dictdDictionaries.begin(),
+                             dictdDictionaries.end() );
+    }
+#endif
+#ifdef GD_XDXF_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > xdxfDictionaries =
+                Xdxf::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), xdxfDictionaries.begin(),
+                             xdxfDictionaries.end() );
+    }
+#endif
+#ifdef GD_SDICT_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > sdictDictionaries =
+                Sdict::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), sdictDictionaries.begin(),
+                             sdictDictionaries.end() );
+    }
+#endif
+#ifdef GD_AARD_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > aardDictionaries =
+                Aard::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing, params.maxHeadwordsToExpand );
+
+        dictionaries.insert( dictionaries.end(), aardDictionaries.begin(),
+                             aardDictionaries.end() );
+    }
+#endif
+#ifdef GD_ZIPSOUNDS_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > zipSoundsDictionaries =
+                ZipSounds::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), zipSoundsDictionaries.begin(),
+                             zipSoundsDictionaries.end() );
+    }
+#endif
+#ifdef GD_MDICT_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > mdxDictionaries =
+                Mdx::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), mdxDictionaries.begin(),
+                             mdxDictionaries.end() );
+    }
+#endif
+#ifdef GD_GLS_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > glsDictionaries =
+                Gls::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), glsDictionaries.begin(),
+                             glsDictionaries.end() );
+    }
+#endif
+#ifdef GD_ZIM_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > zimDictionaries =
+                Zim::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing, params.maxHeadwordsToExpand );
+
+        dictionaries.insert( dictionaries.end(), zimDictionaries.begin(),
+                             zimDictionaries.end() );
+    }
+#endif
+#ifdef GD_SLOB_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > slobDictionaries =
+                Slob::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing, params.maxHeadwordsToExpand );
+
+        dictionaries.insert( dictionaries.end(), slobDictionaries.begin(),
+                             slobDictionaries.end() );
+    }
+#endif
+#ifdef GD_EPWING_SUPPORT
+    {
+        vector< sptr< Dictionary::Class > > epwingDictionaries =
+                Epwing::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), initializing );
+
+        dictionaries.insert( dictionaries.end(), epwingDictionaries.begin(),
+                             epwingDictionaries.end() );
+    }
+#endif
+}
+
+
+/// Reports nothing, since the dictionaries are opened on demand long after
+/// the splash screen is gone
+class SilentInitializing: public Dictionary::Initializing
+{
+public:
+    virtual void indexingDictionary( string const & ) throw()
+    {}
+};
+
+/// Opens the file-based dictionaries behind LazyDictionary proxies
+class FileDictionaryFactory: public LazyDictionary::Factory
+{
+    FileDictionaryParams params;
+
+public:
+
+    FileDictionaryFactory( Config::Class const & cfg ):
+        params( cfg )
+    {}
+
+    virtual sptr< Dictionary::Class > open( LazyDictionary::Snapshot const & snapshot )
+    {
+        if( snapshot.files.empty() )
+            return sptr< Dictionary::Class >();
+
+        // The formats don't agree on which of the files is the one they're
+        // made from, like EPWING, listing its book directory first and being
+        // made from the catalogs file. The companion files are skipped by all
+        // of them, so the whole list is given.
+        vector< sptr< Dictionary::Class > > dictionaries;
+        SilentInitializing initializing;
+
+        makeFileDictionaries( snapshot.files, params, initializing, dictionaries );
+
+        for( size_t x = 0; x < dictionaries.size(); ++x )
+            if( dictionaries[ x ]->getId() == snapshot.id )
+                return dictionaries[ x ];
+
+        return sptr< Dictionary::Class >();
+    }
+};
+
+}
+
 LoadDictionaries::LoadDictionaries( Config::Class const & cfg ,
                                     QElapsedTimer const & timer_ ,
                                     const bool doDeferredInit,
@@ -154,9 +359,6 @@ LoadDictionaries::LoadDictionaries( Config::Class const & cfg ,
                                     std::vector<sptr<Dictionary::Class> > &dicts )
     : dictionaries(dicts), timer(timer_), doDeferredInit_(doDeferredInit),
       cfg_(cfg), dictNetMgr(dtNetMgr)
-    #ifdef DICTS_LOADING_CONCURRENT
-    ,sWait(0), ref(0)
-    #endif
 {
 }
 static const QString rn("\n");
@@ -170,16 +372,7 @@ void LoadDictionaries::run()
         for( Config::Paths::const_iterator i = cfg_.paths.begin(); i != cfg_.paths.end(); ++i )
             handlePath( *i );
 #ifdef DICTS_LOADING_CONCURRENT
-        do
-        {
-            int left = Qt4x5::AtomicInt::loadAcquire(ref);
-            if(left < 1)
-                break;
-            while(!sWait.tryAcquire(1, 1000))
-                emit showMessage(tr("Handling User's Dictionary%1%3%5%7").arg(rn).
-                                 arg(tr("%1 left").arg(left)).arg(rn).
-                                 arg(tes.arg(timer.elapsed() / 1000)) );
-        }while(true);
+        runFileTasks();
 
         if(!exceptionText.empty() && dictionaries.empty())
         {
@@ -232,8 +425,9 @@ void LoadDictionaries::run()
                  && i->size() == 32 )
                 indexDir.remove( *i );
             else
-                if ( i->endsWith( "_FTS" )
-                     && i->size() == 36
+                if ( ( ( ( i->endsWith( "_FTS" ) || i->endsWith( "_NGR" ) ) && i->size() == 36 )
+                       || ( i->endsWith( "_FTS_NGR" ) && i->size() == 40 )
+                       || ( i->endsWith( "_FTS_PART" ) && i->size() == 41 ) )
                      && ids.find( FsEncoding::encode( i->left( 32 ) ) ) == ids.end() )
                     indexDir.remove( *i );
         }
@@ -418,214 +612,307 @@ void LoadDictionaries::handlePath( Config::Path const & path )
 {
     static const DictNameFilter nameFilters;
 
-    vector< string > allFiles;
+    LoadManifest::Directory dir;
 
-    QDir dir( path.path );
-
-    QFileInfoList entries = dir.entryInfoList( nameFilters, QDir::AllDirs | QDir::Files | QDir::NoDotAndDotDot );
-
-    for( QFileInfoList::const_iterator i = entries.constBegin();
-         i != entries.constEnd(); ++i )
+    if ( !LoadManifest::findDirectory( path.path, dir ) )
     {
-        QString fullName = i->absoluteFilePath();
+        LoadManifest::listDirectory( path.path, nameFilters, dir );
+        LoadManifest::storeDirectory( path.path, dir );
+    }
 
-        if ( path.recursive && i->isDir() )
+    if ( path.recursive )
+    {
+        for( QStringList::const_iterator i = dir.subdirs.constBegin();
+             i != dir.subdirs.constEnd(); ++i )
         {
             // Make sure the path doesn't look like with dsl resources
-            if ( !fullName.endsWith( ".dsl.files", Qt::CaseInsensitive ) &&
-                 !fullName.endsWith( ".dsl.dz.files", Qt::CaseInsensitive ) )
-                handlePath( Config::Path( fullName, true ) );
+            if ( !i->endsWith( ".dsl.files", Qt::CaseInsensitive ) &&
+                 !i->endsWith( ".dsl.dz.files", Qt::CaseInsensitive ) )
+                handlePath( Config::Path( *i, true ) );
         }
-
-        if ( !i->isDir() )
-            allFiles.push_back( FsEncoding::encode( QDir::toNativeSeparators( fullName ) ) );
     }
+
+    vector< string > const & allFiles = dir.files;
+
     if(allFiles.empty())
         return;
-    emit showMessage(tr("Handling User's Dictionary%1%3").arg(rn).arg(path.path),
-                     Qt::AlignCenter, Qt::darkBlue);
-#ifdef DICTS_LOADING_CONCURRENT
-    QThreadPool *tp = QThreadPool::globalInstance();
-    int maxThreadCount = tp->maxThreadCount();;
-    if( maxThreadCount <= 1 )
+
+    vector< LazyDictionary::Snapshot > snapshots;
+
+    if ( LoadManifest::findSnapshots( path.path, snapshots ) )
     {
-        handleFiles(dictionaries, allFiles);
+        if ( !fileDictionaryFactory )
+            fileDictionaryFactory = sptr< LazyDictionary::Factory >( new FileDictionaryFactory( cfg_ ) );
+
+        vector< sptr< Dictionary::Class > > proxies;
+        for( size_t x = 0; x < snapshots.size(); ++x )
+            proxies.push_back( sptr< Dictionary::Class >(
+                                   new LazyDictionary::Proxy( snapshots[ x ], fileDictionaryFactory ) ) );
+
+#ifdef DICTS_LOADING_CONCURRENT
+        // Keep them in their place among the dictionaries being loaded
+        loaded.push_back( proxies );
+#else
+        dictionaries.insert( dictionaries.end(), proxies.begin(), proxies.end() );
+#endif
         return;
     }
 
-    QRunnable *r = new LoadDictionariesRunnable(*this, allFiles);
-    while( Qt4x5::AtomicInt::loadAcquire(ref) > maxThreadCount )
-        tp->waitForDone(100);
-    ++ref;
-    tp->start(r);
+    emit showMessage(tr("Handling User's Dictionary%1%3").arg(rn).arg(path.path),
+                     Qt::AlignCenter, Qt::darkBlue);
+#ifdef DICTS_LOADING_CONCURRENT
+    queueFiles( path.path, allFiles, dir.sizes );
 #else
-    handleFiles(allFiles);
+    handleFiles( path.path, allFiles );
 #endif
 }
 
 #ifdef DICTS_LOADING_CONCURRENT
-void LoadDictionaries::handleFiles(std::vector< sptr< Dictionary::Class > > &dictionaries,
-                                   const std::vector< std::string > &allFiles)
-#else
-void LoadDictionaries::handleFiles(const std::vector< std::string > &allFiles)
-#endif
+
+namespace {
+
+/// One task queue per worker. A worker takes from the front of its own queue
+/// and, once that's empty, steals from the back of the others'. Since all
+/// the tasks are queued before the workers start, a worker finding nothing
+/// to steal is done.
+class WorkStealingQueues
 {
-#ifdef GD_BGL_SUPPORT
+    struct Queue
     {
-        vector< sptr< Dictionary::Class > > bglDictionaries =
-                Bgl::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+        Mutex mutex;
+        std::deque< size_t > tasks;
+    };
 
-        dictionaries.insert( dictionaries.end(), bglDictionaries.begin(),
-                             bglDictionaries.end() );
-    }
-#endif
-#ifdef GD_STARDICT_SUPPORT
-    {
-        vector< sptr< Dictionary::Class > > stardictDictionaries =
-                Stardict::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this, cfg_.maxHeadwordsToExpand );
+    vector< sptr< Queue > > queues;
 
-        dictionaries.insert( dictionaries.end(), stardictDictionaries.begin(),
-                             stardictDictionaries.end() );
-    }
-#endif
-#ifdef GD_LSA_SUPPORT
-    {
-        vector< sptr< Dictionary::Class > > lsaDictionaries =
-                Lsa::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+public:
 
-        dictionaries.insert( dictionaries.end(), lsaDictionaries.begin(),
-                             lsaDictionaries.end() );
-    }
-#endif
-#ifdef GD_DSL_SUPPORT
+    WorkStealingQueues( size_t workers )
     {
-        vector< sptr< Dictionary::Class > > dslDictionaries =
-                Dsl::makeDictionaries(
-                    allFiles, FsEncoding::encode( Config::getIndexDir() ), *this, cfg_.maxPictureWidth, cfg_.maxHeadwordSize );
-
-        dictionaries.insert( dictionaries.end(), dslDictionaries.begin(),
-                             dslDictionaries.end() );
+        for( size_t x = 0; x < workers; ++x )
+            queues.push_back( sptr< Queue >( new Queue ) );
     }
-#endif
-#ifdef GD_DICTD_SUPPORT
-    {
-        vector< sptr< Dictionary::Class > > dictdDictionaries =
-                DictdFiles::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
 
-        dictionaries.insert( dictionaries.end(), dictdDictionaries.begin(),
-                             dictdDictionaries.end() );
-    }
-#endif
-#ifdef GD_XDXF_SUPPORT
-    {
-        vector< sptr< Dictionary::Class > > xdxfDictionaries =
-                Xdxf::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+    size_t size() const
+    { return queues.size(); }
 
-        dictionaries.insert( dictionaries.end(), xdxfDictionaries.begin(),
-                             xdxfDictionaries.end() );
+    void push( size_t worker, size_t task )
+    {
+        Mutex::Lock _( queues[ worker ]->mutex );
+        queues[ worker ]->tasks.push_back( task );
     }
-#endif
-#ifdef GD_SDICT_SUPPORT
+
+    bool pop( size_t worker, size_t & task )
     {
-        vector< sptr< Dictionary::Class > > sdictDictionaries =
-                Sdict::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+        {
+            Queue & own = *queues[ worker ];
+            Mutex::Lock _( own.mutex );
 
-        dictionaries.insert( dictionaries.end(), sdictDictionaries.begin(),
-                             sdictDictionaries.end() );
+            if ( !own.tasks.empty() )
+            {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        for( size_t x = 1; x < queues.size(); ++x )
+        {
+            Queue & victim = *queues[ ( worker + x ) % queues.size() ];
+            Mutex::Lock _( victim.mutex );
+
+            if ( !victim.tasks.empty() )
+            {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
     }
-#endif
-#ifdef GD_AARD_SUPPORT
-    {
-        vector< sptr< Dictionary::Class > > aardDictionaries =
-                Aard::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this, cfg_.maxHeadwordsToExpand );
+};
 
-        dictionaries.insert( dictionaries.end(), aardDictionaries.begin(),
-                             aardDictionaries.end() );
+class LoadFilesRunnable: public QRunnable
+{
+    LoadDictionaries & ld;
+    WorkStealingQueues & queues;
+    size_t worker;
+    QSemaphore & hasExited;
+
+public:
+
+    LoadFilesRunnable( LoadDictionaries & ld_, WorkStealingQueues & queues_,
+                       size_t worker_, QSemaphore & hasExited_ ):
+        ld( ld_ ), queues( queues_ ), worker( worker_ ), hasExited( hasExited_ )
+    {}
+
+    ~LoadFilesRunnable()
+    {
+        hasExited.release();
     }
-#endif
-#ifdef GD_ZIPSOUNDS_SUPPORT
+
+    virtual void run()
     {
-        vector< sptr< Dictionary::Class > > zipSoundsDictionaries =
-                ZipSounds::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+        size_t task;
 
-        dictionaries.insert( dictionaries.end(), zipSoundsDictionaries.begin(),
-                             zipSoundsDictionaries.end() );
+        while( queues.pop( worker, task ) )
+            ld.loadFileTask( task );
     }
-#endif
-#ifdef GD_MDICT_SUPPORT
+};
+
+/// Orders the tasks largest first
+struct FileTaskSizeGreater
+{
+    vector< qint64 > const & sizes;
+
+    FileTaskSizeGreater( vector< qint64 > const & sizes_ ): sizes( sizes_ )
+    {}
+
+    bool operator()( size_t a, size_t b ) const
+    { return sizes[ a ] > sizes[ b ]; }
+};
+
+}
+
+void LoadDictionaries::queueFiles( QString const & path, vector< string > const & allFiles,
+                                   QVector< qint64 > const & sizes )
+{
+    PendingDirectory dir;
+    dir.path = path;
+    dir.beginSlot = loaded.size();
+
+    for( size_t x = 0; x < allFiles.size(); ++x )
     {
-        vector< sptr< Dictionary::Class > > mdxDictionaries =
-                Mdx::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+        FileTask task;
+        task.file = allFiles[ x ];
+        // The time to index a dictionary goes with the size of its data, and
+        // the main file is often just a small header
+        task.size = x < (size_t) sizes.size() ? sizes[ x ] : 0;
+        task.slot = loaded.size();
 
-        dictionaries.insert( dictionaries.end(), mdxDictionaries.begin(),
-                             mdxDictionaries.end() );
+        fileTasks.push_back( task );
+        loaded.push_back( vector< sptr< Dictionary::Class > >() );
     }
-#endif
-#ifdef GD_GLS_SUPPORT
-    {
-        vector< sptr< Dictionary::Class > > glsDictionaries =
-                Gls::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
 
-        dictionaries.insert( dictionaries.end(), glsDictionaries.begin(),
-                             glsDictionaries.end() );
+    dir.endSlot = loaded.size();
+    pendingDirectories.push_back( dir );
+}
+
+void LoadDictionaries::loadFileTask( size_t task )
+{
+    FileTask const & t = fileTasks[ task ];
+
+    try
+    {
+        // Each task has its own slot, so no locking is needed to fill it
+        makeFileDictionaries( vector< string >( 1, t.file ), FileDictionaryParams( cfg_ ),
+                              *this, loaded[ t.slot ] );
     }
-#endif
-#ifdef GD_ZIM_SUPPORT
+    catch( std::exception & e )
     {
-        vector< sptr< Dictionary::Class > > zimDictionaries =
-                Zim::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this, cfg_.maxHeadwordsToExpand );
-
-        dictionaries.insert( dictionaries.end(), zimDictionaries.begin(),
-                             zimDictionaries.end() );
+        Mutex::Lock _( sMutex );
+        exceptionText.append( e.what() );
     }
-#endif
-#ifdef GD_SLOB_SUPPORT
+
+    tasksLeft.deref();
+}
+
+void LoadDictionaries::runFileTasks()
+{
+    if ( !fileTasks.empty() )
     {
-        vector< sptr< Dictionary::Class > > slobDictionaries =
-                Slob::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this, cfg_.maxHeadwordsToExpand );
+        vector< qint64 > sizes( fileTasks.size() );
+        vector< size_t > order( fileTasks.size() );
 
-        dictionaries.insert( dictionaries.end(), slobDictionaries.begin(),
-                             slobDictionaries.end() );
+        for( size_t x = 0; x < fileTasks.size(); ++x )
+        {
+            sizes[ x ] = fileTasks[ x ].size;
+            order[ x ] = x;
+        }
+
+        std::stable_sort( order.begin(), order.end(), FileTaskSizeGreater( sizes ) );
+
+        QThreadPool * tp = QThreadPool::globalInstance();
+
+        size_t workers = qMax( 1, tp->maxThreadCount() );
+        if ( workers > fileTasks.size() )
+            workers = fileTasks.size();
+
+        // Dealt round-robin, so every worker starts with the largest it got
+        WorkStealingQueues queues( workers );
+        for( size_t x = 0; x < order.size(); ++x )
+            queues.push( x % workers, order[ x ] );
+
+        tasksLeft.storeRelease( (int) fileTasks.size() );
+
+        QSemaphore hasExited;
+
+        for( size_t x = 0; x < workers; ++x )
+            tp->start( new LoadFilesRunnable( *this, queues, x, hasExited ) );
+
+        const QString tes = tr("Time elapsed: %2 s");
+
+        while( !hasExited.tryAcquire( workers, 1000 ) )
+            emit showMessage(tr("Handling User's Dictionary%1%3%5%7").arg(rn).
+                             arg(tr("%1 left").arg(Qt4x5::AtomicInt::loadAcquire(tasksLeft))).arg(rn).
+                             arg(tes.arg(timer.elapsed() / 1000)) );
     }
-#endif
-#ifdef GD_EPWING_SUPPORT
+
+    // Record what each directory produced, and put everything in order
+    for( size_t x = 0; x < pendingDirectories.size(); ++x )
     {
-        vector< sptr< Dictionary::Class > > epwingDictionaries =
-                Epwing::makeDictionaries( allFiles, FsEncoding::encode( Config::getIndexDir() ), *this );
+        PendingDirectory const & dir = pendingDirectories[ x ];
 
-        dictionaries.insert( dictionaries.end(), epwingDictionaries.begin(),
-                             epwingDictionaries.end() );
+        vector< string > ids;
+        for( size_t y = dir.beginSlot; y < dir.endSlot; ++y )
+            for( size_t z = 0; z < loaded[ y ].size(); ++z )
+                ids.push_back( loaded[ y ][ z ]->getId() );
+
+        LoadManifest::storeDictionaries( dir.path, ids );
     }
-#endif
+
+    for( size_t x = 0; x < loaded.size(); ++x )
+        dictionaries.insert( dictionaries.end(), loaded[ x ].begin(), loaded[ x ].end() );
+
+    fileTasks.clear();
+    pendingDirectories.clear();
+    loaded.clear();
 }
 
-void LoadDictionaries::indexingDictionary( string const & dictionaryName ) throw()
+#else
+
+void LoadDictionaries::handleFiles( QString const & path,
+                                    const std::vector< std::string > & allFiles )
 {
-    emit showMessage( tr("Indexing Dictionary%1%3").arg(rn).arg(QString::fromUtf8( dictionaryName.c_str() )) );
+    vector< sptr< Dictionary::Class > > made;
+
+    makeFileDictionaries( allFiles, FileDictionaryParams( cfg_ ), *this, made );
+
+    vector< string > ids;
+    ids.reserve( made.size() );
+    for( size_t x = 0; x < made.size(); ++x )
+        ids.push_back( made[ x ]->getId() );
+
+    LoadManifest::storeDictionaries( path, ids );
+
+    dictionaries.insert( dictionaries.end(), made.begin(), made.end() );
 }
 
-#ifdef DICTS_LOADING_CONCURRENT
-void LoadDictionariesRunnable::run()
+#endif
+
+void LoadDictionaries::indexingDictionary( string const & dictionaryName ) throw()
 {
-    std::string exceptionText;
-    std::vector< sptr< Dictionary::Class > > dictionaries;
-    try
-    {
-        ld.handleFiles(dictionaries, allFiles);
-    }
-    catch( std::exception & e )
-    {
-        exceptionText = e.what();
-    }
-    ld.addDictionaries(dictionaries, exceptionText);
+    indexedCount.ref();
+    emit showMessage( tr("Indexing Dictionary%1%3").arg(rn).arg(QString::fromUtf8( dictionaryName.c_str() )) );
 }
-#endif
 
 void LoadDictionaries::loadDictionaries( QWidget * parent, bool canHideParent,
                                          Config::Class const & cfg,
                                          std::vector< sptr< Dictionary::Class > > & dictionaries,
                                          QNetworkAccessManager & dictNetMgr,
-                                         bool doDeferredInit_ )
+                                         bool doDeferredInit_,
+                                         bool useManifest )
 {
     QElapsedTimer timer;
     timer.start();
@@ -653,12 +940,16 @@ void LoadDictionaries::loadDictionaries( QWidget * parent, bool canHideParent,
     QObject::connect( &loadDicts, SIGNAL( finished() ),
                       &localLoop, SLOT( quit() ) );
 
+    LoadManifest::beginLoading( Config::getIndexDir() + "manifest", useManifest );
+
     loadDicts.start();
 
     localLoop.exec();
 
     loadDicts.wait();
 
+    LoadManifest::endLoading();
+
     QThreadPool::globalInstance()->setExpiryTimeout(expiryTimeout);
 
     const string &err = loadDicts.getExceptionText();
@@ -677,11 +968,25 @@ void LoadDictionaries::loadDictionaries( QWidget * parent, bool canHideParent,
 
     if(canHideParent && pVisible)
         parent->show();
+    // A cold start is one which had to index anything
+    int indexed = loadDicts.getIndexedCount();
+    QString startTime = indexed ?
+        LoadDictionaries::tr( "Cold start, %1 dictionaries indexed: %2 s" ).arg( indexed ) :
+        LoadDictionaries::tr( "Warm start: %2 s" );
+    startTime = startTime.arg( timer.elapsed() / 1000.0, 0, 'f', 1 );
+
+    gdDebug( "Dictionaries loaded: %s\n", startTime.toUtf8().data() );
+
     splash.showUiMsg(LoadDictionaries::tr("Loading Done.%1%3 Dictionaries Handled%5%7").
-                     arg(rn).arg(dictionaries.size()).arg(rn).arg(LoadDictionaries::tr("Time elapsed: %2 s").arg(timer.elapsed() / 1000)));
+                     arg(rn).arg(dictionaries.size()).arg(rn).arg(startTime));
     splash.finish(parent);
 }
 
+QStringList LoadDictionaries::dictionaryNameFilters()
+{
+    return DictNameFilter();
+}
+
 void LoadDictionaries::doDeferredInit( std::vector< sptr< Dictionary::Class > > & dictionaries )
 {
     for( unsigned x = 0; x < dictionaries.size(); ++x )
@@ -6,10 +6,13 @@
 
 #include "dictionary.hh"
 #include <QThread>
+#include <QStringList>
+#include <QVector>
 class QNetworkAccessManager;
 class QThreadPool;
 class QElapsedTimer;
 namespace Config { struct Class; struct Path;}
+namespace LazyDictionary { class Factory; }
 
 /// Use loadDictionaries() function below -- this is a helper thread class
 class LoadDictionaries: public QThread, public Dictionary::Initializing
@@ -22,10 +25,30 @@ private:
     const bool doDeferredInit_;
     QNetworkAccessManager & dictNetMgr;
     std::string exceptionText;
+    sptr< LazyDictionary::Factory > fileDictionaryFactory;
+    AtomicInt32 indexedCount;
 #ifdef DICTS_LOADING_CONCURRENT
-    QSemaphore sWait;
+    /// A dictionary file waiting to be loaded by the workers
+    struct FileTask
+    {
+        std::string file;
+        qint64 size; // Of all the files the dictionary seems to consist of
+        size_t slot; // Index in 'loaded' to put the results to
+    };
+
+    /// A directory whose files are being loaded by the workers
+    struct PendingDirectory
+    {
+        QString path;
+        size_t beginSlot, endSlot;
+    };
+
+    std::vector< FileTask > fileTasks;
+    std::vector< PendingDirectory > pendingDirectories;
+    /// Dictionaries made, in the order the files were found in
+    std::vector< std::vector< sptr< Dictionary::Class > > > loaded;
+    AtomicInt32 tasksLeft;
     Mutex sMutex;
-    AtomicInt32 ref;
 #endif
 
 protected:
@@ -50,36 +73,47 @@ private:
     { return exceptionText; }
     void handlePath( Config::Path const & );
 
-public:
 #ifdef DICTS_LOADING_CONCURRENT
-    inline void addDictionaries(const std::vector< sptr< Dictionary::Class > > &dics, const std::string &e1 = std::string()) {
-        sMutex.lock();
-        if(!e1.empty())
-            exceptionText.append(e1);
-        dictionaries.insert( dictionaries.end(), dics.begin(), dics.end() );
-        sMutex.unlock();
-        --ref;
-        sWait.release();
-    }
+    /// Queues the files of the directory to be loaded by runFileTasks(). The
+    /// sizes are the ones LoadManifest::listDirectory() gives.
+    void queueFiles( QString const & path, std::vector< std::string > const & allFiles,
+                     QVector< qint64 > const & sizes );
+
+    /// Loads all the queued files on the thread pool, then appends the
+    /// dictionaries made to the list in the order the files were queued.
+    void runFileTasks();
+#else
+    void handleFiles(QString const & path, const std::vector< std::string > &allFiles);
 #endif
+
+public:
 #ifdef DICTS_LOADING_CONCURRENT
-    void handleFiles(std::vector< sptr< Dictionary::Class > > &dictionaries,
-                     const std::vector< std::string > &allFiles);
-#else
-    void handleFiles(const std::vector< std::string > &allFiles);
+    /// Loads a single queued file. Called from the worker threads.
+    void loadFileTask( size_t task );
 #endif
     void handleOthers();
 
+    /// Returns the number of dictionaries which had to be indexed
+    int getIndexedCount()
+    { return Qt4x5::AtomicInt::loadAcquire( indexedCount ); }
+
     /// Loads all dictionaries mentioned in the configuration passed, into the
     /// supplied array. When necessary, a window would pop up describing the process.
     /// If showInitially is passed as true, the window will always popup.
     /// If doDeferredInit is true (default), doDeferredInit() is done on all
     /// dictionaries at the end.
+    /// If useManifest is true, directories and indices which were unchanged
+    /// in the previous run are taken from the load manifest without checking
+    /// them. Use LoadManifest::Validator afterwards to check them.
     static void loadDictionaries( QWidget * parent, bool canHideParent,
                                   Config::Class const & cfg,
                                   std::vector< sptr< Dictionary::Class > > &,
                                   QNetworkAccessManager & dictNetMgr,
-                                  bool doDeferredInit = true );
+                                  bool doDeferredInit = true,
+                                  bool useManifest = false );
+
+    /// Returns the file name patterns of all the supported dictionary files
+    static QStringList dictionaryNameFilters();
 
     /// Runs deferredInit() on all the given dictionaries. Useful when
     /// loadDictionaries() was previously called with doDeferredInit = false.
@@ -87,24 +121,5 @@ public:
 
 };
 
-#ifdef DICTS_LOADING_CONCURRENT
-#include <QRunnable>
-
-class LoadDictionariesRunnable : public QRunnable
-{
-public:
-    LoadDictionariesRunnable(LoadDictionaries & _ld, std::vector< std::string > const &_allFiles)
-        : ld(_ld), allFiles(_allFiles)
-    {}
-    ~LoadDictionariesRunnable()
-    {}
-    void run();
-
-private:
-    LoadDictionaries &ld;
-    const std::vector< std::string > allFiles;
-};
-#endif
-
 #endif
 
@@ -0,0 +1,615 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "loadmanifest.hh"
+#include "config.hh"
+#include "dictionary.hh"
+#include "fsencoding.hh"
+#include "lazydictionary.hh"
+#include "gddebug.hh"
+#include "qt4x5.hh"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+
+#include <map>
+#include <set>
+
+namespace LoadManifest {
+
+using std::map;
+using std::set;
+using LazyDictionary::Snapshot;
+
+namespace {
+
+enum
+{
+    Signature = 0x4D4C4447, // GDLM on little-endian, MLDG on big-endian
+    CurrentFormatVersion = 5
+};
+
+typedef map< string, vector< string > > Indices; // index file -> dictionary files
+typedef map< string, Snapshot > Snapshots; // dictionary id -> snapshot
+
+struct State
+{
+    Mutex mutex;
+    QString fileName;
+    string indexDir;
+    bool loading, useCached;
+
+    // What the previous run left, and what is being recorded now
+    QMap< QString, Directory > oldDirectories, directories;
+    Indices oldIndices, indices;
+    Snapshots oldSnapshots, snapshots;
+
+    // What the last loading took from the cache without checking
+    QMap< QString, Directory > cachedDirectories;
+    Indices cachedIndices;
+
+    State(): loading( false ), useCached( false )
+    {}
+};
+
+State & state()
+{
+    static State s;
+    return s;
+}
+
+/// Returns the name the dictionary's files share, with the dot following it
+QString dictionaryStem( QString const & fileName )
+{
+    QString name = fileName;
+
+    if ( name.endsWith( ".dz", Qt::CaseInsensitive ) )
+        name.chop( 3 );
+
+    int dot = name.lastIndexOf( '.' );
+
+    return dot < 0 ? name + '.' : name.left( dot + 1 );
+}
+
+void writeStrings( QDataStream & out, vector< string > const & strings )
+{
+    out << (quint32) strings.size();
+    for( size_t x = 0; x < strings.size(); ++x )
+        out << QByteArray( strings[ x ].data(), strings[ x ].size() );
+}
+
+void readStrings( QDataStream & in, vector< string > & strings )
+{
+    quint32 count;
+    in >> count;
+
+    strings.clear();
+    for( quint32 x = 0; x < count && in.status() == QDataStream::Ok; ++x )
+    {
+        QByteArray str;
+        in >> str;
+        strings.push_back( string( str.constData(), str.size() ) );
+    }
+}
+
+/// Gives back what the cancelled validation hasn't found up-to-date, for
+/// the next one to check
+void keepPending( QMap< QString, Directory > const & directories,
+                  Indices const & indices )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    // A new loading starts over, with a cache of its own
+    if( s.loading )
+        return;
+
+    for( QMap< QString, Directory >::const_iterator i = directories.constBegin();
+         i != directories.constEnd(); ++i )
+        s.cachedDirectories.insert( i.key(), i.value() );
+
+    for( Indices::const_iterator i = indices.begin(); i != indices.end(); ++i )
+        s.cachedIndices.insert( *i );
+}
+
+/// Reads the manifest file into oldDirectories/oldIndices. Any damage just
+/// makes the manifest be ignored.
+void read( State & s )
+{
+    s.oldDirectories.clear();
+    s.oldIndices.clear();
+    s.oldSnapshots.clear();
+
+    QFile file( s.fileName );
+    if( !file.open( QFile::ReadOnly ) )
+        return;
+
+    QDataStream in( &file );
+
+    quint32 signature, formatVersion;
+    QString programVersion;
+    in >> signature >> formatVersion >> programVersion;
+
+    if( in.status() != QDataStream::Ok || signature != Signature
+        || formatVersion != CurrentFormatVersion || programVersion != PROGRAM_VERSION )
+        return;
+
+    QMap< QString, Directory > directories;
+    Indices indices;
+    Snapshots snapshots;
+
+    quint32 count;
+    in >> count;
+
+    for( quint32 x = 0; x < count && in.status() == QDataStream::Ok; ++x )
+    {
+        QString path;
+        Directory dir;
+        in >> path;
+        readStrings( in, dir.files );
+        in >> dir.sizes >> dir.subdirs;
+        readStrings( in, dir.dictionaryIds );
+        directories.insert( path, dir );
+    }
+
+    in >> count;
+
+    for( quint32 x = 0; x < count && in.status() == QDataStream::Ok; ++x )
+    {
+        QByteArray indexFile;
+        in >> indexFile;
+        readStrings( in, indices[ string( indexFile.constData(), indexFile.size() ) ] );
+    }
+
+    in >> count;
+
+    for( quint32 x = 0; x < count && in.status() == QDataStream::Ok; ++x )
+    {
+        Snapshot snapshot;
+        in >> snapshot;
+        snapshots[ snapshot.id ] = snapshot;
+    }
+
+    if( in.status() != QDataStream::Ok )
+    {
+        gdWarning( "Load manifest \"%s\" is damaged, ignoring it\n", s.fileName.toUtf8().data() );
+        return;
+    }
+
+    s.oldDirectories = directories;
+    s.oldIndices.swap( indices );
+    s.oldSnapshots.swap( snapshots );
+}
+
+/// Writes directories/indices to the manifest file
+void write( State & s )
+{
+    if( s.fileName.isEmpty() )
+        return;
+
+    QString tmpName = s.fileName + ".tmp";
+
+    QFile file( tmpName );
+    if( !file.open( QFile::WriteOnly | QFile::Truncate ) )
+    {
+        gdWarning( "Can't write load manifest \"%s\"\n", tmpName.toUtf8().data() );
+        return;
+    }
+
+    {
+        QDataStream out( &file );
+
+        out << (quint32) Signature << (quint32) CurrentFormatVersion
+            << QString( PROGRAM_VERSION );
+
+        out << (quint32) s.directories.size();
+        for( QMap< QString, Directory >::const_iterator i = s.directories.constBegin();
+             i != s.directories.constEnd(); ++i )
+        {
+            out << i.key();
+            writeStrings( out, i.value().files );
+            out << i.value().sizes << i.value().subdirs;
+            writeStrings( out, i.value().dictionaryIds );
+        }
+
+        out << (quint32) s.indices.size();
+        for( Indices::const_iterator i = s.indices.begin(); i != s.indices.end(); ++i )
+        {
+            out << QByteArray( i->first.data(), i->first.size() );
+            writeStrings( out, i->second );
+        }
+
+        // Only the snapshots of the dictionaries still found are kept
+        vector< Snapshot const * > snapshots;
+        for( QMap< QString, Directory >::const_iterator i = s.directories.constBegin();
+             i != s.directories.constEnd(); ++i )
+        {
+            vector< string > const & ids = i.value().dictionaryIds;
+            for( size_t x = 0; x < ids.size(); ++x )
+            {
+                Snapshots::const_iterator j = s.snapshots.find( ids[ x ] );
+                if( j != s.snapshots.end() )
+                    snapshots.push_back( &j->second );
+            }
+        }
+
+        out << (quint32) snapshots.size();
+        for( size_t x = 0; x < snapshots.size(); ++x )
+            out << *snapshots[ x ];
+    }
+
+    file.close();
+
+    QFile::remove( s.fileName );
+    if( !QFile::rename( tmpName, s.fileName ) )
+        gdWarning( "Can't write load manifest \"%s\"\n", s.fileName.toUtf8().data() );
+}
+
+}
+
+bool operator == ( Directory const & a, Directory const & b )
+{
+    return a.files == b.files && a.subdirs == b.subdirs;
+}
+
+void listDirectory( QString const & path, QStringList const & nameFilters,
+                    Directory & result )
+{
+    result.files.clear();
+    result.sizes.clear();
+    result.subdirs.clear();
+
+    QDir dir( path );
+
+    // All the files are listed, as the ones not matching the filters still
+    // count in the sizes
+    QFileInfoList entries = dir.entryInfoList( QDir::AllDirs | QDir::Files | QDir::Hidden
+                                               | QDir::NoDotAndDotDot );
+
+    map< QString, qint64 > sizes;
+    QStringList names;
+
+    for( QFileInfoList::const_iterator i = entries.constBegin();
+         i != entries.constEnd(); ++i )
+    {
+        if ( i->isDir() )
+        {
+            if ( !i->isHidden() )
+                result.subdirs.append( i->absoluteFilePath() );
+
+            continue;
+        }
+
+        sizes[ i->fileName() ] = i->size();
+
+        if ( !i->isHidden() && QDir::match( nameFilters, i->fileName() ) )
+        {
+            result.files.push_back( FsEncoding::encode( QDir::toNativeSeparators( i->absoluteFilePath() ) ) );
+            names.append( i->fileName() );
+        }
+    }
+
+    for( int x = 0; x < names.size(); ++x )
+    {
+        QString stem = dictionaryStem( names[ x ] );
+        qint64 size = 0;
+
+        for( map< QString, qint64 >::const_iterator i = sizes.lower_bound( stem );
+             i != sizes.end() && i->first.startsWith( stem ); ++i )
+            size += i->second;
+
+        result.sizes.append( size );
+    }
+}
+
+void beginLoading( QString const & fileName, bool useCached )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    s.fileName = fileName;
+    s.indexDir = FsEncoding::encode( Config::getIndexDir() );
+    s.loading = true;
+    s.useCached = useCached;
+
+    s.directories.clear();
+    s.indices.clear();
+    s.snapshots.clear();
+    s.cachedDirectories.clear();
+    s.cachedIndices.clear();
+
+    if( useCached )
+        read( s );
+    else
+    {
+        s.oldDirectories.clear();
+        s.oldIndices.clear();
+        s.oldSnapshots.clear();
+    }
+}
+
+void endLoading()
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    if( !s.loading )
+        return;
+
+    s.loading = false;
+
+    s.oldDirectories.clear();
+    s.oldIndices.clear();
+    s.oldSnapshots.clear();
+
+    write( s );
+}
+
+void save( vector< sptr< Dictionary::Class > > const & dictionaries )
+{
+    State & s = state();
+
+    set< string > ids, haveSnapshots;
+
+    {
+        Mutex::Lock _( s.mutex );
+
+        if( s.loading || s.fileName.isEmpty() )
+            return;
+
+        for( QMap< QString, Directory >::const_iterator i = s.directories.constBegin();
+             i != s.directories.constEnd(); ++i )
+            ids.insert( i.value().dictionaryIds.begin(), i.value().dictionaryIds.end() );
+
+        for( Snapshots::const_iterator i = s.snapshots.begin(); i != s.snapshots.end(); ++i )
+            haveSnapshots.insert( i->first );
+    }
+
+    // Taking the snapshots renders the icons, so it's done unlocked
+    vector< Snapshot > snapshots;
+
+    for( size_t x = 0; x < dictionaries.size(); ++x )
+    {
+        string const & id = dictionaries[ x ]->getId();
+
+        if( ids.find( id ) == ids.end() )
+            continue;
+
+        LazyDictionary::Proxy * proxy =
+            dynamic_cast< LazyDictionary::Proxy * >( dictionaries[ x ].get() );
+
+        if( proxy && !proxy->isOpen() && haveSnapshots.find( id ) != haveSnapshots.end() )
+            continue;
+
+        snapshots.push_back( Snapshot( *dictionaries[ x ] ) );
+    }
+
+    Mutex::Lock _( s.mutex );
+
+    if( s.loading )
+        return;
+
+    for( size_t x = 0; x < snapshots.size(); ++x )
+        s.snapshots[ snapshots[ x ].id ] = snapshots[ x ];
+
+    write( s );
+}
+
+bool findDirectory( QString const & path, Directory & result )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    if( !s.loading || !s.useCached )
+        return false;
+
+    QMap< QString, Directory >::const_iterator i = s.oldDirectories.constFind( path );
+    if( i == s.oldDirectories.constEnd() )
+        return false;
+
+    result = i.value();
+
+    s.directories.insert( path, result );
+    s.cachedDirectories.insert( path, result );
+
+    return true;
+}
+
+void storeDirectory( QString const & path, Directory const & dir )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    if( s.loading )
+        s.directories.insert( path, dir );
+}
+
+bool findSnapshots( QString const & path, vector< Snapshot > & result )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    result.clear();
+
+    if( !s.loading || !s.useCached || !s.cachedDirectories.contains( path ) )
+        return false;
+
+    vector< string > const & ids = s.cachedDirectories[ path ].dictionaryIds;
+
+    for( size_t x = 0; x < ids.size(); ++x )
+    {
+        Snapshots::const_iterator i = s.oldSnapshots.find( ids[ x ] );
+        if( i == s.oldSnapshots.end() )
+            return false;
+
+        result.push_back( i->second );
+    }
+
+    // The indices of these won't be opened, so have the Validator check them
+    for( size_t x = 0; x < result.size(); ++x )
+    {
+        string indexFile = s.indexDir + result[ x ].id;
+
+        s.snapshots[ result[ x ].id ] = result[ x ];
+        s.indices[ indexFile ] = result[ x ].files;
+        s.cachedIndices[ indexFile ] = result[ x ].files;
+    }
+
+    return true;
+}
+
+void storeDictionaries( QString const & path, vector< string > const & ids )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    if( !s.loading )
+        return;
+
+    QMap< QString, Directory >::iterator i = s.directories.find( path );
+    if( i != s.directories.end() )
+        i.value().dictionaryIds = ids;
+}
+
+bool isIndexUpToDate( vector< string > const & dictionaryFiles,
+                      string const & indexFile )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    if( !s.loading || !s.useCached )
+        return false;
+
+    Indices::const_iterator i = s.oldIndices.find( indexFile );
+    if( i == s.oldIndices.end() || i->second != dictionaryFiles )
+        return false;
+
+    s.indices[ indexFile ] = dictionaryFiles;
+    s.cachedIndices[ indexFile ] = dictionaryFiles;
+
+    return true;
+}
+
+void storeIndexUpToDate( vector< string > const & dictionaryFiles,
+                         string const & indexFile )
+{
+    State & s = state();
+    Mutex::Lock _( s.mutex );
+
+    if( s.loading )
+        s.indices[ indexFile ] = dictionaryFiles;
+}
+
+Validator::Validator( QStringList const & nameFilters_, QObject * parent ):
+    QThread( parent ),
+    nameFilters( nameFilters_ )
+{
+}
+
+Validator::~Validator()
+{
+    cancel();
+}
+
+void Validator::cancel()
+{
+    isCancelled.ref();
+    wait();
+    isCancelled.deref();
+}
+
+void Validator::run()
+{
+    State & s = state();
+
+    QMap< QString, Directory > directories;
+    Indices indices;
+
+    {
+        Mutex::Lock _( s.mutex );
+
+        if( s.loading )
+            return;
+
+        directories = s.cachedDirectories;
+        s.cachedDirectories.clear();
+
+        indices.swap( s.cachedIndices );
+    }
+
+    // What's found up-to-date is dropped from the sets as it's checked, so
+    // that what's left gets checked by the next run if this one is cancelled
+
+    QStringList staleDirectories;
+    vector< string > staleIndices;
+
+    for( QMap< QString, Directory >::iterator i = directories.begin(); i != directories.end(); )
+    {
+        if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+        {
+            keepPending( directories, indices );
+            return;
+        }
+
+        Directory actual;
+        listDirectory( i.key(), nameFilters, actual );
+
+        if( !( actual == i.value() ) )
+        {
+            staleDirectories.append( i.key() );
+            ++i;
+        }
+        else
+            i = directories.erase( i );
+    }
+
+    for( Indices::iterator i = indices.begin(); i != indices.end(); )
+    {
+        if( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+        {
+            keepPending( directories, indices );
+            return;
+        }
+
+        if( Dictionary::isIndexOutdated( i->second, i->first ) )
+        {
+            staleIndices.push_back( i->first );
+            ++i;
+        }
+        else
+            indices.erase( i++ );
+    }
+
+    if( staleDirectories.isEmpty() && staleIndices.empty() )
+        return;
+
+    GD_DPRINTF( "Load manifest: %d directories and %d indices changed\n",
+                staleDirectories.size(), (int) staleIndices.size() );
+
+    {
+        Mutex::Lock _( s.mutex );
+
+        if( s.loading )
+            return; // Being reloaded already
+
+        for( int x = 0; x < staleDirectories.size(); ++x )
+            s.directories.remove( staleDirectories[ x ] );
+
+        for( size_t x = 0; x < staleIndices.size(); ++x )
+        {
+            s.indices.erase( staleIndices[ x ] );
+
+            // Make the dictionary be opened for real next time
+            if( staleIndices[ x ].compare( 0, s.indexDir.size(), s.indexDir ) == 0 )
+                s.snapshots.erase( staleIndices[ x ].substr( s.indexDir.size() ) );
+        }
+
+        write( s );
+    }
+
+    emit changed();
+}
+
+}
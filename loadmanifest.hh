@@ -0,0 +1,121 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __LOADMANIFEST_HH_INCLUDED__
+#define __LOADMANIFEST_HH_INCLUDED__
+
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+#include <string>
+#include <vector>
+#include "mutex.hh"
+#include "sptr.hh"
+
+namespace Dictionary { class Class; }
+namespace LazyDictionary { struct Snapshot; }
+
+/// The load manifest remembers between runs what each scanned directory
+/// contained and which indices were found up-to-date. While dictionaries
+/// are being loaded at startup, this lets unchanged directories and
+/// dictionaries be registered without enumerating the directories or
+/// checking the timestamps of every file. The full check is then done in
+/// the background by the Validator once the main window is up. Snapshots of
+/// the dictionaries each directory produced are kept as well, so that they
+/// can be served by LazyDictionary proxies without opening them.
+namespace LoadManifest {
+
+using std::string;
+using std::vector;
+
+/// Contents of a single scanned directory
+struct Directory
+{
+    vector< string > files; // Dictionary files, in the fs encoding
+    QVector< qint64 > sizes; // Of each file and the ones named alike with it
+    QStringList subdirs; // Absolute paths of the subdirectories
+    vector< string > dictionaryIds; // Dictionaries made from the files
+};
+
+bool operator == ( Directory const &, Directory const & );
+
+/// Lists the dictionary files and subdirectories of the given directory
+/// directly from the file system. The size of each file is summed up with
+/// the sizes of all the files named alike, such as its data and index files,
+/// as that's what the time to load the dictionary goes with.
+void listDirectory( QString const & path, QStringList const & nameFilters,
+                    Directory & );
+
+/// Loads the manifest from the given file and starts recording a new one.
+/// If useCached is false, nothing is served from the loaded manifest, but
+/// the new one is still recorded.
+void beginLoading( QString const & fileName, bool useCached );
+
+/// Saves the manifest recorded since beginLoading(). Only the entries
+/// looked up or stored during the loading are kept. After this call no
+/// cached answers are given until the next beginLoading().
+void endLoading();
+
+/// Takes snapshots of the given dictionaries which were made from the
+/// recorded directories and saves the manifest. Must be called from the GUI
+/// thread, after endLoading(). Proxies which were never opened keep the
+/// snapshots they were made from.
+void save( vector< sptr< Dictionary::Class > > const & dictionaries );
+
+/// Retrieves the directory contents remembered from the previous run.
+/// Returns false if there's none, or the cache is not in use.
+bool findDirectory( QString const & path, Directory & );
+
+/// Records the directory contents as listed from the file system.
+void storeDirectory( QString const & path, Directory const & );
+
+/// Retrieves the snapshots of all the dictionaries the directory produced in
+/// the previous run. Returns false unless findDirectory() succeeded for it
+/// and there's a snapshot for each of its dictionaries.
+bool findSnapshots( QString const & path, vector< LazyDictionary::Snapshot > & );
+
+/// Records the ids of the dictionaries made from the directory's files.
+void storeDictionaries( QString const & path, vector< string > const & ids );
+
+/// Returns true if the index was up-to-date with the given dictionary files
+/// in the previous run. Always returns false when the cache is not in use.
+bool isIndexUpToDate( vector< string > const & dictionaryFiles,
+                      string const & indexFile );
+
+/// Records that the index was found up-to-date with the given files.
+void storeIndexUpToDate( vector< string > const & dictionaryFiles,
+                         string const & indexFile );
+
+/// Re-checks, against the file system, everything the last loading took
+/// from the cache. The manifest is corrected and saved, and the changed()
+/// signal is emitted if any of it turned out to be stale.
+class Validator: public QThread
+{
+    Q_OBJECT
+
+    QStringList nameFilters;
+    AtomicInt32 isCancelled;
+
+public:
+
+    Validator( QStringList const & nameFilters, QObject * parent = 0 );
+    ~Validator();
+
+    /// Stops the validation, if it's running, and waits for it to finish.
+    /// What's left unchecked is checked once it's started again.
+    void cancel();
+
+signals:
+
+    /// Some of the dictionaries loaded from the cached data have changed on
+    /// disk, so the dictionaries should be reloaded.
+    void changed();
+
+protected:
+
+    virtual void run();
+};
+
+}
+
+#endif
@@ -0,0 +1,416 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+/// A headless benchmark of the lookups. It loads the dictionaries
+/// configured, then replays a query log through the word finder, the
+/// stemmed search and the article maker, measuring each request. The same
+/// queries are also sent to every dictionary directly, so the figures can be
+/// told apart per dictionary format. Build it with lookupbench.pro.
+
+#include <QApplication>
+#include <QWidget>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QAtomicInt>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "config.hh"
+#include "dictionary.hh"
+#include "loaddictionaries.hh"
+#include "wordfinder.hh"
+#include "article_maker.hh"
+#include "instances.hh"
+#include "wstring_qt.hh"
+#include "lookupbench.hh"
+
+using std::vector;
+using std::string;
+
+// Every allocation made by the process is counted, so the figures include
+// the ones done on the worker threads while serving a request.
+
+static QBasicAtomicInt allocationCount = Q_BASIC_ATOMIC_INITIALIZER( 0 );
+
+static void * countedAlloc( size_t size )
+{
+    allocationCount.fetchAndAddRelaxed( 1 );
+
+    void * p = malloc( size ? size : 1 );
+    if( !p )
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void * operator new( size_t size )
+{ return countedAlloc( size ); }
+
+void * operator new[]( size_t size )
+{ return countedAlloc( size ); }
+
+void * operator new( size_t size, std::nothrow_t const & ) throw()
+{
+    allocationCount.fetchAndAddRelaxed( 1 );
+    return malloc( size ? size : 1 );
+}
+
+void * operator new[]( size_t size, std::nothrow_t const & ) throw()
+{
+    allocationCount.fetchAndAddRelaxed( 1 );
+    return malloc( size ? size : 1 );
+}
+
+void operator delete( void * p ) throw()
+{ free( p ); }
+
+void operator delete[]( void * p ) throw()
+{ free( p ); }
+
+void operator delete( void * p, std::nothrow_t const & ) throw()
+{ free( p ); }
+
+void operator delete[]( void * p, std::nothrow_t const & ) throw()
+{ free( p ); }
+
+namespace {
+
+unsigned allocations()
+{
+    return (unsigned) allocationCount.fetchAndAddRelaxed( 0 );
+}
+
+/// Returns the peak resident set size of the process, in kilobytes
+long peakRss()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS pmc;
+    if( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+        return long( pmc.PeakWorkingSetSize / 1024 );
+    return 0;
+#else
+    struct rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+        return 0;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024; // Bytes there
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+/// Measurements of one kind of request
+struct Series
+{
+    vector< qint64 > nsecs;
+    quint64 allocations;
+
+    Series(): allocations( 0 )
+    {}
+
+    void add( qint64 ns, unsigned allocs )
+    {
+        nsecs.push_back( ns );
+        allocations += allocs;
+    }
+};
+
+/// Series, keyed by the dictionary format and the operation
+typedef std::map< std::pair< string, string >, Series > Results;
+
+/// Measures a single request. Create it right before issuing the request.
+class Probe
+{
+    QElapsedTimer timer;
+    unsigned allocationsBefore;
+
+public:
+
+    Probe(): allocationsBefore( allocations() )
+    { timer.start(); }
+
+    void record( Series & series )
+    { series.add( timer.nsecsElapsed(), allocations() - allocationsBefore ); }
+};
+
+/// Runs the event loop until the request is finished
+void waitFor( sptr< Dictionary::Request > const & req )
+{
+    if( req->isFinished() )
+        return;
+
+    QEventLoop loop;
+    QObject::connect( req.get(), SIGNAL( finished() ), &loop, SLOT( quit() ),
+                      Qt::QueuedConnection );
+
+    if( !req->isFinished() )
+        loop.exec();
+}
+
+/// Returns the format of the dictionary, as the extension of its main file
+string dictionaryFormat( Dictionary::Class & dict )
+{
+    vector< string > const & files = dict.getDictionaryFilenames();
+    if( files.empty() )
+        return "other";
+
+    QString name = QString::fromUtf8( files[ 0 ].c_str() ).toLower();
+    if( name.endsWith( ".dz" ) )
+        name.chop( 3 );
+
+    QString suffix = QFileInfo( name ).suffix();
+    return suffix.isEmpty() ? string( "other" ) : string( suffix.toUtf8().data() );
+}
+
+qint64 percentile( vector< qint64 > const & sorted, int percent )
+{
+    if( sorted.empty() )
+        return 0;
+
+    size_t rank = ( sorted.size() * percent + 99 ) / 100;
+    return sorted[ rank ? rank - 1 : 0 ];
+}
+
+void report( Results & results, bool csv )
+{
+    if( csv )
+        printf( "format,operation,requests,p50_us,p95_us,p99_us,requests_per_sec,allocs_per_request\n" );
+    else
+        printf( "%-12s %-10s %9s %10s %10s %10s %12s %12s\n", "format", "operation", "requests",
+                "p50, us", "p95, us", "p99, us", "requests/s", "allocs/req" );
+
+    for( Results::iterator i = results.begin(); i != results.end(); ++i )
+    {
+        Series & s = i->second;
+        if( s.nsecs.empty() )
+            continue;
+
+        std::sort( s.nsecs.begin(), s.nsecs.end() );
+
+        qint64 total = 0;
+        for( size_t x = 0; x < s.nsecs.size(); ++x )
+            total += s.nsecs[ x ];
+
+        double perSec = total ? s.nsecs.size() * 1e9 / total : 0;
+        double allocsPerRequest = double( s.allocations ) / s.nsecs.size();
+
+        printf( csv ? "%s,%s,%u,%.1f,%.1f,%.1f,%.1f,%.1f\n"
+                    : "%-12s %-10s %9u %10.1f %10.1f %10.1f %12.1f %12.1f\n",
+                i->first.first.c_str(), i->first.second.c_str(), (unsigned) s.nsecs.size(),
+                percentile( s.nsecs, 50 ) / 1000.0, percentile( s.nsecs, 95 ) / 1000.0,
+                percentile( s.nsecs, 99 ) / 1000.0, perSec, allocsPerRequest );
+    }
+}
+
+void usage()
+{
+    fprintf( stderr,
+             "Usage: gdlookupbench --queries <file> [--iterations <n>] [--max-results <n>] [--csv]\n"
+             "The query file lists one query per line, in UTF-8.\n" );
+}
+
+}
+
+int main( int argc, char ** argv )
+{
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
+    // No windows are ever shown
+    if( qgetenv( "QT_QPA_PLATFORM" ).isEmpty() )
+        qputenv( "QT_QPA_PLATFORM", "offscreen" );
+#endif
+
+    QApplication app( argc, argv );
+    app.setApplicationName( "GoldenDict" );
+
+    QString queriesFile;
+    int iterations = 1;
+    unsigned long maxResults = 40;
+    bool csv = false;
+
+    QStringList args = app.arguments();
+    for( int x = 1; x < args.size(); ++x )
+    {
+        if( args[ x ] == "--queries" && x + 1 < args.size() )
+            queriesFile = args[ ++x ];
+        else
+        if( args[ x ] == "--iterations" && x + 1 < args.size() )
+            iterations = qMax( 1, args[ ++x ].toInt() );
+        else
+        if( args[ x ] == "--max-results" && x + 1 < args.size() )
+            maxResults = qMax( 1, args[ ++x ].toInt() );
+        else
+        if( args[ x ] == "--csv" )
+            csv = true;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    if( queriesFile.isEmpty() )
+    {
+        usage();
+        return 1;
+    }
+
+    QStringList queries;
+    {
+        QFile file( queriesFile );
+        if( !file.open( QFile::ReadOnly ) )
+        {
+            fprintf( stderr, "Can't open the query file %s\n", queriesFile.toLocal8Bit().data() );
+            return 1;
+        }
+
+        QTextStream in( &file );
+        in.setCodec( "UTF-8" );
+
+        while( !in.atEnd() )
+        {
+            QString line = in.readLine().trimmed();
+            if( !line.isEmpty() )
+                queries.append( line );
+        }
+    }
+
+    Config::Class cfg;
+    try
+    {
+        cfg = Config::load();
+    }
+    catch( std::exception & e )
+    {
+        fprintf( stderr, "Can't load the configuration: %s\n", e.what() );
+        return 1;
+    }
+
+    vector< sptr< Dictionary::Class > > dictionaries;
+    QNetworkAccessManager dictNetMgr;
+    QWidget parent;
+
+    QElapsedTimer loadTimer;
+    loadTimer.start();
+
+    LoadDictionaries::loadDictionaries( &parent, true, cfg, dictionaries, dictNetMgr );
+
+    if( !csv )
+        printf( "%u dictionaries loaded in %.1f s, peak RSS %ld KiB\n",
+                (unsigned) dictionaries.size(), loadTimer.elapsed() / 1000.0, peakRss() );
+
+    vector< Instances::Group > groups;
+    ArticleMaker articleMaker( dictionaries, groups, cfg.preferences.displayStyle,
+                               cfg.preferences.addonStyle );
+    QMap< QString, QString > contexts;
+
+    WordFinder wordFinder( 0 );
+    SignalWaiter searchWaiter;
+    QObject::connect( &wordFinder, SIGNAL( finished() ), &searchWaiter, SLOT( signalled() ) );
+
+    vector< string > formats;
+    for( size_t x = 0; x < dictionaries.size(); ++x )
+        formats.push_back( dictionaryFormat( *dictionaries[ x ] ) );
+
+    Results results;
+    QElapsedTimer runTimer;
+    runTimer.start();
+
+    for( int iteration = 0; iteration < iterations; ++iteration )
+    {
+        for( int q = 0; q < queries.size(); ++q )
+        {
+            QString const & query = queries[ q ];
+            gd::wstring word = gd::toWString( query );
+
+            // The whole lookup, as done by the main window
+
+            {
+                searchWaiter.reset();
+                Probe probe;
+                wordFinder.prefixMatch( query, dictionaries, maxResults );
+                searchWaiter.wait();
+                probe.record( results[ std::make_pair( string( "all" ), string( "prefix" ) ) ] );
+            }
+
+            {
+                searchWaiter.reset();
+                Probe probe;
+                wordFinder.stemmedMatch( query, dictionaries );
+                searchWaiter.wait();
+                probe.record( results[ std::make_pair( string( "all" ), string( "stemmed" ) ) ] );
+            }
+
+            {
+                Probe probe;
+                sptr< Dictionary::DataRequest > req =
+                    articleMaker.makeDefinitionFor( query, Instances::Group::AllGroupId, contexts );
+                waitFor( req );
+                probe.record( results[ std::make_pair( string( "all" ), string( "article" ) ) ] );
+            }
+
+            // The same requests sent to every dictionary on its own
+
+            for( size_t x = 0; x < dictionaries.size(); ++x )
+            {
+                Dictionary::Class & dict = *dictionaries[ x ];
+
+                try
+                {
+                    {
+                        Probe probe;
+                        sptr< Dictionary::WordSearchRequest > req = dict.prefixMatch( word, maxResults );
+                        waitFor( req );
+                        probe.record( results[ std::make_pair( formats[ x ], string( "prefix" ) ) ] );
+                    }
+
+                    {
+                        Probe probe;
+                        sptr< Dictionary::WordSearchRequest > req = dict.stemmedMatch( word, 3, 3, 30 );
+                        waitFor( req );
+                        probe.record( results[ std::make_pair( formats[ x ], string( "stemmed" ) ) ] );
+                    }
+
+                    {
+                        Probe probe;
+                        sptr< Dictionary::DataRequest > req =
+                            dict.getArticle( word, vector< gd::wstring >() );
+                        waitFor( req );
+                        probe.record( results[ std::make_pair( formats[ x ], string( "article" ) ) ] );
+                    }
+                }
+                catch( std::exception & e )
+                {
+                    fprintf( stderr, "\"%s\" failed on \"%s\": %s\n", query.toUtf8().data(),
+                             dict.getName().c_str(), e.what() );
+                }
+            }
+        }
+    }
+
+    wordFinder.clear();
+
+    report( results, csv );
+
+    if( !csv )
+        printf( "%d queries replayed %d times in %.1f s, peak RSS %ld KiB\n", queries.size(),
+                iterations, runTimer.elapsed() / 1000.0, peakRss() );
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __LOOKUPBENCH_HH_INCLUDED__
+#define __LOOKUPBENCH_HH_INCLUDED__
+
+#include <QObject>
+#include <QEventLoop>
+
+/// Part of the lookup benchmark (see lookupbench.pro). Waits for a signal
+/// which might also get emitted before the wait begins, such as
+/// WordFinder::finished() for the searches which complete instantly.
+class SignalWaiter: public QObject
+{
+    Q_OBJECT
+
+public:
+
+    SignalWaiter(): fired( false )
+    {}
+
+    /// Forgets the signal caught before, if any
+    void reset()
+    { fired = false; }
+
+    /// Runs the event loop until the signal gets caught
+    void wait()
+    {
+        if( !fired )
+            loop.exec();
+    }
+
+public slots:
+
+    void signalled()
+    {
+        fired = true;
+        loop.quit();
+    }
+
+private:
+
+    bool fired;
+    QEventLoop loop;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# Headless lookup benchmark. Loads the dictionaries from the
+# GoldenDict configuration and replays a query log against them:
+#
+#   gdlookupbench --queries queries.txt [--iterations n] [--csv]
+#
+# Built from the same sources as GoldenDict, with main.cc
+# replaced by lookupbench.cc
+#
+#-------------------------------------------------
+
+include( goldendict.pro )
+
+TARGET = gdlookupbench
+
+SOURCES -= main.cc
+SOURCES += lookupbench.cc
+HEADERS += lookupbench.hh
+
+CONFIG += console
+CONFIG -= app_bundle
+
+OBJECTS_DIR = build/lookupbench
+UI_DIR = build/lookupbench
+MOC_DIR = build/lookupbench
+RCC_DIR = build/lookupbench
+
+win32 {
+    LIBS += -lpsapi
+}
@@ -116,7 +116,7 @@ void gdMessageHandler( QtMsgType type, const char *msg_ )
 
 class GDCommandLine
 {
-    bool crashReport, logFile;
+    bool crashReport, logFile, traceRequests;
     QString word, groupName, popupGroupName, errFileName;
     QVector< QString > arguments;
 public:
@@ -143,6 +143,9 @@ public:
     inline bool needLogFile()
     { return logFile; }
 
+    inline bool needTraceRequests()
+    { return traceRequests; }
+
     inline bool needTranslateWord()
     { return !word.isEmpty(); }
 
@@ -152,7 +155,8 @@ public:
 
 GDCommandLine::GDCommandLine( int argc, char **argv ):
     crashReport( false ),
-    logFile( false )
+    logFile( false ),
+    traceRequests( false )
 {
     if( argc > 1 )
     {
@@ -187,6 +191,12 @@ GDCommandLine::GDCommandLine( int argc, char **argv ):
                     logFile = true;
                     continue;
                 }
+                else
+                if( arguments[ i ].compare( "--trace-requests" ) == 0 )
+                {
+                    traceRequests = true;
+                    continue;
+                }
                 else
                     if( arguments[ i ].startsWith( "--group-name=" ) )
                     {
@@ -440,6 +450,10 @@ int main( int argc, char ** argv )
     QWebSecurityOrigin::addLocalScheme( "gdlookup" );
 #endif
 
+    // The trace is saved on exit, see below
+    if( gdcl.needTraceRequests() )
+        GdTrace::setEnabled( true );
+
     MainWindow m( cfg );
 
     app.addDataCommiter( m );
@@ -462,6 +476,9 @@ int main( int argc, char ** argv )
 
     app.removeDataCommiter( m );
 
+    if( gdcl.needTraceRequests() )
+        GdTrace::dump( Config::getConfigDir() + "gd_trace.json" );
+
 #ifdef GD_LOG_MSGOUT
     if( logFilePtr->isOpen() )
         logFilePtr->close();
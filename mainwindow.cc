@@ -17,6 +17,10 @@
 #include "wordfinder.hh"
 #include "editdictionaries.hh"
 #include "loaddictionaries.hh"
+#include "lazydictionary.hh"
+#include "requesttrace.hh"
+#include "articlecache.hh"
+#include "resourcecache.hh"
 #include "dictionary.hh"
 #include "preferences.hh"
 #include "about.hh"
@@ -133,6 +137,7 @@ MainWindow::MainWindow( Config::Class & cfg_ ):
     dictionaryBar(new DictionaryBar( this, configEvents, cfg.editDictionaryCommandLine, cfg.preferences.maxDictionaryRefsInContextMenu )),
     articleMaker( dictionaries, groupInstances, cfg.preferences.displayStyle,
                   cfg.preferences.addonStyle ),
+    articlePrefetcher( articleMaker ),
     articleNetMgr( this, dictionaries, articleMaker,
                    cfg.preferences.disallowContentFromOtherSites, cfg.preferences.hideGoldenDictHeader ),
     dictNetMgr( this ),
@@ -145,7 +150,9 @@ MainWindow::MainWindow( Config::Class & cfg_ ):
   , wasMaximized( false )
   , blockUpdateWindowTitle( false )
   , headwordsDlg( 0 )
+  , requestTraceDlg( 0 )
   , ftsIndexing( dictionaries )
+  , manifestValidator( LoadDictionaries::dictionaryNameFilters() )
   , ftsDlg( 0 )
   , helpWindow( 0 )
   , starIcon( ":/icons/star.png" )
@@ -167,6 +174,12 @@ MainWindow::MainWindow( Config::Class & cfg_ ):
     ui.setupUi( this );
 
     articleMaker.setCollapseParameters( cfg.preferences.collapseBigArticles, cfg.preferences.articleSizeLimit );
+    articleMaker.setLookupDeadline( cfg.preferences.useLookupDeadline ? cfg.preferences.lookupDeadline : 0 );
+
+    // The dictionaries render their articles according to these
+    ArticleCache::setRenderOptions( QByteArray::number( cfg.maxPictureWidth ) + ","
+                                    + QByteArray::number( cfg.maxHeadwordSize ) + ","
+                                    + QByteArray::number( cfg.maxHeadwordsToExpand ) );
 
 #if QT_VERSION >= QT_VERSION_CHECK(4, 6, 0)
     // Set own gesture recognizers
@@ -326,6 +339,9 @@ MainWindow::MainWindow( Config::Class & cfg_ ):
     }
     wordList->attachFinder( wordFinder );
 
+    connect( wordFinder, SIGNAL( finished() ),
+             this, SLOT( prefetchSuggestions() ) );
+
     // for the old UI:
     ui.wordList->setTranslateLine( ui.translateLine );
 
@@ -679,6 +695,8 @@ MainWindow::MainWindow( Config::Class & cfg_ ):
              this, SLOT( visitForum() ) );
     connect( ui.openConfigFolder, SIGNAL( triggered() ),
              this, SLOT( openConfigFolder() ) );
+    connect( ui.requestTracing, SIGNAL( triggered() ),
+             this, SLOT( showRequestTracing() ) );
     connect( ui.about, SIGNAL( triggered() ),
              this, SLOT( showAbout() ) );
     connect( ui.showReference, SIGNAL( triggered() ),
@@ -874,6 +892,15 @@ MainWindow::MainWindow( Config::Class & cfg_ ):
     // makeDictionaries() didn't do deferred init - we do it here, at the end.
     LoadDictionaries::doDeferredInit( dictionaries );
 
+    // Everything taken from the load manifest is checked in the background
+    // now that the window is up. If anything changed, rescan.
+    connect( &manifestValidator, SIGNAL( changed() ),
+             this, SLOT( on_rescanFiles_triggered() ), Qt::QueuedConnection );
+    manifestValidator.start( QThread::LowPriority );
+
+    // Open the dictionaries of the current group before they're asked for
+    LazyDictionary::warmUp( getActiveDicts() );
+
     updateStatusLine();
 
 #ifdef Q_OS_MAC
@@ -1025,6 +1052,9 @@ MainWindow::~MainWindow()
 
     ftsIndexing.stopIndexing();
 
+    // Remember what the dictionaries opened during this run look like now
+    LoadManifest::save( dictionaries );
+
 #if QT_VERSION >= QT_VERSION_CHECK(4, 6, 0)
     ui.centralWidget->ungrabGesture( Gestures::GDPinchGestureType );
     ui.centralWidget->ungrabGesture( Gestures::GDSwipeGestureType );
@@ -1317,13 +1347,14 @@ void MainWindow::makeDictionaries()
                             "It does not support dictionaries changes and must be constructed anew." );
 
     wordFinder->clear();
+    articlePrefetcher.cancel();
 
     dictionariesUnmuted.clear();
 
     ftsIndexing.stopIndexing();
     ftsIndexing.clearDictionaries();
 
-    LoadDictionaries::loadDictionaries( this, true, cfg, dictionaries, dictNetMgr, false );
+    LoadDictionaries::loadDictionaries( this, true, cfg, dictionaries, dictNetMgr, false, true );
     loadUserDictName();
     for( unsigned x = 0; x < dictionaries.size(); x++ )
     {
@@ -1331,6 +1362,11 @@ void MainWindow::makeDictionaries()
         dictionaries[ x ]->setSynonymSearchEnabled( cfg.preferences.synonymSearchEnabled );
     }
 
+    LoadManifest::save( dictionaries );
+
+    ResourceCache::clear();
+    ArticleCache::clearMemory();
+
     ftsIndexing.setDictionaries( dictionaries );
     ftsIndexing.doIndexing();
 
@@ -2015,6 +2051,7 @@ void MainWindow::editDictionaries( unsigned editDictionaryGroup )
     ftsIndexing.clearDictionaries();
 
     wordFinder->clear();
+    articlePrefetcher.cancel();
     dictionariesUnmuted.clear();
 
     hideGDHelp();
@@ -2079,6 +2116,11 @@ void MainWindow::editDictionaries( unsigned editDictionaryGroup )
         dictionaries[ x ]->setSynonymSearchEnabled( cfg.preferences.synonymSearchEnabled );
     }
 
+    LoadManifest::save( dictionaries );
+
+    ResourceCache::clear();
+    ArticleCache::clearMemory();
+
     ftsIndexing.setDictionaries( dictionaries );
     ftsIndexing.doIndexing();
 }
@@ -2149,6 +2191,12 @@ void MainWindow::editPreferences()
             articleMaker.setCollapseParameters( p.collapseBigArticles, p.articleSizeLimit );
         }
 
+        if( cfg.preferences.useLookupDeadline != p.useLookupDeadline
+                || cfg.preferences.lookupDeadline != p.lookupDeadline )
+        {
+            articleMaker.setLookupDeadline( p.useLookupDeadline ? p.lookupDeadline : 0 );
+        }
+
         // See if we need to reapply expand optional parts mode
         if( cfg.preferences.alwaysExpandOptionalParts != p.alwaysExpandOptionalParts )
         {
@@ -2250,6 +2298,8 @@ void MainWindow::currentGroupChanged( QString const & )
 
     updateDictionaryBar();
 
+    LazyDictionary::warmUp( getActiveDicts() );
+
     // Update word search results
     translateBox->setPopupEnabled( false );
     translateInputChanged( translateLine->text() );
@@ -2297,6 +2347,9 @@ void MainWindow::translateInputChanged( QString const & newValue )
     if ( wordList->selectionModel()->hasSelection() )
         wordList->setCurrentItem( 0, QItemSelectionModel::Clear );
 
+    // The old suggestions aren't needed anymore
+    articlePrefetcher.cancel();
+
     QString req = newValue.trimmed();
 
     if ( !req.size() )
@@ -2342,6 +2395,32 @@ void MainWindow::translateInputFinished( bool checkModifiers, QString const & di
     }
 }
 
+void MainWindow::prefetchSuggestions()
+{
+    // Only while the user is still typing. Otherwise the word was looked up
+    // already.
+    if ( !translateLine->hasFocus() )
+        return;
+
+    WordFinder::SearchResults const & results = wordFinder->getResults();
+
+    QStringList words;
+
+    for( size_t x = 0; x < results.size(); ++x )
+        words.append( results[ x ].first );
+
+    unsigned group = groupInstances.empty() ? 0 :
+                                              groupInstances[ groupList->currentIndex() ].id;
+
+    QSet< QString > mutedDicts;
+    Config::MutedDictionaries const * mutedDictionaries = dictionaryBar->getMutedDictionaries();
+
+    if ( dictionaryBar->toggleViewAction()->isChecked() && mutedDictionaries )
+        mutedDicts = *mutedDictionaries;
+
+    articlePrefetcher.prefetch( words, group, mutedDicts, cfg.preferences.ignoreDiacritics );
+}
+
 void MainWindow::handleEsc()
 {
     ArticleView *view = getCurrentArticleView();
@@ -2769,6 +2848,9 @@ void MainWindow::showTranslationFor( QString const & inWord,
 {
     ArticleView *view = getCurrentArticleView();
 
+    // The lookup itself needs the dictionaries more now
+    articlePrefetcher.cancel();
+
     navPronounce->setEnabled( false );
 
     unsigned group = inGroup ? inGroup :
@@ -3288,6 +3370,16 @@ void MainWindow::openConfigFolder()
     QDesktopServices::openUrl( QUrl::fromLocalFile( Config::getConfigDir() ) );
 }
 
+void MainWindow::showRequestTracing()
+{
+    if( !requestTraceDlg )
+        requestTraceDlg = new RequestTraceDialog( this );
+
+    requestTraceDlg->show();
+    requestTraceDlg->raise();
+    requestTraceDlg->activateWindow();
+}
+
 void MainWindow::visitForum()
 {
     QDesktopServices::openUrl( QUrl( "http://goldendict.org/forum/" ) );
@@ -3631,6 +3723,8 @@ void MainWindow::on_saveArticle_triggered()
 
 void MainWindow::on_rescanFiles_triggered()
 {
+    manifestValidator.cancel();
+
     if(hotkeyWrapper)
     {
         delete hotkeyWrapper; // No hotkeys while we're editing dictionaries
@@ -3643,6 +3737,8 @@ void MainWindow::on_rescanFiles_triggered()
     ftsIndexing.stopIndexing();
     ftsIndexing.clearDictionaries();
 
+    articlePrefetcher.cancel();
+
     groupInstances.clear(); // Release all the dictionaries they hold
     dictionaries.clear();
     dictionariesUnmuted.clear();
@@ -3657,9 +3753,17 @@ void MainWindow::on_rescanFiles_triggered()
         dictionaries[ x ]->setSynonymSearchEnabled( cfg.preferences.synonymSearchEnabled );
     }
 
+    LoadManifest::save( dictionaries );
+
+    ResourceCache::clear();
+    ArticleCache::clearMemory();
+
     ftsIndexing.setDictionaries( dictionaries );
     ftsIndexing.doIndexing();
 
+    // Whatever the cancelled validation left unchecked gets checked now
+    manifestValidator.start( QThread::LowPriority );
+
     updateGroupList();
 
     makeScanPopup();
@@ -4296,7 +4400,7 @@ void MainWindow::showDictionaryInfo( const QString & id )
     {
         if( dictionaries[ x ]->getId() == id.toUtf8().data() )
         {
-            DictInfo infoMsg( cfg, this );
+            DictInfo infoMsg( cfg, dictionaries, this );
             infoMsg.showInfo( dictionaries[ x ] );
             int result = infoMsg.exec();
 
@@ -17,8 +17,10 @@
 #include "instances.hh"
 #include "article_maker.hh"
 #include "articleview.hh"
+#include "articleprefetcher.hh"
 #include "history.hh"
 #include "fulltextsearch.hh"
+#include "loadmanifest.hh"
 
 #include "hotkeywrapper.hh"
 
@@ -27,6 +29,7 @@ using std::vector;
 class HotkeyWrapper;
 class ScanPopup;
 class DictHeadwords;
+class RequestTraceDialog;
 class WordList;
 class WordFinder;
 class DictionaryBar;
@@ -147,6 +150,7 @@ private:
     vector< sptr< Dictionary::Class > > dictionariesUnmuted;
     Instances::Groups groupInstances;
     ArticleMaker articleMaker;
+    ArticlePrefetcher articlePrefetcher;
     ArticleNetworkAccessManager articleNetMgr;
     QNetworkAccessManager dictNetMgr; // We give dictionaries a separate manager,
     // since their requests can be destroyed
@@ -178,8 +182,13 @@ private:
 
     DictHeadwords * headwordsDlg;
 
+    RequestTraceDialog * requestTraceDlg;
+
     FTS::FtsIndexing ftsIndexing;
 
+    /// Checks the dictionaries loaded from the load manifest at startup
+    LoadManifest::Validator manifestValidator;
+
     FTS::FullTextSearchDialog * ftsDlg;
 
     Help::HelpWindow * helpWindow;
@@ -359,6 +368,9 @@ private slots:
     void translateInputChanged( QString const & );
     void translateInputFinished( bool checkModifiers = true, QString const & dictID = QString() );
 
+    /// Has the top suggestions for the current input looked up in advance
+    void prefetchSuggestions();
+
     /// Closes any opened search in the article view, and focuses the translateLine/close main window to tray.
     void handleEsc();
 
@@ -411,6 +423,7 @@ private slots:
     void visitHomepage();
     void visitForum();
     void openConfigFolder();
+    void showRequestTracing();
     void showAbout();
 
     void showDictBarNamesTriggered();
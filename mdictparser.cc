@@ -86,22 +86,21 @@ static QDomNamedNodeMap parseHeaderAttributes( const QString & headerText )
 
 size_t MdictParser::RecordIndex::bsearch( const vector<MdictParser::RecordIndex> & offsets, qint64 val )
 {
-    if ( offsets.size() == 0 )
-        return ( size_t ) ( -1 );
-
+    // Search within the half-open range [lo, hi), so that no index ever
+    // wraps around below zero
     size_t lo = 0;
-    size_t hi = offsets.size() - 1;
+    size_t hi = offsets.size();
 
-    while ( lo <= hi )
+    while ( lo < hi )
     {
-        size_t mid = ( lo + hi ) >> 1;
+        size_t mid = lo + ( ( hi - lo ) >> 1 );
         RecordIndex const & p = offsets[mid];
         if ( p == val )
             return mid;
         else if ( p < val )
             lo = mid + 1;
         else
-            hi = mid - 1;
+            hi = mid;
     }
 
     return ( size_t ) ( -1 );
@@ -123,6 +122,12 @@ MdictParser::MdictParser() :
 {
 }
 
+MdictParser::~MdictParser()
+{
+    fileMap_.unmap();
+    delete file_;
+}
+
 bool MdictParser::open( const char * filename )
 {
     filename_ = QString::fromUtf8( filename );
@@ -136,6 +141,11 @@ bool MdictParser::open( const char * filename )
     if ( !file_->open( QIODevice::ReadOnly ) )
         return false;
 
+    // Map the whole file once, all the blocks are then decompressed straight
+    // from the mapping
+    if ( !fileMap_.map( *file_ ) )
+        GD_DPRINTF( "MdictParser: can't map %s, falling back to per-block mapping\n", filename );
+
     QDataStream in( file_ );
     in.setByteOrder( QDataStream::BigEndian );
 
@@ -162,17 +172,16 @@ bool MdictParser::readNextHeadWordIndex( MdictParser::HeadWordIndex & headWordIn
     if ( compressedSize < 8 )
         return false;
 
-    ScopedMemMap compressed( *file_, headWordPos_, compressedSize );
+    ScopedMemMap compressed( fileMap_, *file_, headWordPos_, compressedSize );
     if ( !compressed.startAddress() )
         return false;
 
     headWordPos_ += compressedSize;
-    QByteArray decompressed;
     if ( !parseCompressedBlock( compressedSize, ( char * )compressed.startAddress(),
-                                decompressedSize, decompressed ) )
+                                decompressedSize, decompressedBlock_ ) )
         return false;
 
-    headWordIndex = splitHeadWordBlock( decompressed );
+    headWordIndex = splitHeadWordBlock( decompressedBlock_ );
     headWordBlockInfosIter_++;
     return true;
 }
@@ -270,7 +279,9 @@ bool MdictParser::parseCompressedBlock( qint64 compressedBlockSize,
             return false;
         }
 
-        decompressedBlock = QByteArray( buf, size );
+        // Copy into the existing buffer, so its storage gets reused
+        decompressedBlock.resize( size );
+        memcpy( decompressedBlock.data(), buf, size );
         return true;
 
     case 0x01000000:
@@ -300,8 +311,17 @@ bool MdictParser::parseCompressedBlock( qint64 compressedBlockSize,
         break;
 
     case 0x02000000:
+    {
         // zlib compression
-        decompressedBlock = zlibDecompress( buf, size );
+        // The decompressed size is known beforehand, so inflate straight
+        // into the buffer, and only resort to the streaming decompressor if
+        // the block turns out to be of a different size.
+        uLongf blockSize = ( uLongf )decompressedBlockSize;
+        decompressedBlock.resize( decompressedBlockSize );
+        if ( uncompress( ( Bytef * )decompressedBlock.data(), &blockSize,
+                         ( const Bytef * )buf, size ) != Z_OK
+             || blockSize != ( uLongf )decompressedBlockSize )
+            decompressedBlock = zlibDecompress( buf, size );
 
         if ( !checkAdler32( decompressedBlock.constData(), decompressedBlock.size(),
                             checksum ) )
@@ -309,6 +329,7 @@ bool MdictParser::parseCompressedBlock( qint64 compressedBlockSize,
             gdWarning( "MDict: parseCompressedBlock: zlib: checksum does not match" );
             return false;
         }
+    }
         break;
 
     default:
@@ -652,6 +673,8 @@ MdictParser::HeadWordIndex MdictParser::splitHeadWordBlock( QByteArray const & b
 
     const char * p = block.constData();
     const char * end = p + block.size();
+    bool isUtf16 = ( encoding_ == "UTF-16LE" );
+    QByteArray encoding = encoding_.toLatin1();
 
     while ( p < end )
     {
@@ -659,20 +682,16 @@ MdictParser::HeadWordIndex MdictParser::splitHeadWordBlock( QByteArray const & b
                     qFromBigEndian<qint64>( ( const uchar * )p ) :
                     qFromBigEndian<quint32>( ( const uchar * )p );
         p += numberTypeSize_;
-        QByteArray headWordBuf;
+        int headWordBufSize;
 
-        if ( encoding_ == "UTF-16LE" )
-        {
-            int headWordLength = u16StrSize( ( const ushort * )p );
-            headWordBuf = QByteArray( p, ( headWordLength + 1 ) * 2 );
-        }
+        if ( isUtf16 )
+            headWordBufSize = ( u16StrSize( ( const ushort * )p ) + 1 ) * 2;
         else
-        {
-            int headWordLength = strlen( p );
-            headWordBuf = QByteArray( p, headWordLength + 1 );
-        }
-        p += headWordBuf.size();
-        QString headWord = toUtf16( encoding_, headWordBuf.constBegin(), headWordBuf.size() );
+            headWordBufSize = strlen( p ) + 1;
+
+        // Convert straight from the block, no need to copy the headword first
+        QString headWord = toUtf16( encoding.constData(), p, headWordBufSize );
+        p += headWordBufSize;
         index.push_back( HeadWordIndex::value_type( headWordId, headWord ) );
     }
 
@@ -685,10 +704,19 @@ bool MdictParser::readRecordBlock( MdictParser::HeadWordIndex & headWordIndex,
     // cache the index, the headWordIndex is already sorted
     size_t idx = 0;
 
+    if ( recordBlockInfos_.empty() )
+        return false;
+
     for ( HeadWordIndex::const_iterator i = headWordIndex.begin(); i != headWordIndex.end(); ++i )
     {
-        if ( recordBlockInfos_[idx].endPos <= i->first )
-            idx = RecordIndex::bsearch( recordBlockInfos_, i->first );
+        if ( recordBlockInfos_[idx].shadowEndPos <= i->first )
+        {
+            // Records mostly continue in the very next block
+            if ( idx + 1 < recordBlockInfos_.size() && recordBlockInfos_[idx + 1] == i->first )
+                ++idx;
+            else
+                idx = RecordIndex::bsearch( recordBlockInfos_, i->first );
+        }
 
         if ( idx == ( size_t )( -1 ) )
             return false;
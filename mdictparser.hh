@@ -37,22 +37,104 @@ using std::vector;
 using std::pair;
 using std::map;
 
+// Maps the whole file once, so the blocks could be accessed without
+// further map()/read() calls. Mapping may fail (e.g. no address space left
+// on 32-bit systems), in which case at() returns 0 and callers fall back to
+// mapping each block separately.
+class FileMap
+{
+    QFile * file;
+    uchar * address;
+    qint64 size;
+
+public:
+    FileMap() :
+        file( 0 ),
+        address( 0 ),
+        size( 0 )
+    {
+    }
+
+    ~FileMap()
+    {
+        unmap();
+    }
+
+    bool map( QFile & f )
+    {
+        unmap();
+        qint64 fileSize = f.size();
+        if ( fileSize <= 0 )
+            return false;
+        address = f.map( 0, fileSize );
+        if ( address )
+        {
+            file = &f;
+            size = fileSize;
+        }
+        return address != 0;
+    }
+
+    void unmap()
+    {
+        if ( address && file )
+            file->unmap( address );
+        file = 0;
+        address = 0;
+        size = 0;
+    }
+
+    inline bool isMapped() const
+    {
+        return address != 0;
+    }
+
+    /// Returns the pointer to the given range of the file, or 0 if the file
+    /// isn't mapped or the range lies outside of it.
+    inline uchar * at( qint64 offset, qint64 length ) const
+    {
+        if ( !address || offset < 0 || length < 0 || offset > size - length )
+            return 0;
+        return address + offset;
+    }
+
+private:
+    FileMap( FileMap const & );
+    FileMap & operator=( FileMap const & );
+};
+
 // A helper class to handle memory map for QFile
 class ScopedMemMap
 {
     QFile & file;
     uchar * address;
+    bool ownsAddress;
 
 public:
     ScopedMemMap( QFile & file, qint64 offset, qint64 size ) :
         file( file ),
-        address( file.map( offset, size ) )
+        address( file.map( offset, size ) ),
+        ownsAddress( true )
+    {
+    }
+
+    /// Uses the whole-file mapping if there's one, and maps the block
+    /// separately otherwise.
+    ScopedMemMap( FileMap const & fileMap, QFile & file, qint64 offset, qint64 size ) :
+        file( file ),
+        address( fileMap.at( offset, size ) ),
+        ownsAddress( false )
     {
+        if ( !address )
+        {
+            address = file.map( offset, size );
+            ownsAddress = true;
+        }
     }
 
     ~ScopedMemMap()
     {
-        if ( address )
+        if ( address && ownsAddress )
             file.unmap( address );
     }
 
@@ -155,7 +237,7 @@ public:
     }
 
     MdictParser();
-    ~MdictParser() {}
+    ~MdictParser();
 
     bool open( const char * filename );
     bool readNextHeadWordIndex( HeadWordIndex & headWordIndex );
@@ -191,6 +273,9 @@ protected:
 protected:
     QString filename_;
     QPointer<QFile> file_;
+    FileMap fileMap_;
+    // Reused between the headword blocks to avoid reallocating each time
+    QByteArray decompressedBlock_;
     StyleSheets styleSheets_;
     BlockInfoVector headWordBlockInfos_;
     BlockInfoVector::iterator headWordBlockInfosIter_;
@@ -18,6 +18,8 @@
 #include "filetype.hh"
 #include "ftshelpers.hh"
 #include "htmlescape.hh"
+#include "resourceindex.hh"
+#include "htmlrewriter.hh"
 
 #include <algorithm>
 #include <map>
@@ -62,7 +64,7 @@ using namespace Mdict;
 enum
 {
     kSignature = 0x4349444d,  // MDIC
-    kCurrentFormatVersion = 11 + BtreeIndexing::FormatVersion + Folding::Version
+    kCurrentFormatVersion = 12 + BtreeIndexing::FormatVersion + Folding::Version
 };
 
 DEF_EX( exCorruptDictionary, "dictionary file was tampered or corrupted", std::exception )
@@ -110,25 +112,41 @@ class IndexedMdd: public BtreeIndexing::BtreeIndex
     Mutex fileMutex;
     ChunkedStorage::Reader & chunks;
     QFile mddFile;
+    FileMap mddFileMap;
     bool isFileOpen;
+    ResourceIndex::Table resourceTable;
+
+    // The last decompressed record block, reused while the following
+    // resources come from the same block. Guarded by idxMutex.
+    QByteArray decompressedBlock;
+    qint64 decompressedBlockPos;
 
 public:
 
     IndexedMdd( Mutex & idxMutex, ChunkedStorage::Reader & chunks ):
         idxMutex( idxMutex ),
         chunks( chunks ),
-        isFileOpen( false )
+        isFileOpen( false ),
+        decompressedBlockPos( -1 )
     {}
     virtual ~IndexedMdd(){}
 
     /// Opens the index. The values are those previously returned by buildIndex().
     using BtreeIndexing::BtreeIndex::openIndex;
 
+    /// Loads the resource fingerprint table written at the given offset.
+    void openResourceTable( File::Class & idx, uint32_t offset )
+    {
+        resourceTable.load( idx, offset );
+    }
+
     /// Opens the mdd file itself. Returns true if succeeded, false otherwise.
     bool open( const char * fileName )
     {
         mddFile.setFileName( QString::fromUtf8( fileName ) );
         isFileOpen = mddFile.open( QFile::ReadOnly );
+        if ( isFileOpen )
+            mddFileMap.map( mddFile );
         return isFileOpen;
     }
 
@@ -144,8 +162,8 @@ public:
     {
         if ( !isFileOpen )
             return false;
-        vector< WordArticleLink > links = findArticles( name );
-        return !links.empty();
+        uint32_t address;
+        return findFile( name, address );
     }
 
     /// Attempts loading the given file into the given vector. Returns true on
@@ -155,31 +173,70 @@ public:
         if ( !isFileOpen )
             return false;
 
-        vector< WordArticleLink > links = findArticles( name );
-        if ( links.empty() )
+        uint32_t address;
+        if ( !findFile( name, address ) )
             return false;
 
         MdictParser::RecordInfo indexEntry;
         vector< char > chunk;
         Mutex::Lock _( idxMutex );
-        const char * indexEntryPtr = chunks.getBlock( links[ 0 ].articleOffset, chunk );
+        const char * indexEntryPtr = chunks.getBlock( address, chunk );
         memcpy( &indexEntry, indexEntryPtr, sizeof( indexEntry ) );
 
-        ScopedMemMap compressed( mddFile, indexEntry.compressedBlockPos, indexEntry.compressedBlockSize );
-        if ( !compressed.startAddress() )
+        if ( decompressedBlockPos != indexEntry.compressedBlockPos )
         {
-            return false;
+            decompressedBlockPos = -1;
+
+            ScopedMemMap compressed( mddFileMap, mddFile, indexEntry.compressedBlockPos,
+                                     indexEntry.compressedBlockSize );
+            if ( !compressed.startAddress() )
+            {
+                return false;
+            }
+
+            if ( !MdictParser::parseCompressedBlock( indexEntry.compressedBlockSize, ( char * )compressed.startAddress(),
+                                                     indexEntry.decompressedBlockSize, decompressedBlock ) )
+            {
+                return false;
+            }
+
+            decompressedBlockPos = indexEntry.compressedBlockPos;
         }
 
-        QByteArray decompressed;
-        if ( !MdictParser::parseCompressedBlock( indexEntry.compressedBlockSize, ( char * )compressed.startAddress(),
-                                                 indexEntry.decompressedBlockSize, decompressed ) )
+        if ( indexEntry.recordOffset < 0 || indexEntry.recordSize < 0
+             || indexEntry.recordOffset + indexEntry.recordSize > decompressedBlock.size() )
+            return false;
+
+        result.resize( indexEntry.recordSize );
+        if ( indexEntry.recordSize )
+            memcpy( &result.front(), decompressedBlock.constData() + indexEntry.recordOffset, indexEntry.recordSize );
+        return true;
+    }
+
+private:
+
+    /// Resolves the file name to the address of its record info. The
+    /// fingerprint table is consulted first, the btree is only walked when
+    /// the fingerprint is ambiguous.
+    bool findFile( gd::wstring const & name, uint32_t & address )
+    {
+        switch ( resourceTable.find( name, address ) )
         {
+        case ResourceIndex::Table::Found:
+            return true;
+
+        case ResourceIndex::Table::NotFound:
             return false;
+
+        default:
+            break;
         }
 
-        result.resize( indexEntry.recordSize );
-        memcpy( &result.front(), decompressed.constData() + indexEntry.recordOffset, indexEntry.recordSize );
+        vector< WordArticleLink > links = findArticles( name );
+        if ( links.empty() )
+            return false;
+
+        address = links[ 0 ].articleOffset;
         return true;
     }
 
@@ -193,7 +250,14 @@ class MdxDictionary: public BtreeIndexing::BtreeDictionary
     string encoding;
     ChunkedStorage::Reader chunks;
     QFile dictFile;
+    FileMap dictFileMap;
     vector< sptr< IndexedMdd > > mddResources;
+
+    // The last decompressed record block, so that consecutive articles from
+    // the same block (which is what the full-text indexing does) don't get
+    // decompressed over and over again. Guarded by idxMutex.
+    QByteArray decompressedBlock;
+    qint64 decompressedBlockPos;
     MdictParser::StyleSheets styleSheets;
 
     AtomicInt32 deferredInitDone;
@@ -215,6 +279,14 @@ public:
 
     virtual void deferredInit();
 
+#ifdef MDX_LOCALVIDEO_CACHED
+    /// The videos are copied to cacheDir for the player
+    virtual Dictionary::Features getFeatures() const
+    {
+        return BtreeDictionary::getFeatures() | Dictionary::ArticlesUseSessionFiles;
+    }
+#endif
+
     virtual unsigned long getArticleCount() const
     {
         return idxHeader.articleCount;
@@ -273,9 +345,6 @@ private:
     /// Loads an article with the given offset, filling the given strings.
     void loadArticle( uint32_t offset, string & articleText, bool noFilter = false );
 
-    /// Process resource links (images, audios, etc)
-    QString & filterResource( QString const & articleId, QString & article );
-
 #ifdef MDX_LOCALVIDEO_CACHED
     /// We need cache video files to local for html5 video player
     const QString cacheFile(const QString &filename)
@@ -319,6 +388,7 @@ private:
     friend class MdxArticleRequest;
     friend class MddResourceRequest;
     friend class MdxDeferredInitRunnable;
+    friend class MdxArticleRewriter;
 };
 
 MdxDictionary::MdxDictionary( string const & id, string const & indexFile,
@@ -327,11 +397,14 @@ MdxDictionary::MdxDictionary( string const & id, string const & indexFile,
     idx( indexFile, "rb" ),
     idxHeader( idx.read< IdxHeader >() ),
     chunks( idx, idxHeader.chunksOffset ),
+    decompressedBlockPos( -1 ),
     deferredInitRunnableStarted( false )
   #ifdef MDX_LOCALVIDEO_CACHED
   ,cacheDir(nullptr)
   #endif
 {
+    chunks.setStats( statistics.get() );
+
     // Read the dictionary's name
     idx.seek( sizeof( idxHeader ) );
     size_t len = idx.read< uint32_t >();
@@ -373,6 +446,7 @@ MdxDictionary::~MdxDictionary()
     if ( deferredInitRunnableStarted )
         deferredInitRunnableExited.acquire();
 
+    dictFileMap.unmap();
     dictFile.close();
 #ifdef MDX_LOCALVIDEO_CACHED
     if(cacheDir!=nullptr)
@@ -472,8 +546,16 @@ void MdxDictionary::doDeferredInit()
             openIndex( IndexInfo( idxHeader.indexBtreeMaxElements,
                                   idxHeader.indexRootOffset ), idx, idxMutex );
 
+            // Map the dictionary file, so the articles are decompressed
+            // straight from the mapping
+            {
+                Mutex::Lock _( idxMutex );
+                dictFileMap.map( dictFile );
+            }
+
             vector< string > mddFileNames;
             vector< IndexInfo > mddIndexInfos;
+            vector< uint32_t > mddResourceTableOffsets;
             idx.seek( idxHeader.mddIndexInfosOffset );
             for ( uint32_t i = 0; i < idxHeader.mddIndexInfosCount; i++ )
             {
@@ -482,6 +564,7 @@ void MdxDictionary::doDeferredInit()
                 idx.read( &buf.front(), sz );
                 uint32_t btreeMaxElements = idx.read<uint32_t>();
                 uint32_t rootOffset = idx.read<uint32_t>();
+                mddResourceTableOffsets.push_back( idx.read<uint32_t>() );
                 mddFileNames.push_back( string( &buf.front() ) );
                 mddIndexInfos.push_back( IndexInfo( btreeMaxElements, rootOffset ) );
             }
@@ -497,6 +580,7 @@ void MdxDictionary::doDeferredInit()
 
                 sptr< IndexedMdd > mdd ( new IndexedMdd( idxMutex, chunks ));
                 mdd->openIndex( mddIndexInfos[ i - 1 ], idx, idxMutex );
+                mdd->openResourceTable( idx, mddResourceTableOffsets[ i - 1 ] );
                 mdd->open( dictFiles[ i ].c_str() );
                 mddResources.push_back( mdd );
             }
@@ -1022,373 +1106,250 @@ void MdxDictionary::loadIcon() throw()
     dictionaryIconLoaded = true;
 }
 
-void MdxDictionary::loadArticle( uint32_t offset, string & articleText, bool noFilter )
+/// Rewrites the links and resources of an article: entry:// and sound://
+/// links, anchors, and the relative urls of images, scripts, stylesheets and
+/// media. The <span> and <div> tags are counted on the way, so the unclosed
+/// ones could be closed afterwards.
+class MdxArticleRewriter: public HtmlRewriter::Handler
 {
-    vector< char > chunk;
-    Mutex::Lock _( idxMutex );
+    MdxDictionary & dict;
+    bool filterLinks;
+    QString id;
+    QString uniquePrefix;
+    int openSpans, openDivs;
 
-    // Load record info from index
-    MdictParser::RecordInfo recordInfo;
-    char * pRecordInfo = chunks.getBlock( offset, chunk );
-    memcpy( &recordInfo, pRecordInfo, sizeof( recordInfo ) );
+public:
 
-    // Make a sub unique id for this article
-    QString articleId;
-    articleId.setNum( ( quint64 )pRecordInfo, 16 );
+    MdxArticleRewriter( MdxDictionary & dict_, QString const & articleId, bool filterLinks_ ):
+        dict( dict_ ),
+        filterLinks( filterLinks_ ),
+        id( QString::fromStdString( dict_.getId() ) ),
+        openSpans( 0 ),
+        openDivs( 0 )
+    {
+        uniquePrefix = QString::fromLatin1( "g" ) + id + "_" + articleId + "_";
+    }
 
-    ScopedMemMap compressed( dictFile, recordInfo.compressedBlockPos, recordInfo.compressedBlockSize );
-    if ( !compressed.startAddress() )
-        throw exCorruptDictionary();
+    int unclosedSpans() const
+    { return openSpans; }
 
-    QByteArray decompressed;
-    if ( !MdictParser::parseCompressedBlock( recordInfo.compressedBlockSize, ( char * )compressed.startAddress(),
-                                             recordInfo.decompressedBlockSize, decompressed ) )
-        throw exCorruptDictionary();
+    int unclosedDivs() const
+    { return openDivs; }
 
-    QString article = MdictParser::toUtf16( encoding.c_str(),
-                                            decompressed.constData() + recordInfo.recordOffset,
-                                            recordInfo.recordSize );
+    virtual void handleStartTag( HtmlRewriter::Tag & tag );
+    virtual void handleEndTag( QString const & name );
 
-    article = MdictParser::substituteStylesheet( article, styleSheets );
+private:
+
+    /// Strips the url the same way the relative resource links are stripped
+    /// (leading file://, dots and slash). Returns false for the external
+    /// links and the ones which are already rewritten.
+    static bool stripResourceUrl( QString & url );
 
-    if( !noFilter )
-        article = filterResource( articleId, article );
+    void rewriteResource( HtmlRewriter::Tag & tag, char const * attrName );
+    void rewriteAnchor( HtmlRewriter::Tag & tag );
+};
+
+void MdxArticleRewriter::handleEndTag( QString const & name )
+{
+    if ( name == QLatin1String( "span" ) )
+        --openSpans;
+    else
+    if ( name == QLatin1String( "div" ) )
+        --openDivs;
+}
 
-    // Check for unclosed <span> and <div>
+void MdxArticleRewriter::handleStartTag( HtmlRewriter::Tag & tag )
+{
+    QString const & name = tag.name();
 
-    int openTags = article.count( QRegExp( "<\\s*span\\b", Qt::CaseInsensitive ) );
-    int closedTags = article.count( QRegExp( "<\\s*/span\\s*>", Qt::CaseInsensitive ) );
-    while( openTags > closedTags )
+    if ( name == QLatin1String( "span" ) )
+        ++openSpans;
+    else
+    if ( name == QLatin1String( "div" ) )
+        ++openDivs;
+
+    if ( !filterLinks )
+        return;
+
+    if ( name == QLatin1String( "a" ) || name == QLatin1String( "area" ) )
     {
-        article += "</span>";
-        closedTags += 1;
+        rewriteAnchor( tag );
+        rewriteResource( tag, "src" );
     }
-
-    openTags = article.count( QRegExp( "<\\s*div\\b", Qt::CaseInsensitive ) );
-    closedTags = article.count( QRegExp( "<\\s*/div\\s*>", Qt::CaseInsensitive ) );
-    while( openTags > closedTags )
+    else
+    if ( name == QLatin1String( "link" ) )
     {
-        article += "</div>";
-        closedTags += 1;
+        // stylesheets
+        rewriteResource( tag, "href" );
+    }
+    else
+    if ( name == QLatin1String( "img" ) || name == QLatin1String( "script" )
+         || name == QLatin1String( "embed" ) )
+    {
+        // javascripts and images
+        rewriteResource( tag, "src" );
     }
+    else
+    if ( name == QLatin1String( "source" ) )
+    {
+#ifdef MDX_LOCALVIDEO_CACHED
+        // We need cache video files to local for html5 video player
+        int index = tag.findAttribute( "src" );
+        if ( index < 0 )
+            return;
 
-    articleText = string( article.toUtf8().constData() );
+        QString url = tag.attributeValue( index );
+        if ( stripResourceUrl( url ) )
+            tag.setAttributeValue( index, "file:///" + dict.cacheFile( url ) );
+#endif
+    }
 }
 
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-QString & MdxDictionary::filterResource( QString const & articleId, QString & article )
+bool MdxArticleRewriter::stripResourceUrl( QString & url )
 {
-    QString id = QString::fromStdString( getId() );
-    QString uniquePrefix = QString::fromLatin1( "g" ) + id + "_" + articleId + "_";
-
-    QRegularExpression allLinksRe( "(?:<\\s*(a(?:rea)?|img|link|script|embed|source)(?:\\s+[^>]+|\\s*)>)",
-                                   QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression wordCrossLink( "([\\s\"']href\\s*=)\\s*([\"'])entry://([^>#]*?)((?:#[^>]*?)?)\\2",
-                                      QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression anchorIdRe( "([\\s\"'](?:name|id)\\s*=)\\s*([\"'])\\s*(?=\\S)",
-                                   QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression anchorIdRe2( "([\\s\"'](?:name|id)\\s*=)\\s*(?=[^\"'])([^\\s\">]+)",
-                                    QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression anchorLinkRe( "([\\s\"']href\\s*=\\s*[\"'])entry://#",
-                                     QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression audioRe( "([\\s\"']href\\s*=)\\s*([\"'])sound://([^\">]+)\\2",
-                                QRegularExpression::CaseInsensitiveOption
-                                | QRegularExpression::InvertedGreedinessOption );
-    QRegularExpression stylesRe( "([\\s\"']href\\s*=)\\s*([\"'])(?!\\s*\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\">]+)\\2",
-                                 QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression stylesRe2( "([\\s\"']href\\s*=)\\s*(?![\\s\"']|\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\\s\">]+)",
-                                  QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression inlineScriptRe( "<\\s*script(?:(?=\\s)(?:(?![\\s\"']src\\s*=)[^>])+|\\s*)>",
-                                       QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression closeScriptTagRe( "<\\s*/script\\s*>",
-                                         QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression srcRe( "([\\s\"']src\\s*=)\\s*([\"'])(?!\\s*\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\">]+)\\2",
-                              QRegularExpression::CaseInsensitiveOption );
-    QRegularExpression srcRe2( "([\\s\"']src\\s*=)\\s*(?![\\s\"']|\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\\s\">]+)",
-                               QRegularExpression::CaseInsensitiveOption );
-
-    QString articleNewText;
-    int linkPos = 0;
-    QRegularExpressionMatchIterator it = allLinksRe.globalMatch( article );
-    while( it.hasNext() )
-    {
-        QRegularExpressionMatch allLinksMatch = it.next();
+    static char const * const externalSchemes[] =
+    { "bres://", "http://", "https://", "ftp://", "data:", "javascript:", 0 };
 
-        if( allLinksMatch.capturedEnd() < linkPos )
-            continue;
+    if ( HtmlRewriter::hasScheme( url, externalSchemes ) )
+        return false;
 
-        articleNewText += article.midRef( linkPos, allLinksMatch.capturedStart() - linkPos );
-        linkPos = allLinksMatch.capturedEnd();
+    int start = 0;
+    if ( url.startsWith( "file://", Qt::CaseInsensitive ) )
+        start = 7;
 
-        QString linkTxt = allLinksMatch.captured();
-        QString linkType = allLinksMatch.captured( 1 ).toLower();
-        QString newLink;
+    while ( start < url.size() && ( url[ start ].unicode() < 0x20 || url[ start ].unicode() == 0x7f ) )
+        ++start;
+    while ( start < url.size() && url[ start ] == '.' )
+        ++start;
+    if ( start < url.size() && url[ start ] == '/' )
+        ++start;
 
-        if( !linkType.isEmpty() && linkType.at( 0 ) == 'a' )
-        {
-            QRegularExpressionMatch match = anchorIdRe.match( linkTxt );
-            if( match.hasMatch() )
-            {
-                QString newText = match.captured( 1 ) + match.captured( 2 ) + uniquePrefix;
-                newLink = linkTxt.replace( match.capturedStart(), match.capturedLength(), newText );
-            }
-            else
-                newLink = linkTxt.replace( anchorIdRe2, "\\1\"" + uniquePrefix + "\\2\"" );
+    if ( start >= url.size() )
+        return false;
 
-            newLink = newLink.replace( anchorLinkRe, "\\1#" + uniquePrefix );
+    url.remove( 0, start );
+    return true;
+}
 
-            match = audioRe.match( newLink );
-            if( match.hasMatch() )
-            {
-                // sounds and audio link script
-                QString newTxt = match.captured( 1 ) + match.captured( 2 )
-                        + "gdau://" + id + "/"
-                        + match.captured( 3 ) + match.captured( 2 );
-                newLink = QString::fromUtf8( addAudioLink( "\"gdau://" + getId() + "/" + match.captured( 3 ).toUtf8().data() + "\"", getId() ).c_str() )
-                        + newLink.replace( match.capturedStart(), match.capturedLength(), newTxt );
-            }
+void MdxArticleRewriter::rewriteResource( HtmlRewriter::Tag & tag, char const * attrName )
+{
+    int index = tag.findAttribute( attrName );
+    if ( index < 0 )
+        return;
 
-            match = wordCrossLink.match( newLink );
-            if( match.hasMatch() )
-            {
-                QString newTxt = match.captured( 1 ) + match.captured( 2 )
-                        + "gdlookup://localhost/"
-                        + match.captured( 3 );
+    QString url = tag.attributeValue( index );
+    if ( stripResourceUrl( url ) )
+        tag.setAttributeValue( index, "bres://" + id + "/" + url );
+}
 
-                if( match.lastCapturedIndex() >= 4 && !match.captured( 4 ).isEmpty() )
-                    newTxt += QString( "?gdanchor=" ) + uniquePrefix + match.captured( 4 ).mid( 1 );
+void MdxArticleRewriter::rewriteAnchor( HtmlRewriter::Tag & tag )
+{
+    // Make the anchors unique among all the articles shown
+    for ( int x = 0; x < tag.attributeCount(); ++x )
+    {
+        QString attrName = tag.attributeName( x );
+        if ( attrName != QLatin1String( "name" ) && attrName != QLatin1String( "id" ) )
+            continue;
 
-                newTxt += match.captured( 2 );
-                newLink.replace( match.capturedStart(), match.capturedLength(), newTxt );
-            }
+        QString value = tag.attributeValue( x ).trimmed();
+        if ( !value.isEmpty() )
+            tag.setAttributeValue( x, uniquePrefix + value );
+    }
 
-            match = srcRe.match( newLink );
-            if( match.hasMatch() )
-            {
-                QString newText = match.captured( 1 ) + match.captured( 2 )
-                        + "bres://" + id + "/"
-                        + match.captured( 3 ) + match.captured( 2 );
-                newLink.replace( match.capturedStart(), match.capturedLength(), newText );
-            }
-            else
-                newLink.replace( srcRe2, "\\1\"bres://" + id + "/\\2\"" );
-        }
-        else
-            if( linkType.compare( "link" ) == 0 )
-            {
-                // stylesheets
-                QRegularExpressionMatch match = stylesRe.match( linkTxt );
-                if( match.hasMatch() )
-                {
-                    QString newText = match.captured( 1 ) + match.captured( 2 )
-                            + "bres://" + id + "/"
-                            + match.captured( 3 ) + match.captured( 2 );
-                    newLink = linkTxt.replace( match.capturedStart(), match.capturedLength(), newText );
-                }
-                else
-                    newLink = linkTxt.replace( stylesRe2,
-                                               "\\1\"bres://" + id + "/\\2\"" );
-            }
-            else
-                if( linkType.compare( "script" ) == 0 || linkType.compare( "img" ) == 0
-                        || linkType.compare( "embed" ) == 0
-        #ifdef MDX_LOCALVIDEO_CACHED
-                        || linkType.compare( "source" ) == 0
-        #endif
-                        )
-                {
-                    // javascripts and images
-                    QRegularExpressionMatch match = inlineScriptRe.match( linkTxt );
-                    if( linkType.compare( "script" ) == 0
-                            && match.hasMatch() && match.capturedLength() == linkTxt.length() )
-                    {
-                        // skip inline scripts
-                        articleNewText += linkTxt;
-                        match = closeScriptTagRe.match( article, linkPos );
-                        if( match.hasMatch() )
-                        {
-                            articleNewText += article.midRef( linkPos, match.capturedEnd() - linkPos );
-                            linkPos = match.capturedEnd();
-                        }
-                        continue;
-                    }
-                    else
-                    {
-                        match = srcRe.match( linkTxt );
-                        if( match.hasMatch() )
-                        {
-#ifdef MDX_LOCALVIDEO_CACHED
-                            if(linkType.compare( "source" ) == 0)  {
-                                const QString filename = match.captured( 3 );
-                                const QString tP = cacheFile(filename);
-                                QString newTxt = match.captured( 1 ) + match.captured( 2 )
-                                        //+ "gdvideo://" + id + "/" + filename + match.captured( 2 );
-                                        + "file:///" + tP + match.captured( 2 );
-                                newLink = linkTxt.replace( match.capturedStart(), match.capturedLength(), newTxt );
-                            }
-                            else
-#endif
-                            {
-                                QString newText = match.captured( 1 ) + match.captured( 2 )
-                                        + "bres://" + id + "/"
-                                        + match.captured( 3 ) + match.captured( 2 );
-                                newLink = linkTxt.replace( match.capturedStart(), match.capturedLength(), newText );
-                            }
-                        }
-                        else
-                            newLink = linkTxt.replace( srcRe2,
-                                                       "\\1\"bres://" + id + "/\\2\"" );
-                    }
-                }
-        if( !newLink.isEmpty() )
-        {
-            articleNewText += newLink;
-        }
-        else
-            articleNewText += allLinksMatch.captured();
+    int index = tag.findAttribute( "href" );
+    if ( index < 0 )
+        return;
+
+    QString href = tag.attributeValue( index );
+
+    if ( href.startsWith( "entry://#", Qt::CaseInsensitive ) )
+    {
+        tag.setAttributeValue( index, "#" + uniquePrefix + href.mid( 9 ) );
     }
-    if( linkPos )
+    else
+    if ( href.startsWith( "sound://", Qt::CaseInsensitive ) )
     {
-        articleNewText += article.midRef( linkPos );
-        article = articleNewText;
+        // sounds and audio link script
+        QString target = href.mid( 8 );
+        tag.setAttributeValue( index, "gdau://" + id + "/" + target );
+        tag.prepend( QString::fromUtf8( addAudioLink( "\"gdau://" + dict.getId() + "/"
+                                                      + target.toUtf8().data() + "\"",
+                                                      dict.getId() ).c_str() ) );
     }
+    else
+    if ( href.startsWith( "entry://", Qt::CaseInsensitive ) )
+    {
+        QString target = href.mid( 8 );
+        int n = target.indexOf( '#' );
+
+        QString newHref = "gdlookup://localhost/" + ( n < 0 ? target : target.left( n ) );
+        if ( n >= 0 )
+            newHref += QString( "?gdanchor=" ) + uniquePrefix + target.mid( n + 1 );
 
-    return article;
+        tag.setAttributeValue( index, newHref );
+    }
 }
-#else
-QString & MdxDictionary::filterResource( QString const & articleId, QString & article )
+
+
+void MdxDictionary::loadArticle( uint32_t offset, string & articleText, bool noFilter )
 {
-    QString id = QString::fromStdString( getId() );
-    QString uniquePrefix = QString::fromLatin1( "g" ) + id + "_" + articleId + "_";
-
-    QRegExp allLinksRe( "(?:<\\s*(a(?:rea)?|img|link|script)(?:\\s+[^>]+|\\s*)>)", Qt::CaseInsensitive );
-    QRegExp wordCrossLink( "([\\s\"']href\\s*=)\\s*([\"'])entry://([^>#]*)((?:#[^>]*)?)\\2", Qt::CaseInsensitive );
-    wordCrossLink.setMinimal( true );
-
-    QRegExp anchorIdRe( "([\\s\"'](?:name|id)\\s*=)\\s*([\"'])\\s*(?=\\S)", Qt::CaseInsensitive );
-    QRegExp anchorIdRe2( "([\\s\"'](?:name|id)\\s*=)\\s*(?=[^\"'])([^\\s\">]+)", Qt::CaseInsensitive );
-    QRegExp anchorLinkRe( "([\\s\"']href\\s*=\\s*[\"'])entry://#", Qt::CaseInsensitive );
-    QRegExp audioRe( "([\\s\"']href\\s*=)\\s*([\"'])sound://([^\">]+)\\2", Qt::CaseInsensitive );
-    audioRe.setMinimal( true );
-
-    QRegExp stylesRe( "([\\s\"']href\\s*=)\\s*([\"'])(?!\\s*\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\">]+)\\2",
-                      Qt::CaseInsensitive, QRegExp::RegExp2 );
-    stylesRe.setMinimal( true );
-    QRegExp stylesRe2( "([\\s\"']href\\s*=)\\s*(?![\\s\"']|\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\\s\">]+)",
-                       Qt::CaseInsensitive, QRegExp::RegExp2 );
-    QRegExp inlineScriptRe( "<\\s*script(?:(?=\\s)(?:(?![\\s\"']src\\s*=)[^>])+|\\s*)>", Qt::CaseInsensitive, QRegExp::RegExp2 );
-    QRegExp closeScriptTagRe( "<\\s*/script\\s*>", Qt::CaseInsensitive, QRegExp::RegExp2 );
-    QRegExp srcRe( "([\\s\"']src\\s*=)\\s*([\"'])(?!\\s*\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\">]+)\\2",
-                   Qt::CaseInsensitive, QRegExp::RegExp2 );
-    srcRe.setMinimal( true );
-    QRegExp srcRe2( "([\\s\"']src\\s*=)\\s*(?![\\s\"']|\\b(?:(?:bres|https?|ftp)://|(?:data|javascript):))(?:file://)?[\\x00-\\x1f\\x7f]*\\.*/?([^\\s\">]+)",
-                    Qt::CaseInsensitive, QRegExp::RegExp2 );
-
-    int linkPos = 0;
-    while( linkPos >= 0 )
-    {
-        linkPos = allLinksRe.indexIn( article, linkPos );
-        if( linkPos < 0 )
-            break;
+    vector< char > chunk;
+    Mutex::Lock _( idxMutex );
 
-        QString linkTxt = allLinksRe.cap( 0 );
-        QString linkType = allLinksRe.cap( 1 ).toLower();
-        QString newLink;
+    // Load record info from index
+    MdictParser::RecordInfo recordInfo;
+    char * pRecordInfo = chunks.getBlock( offset, chunk );
+    memcpy( &recordInfo, pRecordInfo, sizeof( recordInfo ) );
 
-        if( !linkType.isEmpty() && linkType.at( 0 ) == 'a' )
-        {
-            int pos = anchorIdRe.indexIn( linkTxt );
-            if( pos >= 0 )
-            {
-                QString newText = anchorIdRe.cap( 1 ) + anchorIdRe.cap( 2 ) + uniquePrefix;
-                newLink = linkTxt.replace( pos, anchorIdRe.cap().length(), newText );
-            }
-            else
-                newLink = linkTxt.replace( anchorIdRe2, "\\1\"" + uniquePrefix + "\\2\"" );
+    // Make a sub unique id for this article
+    QString articleId;
+    articleId.setNum( ( quint64 )pRecordInfo, 16 );
 
-            newLink = newLink.replace( anchorLinkRe, "\\1#" + uniquePrefix );
+    if ( decompressedBlockPos != recordInfo.compressedBlockPos )
+    {
+        decompressedBlockPos = -1;
 
-            pos = audioRe.indexIn( newLink );
-            if( pos >= 0 )
-            {
-                // sounds and audio link script
-                QString newTxt = audioRe.cap( 1 ) + audioRe.cap( 2 )
-                        + "gdau://" + id + "/"
-                        + audioRe.cap( 3 ) + audioRe.cap( 2 );
-                newLink = QString::fromUtf8( addAudioLink( "\"gdau://" + getId() + "/" + audioRe.cap( 3 ).toUtf8().data() + "\"", getId() ).c_str() )
-                        + newLink.replace( pos, audioRe.cap().length(), newTxt );
-            }
+        ScopedMemMap compressed( dictFileMap, dictFile, recordInfo.compressedBlockPos,
+                                 recordInfo.compressedBlockSize );
+        if ( !compressed.startAddress() )
+            throw exCorruptDictionary();
 
-            pos = wordCrossLink.indexIn( newLink );
-            if( pos >= 0 )
-            {
-                QString newTxt = wordCrossLink.cap( 1 ) + wordCrossLink.cap( 2 )
-                        + "gdlookup://localhost/"
-                        + wordCrossLink.cap( 3 );
+        if ( !MdictParser::parseCompressedBlock( recordInfo.compressedBlockSize, ( char * )compressed.startAddress(),
+                                                 recordInfo.decompressedBlockSize, decompressedBlock ) )
+            throw exCorruptDictionary();
 
-                if( !wordCrossLink.cap( 4 ).isEmpty() )
-                    newTxt += QString( "?gdanchor=" ) + uniquePrefix + wordCrossLink.cap( 4 ).mid( 1 );
+        decompressedBlockPos = recordInfo.compressedBlockPos;
 
-                newTxt += wordCrossLink.cap( 2 );
-                newLink.replace( pos, wordCrossLink.cap( 0 ).length(), newTxt );
-            }
-        }
-        else
-            if( linkType.compare( "link" ) == 0 )
-            {
-                // stylesheets
-                int pos = stylesRe.indexIn( linkTxt );
-                if( pos >= 0 )
-                {
-                    QString newText = stylesRe.cap( 1 ) + stylesRe.cap( 2 )
-                            + "bres://" + id + "/"
-                            + stylesRe.cap( 3 ) + stylesRe.cap( 2 );
-                    newLink = linkTxt.replace( pos, stylesRe.cap().length(), newText );
-                }
-                else
-                    newLink = linkTxt.replace( stylesRe2,
-                                               "\\1\"bres://" + id + "/\\2\"" );
-            }
-            else
-                if( linkType.compare( "script" ) == 0 || linkType.compare( "img" ) == 0 )
-                {
-                    // javascripts and images
-                    if( linkType.at( 0 ) == 's' && inlineScriptRe.exactMatch( linkTxt ) )
-                    {
-                        // skip inline scripts
-                        linkPos += linkTxt.length();
-                        int pos = closeScriptTagRe.indexIn( article, linkPos );
-                        if( pos > 0 )
-                            linkPos = pos + closeScriptTagRe.cap().length();
-                        continue;
-                    }
-                    else
-                    {
-                        int pos = srcRe.indexIn( linkTxt );
-                        if( pos >= 0 )
-                        {
-                            QString newText = srcRe.cap( 1 ) + srcRe.cap( 2 )
-                                    + "bres://" + id + "/"
-                                    + srcRe.cap( 3 ) + srcRe.cap( 2 );
-                            newLink = linkTxt.replace( pos, srcRe.cap().length(), newText );
-                        }
-                        else
-                            newLink = linkTxt.replace( srcRe2,
-                                                       "\\1\"bres://" + id + "/\\2\"" );
-                    }
-                }
-        if( !newLink.isEmpty() )
-        {
-            article.replace( linkPos, allLinksRe.cap().length(), newLink );
-            linkPos += newLink.length();
-        }
-        else
-            linkPos += allLinksRe.cap().length();
+        statistics->addCacheAccess( Dictionary::Stats::RecordBlocks, false );
+        statistics->addDecompressed( decompressedBlock.size() );
     }
+    else
+        statistics->addCacheAccess( Dictionary::Stats::RecordBlocks, true );
+
+    if ( recordInfo.recordOffset < 0 || recordInfo.recordSize < 0
+         || recordInfo.recordOffset + recordInfo.recordSize > decompressedBlock.size() )
+        throw exCorruptDictionary();
+
+    QString article = MdictParser::toUtf16( encoding.c_str(),
+                                            decompressedBlock.constData() + recordInfo.recordOffset,
+                                            recordInfo.recordSize );
 
-    return article;
+    article = MdictParser::substituteStylesheet( article, styleSheets );
+
+    // Rewrite the links and resources and check for unclosed <span> and <div>,
+    // all in one pass
+    MdxArticleRewriter rewriter( *this, articleId, !noFilter );
+    article = HtmlRewriter::rewrite( article, rewriter );
+
+    for ( int x = rewriter.unclosedSpans(); x > 0; --x )
+        article += "</span>";
+
+    for ( int x = rewriter.unclosedDivs(); x > 0; --x )
+        article += "</div>";
+
+    articleText = string( article.toUtf8().constData() );
 }
-#endif
 
 static void addEntryToIndex( QString const & word, uint32_t offset, IndexedWords & indexedWords )
 {
@@ -1430,9 +1391,11 @@ private:
 class ResourceHandler: public MdictParser::RecordHandler
 {
 public:
-    ResourceHandler( ChunkedStorage::Writer & chunks, IndexedWords & indexedWords ):
+    ResourceHandler( ChunkedStorage::Writer & chunks, IndexedWords & indexedWords,
+                     ResourceIndex::Writer & resourceTable ):
         chunks( chunks ),
-        indexedWords( indexedWords )
+        indexedWords( indexedWords ),
+        resourceTable( resourceTable )
     {
     }
 
@@ -1442,11 +1405,14 @@ public:
         chunks.addToBlock( &recordInfo, sizeof( recordInfo ) );
         // Add entries to the index
         addEntryToIndexSingle( fileName, resourceInfoAddress, indexedWords );
+        // The same name trimming as in addEntryToIndexSingle()
+        resourceTable.addName( gd::toWString( fileName.trimmed() ), resourceInfoAddress );
     }
 
 private:
     ChunkedStorage::Writer & chunks;
     IndexedWords & indexedWords;
+    ResourceIndex::Writer & resourceTable;
 };
 
 
@@ -1585,13 +1551,15 @@ vector< sptr< Dictionary::Class > > makeDictionaries( vector< string > const & f
 
             // enumerating resources if there's any
             vector< sptr< IndexedWords > > mddIndices;
+            vector< sptr< ResourceIndex::Writer > > mddResourceTables;
             vector< string > mddFileNames;
             while ( !mddParsers.empty() )
             {
                 sptr< MdictParser > mddParser = mddParsers.front();
                 sptr< IndexedWords > mddIndexedWords ( new IndexedWords());
+                sptr< ResourceIndex::Writer > mddResourceTable( new ResourceIndex::Writer() );
                 MdictParser::HeadWordIndex resourcesIndex;
-                ResourceHandler resourceHandler( chunks, *mddIndexedWords );
+                ResourceHandler resourceHandler( chunks, *mddIndexedWords, *mddResourceTable );
 
                 while ( mddParser->readNextHeadWordIndex( headWordIndex ) )
                 {
@@ -1600,6 +1568,7 @@ vector< sptr< Dictionary::Class > > makeDictionaries( vector< string > const & f
                 mddParser->readRecordBlock( resourcesIndex, resourceHandler );
 
                 mddIndices.push_back( mddIndexedWords );
+                mddResourceTables.push_back( mddResourceTable );
                 // Save filename for .mdd files only
                 QFileInfo fi( mddParser->filename() );
                 mddFileNames.push_back( string( fi.fileName().toUtf8().constData() ) );
@@ -1660,6 +1629,11 @@ vector< sptr< Dictionary::Class > > makeDictionaries( vector< string > const & f
                 mddIndexInfos.push_back( resourceIdxInfo );
             }
 
+            // and the fingerprint table for each mdd file
+            vector< uint32_t > mddResourceTableOffsets;
+            for ( uint32_t mi = 0; mi < mddResourceTables.size(); mi++ )
+                mddResourceTableOffsets.push_back( mddResourceTables[ mi ]->write( idx ) );
+
             // Save address of IndexInfos for resource files
             idxHeader.mddIndexInfosOffset = idx.tell();
             idxHeader.mddIndexInfosCount = mddIndexInfos.size();
@@ -1671,6 +1645,7 @@ vector< sptr< Dictionary::Class > > makeDictionaries( vector< string > const & f
                 idx.write( mddfile.c_str(), mddfile.size() + 1 );
                 idx.write<uint32_t>( mddIndexInfos[ mi ].btreeMaxElements );
                 idx.write<uint32_t>( mddIndexInfos[ mi ].rootOffset );
+                idx.write<uint32_t>( mddResourceTableOffsets[ mi ] );
             }
 
             // That concludes it. Update the header.
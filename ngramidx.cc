@@ -0,0 +1,455 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "ngramidx.hh"
+#include "btreeidx.hh"
+#include "folding.hh"
+#include "fsencoding.hh"
+#include "utf8.hh"
+#include "wstring_qt.hh"
+#include "gddebug.hh"
+#include "qt4x5.hh"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <string.h>
+
+namespace NgramIndexing {
+
+using gd::wchar;
+using std::pair;
+
+namespace {
+
+uint64_t packTrigram( wchar const * chars )
+{
+    return ( uint64_t( chars[ 0 ] & 0x1FFFFF ) << 42 ) |
+           ( uint64_t( chars[ 1 ] & 0x1FFFFF ) << 21 ) |
+           uint64_t( chars[ 2 ] & 0x1FFFFF );
+}
+
+void addTrigrams( wstring const & folded, vector< uint64_t > & trigrams )
+{
+    for( size_t x = 0; x + 3 <= folded.size(); ++x )
+        trigrams.push_back( packTrigram( folded.data() + x ) );
+}
+
+bool trigramLess( Trigram const & entry, uint64_t trigram )
+{
+    return entry.trigram < trigram;
+}
+
+bool fewerPostings( Trigram const * first, Trigram const * second )
+{
+    return first->postingsCount < second->postingsCount;
+}
+
+}
+
+bool MainIndexState::stat( string const & fileName )
+{
+    QFileInfo fileInfo( FsEncoding::decode( fileName.c_str() ) );
+
+    if ( !fileInfo.isFile() )
+        return false;
+
+    size = fileInfo.size();
+    modified = fileInfo.lastModified().toTime_t();
+
+    return true;
+}
+
+bool NgramIndex::open( string const & fileName, MainIndexState const & mainIndex_ )
+{
+    Mutex::Lock _( idxMutex );
+
+    idx.reset();
+    trigrams.clear();
+    mainIndex = mainIndex_;
+
+    if ( !File::exists( fileName ) )
+        return false;
+
+    try
+    {
+        sptr< File::Class > file( new File::Class( fileName, "rb" ) );
+
+        NgramIdxHeader header;
+
+        if ( file->readRecords( &header, sizeof( header ), 1 ) != 1 ||
+             header.signature != NgramSignature ||
+             header.formatVersion != CurrentNgramFormatVersion ||
+             header.indexBtreeMaxElements != mainIndex.btreeMaxElements ||
+             header.indexRootOffset != mainIndex.rootOffset ||
+             header.indexSize != mainIndex.size ||
+             header.indexModified != mainIndex.modified )
+            return false;
+
+        trigrams.resize( header.trigramCount );
+
+        if ( !trigrams.empty() )
+        {
+            file->seek( header.trigramsOffset );
+            file->read( &trigrams.front(), trigrams.size() * sizeof( Trigram ) );
+        }
+
+        idx = file;
+
+        return true;
+    }
+    catch( std::exception & e )
+    {
+        gdWarning( "Can't open the trigram index \"%s\", error: %s\n", fileName.c_str(), e.what() );
+        trigrams.clear();
+        return false;
+    }
+}
+
+void NgramIndex::build( string const & fileName, MainIndexState const & mainIndex,
+                        QSet< QString > const & headwords, AtomicInt32 & isCancelled )
+THROW_SPEC( std::exception )
+{
+    // The headwords are stored in the order of their folded forms, so the
+    // matches come in the same order the btree gives them in
+    vector< pair< wstring, wstring > > sorted;
+    sorted.reserve( headwords.size() );
+
+    for( QSet< QString >::const_iterator i = headwords.constBegin(); i != headwords.constEnd(); ++i )
+    {
+        wstring word = gd::toWString( *i );
+        sorted.push_back( pair< wstring, wstring >( Folding::apply( word ), word ) );
+    }
+
+    std::sort( sorted.begin(), sorted.end() );
+
+    File::Class file( fileName, "wb" );
+
+    NgramIdxHeader header;
+    memset( &header, 0, sizeof( header ) );
+
+    // We write a dummy header first. The real one is only written at the
+    // end, so an interrupted build can't be taken for a complete one.
+    file.write( header );
+
+    vector< pair< uint64_t, uint32_t > > postings; // Trigram, headword offset
+    vector< uint64_t > wordTrigrams;
+
+    for( size_t x = 0; x < sorted.size(); ++x )
+    {
+        if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+            return;
+
+        uint32_t offset = file.tell();
+
+        string utf8 = Utf8::encode( sorted[ x ].second );
+
+        file.write( (uint32_t) utf8.size() );
+        file.write( utf8.data(), utf8.size() );
+
+        wordTrigrams.clear();
+        addTrigrams( sorted[ x ].first, wordTrigrams );
+
+        std::sort( wordTrigrams.begin(), wordTrigrams.end() );
+        wordTrigrams.erase( std::unique( wordTrigrams.begin(), wordTrigrams.end() ), wordTrigrams.end() );
+
+        for( size_t y = 0; y < wordTrigrams.size(); ++y )
+            postings.push_back( pair< uint64_t, uint32_t >( wordTrigrams[ y ], offset ) );
+    }
+
+    if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+        return;
+
+    std::sort( postings.begin(), postings.end() );
+
+    vector< Trigram > table;
+
+    for( size_t x = 0; x < postings.size(); )
+    {
+        Trigram entry;
+        entry.trigram = postings[ x ].first;
+        entry.postingsOffset = file.tell();
+        entry.postingsCount = 0;
+
+        for( ; x < postings.size() && postings[ x ].first == entry.trigram; ++x, ++entry.postingsCount )
+            file.write( postings[ x ].second );
+
+        table.push_back( entry );
+    }
+
+    header.trigramsOffset = file.tell();
+
+    if ( !table.empty() )
+        file.write( &table.front(), table.size() * sizeof( Trigram ) );
+
+    header.signature = NgramSignature;
+    header.formatVersion = CurrentNgramFormatVersion;
+    header.indexBtreeMaxElements = mainIndex.btreeMaxElements;
+    header.indexRootOffset = mainIndex.rootOffset;
+    header.indexSize = mainIndex.size;
+    header.indexModified = mainIndex.modified;
+    header.headwordCount = sorted.size();
+    header.trigramCount = table.size();
+
+    file.rewind();
+    file.write( header );
+    file.close();
+}
+
+bool NgramIndex::patternTrigrams( wstring const & foldedPattern,
+                                  vector< uint64_t > & trigrams )
+{
+    trigrams.clear();
+
+    // The literal parts are the runs of characters between the wildcards.
+    // Escaped wildcard characters are punctuation, which folding drops from
+    // the headwords as well, so they don't break the runs.
+
+    wstring run;
+    bool escaped = false;
+
+    for( wstring::size_type x = 0; x <= foldedPattern.size(); ++x )
+    {
+        wchar ch = x < foldedPattern.size() ? foldedPattern[ x ] : 0;
+
+        if ( escaped )
+        {
+            escaped = false;
+
+            if ( ch != L'*' && ch != L'?' && ch != L'[' && ch != L']' && ch != L'\\' )
+                run.push_back( ch );
+
+            continue;
+        }
+
+        if ( ch == L'\\' )
+        {
+            escaped = true;
+            continue;
+        }
+
+        if ( ch == 0 || ch == L'*' || ch == L'?' || ch == L'[' || ch == L']' )
+        {
+            addTrigrams( run, trigrams );
+            run.clear();
+
+            if ( ch == L'[' )
+            {
+                // Skip the set, it matches a single unknown character
+                while( x + 1 < foldedPattern.size() && foldedPattern[ x + 1 ] != L']' )
+                    ++x;
+            }
+
+            continue;
+        }
+
+        run.push_back( ch );
+    }
+
+    std::sort( trigrams.begin(), trigrams.end() );
+    trigrams.erase( std::unique( trigrams.begin(), trigrams.end() ), trigrams.end() );
+
+    return !trigrams.empty();
+}
+
+void NgramIndex::findCandidates( vector< uint64_t > const & queryTrigrams,
+                                 vector< uint32_t > & offsets,
+                                 AtomicInt32 & isCancelled )
+THROW_SPEC( std::exception )
+{
+    offsets.clear();
+
+    Mutex::Lock _( idxMutex );
+
+    if ( !idx.get() || queryTrigrams.empty() )
+        return;
+
+    vector< Trigram const * > found;
+
+    for( size_t x = 0; x < queryTrigrams.size(); ++x )
+    {
+        vector< Trigram >::const_iterator i =
+            std::lower_bound( trigrams.begin(), trigrams.end(), queryTrigrams[ x ], trigramLess );
+
+        if ( i == trigrams.end() || i->trigram != queryTrigrams[ x ] )
+            return; // No headword has this one
+
+        found.push_back( &*i );
+    }
+
+    // Start with the rarest trigram, so that the intersections stay small
+    std::sort( found.begin(), found.end(), fewerPostings );
+
+    readPostings( *found[ 0 ], offsets );
+
+    vector< uint32_t > postings, intersection;
+
+    for( size_t x = 1; x < found.size() && !offsets.empty(); ++x )
+    {
+        if ( Qt4x5::AtomicInt::loadAcquire( isCancelled ) )
+        {
+            offsets.clear();
+            return;
+        }
+
+        readPostings( *found[ x ], postings );
+
+        intersection.clear();
+        std::set_intersection( offsets.begin(), offsets.end(),
+                               postings.begin(), postings.end(),
+                               std::back_inserter( intersection ) );
+        offsets.swap( intersection );
+    }
+}
+
+wstring NgramIndex::getHeadword( uint32_t offset )
+THROW_SPEC( std::exception )
+{
+    Mutex::Lock _( idxMutex );
+
+    if ( !idx.get() )
+        return wstring();
+
+    idx->seek( offset );
+
+    uint32_t size = idx->read< uint32_t >();
+
+    string utf8( size, 0 );
+
+    if ( size )
+        idx->read( &utf8[ 0 ], size );
+
+    return Utf8::decode( utf8 );
+}
+
+void NgramIndex::readPostings( Trigram const & entry, vector< uint32_t > & postings )
+{
+    postings.resize( entry.postingsCount );
+
+    if ( postings.empty() )
+        return;
+
+    idx->seek( entry.postingsOffset );
+    idx->read( &postings.front(), postings.size() * sizeof( uint32_t ) );
+}
+
+/// Builds the index for NgramIndexHolder. It reads the main index through
+/// a file of its own, so that it doesn't depend on the dictionary.
+class BuildRunnable: public QRunnable
+{
+    NgramIndexHolder & holder;
+    string fileName, mainFileName;
+    MainIndexState mainIndex;
+
+public:
+
+    BuildRunnable( NgramIndexHolder & holder_, string const & fileName_,
+                   string const & mainFileName_, MainIndexState const & mainIndex_ ):
+        holder( holder_ ), fileName( fileName_ ), mainFileName( mainFileName_ ),
+        mainIndex( mainIndex_ )
+    {}
+
+    ~BuildRunnable()
+    {
+        holder.buildExited.release();
+    }
+
+    virtual void run();
+};
+
+void BuildRunnable::run()
+{
+    sptr< NgramIndex > index;
+
+    try
+    {
+        // Building it takes a single walk over the main index
+        File::Class file( mainFileName, "rb" );
+        Mutex fileMutex;
+
+        BtreeIndexing::BtreeIndex mainIdx;
+        mainIdx.openIndex( BtreeIndexing::IndexInfo( mainIndex.btreeMaxElements, mainIndex.rootOffset ),
+                           file, fileMutex );
+
+        QSet< QString > headwords;
+        mainIdx.findArticleLinks( 0, 0, &headwords, &holder.isCancelled );
+
+        if ( !Qt4x5::AtomicInt::loadAcquire( holder.isCancelled ) )
+            NgramIndex::build( fileName, mainIndex, headwords, holder.isCancelled );
+
+        // If the main index was rebuilt meanwhile, the index made won't open
+        // for the new one, which gets tried the next time
+        MainIndexState current( mainIndex.btreeMaxElements, mainIndex.rootOffset );
+
+        if ( !Qt4x5::AtomicInt::loadAcquire( holder.isCancelled )
+             && current.stat( mainFileName ) )
+        {
+            index = new NgramIndex;
+
+            if ( !index->open( fileName, current ) )
+                index.reset();
+        }
+    }
+    catch( std::exception & e )
+    {
+        gdWarning( "Can't build the trigram index \"%s\", error: %s\n", fileName.c_str(), e.what() );
+    }
+
+    Mutex::Lock _( holder.mutex );
+
+    holder.index = index;
+    holder.building = false;
+}
+
+NgramIndexHolder::NgramIndexHolder():
+    haveTried( false ), building( false ), buildsStarted( 0 )
+{
+}
+
+NgramIndexHolder::~NgramIndexHolder()
+{
+    isCancelled.ref();
+    buildExited.acquire( buildsStarted );
+}
+
+sptr< NgramIndex > NgramIndexHolder::get( string const & fileName, string const & mainFileName,
+                                          uint32_t btreeMaxElements, uint32_t rootOffset )
+{
+    MainIndexState mainIndex( btreeMaxElements, rootOffset );
+
+    if ( !mainIndex.stat( mainFileName ) )
+        return sptr< NgramIndex >();
+
+    Mutex::Lock _( mutex );
+
+    if ( index.get() && index->getMainIndexState() == mainIndex )
+        return index;
+
+    index.reset();
+
+    if ( building || ( haveTried && tried == mainIndex ) )
+        return index;
+
+    haveTried = true;
+    tried = mainIndex;
+
+    sptr< NgramIndex > opened( new NgramIndex );
+
+    if ( opened->open( fileName, mainIndex ) )
+    {
+        index = opened;
+        return index;
+    }
+
+    building = true;
+    ++buildsStarted;
+    QThreadPool::globalInstance()->start( new BuildRunnable( *this, fileName, mainFileName, mainIndex ) );
+
+    return index;
+}
+
+}
@@ -0,0 +1,181 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __NGRAMIDX_HH_INCLUDED__
+#define __NGRAMIDX_HH_INCLUDED__
+
+#include <QSemaphore>
+#include <QSet>
+#include <QString>
+
+#include <string>
+#include <vector>
+
+#include "file.hh"
+#include "mutex.hh"
+#include "sptr.hh"
+#include "wstring.hh"
+
+#if defined( _MSC_VER ) && _MSC_VER < 1800 // VS2012 and older
+#include <stdint_msvc.h>
+#else
+#include <stdint.h>
+#endif
+
+/// An auxiliary index of the trigrams of the dictionary's folded headwords.
+/// A wildcard pattern beginning with a wildcard can't use the btree, so
+/// instead of matching it against every headword, only the ones containing
+/// all the trigrams of the pattern's literal parts get matched. The index is
+/// kept in a file of its own next to the main index and is built on demand,
+/// in the background.
+namespace NgramIndexing {
+
+using std::string;
+using std::vector;
+using gd::wstring;
+
+enum
+{
+    NgramSignature = 0x4d52474e, // NGRM on little-endian, MRGN on big-endian
+    CurrentNgramFormatVersion = 2
+};
+
+#pragma pack(push,1)
+
+struct NgramIdxHeader
+{
+    uint32_t signature; // First comes the signature, NGRM
+    uint32_t formatVersion; // File format version
+    uint32_t indexBtreeMaxElements; // Two fields from IndexInfo of the main
+    uint32_t indexRootOffset;       // index, which change when it's rebuilt
+    uint64_t indexSize;     // The size and the modification time of the main
+    uint32_t indexModified; // index file, which tell its other rebuilds apart
+    uint32_t headwordCount; // Number of the headwords stored
+    uint32_t trigramCount; // Number of the Trigram entries
+    uint32_t trigramsOffset; // The offset to the table of Trigram entries
+}
+#ifndef _MSC_VER
+__attribute__((packed))
+#endif
+;
+
+/// An entry of the table of trigrams, which is sorted by them
+struct Trigram
+{
+    uint64_t trigram; // Three 21-bit characters
+    uint32_t postingsOffset; // The offset to the offsets of the headwords
+    uint32_t postingsCount;  // which contain the trigram, in increasing order
+}
+#ifndef _MSC_VER
+__attribute__((packed))
+#endif
+;
+
+#pragma pack(pop)
+
+/// Tells apart the versions of the main index the index is built for
+struct MainIndexState
+{
+    uint32_t btreeMaxElements, rootOffset; // From its IndexInfo
+    uint64_t size;
+    uint32_t modified;
+
+    MainIndexState( uint32_t btreeMaxElements_ = 0, uint32_t rootOffset_ = 0 ):
+        btreeMaxElements( btreeMaxElements_ ), rootOffset( rootOffset_ ),
+        size( 0 ), modified( 0 )
+    {}
+
+    /// Reads the size and the modification time of the main index file.
+    /// Returns false if there's no such file.
+    bool stat( string const & fileName );
+
+    bool operator == ( MainIndexState const & other ) const
+    {
+        return btreeMaxElements == other.btreeMaxElements && rootOffset == other.rootOffset
+               && size == other.size && modified == other.modified;
+    }
+};
+
+class NgramIndex
+{
+public:
+
+    /// Opens the index file built for the main index given. Returns false if
+    /// there's no such file, or it's outdated or damaged.
+    bool open( string const & fileName, MainIndexState const & );
+
+    /// Writes the index of the headwords given to the file. Nothing usable is
+    /// left if it gets cancelled.
+    static void build( string const & fileName, MainIndexState const &,
+                       QSet< QString > const & headwords, AtomicInt32 & isCancelled )
+    THROW_SPEC( std::exception );
+
+    /// Returns the main index the index was opened for
+    MainIndexState const & getMainIndexState() const
+    { return mainIndex; }
+
+    /// Collects the trigrams of the literal parts of the wildcard pattern,
+    /// which is to be folded with the wildcards preserved. Returns false if
+    /// there are none, as no literal part is long enough.
+    static bool patternTrigrams( wstring const & foldedPattern,
+                                 vector< uint64_t > & trigrams );
+
+    /// Finds the headwords whose folded forms contain all the trigrams given.
+    /// They still have to be matched against the pattern. Their offsets are
+    /// returned in the order of the folded headwords.
+    void findCandidates( vector< uint64_t > const & trigrams,
+                         vector< uint32_t > & offsets,
+                         AtomicInt32 & isCancelled )
+    THROW_SPEC( std::exception );
+
+    /// Reads the headword at the offset given by findCandidates()
+    wstring getHeadword( uint32_t offset )
+    THROW_SPEC( std::exception );
+
+private:
+
+    sptr< File::Class > idx;
+    Mutex idxMutex;
+    vector< Trigram > trigrams;
+    MainIndexState mainIndex;
+
+    void readPostings( Trigram const &, vector< uint32_t > & );
+};
+
+/// Keeps the trigram index of a main index, building it once, in the
+/// background, when there's none or it's outdated. The searches made in the
+/// meantime go without it.
+class NgramIndexHolder
+{
+public:
+
+    NgramIndexHolder();
+
+    /// Cancels the building, if any, and waits for it
+    ~NgramIndexHolder();
+
+    /// Returns the index kept in the file given for the main index kept in
+    /// mainFileName, which is opened with the IndexInfo fields given, if
+    /// there's an up-to-date one. Otherwise starts building it, unless it's
+    /// being built or has failed for that version of the main index already,
+    /// and returns an empty pointer.
+    sptr< NgramIndex > get( string const & fileName, string const & mainFileName,
+                            uint32_t btreeMaxElements, uint32_t rootOffset );
+
+private:
+
+    Mutex mutex;
+    sptr< NgramIndex > index;
+    bool haveTried;
+    MainIndexState tried; // The last version of the main index tried
+    bool building;
+
+    AtomicInt32 isCancelled;
+    int buildsStarted;
+    QSemaphore buildExited;
+
+    friend class BuildRunnable;
+};
+
+}
+
+#endif
@@ -205,6 +205,8 @@ Preferences::Preferences( QWidget * parent, Config::Class & cfg_ ):
 
     ui.collapseBigArticles->setChecked( p.collapseBigArticles );
     ui.articleSizeLimit->setValue( p.articleSizeLimit );
+    ui.useLookupDeadline->setChecked( p.useLookupDeadline );
+    ui.lookupDeadline->setValue( p.lookupDeadline );
     ui.ignoreDiacritics->setChecked( p.ignoreDiacritics );
 
     ui.synonymSearchEnabled->setChecked( p.synonymSearchEnabled );
@@ -421,6 +423,8 @@ Config::Preferences Preferences::getPreferences()
 
     p.collapseBigArticles = ui.collapseBigArticles->isChecked();
     p.articleSizeLimit = ui.articleSizeLimit->text().toInt();
+    p.useLookupDeadline = ui.useLookupDeadline->isChecked();
+    p.lookupDeadline = ui.lookupDeadline->value();
     p.ignoreDiacritics = ui.ignoreDiacritics->isChecked();
 
     p.synonymSearchEnabled = ui.synonymSearchEnabled->isChecked();
@@ -0,0 +1,142 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "requesttrace.hh"
+#include "gddebug.hh"
+#include "config.hh"
+
+#include <QCheckBox>
+#include <QDialogButtonBox>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTableWidget>
+#include <QVBoxLayout>
+
+namespace {
+
+enum Column
+{
+    DictionaryColumn,
+    PhaseColumn,
+    FinishedColumn,
+    CancelledColumn,
+    PendingColumn,
+    AverageColumn,
+    P95Column,
+    MaxColumn,
+    ColumnCount
+};
+
+QTableWidgetItem * numberItem( double value, int precision = 1 )
+{
+    QTableWidgetItem * item = new QTableWidgetItem( QString::number( value, 'f', precision ) );
+    item->setTextAlignment( Qt::AlignRight | Qt::AlignVCenter );
+    return item;
+}
+
+}
+
+RequestTraceDialog::RequestTraceDialog( QWidget * parent ):
+    QDialog( parent )
+{
+    setWindowTitle( tr( "Request Tracing" ) );
+
+    recording = new QCheckBox( tr( "Record the dictionary requests" ), this );
+    recording->setChecked( GdTrace::isEnabled() );
+    connect( recording, SIGNAL( toggled( bool ) ), this, SLOT( recordingToggled( bool ) ) );
+
+    table = new QTableWidget( 0, ColumnCount, this );
+    table->setHorizontalHeaderLabels( QStringList() << tr( "Dictionary" ) << tr( "Phase" )
+                                      << tr( "Finished" ) << tr( "Cancelled" ) << tr( "Pending" )
+                                      << tr( "Average, ms" ) << tr( "95%, ms" ) << tr( "Max, ms" ) );
+    table->setEditTriggers( QAbstractItemView::NoEditTriggers );
+    table->setSelectionBehavior( QAbstractItemView::SelectRows );
+    table->verticalHeader()->hide();
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
+    table->horizontalHeader()->setSectionResizeMode( DictionaryColumn, QHeaderView::Stretch );
+#else
+    table->horizontalHeader()->setResizeMode( DictionaryColumn, QHeaderView::Stretch );
+#endif
+
+    QDialogButtonBox * buttons = new QDialogButtonBox( QDialogButtonBox::Close, Qt::Horizontal, this );
+    QPushButton * save = buttons->addButton( tr( "Save Trace..." ), QDialogButtonBox::ActionRole );
+    QPushButton * clear = buttons->addButton( tr( "Clear" ), QDialogButtonBox::ResetRole );
+
+    connect( save, SIGNAL( clicked() ), this, SLOT( saveTrace() ) );
+    connect( clear, SIGNAL( clicked() ), this, SLOT( clearTrace() ) );
+    connect( buttons, SIGNAL( rejected() ), this, SLOT( reject() ) );
+
+    QVBoxLayout * layout = new QVBoxLayout( this );
+    layout->addWidget( recording );
+    layout->addWidget( table );
+    layout->addWidget( buttons );
+
+    resize( 760, 420 );
+
+    refreshTimer.setInterval( 1000 );
+    connect( &refreshTimer, SIGNAL( timeout() ), this, SLOT( refresh() ) );
+}
+
+void RequestTraceDialog::showEvent( QShowEvent * ev )
+{
+    recording->setChecked( GdTrace::isEnabled() );
+    refresh();
+    refreshTimer.start();
+
+    QDialog::showEvent( ev );
+}
+
+void RequestTraceDialog::hideEvent( QHideEvent * ev )
+{
+    refreshTimer.stop();
+
+    QDialog::hideEvent( ev );
+}
+
+void RequestTraceDialog::refresh()
+{
+    std::vector< GdTrace::Latency > latencies = GdTrace::latencies();
+
+    table->setRowCount( latencies.size() );
+
+    for( size_t x = 0; x < latencies.size(); ++x )
+    {
+        GdTrace::Latency const & l = latencies[ x ];
+        int row = x;
+
+        table->setItem( row, DictionaryColumn,
+                        new QTableWidgetItem( l.dictId.empty() ? tr( "(All dictionaries)" )
+                                                               : QString::fromUtf8( l.dictName.c_str() ) ) );
+        table->setItem( row, PhaseColumn, new QTableWidgetItem( QString::fromLatin1( l.phase ) ) );
+        table->setItem( row, FinishedColumn, numberItem( l.finished, 0 ) );
+        table->setItem( row, CancelledColumn, numberItem( l.cancelled, 0 ) );
+        table->setItem( row, PendingColumn, numberItem( l.pending, 0 ) );
+        table->setItem( row, AverageColumn, numberItem( l.averageMs ) );
+        table->setItem( row, P95Column, numberItem( l.p95Ms ) );
+        table->setItem( row, MaxColumn, numberItem( l.maxMs ) );
+    }
+}
+
+void RequestTraceDialog::recordingToggled( bool on )
+{
+    GdTrace::setEnabled( on );
+}
+
+void RequestTraceDialog::saveTrace()
+{
+    QString fileName = QFileDialog::getSaveFileName( this, tr( "Save Trace" ),
+                                                     Config::getConfigDir() + "gd_trace.json",
+                                                     tr( "Chrome trace files (*.json)" ) );
+    if( fileName.isEmpty() )
+        return;
+
+    if( !GdTrace::dump( fileName ) )
+        QMessageBox::critical( this, "GoldenDict", tr( "Can't write the file %1" ).arg( fileName ) );
+}
+
+void RequestTraceDialog::clearTrace()
+{
+    GdTrace::clear();
+    refresh();
+}
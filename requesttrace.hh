@@ -0,0 +1,42 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __REQUESTTRACE_HH_INCLUDED__
+#define __REQUESTTRACE_HH_INCLUDED__
+
+#include <QDialog>
+#include <QTimer>
+
+class QCheckBox;
+class QTableWidget;
+
+/// Shows the latencies of the dictionary requests traced by GdTrace, per
+/// dictionary and lookup phase, updating them as the lookups go. Also turns
+/// the tracing on and off, and saves the trace to a file.
+class RequestTraceDialog: public QDialog
+{
+    Q_OBJECT
+
+public:
+
+    RequestTraceDialog( QWidget * parent );
+
+protected:
+
+    virtual void showEvent( QShowEvent * );
+    virtual void hideEvent( QHideEvent * );
+
+private slots:
+
+    void refresh();
+    void recordingToggled( bool );
+    void saveTrace();
+    void clearTrace();
+
+private:
+
+    QCheckBox * recording;
+    QTableWidget * table;
+    QTimer refreshTimer;
+};
+
+#endif
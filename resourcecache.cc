@@ -0,0 +1,127 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "resourcecache.hh"
+#include "qt4x5.hh"
+
+#include <list>
+#include <map>
+
+namespace ResourceCache {
+
+namespace {
+
+size_t const MaxCacheBytes = 32 * 1024 * 1024;
+
+struct Policy
+{
+    char const * scheme;
+    size_t maxResourceSize; // The larger resources aren't cached
+};
+
+/// The schemes not listed here aren't cached
+Policy const policies[] =
+{
+    { "gico", 64 * 1024 }, // The icons shown next to every article
+    { "bres", 1024 * 1024 } // Images and stylesheets
+};
+
+struct Entry
+{
+    QByteArray key;
+    std::vector< char > resource;
+};
+
+Mutex cacheMutex;
+
+std::list< Entry > entries; // The most recently used ones first
+std::map< QByteArray, std::list< Entry >::iterator > index;
+size_t cacheBytes = 0;
+
+Policy const * policyFor( QByteArray const & scheme )
+{
+    for( size_t x = 0; x < sizeof( policies ) / sizeof( *policies ); ++x )
+        if ( scheme == policies[ x ].scheme )
+            return &policies[ x ];
+
+    return 0;
+}
+
+}
+
+QByteArray makeKey( QUrl const & url )
+{
+    QByteArray scheme = url.scheme().toLatin1();
+
+    if ( !policyFor( scheme ) )
+        return QByteArray();
+
+    QByteArray key( scheme );
+    key += '\0';
+    key += url.host().toUtf8();
+    key += '\0';
+    key += Qt4x5::Url::path( url ).toUtf8();
+
+    return key;
+}
+
+sptr< Dictionary::DataRequest > find( QByteArray const & key )
+{
+    Mutex::Lock _( cacheMutex );
+
+    std::map< QByteArray, std::list< Entry >::iterator >::iterator i = index.find( key );
+
+    if ( i == index.end() )
+        return sptr< Dictionary::DataRequest >();
+
+    entries.splice( entries.begin(), entries, i->second );
+
+    sptr< Dictionary::DataRequestInstant > result( new Dictionary::DataRequestInstant( true ) );
+    result->getData() = i->second->resource;
+
+    return result;
+}
+
+void store( QByteArray const & key, std::vector< char > const & resource )
+{
+    if ( key.isEmpty() )
+        return;
+
+    Policy const * policy = policyFor( QByteArray( key.constData() ) ); // Up to the first zero
+
+    if ( !policy || resource.size() > policy->maxResourceSize )
+        return;
+
+    Mutex::Lock _( cacheMutex );
+
+    std::map< QByteArray, std::list< Entry >::iterator >::iterator i = index.find( key );
+
+    if ( i != index.end() )
+    {
+        entries.splice( entries.begin(), entries, i->second );
+        return;
+    }
+
+    entries.push_front( Entry() );
+    entries.front().key = key;
+    entries.front().resource = resource;
+    index[ key ] = entries.begin();
+    cacheBytes += resource.size();
+
+    while ( cacheBytes > MaxCacheBytes && entries.size() > 1 )
+    {
+        cacheBytes -= entries.back().resource.size();
+        index.erase( entries.back().key );
+        entries.pop_back();
+    }
+}
+
+void clear()
+{
+    Mutex::Lock _( cacheMutex );
+
+    entries.clear();
+    index.clear();
+    cacheBytes = 0;
+}
+
+}
@@ -0,0 +1,40 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __RESOURCECACHE_HH_INCLUDED__
+#define __RESOURCECACHE_HH_INCLUDED__
+
+#include <QByteArray>
+#include <QUrl>
+#include <vector>
+#include "dictionary.hh"
+
+/// A process-wide in-memory cache of the dictionary resources shown in the
+/// articles, such as the images, the stylesheets and the dictionary icons,
+/// so that they're not read and decompressed again each time an article is
+/// shown in any of the tabs or in the scan popup. Each URL scheme has its own
+/// size limit for the resources, with the sounds and the videos not cached
+/// at all, since they are large and only played on demand. The cache is
+/// bounded in size, dropping the least recently used resources.
+/// All the functions are thread-safe.
+namespace ResourceCache {
+
+/// Makes the key for the resource URL given, which consists of the scheme,
+/// the dictionary id and the resource path. Returns an empty key if the
+/// resources of the URL's scheme aren't cached.
+QByteArray makeKey( QUrl const & );
+
+/// Returns the cached resource as a finished request, or an empty pointer if
+/// there's no such resource in the cache
+sptr< Dictionary::DataRequest > find( QByteArray const & key );
+
+/// Puts the resource into the cache. The ones too large for their scheme are
+/// ignored.
+void store( QByteArray const & key, std::vector< char > const & resource );
+
+/// Removes all the resources. To be called once the dictionaries are
+/// reloaded, since the resources of the same dictionary id may change.
+void clear();
+
+}
+
+#endif
@@ -0,0 +1,99 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "resourceindex.hh"
+#include "folding.hh"
+#include "utf8.hh"
+#include "wstring_qt.hh"
+
+#include <algorithm>
+
+namespace ResourceIndex {
+
+using std::string;
+
+namespace {
+
+bool entryLess( Entry const & a, Entry const & b )
+{
+    if ( a.fingerprint != b.fingerprint )
+        return a.fingerprint < b.fingerprint;
+    return a.address < b.address;
+}
+
+bool fingerprintLess( Entry const & a, uint64_t b )
+{
+    return a.fingerprint < b;
+}
+
+}
+
+uint64_t fingerprint( wstring const & name )
+{
+    string folded = Utf8::encode( Folding::applySimpleCaseOnly( gd::normalize( name ) ) );
+
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for ( string::const_iterator i = folded.begin(); i != folded.end(); ++i )
+    {
+        hash ^= ( unsigned char ) *i;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+void Writer::addName( wstring const & name, uint32_t address )
+{
+    Entry entry;
+    entry.fingerprint = fingerprint( name );
+    entry.address = address;
+    entries.push_back( entry );
+}
+
+uint32_t Writer::write( File::Class & file )
+{
+    std::sort( entries.begin(), entries.end(), entryLess );
+
+    uint32_t offset = file.tell();
+
+    file.write< uint32_t >( entries.size() );
+    if ( !entries.empty() )
+        file.write( &entries.front(), entries.size() * sizeof( Entry ) );
+
+    return offset;
+}
+
+void Table::load( File::Class & file, uint32_t offset )
+{
+    file.seek( offset );
+
+    uint32_t count = file.read< uint32_t >();
+
+    // Don't trust the count blindly -- it must fit within the file
+    if ( ( qint64 ) count * ( qint64 ) sizeof( Entry ) > file.file().size() )
+        throw exCorruptedTable();
+
+    entries.resize( count );
+    if ( count )
+        file.read( &entries.front(), count * sizeof( Entry ) );
+}
+
+Table::Result Table::find( wstring const & name, uint32_t & address ) const
+{
+    uint64_t value = fingerprint( name );
+
+    vector< Entry >::const_iterator i = std::lower_bound( entries.begin(), entries.end(),
+                                                          value, fingerprintLess );
+
+    if ( i == entries.end() || i->fingerprint != value )
+        return NotFound;
+
+    vector< Entry >::const_iterator next = i + 1;
+    if ( next != entries.end() && next->fingerprint == value )
+        return Ambiguous;
+
+    address = i->address;
+    return Found;
+}
+
+}
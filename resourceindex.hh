@@ -0,0 +1,86 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __RESOURCEINDEX_HH_INCLUDED__
+#define __RESOURCEINDEX_HH_INCLUDED__
+
+#include "ex.hh"
+#include "file.hh"
+#include "wstring.hh"
+
+#include <vector>
+#if defined( _MSC_VER ) && _MSC_VER < 1800 // VS2012 and older
+#include <stdint_msvc.h>
+#else
+#include <stdint.h>
+#endif
+
+/// A sorted table of resource name fingerprints, mapping each name to the
+/// address of the resource's record. It is built along with the btree index
+/// and allows resolving a resource with a single binary search in memory
+/// instead of walking the btree for every image, stylesheet or sound.
+/// Names are compared the same way BtreeIndex::findArticles() does for a
+/// single-word entry, i.e. case-insensitively.
+namespace ResourceIndex {
+
+using std::vector;
+using gd::wstring;
+
+DEF_EX( Ex, "Resource index exception", std::exception )
+DEF_EX( exCorruptedTable, "Corrupted resource fingerprint table", Ex )
+
+#pragma pack( push, 1 )
+
+struct Entry
+{
+    uint64_t fingerprint;
+    uint32_t address;
+};
+
+#pragma pack( pop )
+
+/// Returns the fingerprint of the given resource name.
+uint64_t fingerprint( wstring const & name );
+
+/// Accumulates the names and writes the table out.
+class Writer
+{
+    vector< Entry > entries;
+
+public:
+
+    void addName( wstring const & name, uint32_t address );
+
+    /// Writes the table at the current position of the file and returns the
+    /// offset it was written at.
+    uint32_t write( File::Class & file );
+};
+
+/// Holds the table loaded from the index file.
+class Table
+{
+    vector< Entry > entries;
+
+public:
+
+    enum Result
+    {
+        NotFound,
+        Found,
+        /// The fingerprint is shared by several entries (duplicate names or a
+        /// hash collision). The caller is to resort to the btree then.
+        Ambiguous
+    };
+
+    /// Loads the table previously written by Writer::write() at the given
+    /// offset.
+    void load( File::Class & file, uint32_t offset );
+
+    bool isEmpty() const
+    { return entries.empty(); }
+
+    Result find( wstring const & name, uint32_t & address ) const;
+};
+
+}
+
+#endif
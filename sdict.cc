@@ -195,6 +195,8 @@ SdictDictionary::SdictDictionary( string const & id,
     chunks( idx, idxHeader.chunksOffset ),
     df( dictionaryFiles[ 0 ], "rb" )
 {
+    chunks.setStats( statistics.get() );
+
     // Read dictionary name
 
     idx.seek( sizeof( idxHeader ) );
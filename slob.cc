@@ -14,6 +14,7 @@
 #include "ftshelpers.hh"
 #include "htmlescape.hh"
 #include "filetype.hh"
+#include "htmlrewriter.hh"
 #ifdef MAKE_EXTRA_TIFF_HANDLER
 #include "tiff.hh"
 #endif
@@ -581,6 +582,15 @@ public:
 
     ~SlobDictionary();
 
+    /// The TeX formulas are rendered to texCachePath, if there's the renderer
+    virtual Dictionary::Features getFeatures() const
+    {
+        if( texCgiPath.isEmpty() )
+            return BtreeDictionary::getFeatures();
+
+        return BtreeDictionary::getFeatures() | Dictionary::ArticlesUseSessionFiles;
+    }
+
     virtual unsigned long getArticleCount() const
     { return idxHeader.articleCount; }
 
@@ -805,88 +815,97 @@ void SlobDictionary::loadArticle( quint32 address,
     articleText = prefix + articleText + cleaner + "</div>";
 }
 
-string SlobDictionary::convert( const string & in, RefEntry const & entry )
+/// Rewrites the links of an article: relative images, scripts and stylesheets
+/// are taken from the dictionary, and the links to other pages become lookups.
+class SlobArticleRewriter: public HtmlRewriter::Handler
 {
-    QString text = QString::fromUtf8( in.c_str() );
+    QString id;
 
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-    // pattern of img and script
-    text.replace( QRegularExpression( "<\\s*(img|script)\\s+([^>]*)src=\"(?!(?:data|https?|ftp):)(|/)([^\"]*)\"" ),
-                  QString( "<\\1 \\2src=\"bres://%1/\\4\"").arg( getId().c_str() ) );
+public:
 
-    // pattern <link... href="..." ...>
-    text.replace( QRegularExpression( "<\\s*link\\s+([^>]*)href=\"(?!(?:data|https?|ftp):)" ),
-                  QString( "<link \\1href=\"bres://%1/").arg( getId().c_str() ) );
-#else
-    // pattern of img and script
-    text.replace( QRegExp( "<\\s*(img|script)\\s+([^>]*)src=\"(?!(?:data|https?|ftp):)(|/)([^\"]*)\"" ),
-                  QString( "<\\1 \\2src=\"bres://%1/\\4\"").arg( getId().c_str() ) );
+    explicit SlobArticleRewriter( string const & id_ ):
+        id( QString::fromUtf8( id_.c_str() ) )
+    {}
 
-    // pattern <link... href="..." ...>
-    text.replace( QRegExp( "<\\s*link\\s+([^>]*)href=\"(?!(?:data|https?|ftp):)" ),
-                  QString( "<link \\1href=\"bres://%1/").arg( getId().c_str() ) );
-#endif
+    virtual void handleStartTag( HtmlRewriter::Tag & tag );
+};
 
-    // pattern <a href="..." ...>, excluding any known protocols such as http://, mailto:, #(comment)
-    // these links will be translated into local definitions
-    QString anchor;
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-    QRegularExpression rxLink( "<\\s*a\\s+([^>]*)href=\"(?!(?:\\w+://|#|mailto:|tel:))(/|)([^\"]*)\"\\s*(title=\"[^\"]*\")?[^>]*>" );
-    QRegularExpressionMatchIterator it = rxLink.globalMatch( text );
-    int pos = 0;
-    QString newText;
-    while( it.hasNext() )
+void SlobArticleRewriter::handleStartTag( HtmlRewriter::Tag & tag )
+{
+    static char const * const externalSchemes[] = { "data:", "http:", "https:", "ftp:", 0 };
+
+    QString const & name = tag.name();
+
+    if ( name == QLatin1String( "img" ) || name == QLatin1String( "script" ) )
     {
-        QRegularExpressionMatch match = it.next();
+        int index = tag.findAttribute( "src" );
+        if ( index < 0 )
+            return;
 
-        newText += text.midRef( pos, match.capturedStart() - pos );
-        pos = match.capturedEnd();
+        QString url = tag.attributeValue( index );
+        if ( HtmlRewriter::hasScheme( url, externalSchemes ) )
+            return;
 
-        QStringList list = match.capturedTexts();
-        // Add empty strings for compatibility with QRegExp behaviour
-        for( int i = match.lastCapturedIndex() + 1; i < 5; i++ )
-            list.append( QString() );
-#else
-    QRegExp rxLink( "<\\s*a\\s+([^>]*)href=\"(?!(\\w+://|#|mailto:|tel:))(/|)([^\"]*)\"\\s*(title=\"[^\"]*\")?[^>]*>",
-                    Qt::CaseSensitive,
-                    QRegExp::RegExp2 );
+        if ( url.startsWith( '/' ) )
+            url.remove( 0, 1 );
 
-    int pos = 0;
-    while( (pos = rxLink.indexIn( text, pos )) >= 0 )
+        tag.setAttributeValue( index, "bres://" + id + "/" + url );
+    }
+    else
+    if ( name == QLatin1String( "link" ) )
     {
-        QStringList list = rxLink.capturedTexts();
-#endif
-        QString tag = list[3];
-        if ( !list[4].isEmpty() )
-            tag = list[4].split("\"")[1];
+        int index = tag.findAttribute( "href" );
+        if ( index < 0 )
+            return;
+
+        QString url = tag.attributeValue( index );
+        if ( !HtmlRewriter::hasScheme( url, externalSchemes ) )
+            tag.setAttributeValue( index, "bres://" + id + "/" + url );
+    }
+    else
+    if ( name == QLatin1String( "a" ) )
+    {
+        // Links excluding any known protocols such as http://, mailto:,
+        // #(comment) are translated into local definitions
+        int index = tag.findAttribute( "href" );
+        if ( index < 0 )
+            return;
+
+        QString url = tag.attributeValue( index );
+        if ( HtmlRewriter::hasAnyScheme( url ) || url.startsWith( '#' )
+             || url.startsWith( "mailto:" ) || url.startsWith( "tel:" ) )
+            return;
+
+        if ( url.startsWith( '/' ) )
+            url.remove( 0, 1 );
 
         // Find anchor
-        int n = list[ 3 ].indexOf( '#' );
-        if( n > 0 )
-            anchor = QString( "?gdanchor=" ) + list[ 3 ].mid( n + 1 );
-        else
-            anchor.clear();
+        QString anchor;
+        int n = url.indexOf( '#' );
+        if ( n >= 0 )
+        {
+            if ( n > 0 )
+                anchor = QString( "?gdanchor=" ) + url.mid( n + 1 );
+            url.truncate( n );
+        }
 
-        tag.remove( QRegExp(".*/") ).
-                remove( QRegExp( "\\.(s|)htm(l|)$", Qt::CaseInsensitive ) ).
-                replace( "_", "%20" ).
-                prepend( "<a href=\"gdlookup://localhost/" ).
-                append( anchor + "\" " + list[4] + ">" );
+        QString title = tag.attributeValue( "title" );
+        QString word = HtmlRewriter::linkedPageName( title.isEmpty() ? url : title );
+        word.replace( "_", "%20" );
 
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-        newText += tag;
+        tag.setAttributeValue( index, "gdlookup://localhost/" + word + anchor );
     }
-    if( pos )
+}
+
+string SlobDictionary::convert( const string & in, RefEntry const & entry )
+{
+    QString text = QString::fromUtf8( in.c_str() );
+
+    // Fix up the links to the resources and to the other articles
     {
-        newText += text.midRef( pos );
-        text = newText;
-    }
-    newText.clear();
-#else
-        text.replace( pos, list[0].length(), tag );
-        pos += tag.length() + 1;
+        SlobArticleRewriter rewriter( getId() );
+        text = HtmlRewriter::rewrite( text, rewriter );
     }
-#endif
 
     // Handle TeX formulas via mimetex.cgi
 
@@ -906,7 +925,7 @@ string SlobDictionary::convert( const string & in, RefEntry const & entry )
         QRegExp multReg = QRegExp( "\\*\\{(\\d+)\\}([^\\{]|\\{([^\\}]+)\\})", Qt::CaseSensitive, QRegExp::RegExp2 );
 
         QString arrayDesc( "\\begin{array}{" );
-        pos = 0;
+        int pos = 0;
         unsigned texCount = 0;
         QString imgName;
 
@@ -1281,6 +1300,8 @@ void SlobDictionary::makeFTSIndex( AtomicInt32 & isCancelled, bool firstIteratio
         ftsIdxHeader.indexBtreeMaxElements = ftsIdxInfo.btreeMaxElements;
         ftsIdxHeader.indexRootOffset = ftsIdxInfo.rootOffset;
 
+        FtsHelpers::writeHeadwordMap( ftsIdx, this, ftsIdxHeader, isCancelled );
+
         ftsIdxHeader.signature = FtsHelpers::FtsSignature;
         ftsIdxHeader.formatVersion = FtsHelpers::CurrentFtsFormatVersion + getFtsIndexVersion();
 
@@ -110,6 +110,8 @@ SoundDirDictionary::SoundDirDictionary( string const & id,
     chunks( idx, idxHeader.chunksOffset ),
     iconFilename( iconFilename_ )
 {
+    chunks.setStats( statistics.get() );
+
     setDictionaryName(name_);
     // Initialize the index
 
@@ -22,8 +22,10 @@
 #include "audiolink.hh"
 
 #include <zlib.h>
+#include <algorithm>
 #include <map>
 #include <set>
+#include <list>
 #include <string>
 #ifndef __WIN32
 #include <arpa/inet.h>
@@ -33,6 +35,7 @@
 #include <stdlib.h>
 
 #include <QDir>
+#include <QFile>
 #include <QThreadPool>
 #include <QDebug>
 #include <QRegExp>
@@ -190,6 +193,9 @@ public:
                                                               bool ignoreDiacritics );
     virtual void getArticleText( uint32_t articleAddress, QString & headword, QString & text );
 
+    virtual void getArticleTexts( QVector< uint32_t > const & articleAddresses,
+                                  BtreeIndexing::ArticleTextHandler & handler );
+
     virtual void makeFTSIndex(AtomicInt32 & isCancelled, bool firstIteration );
 
     virtual void setFTSParameters( Config::FullTextSearch const & fts )
@@ -215,6 +221,14 @@ private:
                        string & headword,
                        string & articleText );
 
+    /// Formats the raw article data read from the .dict file into an html.
+    void convertArticle( string const & headword, char * ptr, uint32_t size,
+                         string & articleText );
+
+    /// Converts the loaded article to the plain text used by full-text search.
+    static void articleToText( string const & headwordStr, string const & articleStr,
+                               QString & headword, QString & text );
+
     string loadString( size_t size );
 
     string handleResource( char type, char const * resource, size_t size );
@@ -236,6 +250,8 @@ StardictDictionary::StardictDictionary( string const & id,
     sameTypeSequence( loadString( idxHeader.sameTypeSequenceSize ) ),
     chunks( idx, idxHeader.chunksOffset )
 {
+    chunks.setStats( statistics.get() );
+
     setDictionaryName(bookName);
     // Open the .dict file
 
@@ -246,6 +262,8 @@ StardictDictionary::StardictDictionary( string const & id,
         throw exDictzipError( string( dz_error_str( error ) )
                               + "(" + dictionaryFiles[ 2 ] + ")" );
 
+    statistics->attach( dz );
+
     // Initialize the index
 
     openIndex( IndexInfo( idxHeader.indexBtreeMaxElements,
@@ -1043,9 +1061,15 @@ void StardictDictionary::loadArticle( uint32_t address,
         return;
     }
 
-    articleText.clear();
+    convertArticle( headword, articleBody, size, articleText );
 
-    char * ptr = articleBody;
+    xfree( articleBody );
+}
+
+void StardictDictionary::convertArticle( string const & headword, char * ptr, uint32_t size,
+                                         string & articleText )
+{
+    articleText.clear();
 
     if ( sameTypeSequence.size() )
     {
@@ -1185,8 +1209,6 @@ void StardictDictionary::loadArticle( uint32_t address,
                 }
         }
     }
-
-    xfree( articleBody );
 }
 
 QString const& StardictDictionary::getDescription()
@@ -1295,11 +1317,7 @@ void StardictDictionary::getArticleText( uint32_t articleAddress, QString & head
         string headwordStr, articleStr;
         loadArticle( articleAddress, headwordStr, articleStr );
 
-        headword = QString::fromUtf8( headwordStr.data(), headwordStr.size() );
-
-        wstring wstr = Utf8::decode( articleStr );
-
-        text = Html::unescape( gd::toQString( wstr ) );
+        articleToText( headwordStr, articleStr, headword, text );
     }
     catch( std::exception &ex )
     {
@@ -1307,6 +1325,145 @@ void StardictDictionary::getArticleText( uint32_t articleAddress, QString & head
     }
 }
 
+void StardictDictionary::articleToText( string const & headwordStr, string const & articleStr,
+                                        QString & headword, QString & text )
+{
+    headword = QString::fromUtf8( headwordStr.data(), headwordStr.size() );
+
+    wstring wstr = Utf8::decode( articleStr );
+
+    text = Html::unescape( gd::toQString( wstr ) );
+}
+
+/// An article to be fetched by StardictDictionary::getArticleTexts()
+struct ArticleFetch
+{
+    uint32_t address;
+    uint32_t offset, size;
+    string headword;
+};
+
+struct ArticleFetchOffsetLess
+{
+    bool operator()( ArticleFetch const & a, ArticleFetch const & b ) const
+    { return a.offset < b.offset; }
+};
+
+void StardictDictionary::getArticleTexts( QVector< uint32_t > const & articleAddresses,
+                                          BtreeIndexing::ArticleTextHandler & handler )
+{
+    // The addresses are processed in slices, so that only a bounded amount of
+    // article data is held in memory at once. Within a slice, the articles are
+    // read in their .dict file order, and the ones lying close to each other
+    // are read together, so every dictzip chunk is decompressed once.
+    int const sliceSize = 256;
+    uint32_t const maxGap = 4096;
+    uint32_t const maxRunSize = 1024 * 1024;
+
+    vector< ArticleFetch > fetches;
+    string articleStr;
+    QString headword, text;
+
+    for( int first = 0; first < articleAddresses.size(); first += sliceSize )
+    {
+        int last = qMin( first + sliceSize, articleAddresses.size() );
+
+        fetches.clear();
+        fetches.reserve( last - first );
+
+        for( int x = first; x < last; ++x )
+        {
+            ArticleFetch fetch;
+            fetch.address = articleAddresses.at( x );
+
+            try
+            {
+                getArticleProps( fetch.address, fetch.headword, fetch.offset, fetch.size );
+            }
+            catch( std::exception &ex )
+            {
+                // A damaged article is passed on empty, as the others still count
+                gdWarning( "Stardict: Failed retrieving article from \"%s\", reason: %s\n", getName().c_str(), ex.what() );
+
+                if ( !handler.handleArticleText( fetch.address, QString(), QString() ) )
+                    return;
+
+                continue;
+            }
+
+            fetches.push_back( fetch );
+        }
+
+        std::sort( fetches.begin(), fetches.end(), ArticleFetchOffsetLess() );
+
+        for( size_t begin = 0; begin < fetches.size(); )
+        {
+            uint32_t runStart = fetches[ begin ].offset;
+            uint32_t runEnd = runStart + fetches[ begin ].size;
+
+            size_t end = begin + 1;
+
+            for( ; end < fetches.size(); ++end )
+            {
+                uint32_t articleEnd = fetches[ end ].offset + fetches[ end ].size;
+
+                if ( fetches[ end ].offset > runEnd + maxGap ||
+                     qMax( runEnd, articleEnd ) - runStart > maxRunSize )
+                    break;
+
+                runEnd = qMax( runEnd, articleEnd );
+            }
+
+            char * runBody;
+
+            {
+                Mutex::Lock _( dzMutex );
+
+                // Note that the function always zero-pads the result.
+                runBody = dict_data_read_( dz, runStart, runEnd - runStart, 0, 0 );
+            }
+
+            for( size_t x = begin; x < end; ++x )
+            {
+                ArticleFetch const & fetch = fetches[ x ];
+
+                headword.clear();
+                text.clear();
+
+                if ( runBody )
+                {
+                    try
+                    {
+                        convertArticle( fetch.headword, runBody + ( fetch.offset - runStart ),
+                                        fetch.size, articleStr );
+
+                        articleToText( fetch.headword, articleStr, headword, text );
+                    }
+                    catch( std::exception &ex )
+                    {
+                        gdWarning( "Stardict: Failed retrieving article from \"%s\", reason: %s\n", getName().c_str(), ex.what() );
+                    }
+                }
+                else
+                    articleToText( fetch.headword, string( "<div class=\"sdict_m\">DICTZIP error: " )
+                                                   + dict_error_str( dz ) + "</div>", headword, text );
+
+                if ( !handler.handleArticleText( fetch.address, headword, text ) )
+                {
+                    if ( runBody )
+                        xfree( runBody );
+                    return;
+                }
+            }
+
+            if ( runBody )
+                xfree( runBody );
+
+            begin = end;
+        }
+    }
+}
+
 sptr< Dictionary::DataRequest > StardictDictionary::getSearchResults( QString const & searchString,
                                                                       int searchMode, bool matchCase,
                                                                       int distanceBetweenWords,
@@ -2005,137 +2162,300 @@ static void findCorrespondingFiles( string const & ifo,
         syn.clear();
 }
 
-static void handleIdxSynFile( string const & fileName,
-                              IndexedWords & indexedWords,
-                              ChunkedStorage::Writer & chunks,
-                              vector< uint32_t > * articleOffsets,
-                              bool isSynFile, bool parseHeadwords )
+/// Sequential reader for StarDict .idx/.syn files. Plain files are mapped
+/// into memory and scanned in place; gzipped/dictzipped ones are inflated
+/// through a fixed-size window. Either way the whole file is never copied
+/// into memory.
+class IdxSynReader
 {
-    gzFile stardictIdx = gd_gzopen( fileName.c_str() );
-    if ( !stardictIdx )
-        throw exCantReadFile( fileName );
+    string fileName;
+    QFile file;
+    uchar * mapped;
+    gzFile gz;
+    vector< char > window;
+    char const * dataBegin, * dataEnd;
 
-    vector< char > image;
+public:
 
-    for( ; ; )
-    {
-        size_t oldSize = image.size();
+    IdxSynReader( string const & fileName );
+    ~IdxSynReader();
 
-        image.resize( oldSize + 65536 );
+    /// The range of the data read so far and not yet consumed
+    char const * begin() const
+    { return dataBegin; }
+    char const * end() const
+    { return dataEnd; }
 
-        int rd = gzread( stardictIdx, &image.front() + oldSize, 65536 );
+    /// Marks everything up to the given pointer as consumed
+    void consume( char const * ptr )
+    { dataBegin = ptr; }
 
-        if ( rd < 0 )
-        {
-            gzclose( stardictIdx );
-            throw exCantReadFile( fileName );
-        }
+    /// Makes more data available, keeping the unconsumed part. Any pointers
+    /// into the previous range become invalid. Returns false at the end of
+    /// file.
+    bool refill();
+
+private:
+
+    enum { WindowSize = 1024 * 1024 };
+};
 
-        if ( rd != 65536 )
+IdxSynReader::IdxSynReader( string const & fileName_ ):
+    fileName( fileName_ ), mapped( 0 ), gz( 0 ), dataBegin( 0 ), dataEnd( 0 )
+{
+    file.setFileName( FsEncoding::decode( fileName.c_str() ) );
+    if ( !file.open( QFile::ReadOnly ) )
+        throw exCantReadFile( fileName );
+
+    unsigned char magic[ 2 ];
+    bool compressed = file.read( (char *) magic, 2 ) == 2 &&
+                      magic[ 0 ] == 0x1F && magic[ 1 ] == 0x8B;
+
+    if ( !compressed && file.size() > 0 )
+    {
+        mapped = file.map( 0, file.size() );
+        if ( mapped )
         {
-            image.resize( oldSize + rd + 1 );
-            break;
+            dataBegin = (char const *) mapped;
+            dataEnd = dataBegin + file.size();
+            return;
         }
     }
-    gzclose( stardictIdx );
 
-    // We append one zero byte to catch runaway string at the end, if any
+    file.close();
 
-    image.back() = 0;
+    // Either compressed or couldn't be mapped -- stream it through zlib,
+    // which handles the plain files transparently as well
+    gz = gd_gzopen( fileName.c_str() );
+    if ( !gz )
+        throw exCantReadFile( fileName );
 
-    // Now parse it
+    window.resize( WindowSize );
+    dataBegin = dataEnd = &window.front();
+}
 
-    for( char const * ptr = &image.front(); ptr != &image.back(); )
-    {
-        size_t wordLen = strlen( ptr );
+IdxSynReader::~IdxSynReader()
+{
+    if ( mapped )
+        file.unmap( mapped );
+    if ( gz )
+        gzclose( gz );
+}
 
-        if ( ptr + wordLen + 1 + ( isSynFile ? sizeof( uint32_t ) :
-                                   sizeof( uint32_t ) * 2 ) >
-             &image.back() )
-        {
-            GD_FDPRINTF( stderr, "Warning: sudden end of file %s\n", fileName.c_str() );
-            break;
-        }
+bool IdxSynReader::refill()
+{
+    if ( !gz )
+        return false; // Mapped files are available in full from the start
+
+    size_t left = dataEnd - dataBegin;
 
-        char const * word = ptr;
+    if ( left == window.size() )
+        window.resize( window.size() * 2 ); // A single entry larger than the window
+    else
+    if ( left )
+        memmove( &window.front(), dataBegin, left );
 
-        ptr += wordLen + 1;
+    int rd = gzread( gz, &window.front() + left, window.size() - left );
+
+    if ( rd < 0 )
+        throw exCantReadFile( fileName );
+
+    dataBegin = &window.front();
+    dataEnd = dataBegin + left + rd;
+
+    return rd > 0;
+}
 
+/// Headwords collected from the .idx/.syn file, handed over to the index
+/// in batches. The words point either into the reader's data or into
+/// 'unescaped', so the batch has to be flushed before the reader refills.
+class HeadwordBatch
+{
+    struct Entry
+    {
+        char const * word;
+        size_t size;
         uint32_t offset;
+    };
 
-        if( strstr( word, "&#" ) )
-        {
-            // Decode some html-coded symbols in headword
-            string unescapedWord = Html::unescapeUtf8( word );
-            strncpy( (char *)word, unescapedWord.c_str(), wordLen );
-            wordLen = strlen( word );
-        }
+    IndexedWords & indexedWords;
+    bool parseHeadwords;
+    vector< Entry > entries;
+    std::list< string > unescaped;
+    vector< gd::wchar > buffer;
 
-        if ( !isSynFile )
-        {
-            // We're processing the .idx file
-            uint32_t articleOffset, articleSize;
+public:
 
-            memcpy( &articleOffset, ptr, sizeof( uint32_t ) );
-            ptr += sizeof( uint32_t );
-            memcpy( &articleSize, ptr, sizeof( uint32_t ) );
-            ptr += sizeof( uint32_t );
+    enum { Size = 4096 };
 
-            articleOffset = ntohl( articleOffset );
-            articleSize = ntohl( articleSize );
+    HeadwordBatch( IndexedWords & indexedWords_, bool parseHeadwords_ ):
+        indexedWords( indexedWords_ ), parseHeadwords( parseHeadwords_ )
+    { entries.reserve( Size ); }
 
-            // Create an entry for the article in the chunked storage
+    /// Decodes html-coded symbols in the given headword. The result stays
+    /// valid until the next flush().
+    string const & unescape( char const * word )
+    {
+        unescaped.push_back( Html::unescapeUtf8( word ) );
+        return unescaped.back();
+    }
 
-            offset = chunks.startNewBlock();
+    void add( char const * word, size_t size, uint32_t offset )
+    {
+        Entry e = { word, size, offset };
+        entries.push_back( e );
 
-            if ( articleOffsets )
-                articleOffsets->push_back( offset );
+        if ( entries.size() >= Size )
+            flush();
+    }
 
-            chunks.addToBlock( &articleOffset, sizeof( uint32_t ) );
-            chunks.addToBlock( &articleSize, sizeof( uint32_t ) );
-            chunks.addToBlock( word, wordLen + 1 );
-        }
+    void flush();
+};
+
+void HeadwordBatch::flush()
+{
+    wstring word;
+
+    for ( size_t x = 0; x < entries.size(); ++x )
+    {
+        Entry const & e = entries[ x ];
+
+        if ( buffer.size() < e.size + 1 )
+            buffer.resize( e.size + 1 );
+
+        long result = e.size ? Utf8::decode( e.word, e.size, &buffer.front() ) : 0;
+
+        if ( result < 0 )
+            throw Utf8::exCantDecode( string( e.word, e.size ) );
+
+        word.assign( &buffer.front(), result );
+
+        if( parseHeadwords )
+            indexedWords.addWord( word, e.offset );
         else
+            indexedWords.addSingleWord( word, e.offset );
+    }
+
+    entries.clear();
+    unescaped.clear();
+}
+
+static void handleIdxSynFile( string const & fileName,
+                              IndexedWords & indexedWords,
+                              ChunkedStorage::Writer & chunks,
+                              vector< uint32_t > * articleOffsets,
+                              bool isSynFile, bool parseHeadwords )
+{
+    IdxSynReader reader( fileName );
+    HeadwordBatch batch( indexedWords, parseHeadwords );
+
+    size_t const trailerSize = isSynFile ? sizeof( uint32_t ) : sizeof( uint32_t ) * 2;
+
+    for( ; ; )
+    {
+        char const * ptr = reader.begin();
+        char const * end = reader.end();
+
+        for( ; ; )
         {
-            // We're processing the .syn file
-            uint32_t offsetInIndex;
+            char const * wordEnd = (char const *) memchr( ptr, 0, end - ptr );
+
+            if ( !wordEnd || (size_t)( end - wordEnd - 1 ) < trailerSize )
+                break; // Incomplete entry
+
+            char const * word = ptr;
+            size_t wordLen = wordEnd - word;
+
+            ptr = wordEnd + 1;
+
+            uint32_t offset, articleOffset, articleSize;
+
+            if ( !isSynFile )
+            {
+                // We're processing the .idx file
+                memcpy( &articleOffset, ptr, sizeof( uint32_t ) );
+                ptr += sizeof( uint32_t );
+                memcpy( &articleSize, ptr, sizeof( uint32_t ) );
+                ptr += sizeof( uint32_t );
+
+                articleOffset = ntohl( articleOffset );
+                articleSize = ntohl( articleSize );
+            }
+            else
+            {
+                // We're processing the .syn file
+                uint32_t offsetInIndex;
 
-            memcpy( &offsetInIndex, ptr, sizeof( uint32_t ) );
-            ptr += sizeof( uint32_t );
+                memcpy( &offsetInIndex, ptr, sizeof( uint32_t ) );
+                ptr += sizeof( uint32_t );
 
-            offsetInIndex = ntohl( offsetInIndex );
+                offsetInIndex = ntohl( offsetInIndex );
 
-            if ( offsetInIndex >= articleOffsets->size() )
-                throw exIncorrectOffset( fileName );
+                if ( offsetInIndex >= articleOffsets->size() )
+                    throw exIncorrectOffset( fileName );
 
-            offset = (*articleOffsets)[ offsetInIndex ];
+                offset = (*articleOffsets)[ offsetInIndex ];
+            }
+
+            if( strstr( word, "&#" ) )
+            {
+                // Decode some html-coded symbols in headword
+                string const & unescapedWord = batch.unescape( word );
+                word = unescapedWord.c_str();
+                wordLen = unescapedWord.size();
+            }
 
-            // Some StarDict dictionaries are in fact badly converted Babylon ones.
-            // They contain a lot of superfluous slashed entries with dollar signs.
-            // We try to filter them out here, since those entries become much more
-            // apparent in GoldenDict than they were in StarDict because of
-            // punctuation folding. Hopefully there are not a whole lot of valid
-            // synonyms which really start from slash and contain dollar signs, or
-            // end with dollar and contain slashes.
-            if ( *word == '/' )
+            if ( !isSynFile )
             {
-                if ( strchr( word, '$' ) )
-                    continue; // Skip this entry
+                // Create an entry for the article in the chunked storage
+
+                offset = chunks.startNewBlock();
+
+                if ( articleOffsets )
+                    articleOffsets->push_back( offset );
+
+                chunks.addToBlock( &articleOffset, sizeof( uint32_t ) );
+                chunks.addToBlock( &articleSize, sizeof( uint32_t ) );
+                chunks.addToBlock( word, wordLen + 1 );
             }
             else
-                if ( wordLen && word[ wordLen - 1 ] == '$' )
+            {
+                // Some StarDict dictionaries are in fact badly converted Babylon ones.
+                // They contain a lot of superfluous slashed entries with dollar signs.
+                // We try to filter them out here, since those entries become much more
+                // apparent in GoldenDict than they were in StarDict because of
+                // punctuation folding. Hopefully there are not a whole lot of valid
+                // synonyms which really start from slash and contain dollar signs, or
+                // end with dollar and contain slashes.
+                if ( *word == '/' )
                 {
-                    if ( strchr( word, '/' ) )
+                    if ( strchr( word, '$' ) )
                         continue; // Skip this entry
                 }
+                else
+                    if ( wordLen && word[ wordLen - 1 ] == '$' )
+                    {
+                        if ( strchr( word, '/' ) )
+                            continue; // Skip this entry
+                    }
+            }
+
+            // Queue the new entry for the index
+
+            batch.add( word, wordLen, offset );
         }
 
-        // Insert new entry into an index
+        reader.consume( ptr );
 
-        if( parseHeadwords )
-            indexedWords.addWord( Utf8::decode( word ), offset );
-        else
-            indexedWords.addSingleWord( Utf8::decode( word ), offset );
+        // The batch refers to the reader's data, so hand it over now
+        batch.flush();
+
+        if ( !reader.refill() )
+        {
+            if ( reader.begin() != reader.end() )
+                GD_FDPRINTF( stderr, "Warning: sudden end of file %s\n", fileName.c_str() );
+            break;
+        }
     }
 
     GD_DPRINTF( "%u entires made\n", (unsigned) indexedWords.size() );
@@ -0,0 +1,503 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#include "syntheticdict.hh"
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QtEndian>
+
+#include <cstring>
+#include <zlib.h>
+
+namespace SyntheticDict {
+
+namespace {
+
+char const * const formatNames[ FormatCount ] = { "dsl", "stardict", "xdxf", "mdx", "dictd" };
+
+/// A xorshift generator, so that the sequence is the same everywhere
+class Random
+{
+    quint32 state;
+
+public:
+
+    Random( quint32 seed ): state( seed ? seed : 0x9E3779B9 )
+    {}
+
+    quint32 next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    /// Returns a number in the [ 0, n ) range
+    unsigned below( unsigned n )
+    { return n ? next() % n : 0; }
+};
+
+char const * const syllables[] =
+{
+    "ka", "lo", "min", "ter", "sa", "ve", "ro", "nu", "pi", "del",
+    "gra", "tho", "ul", "esk", "bar", "qui", "zo", "fen", "mar", "ti",
+    "an", "bel", "cor", "dun", "ig", "ost", "pra", "lu", "ser", "wen"
+};
+
+unsigned const syllableCount = sizeof( syllables ) / sizeof( *syllables );
+
+/// Letters which get replaced when adding diacritics, and their replacements
+char const plainLetters[] = "aeiouncsz";
+
+ushort const accentedLetters[][ 3 ] =
+{
+    { 0x00E1, 0x00E4, 0x00E5 }, // a
+    { 0x00E9, 0x00E8, 0x00EA }, // e
+    { 0x00ED, 0x00EF, 0x00EE }, // i
+    { 0x00F6, 0x00F8, 0x00F3 }, // o
+    { 0x00FC, 0x00FA, 0x016F }, // u
+    { 0x00F1, 0x0148, 0x0144 }, // n
+    { 0x00E7, 0x010D, 0x0107 }, // c
+    { 0x015F, 0x0161, 0x015B }, // s
+    { 0x017E, 0x017A, 0x017C }  // z
+};
+
+/// Produces the entries of the dictionary one by one
+class Entries
+{
+    Options const & options;
+    Random random;
+
+public:
+
+    Entries( Options const & options_ ):
+        options( options_ ), random( options_.seed )
+    {}
+
+    void next( QString & headword, QString & article )
+    {
+        unsigned kind = random.below( 100 );
+
+        if( kind < (unsigned) options.cjkPercent )
+            headword = cjkWord();
+        else
+        if( kind < (unsigned)( options.cjkPercent + options.diacriticsPercent ) )
+            headword = withDiacritics( word() );
+        else
+        if( kind < (unsigned)( options.cjkPercent + options.diacriticsPercent + options.phrasePercent ) )
+            headword = phrase();
+        else
+            headword = word();
+
+        article.clear();
+
+        unsigned words = options.articleWords / 2 + random.below( options.articleWords + 1 );
+        for( unsigned x = 0; x < words; ++x )
+        {
+            if( x )
+                article += random.below( 8 ) ? " " : ", ";
+            article += word();
+        }
+    }
+
+private:
+
+    QString word()
+    {
+        QString result;
+
+        // Short words are the most frequent ones
+        unsigned length = 1 + random.below( 2 ) + random.below( 3 );
+        for( unsigned x = 0; x < length; ++x )
+            result += QString::fromLatin1( syllables[ random.below( syllableCount ) ] );
+
+        return result;
+    }
+
+    QString withDiacritics( QString const & plain )
+    {
+        QString result = plain;
+
+        bool changed = false;
+        for( int x = 0; x < result.size(); ++x )
+        {
+            char const * letter = strchr( plainLetters, result[ x ].toLatin1() );
+            if( letter && *letter && ( !changed || !random.below( 3 ) ) )
+            {
+                result[ x ] = QChar( accentedLetters[ letter - plainLetters ][ random.below( 3 ) ] );
+                changed = true;
+            }
+        }
+
+        return result;
+    }
+
+    QString cjkWord()
+    {
+        QString result;
+
+        unsigned length = 1 + random.below( 4 );
+        for( unsigned x = 0; x < length; ++x )
+            result += QChar( ushort( 0x4E00 + random.below( 0x9FA5 - 0x4E00 ) ) );
+
+        return result;
+    }
+
+    QString phrase()
+    {
+        QStringList words;
+
+        unsigned length = 3 + random.below( 6 );
+        for( unsigned x = 0; x < length; ++x )
+            words.append( word() );
+
+        return words.join( " " );
+    }
+};
+
+/// A file written through a buffer, which throws on errors
+class Output
+{
+    QFile file;
+    QByteArray buffer;
+
+public:
+
+    Output( QString const & name ): file( name )
+    {
+        if( !file.open( QFile::WriteOnly | QFile::Truncate ) )
+            throw exCantWrite( name.toUtf8().data() );
+    }
+
+    ~Output()
+    {
+        if( file.isOpen() )
+            file.write( buffer );
+    }
+
+    void write( QByteArray const & data )
+    {
+        buffer += data;
+
+        if( buffer.size() >= 65536 )
+            flush();
+    }
+
+    void flush()
+    {
+        if( file.write( buffer ) != buffer.size() )
+            throw exCantWrite( file.fileName().toUtf8().data() );
+
+        buffer.clear();
+    }
+
+    void close()
+    {
+        flush();
+        file.close();
+    }
+
+    qint64 size()
+    { return file.size() + buffer.size(); }
+};
+
+QByteArray escapeXml( QString const & str )
+{
+    QString result = str;
+    result.replace( '&', "&amp;" ).replace( '<', "&lt;" ).replace( '>', "&gt;" );
+    return result.toUtf8();
+}
+
+QByteArray bigEndian32( quint32 value )
+{
+    uchar buf[ 4 ];
+    qToBigEndian( value, buf );
+    return QByteArray( (char const *) buf, sizeof( buf ) );
+}
+
+QByteArray bigEndian64( quint64 value )
+{
+    uchar buf[ 8 ];
+    qToBigEndian( value, buf );
+    return QByteArray( (char const *) buf, sizeof( buf ) );
+}
+
+QByteArray bigEndian16( quint16 value )
+{
+    uchar buf[ 2 ];
+    qToBigEndian( value, buf );
+    return QByteArray( (char const *) buf, sizeof( buf ) );
+}
+
+quint32 adler( QByteArray const & data )
+{
+    uLong result = adler32( 0L, Z_NULL, 0 );
+    return adler32( result, (Bytef const *) data.constData(), data.size() ) & 0xFFFFFFFF;
+}
+
+void generateDsl( Options const & options, QString const & dir )
+{
+    Output out( dir + "/synthetic.dsl" );
+
+    out.write( "\xEF\xBB\xBF#NAME \"Synthetic DSL dictionary\"\n"
+               "#INDEX_LANGUAGE \"English\"\n"
+               "#CONTENTS_LANGUAGE \"English\"\n\n" );
+
+    Entries entries( options );
+    QString headword, article;
+
+    for( unsigned x = 0; x < options.entries; ++x )
+    {
+        entries.next( headword, article );
+        out.write( headword.toUtf8() + "\n\t[m1][trn]" + article.toUtf8() + "[/trn][/m]\n\n" );
+    }
+
+    out.close();
+}
+
+void generateStarDict( Options const & options, QString const & dir )
+{
+    Output idx( dir + "/synthetic.idx" );
+    Output dict( dir + "/synthetic.dict" );
+
+    Entries entries( options );
+    QString headword, article;
+
+    for( unsigned x = 0; x < options.entries; ++x )
+    {
+        entries.next( headword, article );
+
+        QByteArray data = article.toUtf8();
+        idx.write( headword.toUtf8() + '\0' + bigEndian32( dict.size() )
+                   + bigEndian32( data.size() ) );
+        dict.write( data );
+    }
+
+    qint64 idxSize = idx.size();
+    idx.close();
+    dict.close();
+
+    Output ifo( dir + "/synthetic.ifo" );
+    ifo.write( "StarDict's dict ifo file\n"
+               "version=2.4.2\n"
+               "bookname=Synthetic StarDict dictionary\n"
+               "wordcount=" + QByteArray::number( options.entries ) + "\n"
+               "idxfilesize=" + QByteArray::number( idxSize ) + "\n"
+               "sametypesequence=m\n" );
+    ifo.close();
+}
+
+void generateXdxf( Options const & options, QString const & dir )
+{
+    Output out( dir + "/synthetic.xdxf" );
+
+    out.write( "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<xdxf lang_from=\"ENG\" lang_to=\"ENG\" format=\"visual\">\n"
+               "<full_name>Synthetic XDXF dictionary</full_name>\n"
+               "<description>Made up words</description>\n" );
+
+    Entries entries( options );
+    QString headword, article;
+
+    for( unsigned x = 0; x < options.entries; ++x )
+    {
+        entries.next( headword, article );
+        out.write( "<ar><k>" + escapeXml( headword ) + "</k>\n" + escapeXml( article ) + "</ar>\n" );
+    }
+
+    out.write( "</xdxf>\n" );
+    out.close();
+}
+
+/// Makes an MDict block, compressed with zlib
+QByteArray mdxBlock( QByteArray const & data )
+{
+    // qCompress() prepends the uncompressed size, the rest is a zlib stream
+    return bigEndian32( 0x02000000 ) + bigEndian32( adler( data ) ) + qCompress( data ).mid( 4 );
+}
+
+/// Writes an MDict 2.0 file with the UTF-8 encoding. The headword and the
+/// record blocks are put together in memory, as their sizes go first.
+void generateMdx( Options const & options, QString const & dir )
+{
+    unsigned const entriesPerKeyBlock = 256;
+    int const recordBlockSize = 65536;
+
+    QByteArray keyBlockInfo, keyBlocks, recordBlockInfo, recordBlocks;
+    QByteArray keyBlock, recordBlock;
+    QByteArray firstHeadword, lastHeadword;
+    quint64 keyBlockCount = 0, keyBlockEntries = 0, recordBlockCount = 0;
+    quint64 recordOffset = 0;
+
+    Entries entries( options );
+    QString headword, article;
+
+    for( unsigned x = 0; x < options.entries; ++x )
+    {
+        entries.next( headword, article );
+
+        QByteArray word = headword.toUtf8();
+        QByteArray record = "<div>" + escapeXml( article ) + "</div>" + '\0';
+
+        if( !keyBlockEntries )
+            firstHeadword = word;
+        lastHeadword = word;
+
+        keyBlock += bigEndian64( recordOffset ) + word + '\0';
+        recordBlock += record;
+        recordOffset += record.size();
+
+        if( ++keyBlockEntries == entriesPerKeyBlock || x + 1 == options.entries )
+        {
+            QByteArray block = mdxBlock( keyBlock );
+            keyBlockInfo += bigEndian64( keyBlockEntries )
+                            + bigEndian16( firstHeadword.size() ) + firstHeadword + '\0'
+                            + bigEndian16( lastHeadword.size() ) + lastHeadword + '\0'
+                            + bigEndian64( block.size() ) + bigEndian64( keyBlock.size() );
+            keyBlocks += block;
+            keyBlock.clear();
+            keyBlockEntries = 0;
+            ++keyBlockCount;
+        }
+
+        if( recordBlock.size() >= recordBlockSize || x + 1 == options.entries )
+        {
+            QByteArray block = mdxBlock( recordBlock );
+            recordBlockInfo += bigEndian64( block.size() ) + bigEndian64( recordBlock.size() );
+            recordBlocks += block;
+            recordBlock.clear();
+            ++recordBlockCount;
+        }
+    }
+
+    Output out( dir + "/synthetic.mdx" );
+
+    // The header is an XML tag in UTF-16LE, with a little-endian checksum
+    QString headerText = "<Dictionary GeneratedByEngineVersion=\"2.0\" RequiredEngineVersion=\"2.0\" "
+                         "Encrypted=\"0\" Encoding=\"UTF-8\" Format=\"Html\" "
+                         "Title=\"Synthetic MDict dictionary\" Description=\"Made up words\"/>\r\n";
+    QByteArray header;
+    for( int x = 0; x < headerText.size(); ++x )
+    {
+        uchar buf[ 2 ];
+        qToLittleEndian( headerText[ x ].unicode(), buf );
+        header.append( (char const *) buf, sizeof( buf ) );
+    }
+
+    uchar checksum[ 4 ];
+    qToLittleEndian( adler( header ), checksum );
+
+    out.write( bigEndian32( header.size() ) + header + QByteArray( (char const *) checksum, 4 ) );
+
+    QByteArray keyInfoBlock = mdxBlock( keyBlockInfo );
+    QByteArray keySectionHeader = bigEndian64( keyBlockCount ) + bigEndian64( options.entries )
+                                  + bigEndian64( keyBlockInfo.size() ) + bigEndian64( keyInfoBlock.size() )
+                                  + bigEndian64( keyBlocks.size() );
+
+    out.write( keySectionHeader + bigEndian32( adler( keySectionHeader ) ) );
+    out.write( keyInfoBlock );
+    out.write( keyBlocks );
+
+    out.write( bigEndian64( recordBlockCount ) + bigEndian64( options.entries )
+               + bigEndian64( recordBlockInfo.size() ) + bigEndian64( recordBlocks.size() ) );
+    out.write( recordBlockInfo );
+    out.write( recordBlocks );
+
+    out.close();
+}
+
+QByteArray encodeBase64Number( quint32 number )
+{
+    static char const digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    QByteArray result;
+
+    do
+    {
+        result.prepend( digits[ number % 64 ] );
+        number /= 64;
+    } while( number );
+
+    return result;
+}
+
+void generateDictd( Options const & options, QString const & dir )
+{
+    Output index( dir + "/synthetic.index" );
+    Output dict( dir + "/synthetic.dict" );
+
+    QByteArray name = "00-database-short\n    Synthetic dictd dictionary\n";
+    index.write( "00-database-short\t" + encodeBase64Number( 0 ) + "\t"
+                 + encodeBase64Number( name.size() ) + "\n" );
+    dict.write( name );
+
+    Entries entries( options );
+    QString headword, article;
+
+    for( unsigned x = 0; x < options.entries; ++x )
+    {
+        entries.next( headword, article );
+
+        QByteArray word = headword.toUtf8();
+        QByteArray data = word + "\n    " + article.toUtf8() + "\n";
+
+        index.write( word + "\t" + encodeBase64Number( dict.size() ) + "\t"
+                     + encodeBase64Number( data.size() ) + "\n" );
+        dict.write( data );
+    }
+
+    index.close();
+    dict.close();
+}
+
+}
+
+char const * formatName( Format format )
+{
+    return formatNames[ format ];
+}
+
+bool findFormat( QString const & name, Format & format )
+{
+    for( int x = 0; x < FormatCount; ++x )
+        if( name == formatNames[ x ] )
+        {
+            format = (Format) x;
+            return true;
+        }
+
+    return false;
+}
+
+void generate( Format format, Options const & options, QString const & directory )
+THROW_SPEC( std::exception )
+{
+    if( !QDir().mkpath( directory ) )
+        throw exCantWrite( directory.toUtf8().data() );
+
+    switch( format )
+    {
+        case Dsl:
+            generateDsl( options, directory );
+            break;
+        case StarDict:
+            generateStarDict( options, directory );
+            break;
+        case Xdxf:
+            generateXdxf( options, directory );
+            break;
+        case Mdx:
+            generateMdx( options, directory );
+            break;
+        case Dictd:
+            generateDictd( options, directory );
+            break;
+        default:
+            break;
+    }
+}
+
+}
@@ -0,0 +1,57 @@
+/* This file is part of GoldenDict. Licensed under GPLv3 or later, see the LICENSE file */
+
+#ifndef __SYNTHETICDICT_HH_INCLUDED__
+#define __SYNTHETICDICT_HH_INCLUDED__
+
+#include <QString>
+#include "ex.hh"
+#include "cpp_features.hh"
+
+/// Generates dictionaries of made up words, for benchmarking. The output
+/// only depends on the options given, so the same dictionaries can be
+/// produced again on any machine to compare the results.
+namespace SyntheticDict {
+
+enum Format
+{
+    Dsl,
+    StarDict,
+    Xdxf,
+    Mdx,
+    Dictd,
+    FormatCount
+};
+
+/// Returns the short name of the format, such as "dsl"
+char const * formatName( Format );
+
+/// Finds the format by its short name. Returns false if there's no such one.
+bool findFormat( QString const & name, Format & );
+
+struct Options
+{
+    unsigned entries;
+    quint32 seed;
+    /// Percentages of the headwords made of CJK ideographs, of the ones with
+    /// diacritics and of the multi-word phrases. The rest are plain words.
+    int cjkPercent, diacriticsPercent, phrasePercent;
+    /// Average number of words in an article
+    unsigned articleWords;
+
+    Options():
+        entries( 10000 ), seed( 1 ),
+        cjkPercent( 10 ), diacriticsPercent( 20 ), phrasePercent( 10 ),
+        articleWords( 40 )
+    {}
+};
+
+DEF_EX( Ex, "Synthetic dictionary exception", std::exception )
+DEF_EX_STR( exCantWrite, "Can't write the file", Ex )
+
+/// Writes a dictionary of the given format into the directory given, as
+/// the set of files named "synthetic" with the format's extensions.
+void generate( Format, Options const &, QString const & directory ) THROW_SPEC( std::exception );
+
+}
+
+#endif
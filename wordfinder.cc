@@ -15,6 +15,30 @@ using gd::wchar;
 using std::map;
 using std::pair;
 
+namespace {
+
+/// The words shorter than this, when folded, get no fuzzy matches, as
+/// there would be too many of them to be of any help
+unsigned const MinFuzzyLength = 4;
+
+/// Returns the edit distance the fuzzy matches of the word are allowed
+unsigned fuzzyDistanceFor( wstring const & word )
+{
+    // The wildcard patterns are matched as they are
+    if ( word.find( '*' ) != wstring::npos || word.find( '?' ) != wstring::npos ||
+         word.find( '[' ) != wstring::npos || word.find( ']' ) != wstring::npos )
+        return 0;
+
+    size_t size = Folding::apply( word ).size();
+
+    if ( size < MinFuzzyLength )
+        return 0;
+
+    return size < 8 ? 1 : 2;
+}
+
+}
+
 WordFinder::WordFinder( QObject * parent ):
     QObject( parent ), searchInProgress( false ),
     updateResultsTimer( this ),
@@ -142,6 +166,12 @@ void WordFinder::startSearch()
 
     // Query each dictionary for all word writings
 
+    char const * tracePhase = searchType == PrefixMatch ? "prefix" :
+                              searchType == StemmedMatch ? "stemmed" : "compound";
+
+    // The suggestions for misspellings, for the word as it was typed only
+    unsigned fuzzyDistance = searchType == PrefixMatch ? fuzzyDistanceFor( allWordWritings[ 0 ] ) : 0;
+
     for( size_t x = 0; x < inputDicts->size(); ++x )
     {
         if ( ( (*inputDicts)[ x ]->getFeatures() & requestedFeatures ) != requestedFeatures )
@@ -149,6 +179,11 @@ void WordFinder::startSearch()
 
         for( size_t y = 0; y < allWordWritings.size(); ++y )
         {
+            int traceId = GdTrace::isEnabled() ?
+                              GdTrace::begin( (*inputDicts)[ x ]->getId(), (*inputDicts)[ x ]->getName(),
+                                              tracePhase ) : 0;
+            qint64 started = Dictionary::Stats::now();
+
             try
             {
                 sptr< Dictionary::WordSearchRequest > sr =
@@ -156,6 +191,9 @@ void WordFinder::startSearch()
                             (*inputDicts)[ x ]->prefixMatch( allWordWritings[ y ], requestedMaxResults ) :
                             (*inputDicts)[ x ]->stemmedMatch( allWordWritings[ y ], stemmedMinLength, stemmedMaxSuffixVariation, requestedMaxResults );
 
+                sr->setTraceId( traceId );
+                sr->setStats( (*inputDicts)[ x ]->getStats(), Dictionary::Stats::Search, started );
+
                 connect( sr.get(), SIGNAL( finished() ),
                          this, SLOT( requestFinished() ), Qt::QueuedConnection );
 
@@ -163,10 +201,41 @@ void WordFinder::startSearch()
             }
             catch( std::exception & e )
             {
+                GdTrace::end( traceId );
+
                 gdWarning( "Word \"%s\" search error (%s) in \"%s\"\n",
                            inputWord.toUtf8().data(), e.what(), (*inputDicts)[ x ]->getName().c_str() );
             }
         }
+
+        if ( fuzzyDistance )
+        {
+            int traceId = GdTrace::isEnabled() ?
+                              GdTrace::begin( (*inputDicts)[ x ]->getId(), (*inputDicts)[ x ]->getName(),
+                                              "fuzzy" ) : 0;
+            qint64 started = Dictionary::Stats::now();
+
+            try
+            {
+                sptr< Dictionary::WordSearchRequest > sr =
+                        (*inputDicts)[ x ]->fuzzyMatch( allWordWritings[ 0 ], fuzzyDistance, requestedMaxResults );
+
+                sr->setTraceId( traceId );
+                sr->setStats( (*inputDicts)[ x ]->getStats(), Dictionary::Stats::Search, started );
+
+                connect( sr.get(), SIGNAL( finished() ),
+                         this, SLOT( requestFinished() ), Qt::QueuedConnection );
+
+                queuedRequests.push_back( sr );
+            }
+            catch( std::exception & e )
+            {
+                GdTrace::end( traceId );
+
+                gdWarning( "Word \"%s\" fuzzy search error (%s) in \"%s\"\n",
+                           inputWord.toUtf8().data(), e.what(), (*inputDicts)[ x ]->getName().c_str() );
+            }
+        }
     }
 
     // Handle any requests finished already
@@ -348,6 +417,10 @@ void WordFinder::updateResults()
                 }
                 if ( !weight && insertResult.first->second->wasSuggested )
                     insertResult.first->second->wasSuggested = false;
+
+                if ( weight < 0 && ( !insertResult.first->second->distance ||
+                                     (unsigned)-weight < insertResult.first->second->distance ) )
+                    insertResult.first->second->distance = -weight;
             }
             else
             {
@@ -356,6 +429,7 @@ void WordFinder::updateResults()
                 resultsArray.back().word = match;
                 resultsArray.back().rank = INT_MAX;
                 resultsArray.back().wasSuggested = ( weight != 0 );
+                resultsArray.back().distance = weight < 0 ? -weight : 0;
 
                 insertResult.first->second = --resultsArray.end();
             }
@@ -385,6 +459,7 @@ void WordFinder::updateResults()
                 PrefixNoDiaMatch,
                 PrefixNoPunctMatch,
                 PrefixNoWsMatch,
+                FuzzyMatch,
                 WorstMatch,
                 Multiplier = 256 // Categories should be multiplied by Multiplier
             };
@@ -442,7 +517,10 @@ void WordFinder::updateResults()
                                                                 if ( resultNoWs.size() > targetNoWs.size() && resultNoWs.compare( 0, targetNoWs.size(), targetNoWs ) == 0 )
                                                                     rank = PrefixNoWsMatch * Multiplier + saturated( i->first.size() );
                                                                 else
-                                                                    rank = WorstMatch * Multiplier;
+                                                                    if ( i->second->distance )
+                                                                        rank = FuzzyMatch * Multiplier + i->second->distance;
+                                                                    else
+                                                                        rank = WorstMatch * Multiplier;
 
                     if ( i->second->rank > rank )
                         i->second->rank = rank; // We store the best rank of any writing
@@ -520,6 +598,9 @@ void WordFinder::cancelSearches()
 {
     for( list< sptr< Dictionary::WordSearchRequest > >::iterator i =
          queuedRequests.begin(); i != queuedRequests.end(); ++i )
+    {
+        (*i)->traceCancel();
         (*i)->cancel();
+    }
 }
 
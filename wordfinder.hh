@@ -52,6 +52,7 @@ private:
         gd::wstring word;
         int rank;
         bool wasSuggested;
+        unsigned distance; // The edit distance of a fuzzy match, 0 otherwise
     };
 
     // Maps lowercased string to the original one. This catches all duplicates
@@ -75,6 +76,9 @@ public:
     /// the dictionaries which possess all the features requested.
     /// If there already was a prefixMatch operation underway, it gets cancelled
     /// and the new one replaces it.
+    /// For the words long enough, the dictionaries are also asked for the
+    /// headwords spelled similarly, which are listed after all the others, the
+    /// closest ones first.
     void prefixMatch( QString const &,
                       std::vector< sptr< Dictionary::Class > > const &,
                       unsigned long maxResults = 40,
@@ -210,6 +210,7 @@ XdxfDictionary::XdxfDictionary( string const & id,
     // Read the dictionary name
 
     chunks =  sptr< ChunkedStorage::Reader >(new ChunkedStorage::Reader( idx, idxHeader.chunksOffset ));
+    chunks->setStats( statistics.get() );
 
     if ( idxHeader.nameSize )
     {
@@ -228,6 +229,8 @@ XdxfDictionary::XdxfDictionary( string const & id,
         throw exDictzipError( string( dz_error_str( error ) )
                               + "(" + dictionaryFiles[ 0 ] + ")" );
 
+    statistics->attach( dz );
+
     // Read the abrv, if any
 
     if ( idxHeader.hasAbrv )
@@ -987,6 +990,8 @@ class XdxfResourceRequest: public Dictionary::DataRequest
     XdxfDictionary & dict;
 
     string resourceName;
+    string fileName; // In the dictionary's directory
+    string filesDirFileName; // In its .files directory
 
     AtomicInt32 isCancelled;
     QSemaphore hasExited;
@@ -996,9 +1001,19 @@ public:
     XdxfResourceRequest( XdxfDictionary & dict_,
                          string const & resourceName_ ):
         dict( dict_ ),
-        resourceName( resourceName_ )
+        resourceName( resourceName_ ),
+        fileName( FsEncoding::dirname( dict.getDictionaryFilenames()[ 0 ] ) +
+                  FsEncoding::separator() +
+                  FsEncoding::encode( resourceName ) ),
+        filesDirFileName( dict.getDictionaryFilenames()[ 0 ] + ".files" +
+                          FsEncoding::separator() +
+                          FsEncoding::encode( resourceName ) )
     {
-        QThreadPool::globalInstance()->start(
+        vector< string > fileNames;
+        fileNames.push_back( fileName );
+        fileNames.push_back( filesDirFileName );
+
+        Dictionary::threadPoolForFiles( fileNames )->start(
                     new XdxfResourceRequestRunnable( *this, hasExited ) );
     }
 
@@ -1038,15 +1053,22 @@ void XdxfResourceRequest::run()
         return;
     }
 
-    string n =
-            FsEncoding::dirname( dict.getDictionaryFilenames()[ 0 ] ) +
-            FsEncoding::separator() +
-            FsEncoding::encode( resourceName );
+    string n = fileName;
 
     GD_DPRINTF( "n is %s\n", n.c_str() );
 
     try
     {
+        if ( !Filetype::isNameOfTiff( resourceName ) )
+        {
+            // Nothing is converted, so the files can be streamed
+            if ( appendFile( n, isCancelled ) || appendFile( filesDirFileName, isCancelled ) )
+            {
+                finish();
+                return;
+            }
+        }
+
         try
         {
             Mutex::Lock _( dataMutex );
@@ -1055,9 +1077,7 @@ void XdxfResourceRequest::run()
         }
         catch( File::exCantOpen & )
         {
-            n = dict.getDictionaryFilenames()[ 0 ] + ".files" +
-                    FsEncoding::separator() +
-                    FsEncoding::encode( resourceName );
+            n = filesDirFileName;
 
             try
             {
@@ -19,6 +19,7 @@
 #include "ftshelpers.hh"
 #include "htmlescape.hh"
 #include "splitfile.hh"
+#include "htmlrewriter.hh"
 
 #include <QByteArray>
 #include <QBuffer>
@@ -592,6 +593,7 @@ private:
     string convert( string const & in_data );
     friend class ZimArticleRequest;
     friend class ZimResourceRequest;
+    friend class ZimArticleRewriter;
 };
 
 ZimDictionary::ZimDictionary( string const & id,
@@ -684,143 +686,208 @@ quint32 ZimDictionary::loadArticle( quint32 address,
     return ret;
 }
 
-string ZimDictionary::convert( const string & in )
+/// Rewrites the links of an article: relative images, scripts and stylesheets
+/// are taken from the dictionary, and the links to other pages, as well as
+/// the links to the English wiki projects, become lookups.
+class ZimArticleRewriter: public HtmlRewriter::Handler
 {
-    QString text = QString::fromUtf8( in.c_str() );
+    ZimDictionary & dict;
+    QString id;
 
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-    // replace background
-    text.replace( QRegularExpression( "<\\s*body\\s+([^>]*)(background(|-color)):([^;\"]*(;|))" ),
-                  QString( "<body \\1" ) );
+public:
 
-    // pattern of img and script
-    text.replace( QRegularExpression( "<\\s*(img|script)\\s+([^>]*)src=(\"|)(\\.\\.|)/" ),
-                  QString( "<\\1 \\2src=\\3bres://%1/").arg( getId().c_str() ) );
+    explicit ZimArticleRewriter( ZimDictionary & dict_ ):
+        dict( dict_ ),
+        id( QString::fromUtf8( dict_.getId().c_str() ) )
+    {}
 
-    // Fix links without '"'
-    text.replace( QRegularExpression( "href=(\\.\\.|)/([^\\s>]+)" ),
-                  QString( "href=\"\\1/\\2\"" ) );
+    virtual void handleStartTag( HtmlRewriter::Tag & tag );
 
-    // pattern <link... href="..." ...>
-    text.replace( QRegularExpression( "<\\s*link\\s+([^>]*)href=\"(\\.\\.|)/" ),
-                  QString( "<link \\1href=\"bres://%1/").arg( getId().c_str() ) );
+private:
 
-    // localize the http://en.wiki***.com|org/wiki/<key> series links
-    // excluding those keywords that have ":" in it
-    QString urlWiki = "\"http(s|)://en\\.(wiki(pedia|books|news|quote|source|voyage|versity)|wiktionary)\\.(org|com)/wiki/([^:\"]*)\"";
-    text.replace( QRegularExpression( "<\\s*a\\s+(class=\"external\"\\s+|)href=" + urlWiki ),
-                  QString( "<a href=\"gdlookup://localhost/\\6\"" ) );
-#else
-    // replace background
-    text.replace( QRegExp( "<\\s*body\\s+([^>]*)(background(|-color)):([^;\"]*(|;))" ),
-                  QString( "<body \\1" ) );
+    /// Strips the leading "/" or "../" of a link relative to the root.
+    /// Returns false if the link isn't such one.
+    static bool stripRootPrefix( QString & url );
 
-    // pattern of img and script
-    text.replace( QRegExp( "<\\s*(img|script)\\s+([^>]*)src=(\"|)(\\.\\.|)/" ),
-                  QString( "<\\1 \\2src=\\3bres://%1/").arg( getId().c_str() ) );
+    /// Extracts the key from the links like http://en.wikipedia.org/wiki/<key>,
+    /// excluding those keys that have ":" in them.
+    static bool getWikiKey( QString const & url, QString & key );
 
-    // Fix links without '"'
-    text.replace( QRegExp( "href=(\\.\\.|)/([^\\s>]+)" ), QString( "href=\"\\1/\\2\"" ) );
+    void rewriteResource( HtmlRewriter::Tag & tag, char const * attrName );
+    void rewriteLink( HtmlRewriter::Tag & tag );
+};
 
-    // pattern <link... href="..." ...>
-    text.replace( QRegExp( "<\\s*link\\s+([^>]*)href=\"(\\.\\.|)/" ),
-                  QString( "<link \\1href=\"bres://%1/").arg( getId().c_str() ) );
+bool ZimArticleRewriter::stripRootPrefix( QString & url )
+{
+    if ( url.startsWith( '/' ) )
+        url.remove( 0, 1 );
+    else
+    if ( url.startsWith( "../" ) )
+        url.remove( 0, 3 );
+    else
+        return false;
 
-    // localize the http://en.wiki***.com|org/wiki/<key> series links
-    // excluding those keywords that have ":" in it
-    QString urlWiki = "\"http(s|)://en\\.(wiki(pedia|books|news|quote|source|voyage|versity)|wiktionary)\\.(org|com)/wiki/([^:\"]*)\"";
-    text.replace( QRegExp( "<\\s*a\\s+(class=\"external\"\\s+|)href=" + urlWiki ),
-                  QString( "<a href=\"gdlookup://localhost/\\6\"" ) );
-#endif
+    return true;
+}
 
-    // pattern <a href="..." ...>, excluding any known protocols such as http://, mailto:, #(comment)
-    // these links will be translated into local definitions
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-    QRegularExpression rxLink( "<\\s*a\\s+([^>]*)href=\"(?!(?:\\w+://|#|mailto:|tel:))(/|)([^\"]*)\"\\s*(title=\"[^\"]*\")?[^>]*>" );
-    QRegularExpressionMatchIterator it = rxLink.globalMatch( text );
-    int pos = 0;
-    QString newText;
-    while( it.hasNext() )
-    {
-        QRegularExpressionMatch match = it.next();
+bool ZimArticleRewriter::getWikiKey( QString const & url, QString & key )
+{
+    static char const * const projects[] =
+    { "wikipedia", "wikibooks", "wikinews", "wikiquote", "wikisource",
+      "wikivoyage", "wikiversity", "wiktionary", 0 };
 
-        newText += text.midRef( pos, match.capturedStart() - pos );
-        pos = match.capturedEnd();
+    int pos;
+    if ( url.startsWith( "http://en." ) )
+        pos = 10;
+    else
+    if ( url.startsWith( "https://en." ) )
+        pos = 11;
+    else
+        return false;
 
-        QStringList list = match.capturedTexts();
-        // Add empty strings for compatibility with QRegExp behaviour
-        for( int i = match.lastCapturedIndex() + 1; i < 5; i++ )
-            list.append( QString() );
-#else
-    QRegExp rxLink( "<\\s*a\\s+([^>]*)href=\"(?!(\\w+://|#|mailto:|tel:))(/|)([^\"]*)\"\\s*(title=\"[^\"]*\")?[^>]*>",
-                    Qt::CaseSensitive,
-                    QRegExp::RegExp2 );
-    int pos = 0;
-    while( (pos = rxLink.indexIn( text, pos )) >= 0 )
+    int hostEnd = url.indexOf( '/', pos );
+    if ( hostEnd < 0 )
+        return false;
+
+    QString host = url.mid( pos, hostEnd - pos );
+    if ( !host.endsWith( ".org" ) && !host.endsWith( ".com" ) )
+        return false;
+    host.chop( 4 );
+
+    bool known = false;
+    for ( int x = 0; projects[ x ] && !known; ++x )
+        known = ( host == QLatin1String( projects[ x ] ) );
+
+    if ( !known || url.midRef( hostEnd, 6 ) != QLatin1String( "/wiki/" ) )
+        return false;
+
+    key = url.mid( hostEnd + 6 );
+    return !key.contains( ':' );
+}
+
+void ZimArticleRewriter::rewriteResource( HtmlRewriter::Tag & tag, char const * attrName )
+{
+    int index = tag.findAttribute( attrName );
+    if ( index < 0 )
+        return;
+
+    QString url = tag.attributeValue( index );
+    if ( stripRootPrefix( url ) )
+        tag.setAttributeValue( index, "bres://" + id + "/" + url );
+}
+
+void ZimArticleRewriter::rewriteLink( HtmlRewriter::Tag & tag )
+{
+    int index = tag.findAttribute( "href" );
+    if ( index < 0 )
+        return;
+
+    QString url = tag.attributeValue( index );
+
+    // localize the http://en.wiki***.com|org/wiki/<key> series links
+    QString key;
+    if ( getWikiKey( url, key ) )
     {
-        QStringList list = rxLink.capturedTexts();
-#endif
-        QString tag = list[3];     // a url, ex: Precambrian_Chaotian.html
-        if ( !list[4].isEmpty() )  // a title, ex: title="Precambrian/Chaotian"
-            tag = list[4].split("\"")[1];
+        tag.setAttributeValue( index, "gdlookup://localhost/" + key );
 
+        int classIndex = tag.findAttribute( "class" );
+        if ( classIndex >= 0 && tag.attributeValue( classIndex ) == QLatin1String( "external" ) )
+            tag.removeAttribute( classIndex );
+        return;
+    }
 
-        // Check type of links inside articles
-        if( linksType == UNKNOWN && tag.indexOf( '/' ) >= 0 )
-        {
-            QString word = QUrl::fromPercentEncoding( tag.toLatin1() );
-            word.remove( QRegExp( "\\.(s|)htm(l|)$", Qt::CaseInsensitive ) ).
-                    replace( "_", " " );
+    // Links excluding any known protocols such as http://, mailto:, #(comment)
+    // are translated into local definitions
+    if ( HtmlRewriter::hasAnyScheme( url ) || url.startsWith( '#' )
+         || url.startsWith( "mailto:" ) || url.startsWith( "tel:" ) )
+        return;
 
-            vector< WordArticleLink > links;
-            links = findArticles( gd::toWString( word ) );
+    if ( url.startsWith( '/' ) )
+        url.remove( 0, 1 );
 
-            if( !links.empty() )
-            {
-                linksType = SLASH;
-            }
-            else
-            {
-                word.remove( QRegExp(".*/") );
-                links = findArticles( gd::toWString( word ) );
-                if( !links.empty() )
-                {
-                    linksType = NO_SLASH;
-                    links.clear();
-                }
-            }
-        }
+    QString title = tag.attributeValue( "title" );
+    QString link = title.isEmpty() ? url : title; // a title, ex: title="Precambrian/Chaotian"
+
+    // Check type of links inside articles
+    if( dict.linksType == ZimDictionary::UNKNOWN && link.indexOf( '/' ) >= 0 )
+    {
+        QString word = QUrl::fromPercentEncoding( link.toLatin1() );
+        word.remove( QRegExp( "\\.(s|)htm(l|)$", Qt::CaseInsensitive ) ).
+                replace( "_", " " );
+
+        vector< WordArticleLink > links;
+        links = dict.findArticles( gd::toWString( word ) );
 
-        if( linksType == SLASH || linksType == UNKNOWN )
+        if( !links.empty() )
         {
-            tag.remove( QRegExp( "\\.(s|)htm(l|)$", Qt::CaseInsensitive ) ).
-                    replace( "_", "%20" ).
-                    prepend( "<a href=\"gdlookup://localhost/" ).
-                    append( "\" " + list[4] + ">" );
+            dict.linksType = ZimDictionary::SLASH;
         }
         else
         {
-            tag.remove( QRegExp(".*/") ).
-                    remove( QRegExp( "\\.(s|)htm(l|)$", Qt::CaseInsensitive ) ).
-                    replace( "_", "%20" ).
-                    prepend( "<a href=\"gdlookup://localhost/" ).
-                    append( "\" " + list[4] + ">" );
+            word.remove( QRegExp(".*/") );
+            links = dict.findArticles( gd::toWString( word ) );
+            if( !links.empty() )
+            {
+                dict.linksType = ZimDictionary::NO_SLASH;
+                links.clear();
+            }
         }
+    }
 
-#if QT_VERSION >= QT_VERSION_CHECK( 5, 0, 0 )
-        newText += tag;
+    QString word;
+    if( dict.linksType == ZimDictionary::SLASH || dict.linksType == ZimDictionary::UNKNOWN )
+    {
+        word = link;
+        word.remove( QRegExp( "\\.(s|)htm(l|)$", Qt::CaseInsensitive ) );
     }
-    if( pos )
+    else
+        word = HtmlRewriter::linkedPageName( link );
+
+    tag.setAttributeValue( index, "gdlookup://localhost/" + word.replace( "_", "%20" ) );
+}
+
+void ZimArticleRewriter::handleStartTag( HtmlRewriter::Tag & tag )
+{
+    QString const & name = tag.name();
+
+    if ( name == QLatin1String( "img" ) || name == QLatin1String( "script" ) )
+        rewriteResource( tag, "src" );
+    else
+    if ( name == QLatin1String( "link" ) )
+        rewriteResource( tag, "href" );
+    else
+    if ( name == QLatin1String( "a" ) )
+        rewriteLink( tag );
+    else
+    if ( name == QLatin1String( "body" ) )
     {
-        newText += text.midRef( pos );
-        text = newText;
+        // remove the background
+        int index = tag.findAttribute( "style" );
+        if ( index < 0 )
+            return;
+
+        QStringList declarations = tag.attributeValue( index ).split( ';' );
+        for ( int x = declarations.size(); x--; )
+        {
+            if ( declarations[ x ].trimmed().startsWith( "background", Qt::CaseInsensitive ) )
+                declarations.removeAt( x );
+        }
+
+        tag.setAttributeValue( index, declarations.join( ";" ) );
     }
-    newText.clear();
-#else
-        text.replace( pos, list[0].length(), tag );
-        pos += tag.length() + 1;
+}
+
+string ZimDictionary::convert( const string & in )
+{
+    QString text = QString::fromUtf8( in.c_str() );
+
+    // Fix up the links to the resources and to the other articles
+    {
+        ZimArticleRewriter rewriter( *this );
+        text = HtmlRewriter::rewrite( text, rewriter );
     }
-#endif
+
+    int pos;
 
     // Occasionally words needs to be displayed in vertical, but <br/> were changed to <br\> somewhere
     // proper style: <a href="gdlookup://localhost/Neoptera" ... >N<br/>e<br/>o<br/>p<br/>t<br/>e<br/>r<br/>a</a>
@@ -828,10 +895,11 @@ string ZimDictionary::convert( const string & in )
     QRegularExpression rxBR( "(<a href=\"gdlookup://localhost/[^\"]*\"\\s*[^>]*>)\\s*((\\w\\s*&lt;br(\\\\|/|)&gt;\\s*)+\\w)\\s*</a>",
                              QRegularExpression::UseUnicodePropertiesOption );
     pos = 0;
-    QRegularExpressionMatchIterator it2 = rxLink.globalMatch( text );
+    QString newText;
+    QRegularExpressionMatchIterator it2 = rxBR.globalMatch( text );
     while( it2.hasNext() )
     {
-        QRegularExpressionMatch match = it.next();
+        QRegularExpressionMatch match = it2.next();
 
         newText += text.midRef( pos, match.capturedStart() - pos );
         pos = match.capturedEnd();
@@ -1065,6 +1133,8 @@ void ZimDictionary::makeFTSIndex( AtomicInt32 & isCancelled, bool firstIteration
         ftsIdxHeader.indexBtreeMaxElements = ftsIdxInfo.btreeMaxElements;
         ftsIdxHeader.indexRootOffset = ftsIdxInfo.rootOffset;
 
+        FtsHelpers::writeHeadwordMap( ftsIdx, this, ftsIdxHeader, isCancelled );
+
         ftsIdxHeader.signature = FtsHelpers::FtsSignature;
         ftsIdxHeader.formatVersion = FtsHelpers::CurrentFtsFormatVersion + getFtsIndexVersion();
 
@@ -142,6 +142,7 @@ ZipSoundsDictionary::ZipSoundsDictionary( string const & id,
 {
     setDictionaryName(genName(dictionaryFiles[ 0 ]));
     chunks = sptr< ChunkedStorage::Reader >(new ChunkedStorage::Reader( idx, idxHeader.chunksOffset ));
+    chunks->setStats( statistics.get() );
 
     // Initialize the index
 